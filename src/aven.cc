@@ -51,10 +51,18 @@
 #include <windows.h>
 #endif
 
+enum {
+    OPT_PRESENTATION = 0x100, OPT_MOVIE, OPT_SCREENSHOT, OPT_SIZE
+};
+
 static const struct option long_opts[] = {
     /* const char *name; int has_arg (0 no_argument, 1 required_*, 2 optional_*); int *flag; int val; */
     {"survey", required_argument, 0, 's'},
     {"print", no_argument, 0, 'p'},
+    {"presentation", required_argument, 0, OPT_PRESENTATION},
+    {"movie", required_argument, 0, OPT_MOVIE},
+    {"screenshot", required_argument, 0, OPT_SCREENSHOT},
+    {"size", required_argument, 0, OPT_SIZE},
     {"help", no_argument, 0, HLP_HELP},
     {"version", no_argument, 0, HLP_VERSION},
     {0, 0, 0, 0}
@@ -70,6 +78,15 @@ static struct help_msg help[] = {
     {HLP_ENCODELONG(0),       /*only load the sub-survey with this prefix*/199, 0},
     /* TRANSLATORS: --help output for aven --print option */
     {HLP_ENCODELONG(1),       /*print and exit (requires a 3d file)*/119, 0},
+    /* TRANSLATORS: --help output for aven --presentation option */
+    {HLP_ENCODELONG(2),       /*load this presentation file*/528, 0},
+    /* TRANSLATORS: --help output for aven --movie option */
+    {HLP_ENCODELONG(3),       /*render the presentation to this movie file and exit (requires a 3d file)*/529, 0},
+    /* TRANSLATORS: --help output for aven --screenshot option */
+    {HLP_ENCODELONG(4),       /*save a screenshot to this PNG file and exit (requires a 3d file)*/530, 0},
+    /* TRANSLATORS: --help output for aven --size option.  Don't translate
+     * "WIDTHxHEIGHT" or "1280x720". */
+    {HLP_ENCODELONG(5),       /*size to render --movie and --screenshot at as WIDTHxHEIGHT (default 1280x720)*/531, 0},
     {0, 0, 0}
 };
 
@@ -81,7 +98,7 @@ IMPLEMENT_WX_THEME_SUPPORT
 #endif
 
 Aven::Aven() :
-    m_Frame(NULL), m_pageSetupData(NULL)
+    m_Frame(NULL), m_pageSetupData(NULL), batch_mode(false)
 {
     wxFont::SetDefaultEncoding(wxFONTENCODING_UTF8);
 }
@@ -250,6 +267,8 @@ bool Aven::OnInit()
 
     const char* opt_survey = NULL;
     bool print_and_exit = false;
+    wxString presentation, movie, screenshot;
+    int render_width = 1280, render_height = 720;
 
     while (true) {
 	int opt;
@@ -273,9 +292,30 @@ bool Aven::OnInit()
 	if (opt == 'p') {
 	    print_and_exit = true;
 	}
+	if (opt == OPT_PRESENTATION) {
+	    presentation = wxString(optarg, wxConvUTF8);
+	}
+	if (opt == OPT_MOVIE) {
+	    movie = wxString(optarg, wxConvUTF8);
+	}
+	if (opt == OPT_SCREENSHOT) {
+	    screenshot = wxString(optarg, wxConvUTF8);
+	}
+	if (opt == OPT_SIZE) {
+	    char dummy;
+	    if (sscanf(optarg, "%dx%d%c",
+		       &render_width, &render_height, &dummy) != 2 ||
+		render_width <= 0 || render_height <= 0) {
+		cmdline_syntax(); // FIXME : not a helpful error...
+		exit(1);
+	    }
+	}
     }
 
-    if (print_and_exit && !utf8_argv[optind]) {
+    bool render_and_exit = !movie.empty() || !screenshot.empty();
+    // A presentation is only useful with a survey to show it for.
+    if ((print_and_exit || render_and_exit || !presentation.empty()) &&
+	!utf8_argv[optind]) {
 	cmdline_syntax(); // FIXME : not a helpful error...
 	exit(1);
     }
@@ -354,9 +394,27 @@ bool Aven::OnInit()
 	m_Frame->Maximize();
     }
 
+    if (render_and_exit) {
+	// Report errors on stderr rather than waiting for someone to dismiss
+	// a dialog.
+	batch_mode = true;
+	if (!opt_survey) opt_survey = "";
+	bool ok = m_Frame->RenderOffscreen(fnm, wxString(opt_survey, wxConvUTF8),
+					   presentation, movie, screenshot,
+					   render_width, render_height);
+	exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     if (utf8_argv[optind]) {
 	if (!opt_survey) opt_survey = "";
-	m_Frame->OpenFile(fnm, wxString(opt_survey, wxConvUTF8));
+	// We need the survey loaded before we can print it.
+	m_Frame->OpenFile(fnm, wxString(opt_survey, wxConvUTF8),
+			  !print_and_exit);
+	// The presentation doesn't depend on the survey data, so we don't
+	// need to wait for it to finish loading.
+	if (!presentation.empty() && !print_and_exit) {
+	    m_Frame->OpenPresentation(presentation);
+	}
     }
 
     if (print_and_exit) {
@@ -435,6 +493,10 @@ Aven::MacPrintFiles(const wxArrayString & filenames)
 
 void Aven::ReportError(const wxString& msg)
 {
+    if (batch_mode) {
+	fprintf(stderr, "%s: %s\n", msg_appname(), (const char *)msg.utf8_str());
+	return;
+    }
     if (!m_Frame) {
 	wxMessageBox(msg, APP_NAME, wxOK | wxICON_ERROR);
 	return;
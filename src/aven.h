@@ -90,6 +90,8 @@ class Aven : public wxApp {
     // sizes in wxThePrintPaperDatabase which is still NULL at the point
     // when the Aven class is constructed.
     wxPageSetupDialogData * m_pageSetupData;
+    // True when rendering from the command line without user interaction.
+    bool batch_mode;
 
 public:
     Aven();
@@ -29,7 +29,9 @@
 #include "aventreectrl.h"
 #include "mainfrm.h"
 
-#include <stack>
+#include "namecompare.h"
+
+#include <algorithm>
 
 using namespace std;
 
@@ -114,6 +116,7 @@ BEGIN_EVENT_TABLE(AvenTreeCtrl, wxTreeCtrl)
     EVT_LEAVE_WINDOW(AvenTreeCtrl::OnLeaveWindow)
     EVT_TREE_SEL_CHANGED(-1, AvenTreeCtrl::OnSelChanged)
     EVT_TREE_ITEM_ACTIVATED(-1, AvenTreeCtrl::OnItemActivated)
+    EVT_TREE_ITEM_EXPANDING(-1, AvenTreeCtrl::OnItemExpanding)
     EVT_CHAR(AvenTreeCtrl::OnKeyPress)
     EVT_TREE_ITEM_MENU(-1, AvenTreeCtrl::OnMenu)
     EVT_MENU(menu_SURVEY_SHOW_ALL, AvenTreeCtrl::OnRestrict)
@@ -152,118 +155,62 @@ void AvenTreeCtrl::FillTree(const wxString& root_name)
     filter.clear();
     filter.SetSeparator(separator);
 
-    // Create the root of the tree.
-    wxTreeItemId treeroot = AddRoot(root_name);
-
-    // Fill the tree of stations and prefixes.
-    stack<wxTreeItemId> previous_ids;
-    wxString current_prefix;
-    wxTreeItemId current_id = treeroot;
-
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    // The labels are sorted by name at this point.
+    stations.clear();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
+	if (!label->IsAnon()) stations.push_back(label);
+    }
 
-	if (label->IsAnon()) continue;
-
-	// Determine the current prefix.
-	wxString prefix = label->GetText().BeforeLast(separator);
-
-	// Determine if we're still on the same prefix.
-	if (prefix == current_prefix) {
-	    // no need to fiddle with branches...
-	}
-	// If not, then see if we've descended to a new prefix.
-	else if (prefix.length() > current_prefix.length() &&
-		 prefix.StartsWith(current_prefix) &&
-		 (prefix[current_prefix.length()] == separator ||
-		  current_prefix.empty())) {
-	    // We have, so start as many new branches as required.
-	    int current_prefix_length = current_prefix.length();
-	    current_prefix = prefix;
-	    size_t next_dot = current_prefix_length;
-	    if (!next_dot) --next_dot;
-	    do {
-		size_t prev_dot = next_dot + 1;
-
-		// Extract the next bit of prefix.
-		next_dot = prefix.find(separator, prev_dot + 1);
-
-		wxString bit = prefix.substr(prev_dot, next_dot - prev_dot);
-		assert(!bit.empty());
-
-		// Add the current tree ID to the stack.
-		previous_ids.push(current_id);
-
-		// Append the new item to the tree and set this as the current branch.
-		current_id = AppendItem(current_id, bit);
-		SetItemData(current_id, new TreeData(prefix.substr(0, next_dot)));
-	    } while (next_dot != wxString::npos);
-	}
-	// Otherwise, we must have moved up, and possibly then down again.
-	else {
-	    size_t count = 0;
-	    bool ascent_only = (prefix.length() < current_prefix.length() &&
-				current_prefix.StartsWith(prefix) &&
-				(current_prefix[prefix.length()] == separator ||
-				 prefix.empty()));
-	    if (!ascent_only) {
-		// Find out how much of the current prefix and the new prefix
-		// are the same.
-		// Note that we require a match of a whole number of parts
-		// between dots!
-		size_t n = min(prefix.length(), current_prefix.length());
-		size_t i;
-		for (i = 0; i < n && prefix[i] == current_prefix[i]; ++i) {
-		    if (prefix[i] == separator) count = i + 1;
-		}
-	    } else {
-		count = prefix.length() + 1;
-	    }
-
-	    // Extract the part of the current prefix after the bit (if any)
-	    // which has matched.
-	    // This gives the prefixes to ascend over.
-	    wxString prefixes_ascended = current_prefix.substr(count);
-
-	    // Count the number of prefixes to ascend over.
-	    int num_prefixes = prefixes_ascended.Freq(separator);
-
-	    // Reverse up over these prefixes.
-	    for (int i = 1; i <= num_prefixes; i++) {
-		previous_ids.pop();
-	    }
-	    current_id = previous_ids.top();
-	    previous_ids.pop();
-
-	    if (!ascent_only) {
-		// Add branches for this new part.
-		size_t next_dot = count - 1;
-		do {
-		    size_t prev_dot = next_dot + 1;
-
-		    // Extract the next bit of prefix.
-		    next_dot = prefix.find(separator, prev_dot + 1);
-
-		    wxString bit = prefix.substr(prev_dot, next_dot - prev_dot);
-		    assert(!bit.empty());
+    // Create the root of the tree.  Creating items for every station is slow
+    // for a large survey, so we only add the top level of the tree here, and
+    // add what's inside each survey when it's first expanded.
+    wxTreeItemId treeroot = AddRoot(root_name);
+    AddItems(treeroot, wxString(), 0, stations.size());
 
-		    // Add the current tree ID to the stack.
-		    previous_ids.push(current_id);
+    Expand(treeroot);
+    m_Enabled = true;
+    Thaw();
+}
 
-		    // Append the new item to the tree and set this as the current branch.
-		    current_id = AppendItem(current_id, bit);
-		    SetItemData(current_id, new TreeData(prefix.substr(0, next_dot)));
-		} while (next_dot != wxString::npos);
+void AvenTreeCtrl::AddItems(wxTreeItemId parent, const wxString& prefix,
+			    unsigned first, unsigned last)
+{
+    const wxChar separator = m_Parent->GetSeparator();
+    // Where the part of each name inside prefix starts.
+    size_t start = prefix.empty() ? 0 : prefix.length() + 1;
+
+    // The survey item the previous station was inside, if any.
+    TreeData* survey_data = NULL;
+    for (unsigned i = first; i != last; ++i) {
+	LabelInfo* label = stations[i];
+	const wxString& name = label->GetText();
+	size_t next_dot = name.find(separator, start);
+	if (next_dot != wxString::npos) {
+	    if (survey_data &&
+		survey_data->GetSurvey().length() == next_dot &&
+		name.StartsWith(survey_data->GetSurvey())) {
+		// Still inside the same survey.
+		survey_data->last = i + 1;
+		continue;
 	    }
 
-	    current_prefix = prefix;
+	    wxString bit = name.substr(start, next_dot - start);
+	    assert(!bit.empty());
+	    wxTreeItemId id = AppendItem(parent, bit);
+	    survey_data = new TreeData(name.substr(0, next_dot), i, i + 1);
+	    SetItemData(id, survey_data);
+	    SetItemHasChildren(id);
+	    continue;
 	}
 
+	survey_data = NULL;
+
 	// Now add the leaf.
-	wxString bit = label->GetText().AfterLast(separator);
+	wxString bit = name.substr(start);
 	assert(!bit.empty());
-	wxTreeItemId id = AppendItem(current_id, bit);
+	wxTreeItemId id = AppendItem(parent, bit);
 	SetItemData(id, new TreeData(label));
 	label->tree_id = id;
 	// Set the colour for an item in the survey tree.
@@ -275,12 +222,50 @@ void AvenTreeCtrl::FillTree(const wxString& root_name)
 	    SetItemTextColour(id, wxColour(49, 158, 79));
 	}
     }
+}
 
-    Expand(treeroot);
-    m_Enabled = true;
+void AvenTreeCtrl::FillSurvey(wxTreeItemId id)
+{
+    TreeData* data = static_cast<TreeData*>(GetItemData(id));
+    if (!data || data->IsStation() || data->filled) return;
+    data->filled = true;
+    Freeze();
+    AddItems(id, data->GetSurvey(), data->first, data->last);
     Thaw();
 }
 
+wxTreeItemId AvenTreeCtrl::GetStationItem(const LabelInfo* label)
+{
+    if (label->tree_id.IsOk() || label->IsAnon()) return label->tree_id;
+
+    // Find the station in our list, then fill in the surveys containing it
+    // from the top down until its item is added.
+    const wxChar separator = m_Parent->GetSeparator();
+    auto it = lower_bound(stations.begin(), stations.end(), label,
+			  [separator](const LabelInfo* a, const LabelInfo* b) {
+			      return name_cmp(a->GetText(), b->GetText(),
+					      separator) < 0;
+			  });
+    if (it == stations.end() || *it != label) return wxTreeItemId();
+    unsigned i = it - stations.begin();
+
+    wxTreeItemId item = GetRootItem();
+    while (!label->tree_id.IsOk()) {
+	wxTreeItemIdValue cookie;
+	wxTreeItemId child = GetFirstChild(item, cookie);
+	while (child.IsOk()) {
+	    const TreeData* data = static_cast<const TreeData*>(GetItemData(child));
+	    if (!data->IsStation() && data->first <= i && i < data->last) break;
+	    child = GetNextChild(item, cookie);
+	}
+	// Shouldn't happen, but avoid looping forever if it does.
+	if (!child.IsOk()) break;
+	FillSurvey(child);
+	item = child;
+    }
+    return label->tree_id;
+}
+
 constexpr auto TREE_MASK = wxTREE_HITTEST_ONITEMLABEL |
 			   wxTREE_HITTEST_ONITEMRIGHT |
 			   wxTREE_HITTEST_ONITEMSTATEICON;
@@ -344,6 +329,12 @@ void AvenTreeCtrl::OnItemActivated(wxTreeEvent& e)
     m_Parent->TreeItemSelected(GetItemData(e.GetItem()));
 }
 
+void AvenTreeCtrl::OnItemExpanding(wxTreeEvent& e)
+{
+    FillSurvey(e.GetItem());
+    e.Skip();
+}
+
 void AvenTreeCtrl::OnMenu(wxTreeEvent& e)
 {
     if (!m_Enabled) return;
@@ -437,6 +428,7 @@ void AvenTreeCtrl::OnKeyPress(wxKeyEvent &e)
 		    if (IsExpanded(id)) {
 			Collapse(id);
 		    } else {
+			FillSurvey(id);
 			Expand(id);
 		    }
 		} else {
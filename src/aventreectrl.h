@@ -37,9 +37,15 @@ class TreeData : public wxTreeItemData {
     wxString survey;
 
 public:
+    // For a survey, the stations inside it are [first, last) in the tree
+    // control's list of stations.  Items for what's inside a survey are only
+    // added when it is first expanded, which sets filled.
+    unsigned first = 0, last = 0;
+    bool filled = false;
+
     explicit TreeData(const LabelInfo* label) : m_Label(label) {}
-    explicit TreeData(const wxString & survey_)
-	: m_Label(NULL), survey(survey_) {}
+    TreeData(const wxString & survey_, unsigned first_, unsigned last_)
+	: m_Label(NULL), survey(survey_), first(first_), last(last_) {}
     const LabelInfo* GetLabel() const { return m_Label; }
     const wxString & GetSurvey() const { return survey; }
     bool IsStation() const { return m_Label != NULL; }
@@ -56,11 +62,26 @@ class AvenTreeCtrl : public wxTreeCtrl {
 
     SurveyFilter filter;
 
+    // The named stations, sorted by name.
+    std::vector<LabelInfo*> stations;
+
+    void AddItems(wxTreeItemId parent, const wxString& prefix,
+		  unsigned first, unsigned last);
+
+    void FillSurvey(wxTreeItemId id);
+
 public:
     AvenTreeCtrl(MainFrm* parent, wxWindow* window_parent);
 
     void FillTree(const wxString& root_name);
 
+    /** Get the tree item for a station.
+     *
+     *  Items for the surveys containing the station are added if they
+     *  haven't been yet.  Returns an invalid item for an anonymous station.
+     */
+    wxTreeItemId GetStationItem(const LabelInfo* label);
+
     void UnselectAll();
 
     void OnMouseMove(wxMouseEvent& event);
@@ -68,6 +89,7 @@ public:
     void OnSelChanged(wxTreeEvent& event);
     void OnKeyPress(wxKeyEvent &e);
     void OnItemActivated(wxTreeEvent& e);
+    void OnItemExpanding(wxTreeEvent& e);
     void OnMenu(wxTreeEvent& e);
 
     void OnRestrict(wxCommandEvent& e);
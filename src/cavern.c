@@ -50,6 +50,14 @@
 # include <conio.h> /* for _kbhit() and _getch() */
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
 /* For funcs which want to be immune from messing around with different
  * calling conventions */
 #ifndef CDECL
@@ -74,6 +82,35 @@ bool fMute = fFalse; /* just show errors */
 bool fSuppress = fFalse; /* only output 3d file */
 static bool fLog = fFalse; /* stdout to .log file */
 static bool f_warnings_are_errors = fFalse; /* turn warnings into errors */
+static FILE *fh_list_files = NULL; /* list data files read to this file */
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* After a data file changes, wait until there have been no further changes
+ * for this many milliseconds before reprocessing, so that saving several
+ * files in quick succession only triggers one run. */
+#define WATCH_SETTLE_TIME 250
+
+/* The events to watch for in each directory containing a data file.  We
+ * watch the directory rather than the file itself, since many editors save
+ * by writing a new file and renaming it over the old one, and so we notice
+ * *include-d files which don't exist yet being created. */
+#define WATCH_EVENTS \
+   (IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)
+
+/* inotify file descriptor if --watch was specified, or -1. */
+static int watch_fd = -1;
+
+static char **watch_argv;
+
+typedef struct {
+   int wd; /* watch descriptor for the directory the file is in */
+   char *leaf;
+} watched_file;
+
+static watched_file *watched = NULL;
+static size_t n_watched = 0;
+static size_t watched_size = 0;
+#endif
 
 nosurveylink *nosurveyhead;
 
@@ -93,6 +130,8 @@ lrudlist * model = NULL;
 lrud ** next_lrud = NULL;
 
 static void do_stats(void);
+static void init_state(void);
+static void process_files(char **fnms);
 
 static const struct option long_opts[] = {
    /* const char *name; int has_arg (0 no_argument, 1 required_*, 2 optional_*); int *flag; int val; */
@@ -105,6 +144,10 @@ static const struct option long_opts[] = {
    {"warnings-are-errors", no_argument, 0, 'w'},
    {"log", no_argument, 0, 1},
    {"3d-version", required_argument, 0, 'v'},
+   {"list-files", required_argument, 0, 3},
+#ifdef HAVE_SYS_INOTIFY_H
+   {"watch", no_argument, 0, 4},
+#endif
 #if OS_WIN32
    {"pause", no_argument, 0, 2},
 #endif
@@ -129,6 +172,12 @@ static struct help_msg help[] = {
    {HLP_ENCODELONG(6),	      /*log output to .log file*/170, 0},
    /* TRANSLATORS: --help output for cavern --3d-version option */
    {HLP_ENCODELONG(7),	      /*specify the 3d file format version to output*/171, 0},
+   /* TRANSLATORS: --help output for cavern --list-files option */
+   {HLP_ENCODELONG(8),	      /*write the names of the data files read to LIST-FILES*/534, 0},
+#ifdef HAVE_SYS_INOTIFY_H
+   /* TRANSLATORS: --help output for cavern --watch option */
+   {HLP_ENCODELONG(9),	      /*process the data again whenever a data file changes*/535, 0},
+#endif
  /*{'z',			"set optimizations for network reduction"},*/
    {0, 0, 0}
 };
@@ -141,6 +190,160 @@ delete_output_on_error(void)
       filename_delete_output();
 }
 
+#ifdef HAVE_SYS_INOTIFY_H
+/* Check if a buffer of inotify events includes a change to a data file. */
+static bool
+data_file_changed(const char *buf, ssize_t len)
+{
+   const char *p = buf;
+   while (p < buf + len) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->len) {
+	 size_t i;
+	 for (i = 0; i < n_watched; i++) {
+	    if (watched[i].wd == event->wd &&
+		strcmp(watched[i].leaf, event->name) == 0) {
+	       return fTrue;
+	    }
+	 }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+   }
+   return fFalse;
+}
+
+/* Wait for one of the data files to change, then run cavern again with the
+ * same arguments.  This runs at exit so that it happens however this run
+ * ends, including after a fatal error in the data.
+ */
+static void
+watch_and_reprocess(void)
+{
+   union {
+      struct inotify_event event;
+      char buf[4096];
+   } u;
+   struct pollfd pfd;
+
+   /* If no data files were opened, there's nothing to watch. */
+   if (n_watched == 0) return;
+
+   if (!fMute) {
+      putnl();
+      /* TRANSLATORS: Shown by cavern --watch after processing the survey
+       * data. */
+      puts(msg(/*Waiting for a survey data file to change…*/532));
+   }
+   fflush(NULL);
+
+   while (1) {
+      ssize_t len = read(watch_fd, u.buf, sizeof(u.buf));
+      if (len < 0 && errno == EINTR) continue;
+      if (len <= 0) return;
+      if (data_file_changed(u.buf, len)) break;
+   }
+
+   /* Wait for the changes to settle. */
+   pfd.fd = watch_fd;
+   pfd.events = POLLIN;
+   while (poll(&pfd, 1, WATCH_SETTLE_TIME) > 0) {
+      if (read(watch_fd, u.buf, sizeof(u.buf)) <= 0) break;
+   }
+
+   /* A fatal error can leave files open, but those we open are marked
+    * close-on-exec so they won't accumulate with each run.
+    */
+   execvp(watch_argv[0], watch_argv);
+
+   /* We're already exiting, so report the failure directly - error() and
+    * fatalerror() may call exit() again.
+    */
+   fprintf(STDERR, "%s: %s: ", msg_appname(), msg(/*error*/93));
+   fprintf(STDERR, msg(/*Couldn’t run external command: “%s”*/17),
+	   watch_argv[0]);
+   fputnl(STDERR);
+   fflush(STDERR);
+   _exit(EXIT_FAILURE);
+}
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void
+watch_data_file(const char *fnm)
+{
+   char *pth = path_from_fnm(fnm);
+   int wd = inotify_add_watch(watch_fd, *pth ? pth : ".", WATCH_EVENTS);
+   osfree(pth);
+   if (wd < 0) return;
+   if (n_watched == watched_size) {
+      watched_size = watched_size ? watched_size * 2 : 16;
+      watched = osrealloc(watched, watched_size * ossizeof(watched_file));
+   }
+   watched[n_watched].wd = wd;
+   watched[n_watched].leaf = leaf_from_fnm(fnm);
+   n_watched++;
+}
+#endif
+
+void
+set_close_on_exec(FILE *fh)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   if (watch_fd >= 0) {
+      int fd = fileno(fh);
+      int flags = fcntl(fd, F_GETFD);
+      if (flags >= 0) (void)fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+   }
+#else
+   (void)fh;
+#endif
+}
+
+void
+data_file_opened(const char *fnm, FILE *fh)
+{
+   if (fh_list_files) {
+      fputs(fnm, fh_list_files);
+      putc('\n', fh_list_files);
+   }
+   set_close_on_exec(fh);
+#ifdef HAVE_SYS_INOTIFY_H
+   if (watch_fd >= 0) watch_data_file(fnm);
+#endif
+}
+
+void
+data_file_missing(const char *pth, const char *fnm)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   if (watch_fd >= 0) {
+      /* Watch for the file being created under any of the names which
+       * data_file() would have tried to open it as. */
+      char *fnm_full, *fnm_ext;
+      if (pth && *pth && !fAbsoluteFnm(fnm)) {
+	 fnm_full = use_path(pth, fnm);
+      } else {
+	 fnm_full = osstrdup(fnm);
+      }
+      if (pth) {
+	 /* Translate a "foreign" path as fopen_portable() does. */
+	 char *p;
+	 for (p = fnm_full; *p; p++) {
+	    if (*p == '\\') *p = '/';
+	 }
+      }
+      fnm_ext = add_ext(fnm_full, EXT_SVX_DATA);
+      watch_data_file(fnm_full);
+      watch_data_file(fnm_ext);
+      osfree(fnm_full);
+      osfree(fnm_ext);
+   }
+#else
+   (void)pth;
+   (void)fnm;
+#endif
+}
+
 #if OS_WIN32
 static void
 pause_on_exit(void)
@@ -150,25 +353,11 @@ pause_on_exit(void)
 }
 #endif
 
-int current_days_since_1900;
-
-extern CDECL int
-main(int argc, char **argv)
+/* Set up the global state which the survey data is read into. */
+static void
+init_state(void)
 {
    int d;
-   time_t tmUserStart = time(NULL);
-   clock_t tmCPUStart = clock();
-   {
-       /* FIXME: localtime? */
-       struct tm * t = localtime(&tmUserStart);
-       int y = t->tm_year + 1900;
-       current_days_since_1900 = days_since_1900(y, t->tm_mon + 1, t->tm_mday);
-   }
-
-   /* Always buffer by line for aven's benefit. */
-   setvbuf(stdout, NULL, _IOLBF, 0);
-
-   msg_init(argv);
 
    pcs = osnew(settings);
    pcs->next = NULL;
@@ -199,6 +388,63 @@ main(int argc, char **argv)
       max[d] = -HUGE_REAL;
       pfxHi[d] = pfxLo[d] = NULL;
    }
+}
+
+/* Read the survey data files listed in the NULL-terminated array fnms, solve
+ * the network, and write the .3d file.
+ */
+static void
+process_files(char **fnms)
+{
+   while (*fnms) {
+      const char *fnm = *fnms++;
+
+      if (!fExplicitTitle) {
+	 char *lf;
+	 lf = baseleaf_from_fnm(fnm);
+	 if (survey_title) s_catchar(&survey_title, &survey_title_len, ' ');
+	 s_cat(&survey_title, &survey_title_len, lf);
+	 osfree(lf);
+      }
+
+      /* Select defaults settings */
+      default_all(pcs);
+      data_file(NULL, fnm); /* first argument is current path */
+   }
+
+   validate();
+
+   solve_network(/*stnlist*/); /* Find coordinates of all points */
+   validate();
+
+   /* close .3d file */
+   if (!img_close(pimg)) {
+      char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
+      fatalerror(img_error2msg(img_error()), fnm);
+   }
+   if (fhErrStat) safe_fclose(fhErrStat);
+}
+
+int current_days_since_1900;
+
+extern CDECL int
+main(int argc, char **argv)
+{
+   time_t tmUserStart = time(NULL);
+   clock_t tmCPUStart = clock();
+   {
+       /* FIXME: localtime? */
+       struct tm * t = localtime(&tmUserStart);
+       int y = t->tm_year + 1900;
+       current_days_since_1900 = days_since_1900(y, t->tm_mon + 1, t->tm_mday);
+   }
+
+   /* Always buffer by line for aven's benefit. */
+   setvbuf(stdout, NULL, _IOLBF, 0);
+
+   msg_init(argv);
+
+   init_state();
 
    /* at least one argument must be given */
    cmdline_init(argc, argv, short_opts, long_opts, NULL, help, 1, -1);
@@ -256,6 +502,21 @@ main(int argc, char **argv)
        case 1:
 	 fLog = fTrue;
 	 break;
+       case 3:
+	 if (fh_list_files) fclose(fh_list_files);
+	 fh_list_files = fopen(optarg, "w");
+	 if (!fh_list_files)
+	    fatalerror(/*Failed to open output file “%s”*/47, optarg);
+	 break;
+#ifdef HAVE_SYS_INOTIFY_H
+       case 4:
+	 if (watch_fd < 0) {
+	    watch_fd = inotify_init1(IN_CLOEXEC);
+	    if (watch_fd < 0)
+	       fatalerror(/*Failed to watch the survey data files for changes*/533);
+	 }
+	 break;
+#endif
 #if OS_WIN32
        case 2:
 	 atexit(pause_on_exit);
@@ -305,38 +566,19 @@ main(int argc, char **argv)
       }
    }
 
-   atexit(delete_output_on_error);
-
-   /* end of options, now process data files */
-   while (argv[optind]) {
-      const char *fnm = argv[optind];
-
-      if (!fExplicitTitle) {
-	 char *lf;
-	 lf = baseleaf_from_fnm(fnm);
-	 if (survey_title) s_catchar(&survey_title, &survey_title_len, ' ');
-	 s_cat(&survey_title, &survey_title_len, lf);
-	 osfree(lf);
-      }
-
-      /* Select defaults settings */
-      default_all(pcs);
-      data_file(NULL, fnm); /* first argument is current path */
-
-      optind++;
+#ifdef HAVE_SYS_INOTIFY_H
+   if (watch_fd >= 0) {
+      /* Register this first so it runs after delete_output_on_error(). */
+      watch_argv = argv;
+      if (fh_list_files) set_close_on_exec(fh_list_files);
+      atexit(watch_and_reprocess);
    }
+#endif
 
-   validate();
-
-   solve_network(/*stnlist*/); /* Find coordinates of all points */
-   validate();
+   atexit(delete_output_on_error);
 
-   /* close .3d file */
-   if (!img_close(pimg)) {
-      char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
-      fatalerror(img_error2msg(img_error()), fnm);
-   }
-   if (fhErrStat) safe_fclose(fhErrStat);
+   /* end of options, now process data files */
+   process_files(argv + optind);
 
    out_current_action(msg(/*Calculating statistics*/120));
    if (!fMute) do_stats();
@@ -443,4 +443,16 @@ extern lrudlist * model;
 
 extern lrud ** next_lrud;
 
+/* Note that data file fnm has been opened as fh (for --list-files and
+ * --watch). */
+void data_file_opened(const char *fnm, FILE *fh);
+
+/* Note that data file fnm couldn't be opened (so --watch can watch for it
+ * being created).  pth is as passed to data_file(). */
+void data_file_missing(const char *pth, const char *fnm);
+
+/* Mark fh so the process --watch runs to reprocess the data doesn't inherit
+ * it. */
+void set_close_on_exec(FILE *fh);
+
 #endif /* CAVERN_H */
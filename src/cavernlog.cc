@@ -40,6 +40,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <wx/ffile.h>
+#include <wx/filename.h>
+#include <wx/htmllbox.h>
 #include <wx/process.h>
 
 #define GVIM_COMMAND "gvim +'call cursor($l,$c)' $f"
@@ -62,7 +65,19 @@
 # define DEFAULT_EDITOR_COMMAND VIM_COMMAND
 #endif
 
-enum { LOG_REPROCESS = 1234, LOG_SAVE = 1235 };
+enum {
+    LOG_REPROCESS = 1234, LOG_SAVE = 1235,
+    LOG_UPDATE_TIMER = 1236, LOG_WATCH_TIMER = 1237
+};
+
+// Minimum time between updates of the list while cavern is running.
+const int UPDATE_INTERVAL = 100; // milliseconds
+
+#ifdef CAVERNLOG_WATCH_FILES
+// How long the data files need to be left unchanged after a change before we
+// reprocess them.
+const int WATCH_SETTLE_TIME = 250; // milliseconds
+#endif
 
 static const wxString badutf8_html(
     wxT("<span style=\"color:white;background-color:red;\">&#xfffd;</span>"));
@@ -162,11 +177,33 @@ CavernLogWindow::OnIdle(wxIdleEvent& event)
 }
 #endif
 
-BEGIN_EVENT_TABLE(CavernLogWindow, wxHtmlWindow)
+// Lists the rows of the log, only formatting those which are shown.
+class CavernLogList : public wxHtmlListBox {
+    CavernLogWindow * log;
+
+  public:
+    CavernLogList(CavernLogWindow * log_)
+	: wxHtmlListBox(log_), log(log_) { }
+
+    wxString OnGetItem(size_t n) const {
+	return log->rows[n];
+    }
+
+    void OnLinkClicked(size_t, const wxHtmlLinkInfo &link) {
+	log->OnLinkClicked(link);
+    }
+};
+
+BEGIN_EVENT_TABLE(CavernLogWindow, wxPanel)
     EVT_BUTTON(LOG_REPROCESS, CavernLogWindow::OnReprocess)
     EVT_BUTTON(LOG_SAVE, CavernLogWindow::OnSave)
     EVT_BUTTON(wxID_OK, CavernLogWindow::OnOK)
     EVT_COMMAND(wxID_ANY, wxEVT_CAVERN_OUTPUT, CavernLogWindow::OnCavernOutput)
+    EVT_TIMER(LOG_UPDATE_TIMER, CavernLogWindow::OnUpdateTimer)
+#ifdef CAVERNLOG_WATCH_FILES
+    EVT_TIMER(LOG_WATCH_TIMER, CavernLogWindow::OnWatchTimer)
+    EVT_FSWATCHER(wxID_ANY, CavernLogWindow::OnFileSystemEvent)
+#endif
 #ifdef CAVERNLOG_USE_THREADS
     EVT_CLOSE(CavernLogWindow::OnClose)
 #else
@@ -259,16 +296,39 @@ wxString get_command_path(const wxChar * command_name)
 }
 
 CavernLogWindow::CavernLogWindow(MainFrm * mainfrm_, const wxString & survey_, wxWindow * parent)
-    : wxHtmlWindow(parent),
+    : wxPanel(parent),
       mainfrm(mainfrm_), cavern_out(NULL), highlight(NULL),
-      link_count(0), end(buf), init_done(false), survey(survey_)
+      link_count(0), end(buf), init_done(false), survey(survey_),
+      update_timer(this, LOG_UPDATE_TIMER), last_update(0)
+#ifdef CAVERNLOG_WATCH_FILES
+      , watcher(NULL), watch_timer(this, LOG_WATCH_TIMER)
+#endif
 #ifdef CAVERNLOG_USE_THREADS
       , thread(NULL)
 #endif
 {
-    int fsize = parent->GetFont().GetPointSize();
-    int sizes[7] = { fsize, fsize, fsize, fsize, fsize, fsize, fsize };
-    SetFonts(wxString(), wxString(), sizes);
+    list = new CavernLogList(this);
+
+    // These are only shown once cavern has finished.
+    buttons = new wxBoxSizer(wxHORIZONTAL);
+    buttons->AddStretchSpacer();
+    /* TRANSLATORS: Label for button in aven’s cavern log window which
+     * allows the user to save the log to a file. */
+    buttons->Add(new wxButton(this, LOG_SAVE, wmsg(/*&Save Log*/446)),
+		 0, wxALL, 4);
+    /* TRANSLATORS: Label for button in aven’s cavern log window which
+     * causes the survey data to be reprocessed. */
+    reprocess_button = new wxButton(this, LOG_REPROCESS,
+				    wmsg(/*&Reprocess*/184));
+    buttons->Add(reprocess_button, 0, wxALL, 4);
+    ok_button = new wxButton(this, wxID_OK);
+    buttons->Add(ok_button, 0, wxALL, 4);
+
+    wxBoxSizer * sizer = new wxBoxSizer(wxVERTICAL);
+    sizer->Add(list, 1, wxEXPAND);
+    sizer->Add(buttons, 0, wxEXPAND);
+    sizer->Show(buttons, false);
+    SetSizer(sizer);
 }
 
 CavernLogWindow::~CavernLogWindow()
@@ -280,6 +340,10 @@ CavernLogWindow::~CavernLogWindow()
 	wxEndBusyCursor();
 	cavern_out->Detach();
     }
+#ifdef CAVERNLOG_WATCH_FILES
+    delete watcher;
+    if (!data_files_list.empty()) wxRemoveFile(data_files_list);
+#endif
 }
 
 #ifdef CAVERNLOG_USE_THREADS
@@ -435,10 +499,50 @@ CavernLogWindow::OnLinkClicked(const wxHtmlLinkInfo &link)
     wxGetApp().ReportError(m);
 }
 
+void
+CavernLogWindow::AddRow(const wxString & html)
+{
+    rows.push_back(html);
+}
+
+void
+CavernLogWindow::UpdateList(bool force)
+{
+    if (!force) {
+	wxLongLong now = wxGetLocalTimeMillis();
+	if (now - last_update < UPDATE_INTERVAL) {
+	    // Make sure the rows still get shown if no more output arrives.
+	    if (!update_timer.IsRunning())
+		update_timer.Start(UPDATE_INTERVAL, wxTIMER_ONE_SHOT);
+	    return;
+	}
+    }
+    update_timer.Stop();
+    last_update = wxGetLocalTimeMillis();
+
+    if (list->GetItemCount() == rows.size()) return;
+    list->SetItemCount(rows.size());
+    if (!link_count && !rows.empty()) {
+	// Auto-scroll the window until we've reported a warning or error.
+	list->ScrollToRow(rows.size() - 1);
+    }
+}
+
+void
+CavernLogWindow::OnUpdateTimer(wxTimerEvent &)
+{
+    UpdateList(true);
+}
+
 void
 CavernLogWindow::process(const wxString &file)
 {
-    SetPage(wxString());
+    rows.clear();
+    update_timer.Stop();
+    list->SetItemCount(0);
+    list->RefreshAll();
+    GetSizer()->Show(buttons, false);
+    Layout();
 #ifdef CAVERNLOG_USE_THREADS
     if (thread) stop_thread();
 #endif
@@ -449,7 +553,9 @@ CavernLogWindow::process(const wxString &file)
 	wxBeginBusyCursor();
     }
 
-    SetFocus();
+    // If we're reprocessing because a data file changed while the survey is
+    // being viewed, leave the focus with the view.
+    if (IsShown()) SetFocus();
     filename = file;
 
     link_count = 0;
@@ -467,6 +573,15 @@ CavernLogWindow::process(const wxString &file)
     cmd = escape_for_shell(cmd, false);
     cmd += wxT(" -o ");
     cmd += escaped_file;
+#ifdef CAVERNLOG_WATCH_FILES
+    if (data_files_list.empty()) {
+	data_files_list = wxFileName::CreateTempFileName(wxT("survex"));
+    }
+    if (!data_files_list.empty()) {
+	cmd += wxT(" --list-files ");
+	cmd += escape_for_shell(data_files_list, true);
+    }
+#endif
     cmd += wxT(' ');
     cmd += escaped_file;
 
@@ -599,8 +714,7 @@ bad_utf8:
 				source_line.append(cur, 1, wxString::npos);
 				swap(cur, source_line);
 			    }
-			    cur += "<br>\n";
-			    AppendToPage(cur);
+			    AddRow(cur);
 			    cur.clear();
 			    source_line.clear();
 			}
@@ -611,8 +725,7 @@ bad_utf8:
 			// Previous line was a source line without column info
 			// so just show it.
 			source_line.replace(0, 1, "&nbsp;");
-			source_line += "<br>\n";
-			AppendToPage(source_line);
+			AddRow(source_line);
 			source_line.clear();
 		    }
 #ifndef __WXMSW__
@@ -681,29 +794,7 @@ bad_utf8:
 			}
 		    }
 
-		    // Save the scrollbar positions.
-		    int scroll_x = 0, scroll_y = 0;
-		    GetViewStart(&scroll_x, &scroll_y);
-
-		    cur += wxT("<br>\n");
-		    AppendToPage(cur);
-
-		    if (!link_count) {
-			// Auto-scroll the window until we've reported a
-			// warning or error.
-			int x, y;
-			GetVirtualSize(&x, &y);
-			int xs, ys;
-			GetClientSize(&xs, &ys);
-			y -= ys;
-			int xu, yu;
-			GetScrollPixelsPerUnit(&xu, &yu);
-			Scroll(scroll_x, y / yu);
-		    } else {
-			// Restore the scrollbar positions.
-			Scroll(scroll_x, scroll_y);
-		    }
-
+		    AddRow(cur);
 		    cur.clear();
 		    break;
 		}
@@ -740,7 +831,7 @@ bad_utf8:
 	size_t left = end - p;
 	end = buf + left;
 	if (left) memmove(buf, p, left);
-	Update();
+	UpdateList(false);
 	return;
     }
 
@@ -748,8 +839,7 @@ bad_utf8:
 	// Previous line was a source line without column info
 	// so just show it.
 	source_line.replace(0, 1, "&nbsp;");
-	source_line += "<br>\n";
-	AppendToPage(source_line);
+	AddRow(source_line);
 	source_line.clear();
     }
 
@@ -758,32 +848,36 @@ bad_utf8:
 	cur += badutf8_html;
     }
     if (!cur.empty()) {
-	cur += "<br>\n";
-	AppendToPage("<hr>" + cur);
+	AddRow("<hr>" + cur);
     }
+    UpdateList(true);
 
-    /* TRANSLATORS: Label for button in aven’s cavern log window which
-     * allows the user to save the log to a file. */
-    AppendToPage(wxString::Format(wxT("<avenbutton id=%d name=\"%s\">"),
-				  (int)LOG_SAVE,
-				  wmsg(/*&Save Log*/446).c_str()));
     wxEndBusyCursor();
     delete cavern_out;
     cavern_out = NULL;
-    if (e.len < 0) {
-	/* Negative length indicates non-zero exit status from cavern. */
-	/* TRANSLATORS: Label for button in aven’s cavern log window which
-	 * causes the survey data to be reprocessed. */
-	AppendToPage(wxString::Format(wxT("<avenbutton default id=%d name=\"%s\">"),
-				      (int)LOG_REPROCESS,
-				      wmsg(/*&Reprocess*/184).c_str()));
+    /* Negative length indicates non-zero exit status from cavern. */
+    bool failed = (e.len < 0);
+    GetSizer()->Show(buttons, true);
+    buttons->Show(ok_button, !failed);
+    if (failed) {
+	reprocess_button->SetDefault();
+    } else {
+	ok_button->SetDefault();
+    }
+    Layout();
+#ifdef CAVERNLOG_WATCH_FILES
+    // Watch the files this run read, including any which had errors, so that
+    // fixing an error reprocesses the data.
+    UpdateWatches();
+#endif
+    if (failed) {
+	if (!IsShown()) {
+	    // Reprocessing after a data file changed failed, so show the log.
+	    wxCommandEvent dummy;
+	    mainfrm->OnShowLog(dummy);
+	}
 	return;
     }
-    AppendToPage(wxString::Format(wxT("<avenbutton id=%d name=\"%s\">"),
-				  (int)LOG_REPROCESS,
-				  wmsg(/*&Reprocess*/184).c_str()));
-    AppendToPage(wxString::Format(wxT("<avenbutton default id=%d>"), (int)wxID_OK));
-    Update();
     init_done = false;
 
     {
@@ -794,7 +888,9 @@ bad_utf8:
 	}
     }
 
-    if (link_count == 0) {
+    // If the log isn't being shown then we reprocessed because a data file
+    // changed, so update the view even if there were warnings.
+    if (link_count == 0 || !IsShown()) {
 	wxCommandEvent dummy;
 	OnOK(dummy);
     }
@@ -809,6 +905,78 @@ CavernLogWindow::OnEndProcess(wxProcessEvent & evt)
     QueueEvent(e);
 }
 
+#ifdef CAVERNLOG_WATCH_FILES
+void
+CavernLogWindow::UpdateWatches()
+{
+    if (!mainfrm->GetWatchDataFiles()) {
+	delete watcher;
+	watcher = NULL;
+	data_files.clear();
+	watch_timer.Stop();
+	return;
+    }
+
+    // cavern lists the filenames as it opened them, so they're in the
+    // filesystem's encoding rather than necessarily UTF-8.
+    wxString list;
+    {
+	wxFFile fh(data_files_list);
+	if (!fh.IsOpened() || !fh.ReadAll(&list, wxConvFile)) return;
+    }
+
+    if (!watcher) {
+	watcher = new wxFileSystemWatcher();
+	watcher->SetOwner(this);
+    }
+    watcher->RemoveAll();
+    data_files.clear();
+
+    // Watch the directories containing the data files rather than the files
+    // themselves, since many editors save by writing a new file and renaming
+    // it over the old one.
+    std::set<wxString> dirs;
+    size_t start = 0;
+    while (start < list.size()) {
+	size_t nl = list.find('\n', start);
+	if (nl == wxString::npos) nl = list.size();
+	wxFileName fnm(list.substr(start, nl - start));
+	start = nl + 1;
+	if (!fnm.IsOk()) continue;
+	fnm.MakeAbsolute();
+	data_files.insert(fnm.GetFullPath());
+	wxString dir = fnm.GetPath();
+	if (dirs.insert(dir).second) {
+	    watcher->Add(wxFileName::DirName(dir),
+			 wxFSW_EVENT_CREATE|wxFSW_EVENT_DELETE|
+			 wxFSW_EVENT_RENAME|wxFSW_EVENT_MODIFY);
+	}
+    }
+}
+
+void
+CavernLogWindow::OnFileSystemEvent(wxFileSystemWatcherEvent & e)
+{
+    if (data_files.count(e.GetPath().GetFullPath()) == 0 &&
+	(e.GetChangeType() != wxFSW_EVENT_RENAME ||
+	 data_files.count(e.GetNewPath().GetFullPath()) == 0)) {
+	return;
+    }
+    watch_timer.Start(WATCH_SETTLE_TIME, wxTIMER_ONE_SHOT);
+}
+
+void
+CavernLogWindow::OnWatchTimer(wxTimerEvent &)
+{
+    if (cavern_out) {
+	// Wait for the current run to finish, then process the data again.
+	watch_timer.Start(WATCH_SETTLE_TIME, wxTIMER_ONE_SHOT);
+	return;
+    }
+    process(filename);
+}
+#endif
+
 void
 CavernLogWindow::OnReprocess(wxCommandEvent &)
 {
@@ -25,7 +25,9 @@
 #include <wx/html/htmlwin.h>
 #include <wx/process.h>
 
+#include <set>
 #include <string>
+#include <vector>
 
 // We probably want to use a thread if we can - that way we can use a blocking
 // read from cavern rather than busy-waiting via idle events.
@@ -33,15 +35,25 @@
 # define CAVERNLOG_USE_THREADS
 #endif
 
+// Reprocess the survey data automatically when any of the files it was read
+// from changes, if wxWidgets can watch files on this platform (it uses
+// inotify on Linux).
+#if wxUSE_FSWATCHER
+# define CAVERNLOG_WATCH_FILES
+# include <wx/fswatcher.h>
+#endif
+
 #ifdef CAVERNLOG_USE_THREADS
 class CavernThread;
 #endif
+class CavernLogList;
 class MainFrm;
 
-class CavernLogWindow : public wxHtmlWindow {
+class CavernLogWindow : public wxPanel {
 #ifdef CAVERNLOG_USE_THREADS
     friend class CavernThread;
 #endif
+    friend class CavernLogList;
 
     wxString filename;
 
@@ -61,6 +73,49 @@ class CavernLogWindow : public wxHtmlWindow {
 
     std::string log_txt;
 
+    // The log as HTML, one row per line (or per message with the line of
+    // source it refers to).  The list only formats the rows which are
+    // visible, so a log with many thousands of warnings stays responsive.
+    std::vector<wxString> rows;
+
+    CavernLogList * list;
+
+    wxSizer * buttons;
+
+    wxButton * reprocess_button;
+
+    wxButton * ok_button;
+
+    // Telling the list about new rows is batched, and done at most once per
+    // UPDATE_INTERVAL milliseconds while cavern is running.
+    wxTimer update_timer;
+
+    wxLongLong last_update;
+
+    void AddRow(const wxString & html);
+
+    void UpdateList(bool force);
+
+    void OnUpdateTimer(wxTimerEvent &);
+
+#ifdef CAVERNLOG_WATCH_FILES
+    // cavern writes the names of the data files it reads to this file.
+    wxString data_files_list;
+
+    // The full paths of the data files the survey was last processed from.
+    std::set<wxString> data_files;
+
+    wxFileSystemWatcher * watcher;
+
+    // Started when a data file changes, and restarted by each further change,
+    // so saving several files only reprocesses once.
+    wxTimer watch_timer;
+
+    void OnFileSystemEvent(wxFileSystemWatcherEvent & e);
+
+    void OnWatchTimer(wxTimerEvent &);
+#endif
+
 #ifdef CAVERNLOG_USE_THREADS
     void stop_thread();
 
@@ -77,7 +132,7 @@ class CavernLogWindow : public wxHtmlWindow {
     /** Start to process survey data in file. */
     void process(const wxString &file);
 
-    virtual void OnLinkClicked(const wxHtmlLinkInfo &link);
+    void OnLinkClicked(const wxHtmlLinkInfo &link);
 
     void OnReprocess(wxCommandEvent &);
 
@@ -87,6 +142,11 @@ class CavernLogWindow : public wxHtmlWindow {
 
     void OnCavernOutput(wxCommandEvent & e);
 
+#ifdef CAVERNLOG_WATCH_FILES
+    /** Start or stop watching the data files, as the user has chosen. */
+    void UpdateWatches();
+#endif
+
 #ifdef CAVERNLOG_USE_THREADS
     void OnClose(wxCloseEvent &);
 #else
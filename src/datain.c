@@ -501,6 +501,7 @@ data_file(const char *pth, const char *fnm)
       }
 
       if (fh == NULL) {
+	 data_file_missing(pth, fnm);
 	 compile_error_string(fnm, /*Couldn’t open file “%s”*/24, fnm);
 	 return;
       }
@@ -533,6 +534,7 @@ data_file(const char *pth, const char *fnm)
    }
 
    using_data_file(file.filename);
+   data_file_opened(file.filename, file.fh);
 
    begin_lineno_store = pcs->begin_lineno;
    pcs->begin_lineno = 0;
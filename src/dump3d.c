@@ -25,24 +25,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 
 #include "cmdline.h"
 #include "date.h"
 #include "debug.h"
 #include "filelist.h"
+#include "filename.h"
 #include "img_hosted.h"
+#include "osalloc.h"
+#include "useful.h"
 
 static const struct option long_opts[] = {
    /* const char *name; int has_arg (0 no_argument, 1 required_*, 2 optional_*); int *flag; int val; */
    {"survey", required_argument, 0, 's'},
    {"rewind", no_argument, 0, 'r'},
    {"show-dates", no_argument, 0, 'd'},
+   {"binary", required_argument, 0, 'b'},
    {"help", no_argument, 0, HLP_HELP},
    {"version", no_argument, 0, HLP_VERSION},
    {0, 0, 0, 0}
 };
 
-#define short_opts "rds:"
+#define short_opts "rds:b:"
 
 static struct help_msg help[] = {
 /*				<-- */
@@ -50,9 +55,223 @@ static struct help_msg help[] = {
    /* TRANSLATORS: --help output for dump3d --rewind option */
    {HLP_ENCODELONG(1),	      /*rewind file and read it a second time*/204, 0},
    {HLP_ENCODELONG(2),	      /*show survey date information (if present)*/396, 0},
+   {HLP_ENCODELONG(3),	      /*write legs and stations to this file as binary columns*/527, 0},
    {0, 0, 0}
 };
 
+/* Binary columnar output.
+ *
+ * The file starts with a header:
+ *
+ *   char magic[8]	    "SVX3DCOL"
+ *   uint32 version	    currently 1
+ *   uint32 n_columns
+ *   uint64 n_legs
+ *   uint64 n_stations
+ *
+ * followed by n_columns directory entries:
+ *
+ *   char name[16]	    NUL padded
+ *   uint64 offset	    from the start of the file (always a multiple of 8)
+ *   uint64 size	    in bytes
+ *
+ * All integers and floating point values are little-endian.  The columns are
+ * described in dump3d.sgml.
+ */
+
+#define COLUMNS_MAGIC "SVX3DCOL"
+#define COLUMNS_VERSION 1
+
+typedef struct {
+   const char *name;
+   unsigned char *data;
+   size_t len, size;
+} column;
+
+enum {
+   COL_LEG_FROM_X, COL_LEG_FROM_Y, COL_LEG_FROM_Z,
+   COL_LEG_TO_X, COL_LEG_TO_Y, COL_LEG_TO_Z,
+   COL_LEG_FLAGS, COL_LEG_STYLE, COL_LEG_DATE1, COL_LEG_DATE2,
+   COL_LEG_SURVEY,
+   COL_STN_X, COL_STN_Y, COL_STN_Z, COL_STN_FLAGS, COL_STN_NAME,
+   COL_LABELS, COL_TITLE, COL_CS,
+   COL_COUNT_
+};
+
+static column columns[COL_COUNT_] = {
+   { "leg.from_x", NULL, 0, 0 },
+   { "leg.from_y", NULL, 0, 0 },
+   { "leg.from_z", NULL, 0, 0 },
+   { "leg.to_x", NULL, 0, 0 },
+   { "leg.to_y", NULL, 0, 0 },
+   { "leg.to_z", NULL, 0, 0 },
+   { "leg.flags", NULL, 0, 0 },
+   { "leg.style", NULL, 0, 0 },
+   { "leg.date1", NULL, 0, 0 },
+   { "leg.date2", NULL, 0, 0 },
+   { "leg.survey", NULL, 0, 0 },
+   { "stn.x", NULL, 0, 0 },
+   { "stn.y", NULL, 0, 0 },
+   { "stn.z", NULL, 0, 0 },
+   { "stn.flags", NULL, 0, 0 },
+   { "stn.name", NULL, 0, 0 },
+   { "labels", NULL, 0, 0 },
+   { "title", NULL, 0, 0 },
+   { "cs", NULL, 0, 0 }
+};
+
+static unsigned char *
+col_grow(column *col, size_t n)
+{
+   unsigned char *p;
+   if (col->len + n > col->size) {
+      col->size = col->size ? col->size * 2 : 4096;
+      while (col->len + n > col->size) col->size *= 2;
+      col->data = osrealloc(col->data, col->size);
+   }
+   p = col->data + col->len;
+   col->len += n;
+   return p;
+}
+
+static void
+col_add_u32(column *col, uint32_t v)
+{
+   unsigned char *p = col_grow(col, 4);
+   int i;
+   for (i = 0; i < 4; i++) {
+      p[i] = (unsigned char)v;
+      v >>= 8;
+   }
+}
+
+static void
+col_add_u64(column *col, uint64_t v)
+{
+   unsigned char *p = col_grow(col, 8);
+   int i;
+   for (i = 0; i < 8; i++) {
+      p[i] = (unsigned char)v;
+      v >>= 8;
+   }
+}
+
+static void
+col_add_double(column *col, double d)
+{
+   uint64_t v;
+   memcpy(&v, &d, sizeof(v));
+   col_add_u64(col, v);
+}
+
+/* Add string s to the labels blob, returning its offset. */
+static uint64_t
+add_label(const char *s)
+{
+   size_t len = strlen(s) + 1;
+   uint64_t offset = columns[COL_LABELS].len;
+   memcpy(col_grow(&columns[COL_LABELS], len), s, len);
+   return offset;
+}
+
+static void
+put_u64(uint64_t v, FILE *fh)
+{
+   put32((int32_t)(v & 0xffffffff), fh);
+   put32((int32_t)(v >> 32), fh);
+}
+
+static void
+write_columns(img *pimg, const char *fnm, const char *fnm_out)
+{
+   img_point pt, prev = { 0, 0, 0 };
+   int code;
+   /* Consecutive legs are usually in the same survey, so only store the
+    * survey name again when it changes. */
+   char *last_survey = NULL;
+   uint64_t survey_offset = 0;
+   uint64_t n_legs = 0, n_stations = 0;
+   uint64_t offset;
+   FILE *fh;
+   int i;
+
+   do {
+      code = img_read_item(pimg, &pt);
+      switch (code) {
+       case img_MOVE:
+	 prev = pt;
+	 break;
+       case img_LINE:
+	 if (!last_survey || strcmp(last_survey, pimg->label) != 0) {
+	    osfree(last_survey);
+	    last_survey = osstrdup(pimg->label);
+	    survey_offset = add_label(pimg->label);
+	 }
+	 col_add_double(&columns[COL_LEG_FROM_X], prev.x);
+	 col_add_double(&columns[COL_LEG_FROM_Y], prev.y);
+	 col_add_double(&columns[COL_LEG_FROM_Z], prev.z);
+	 col_add_double(&columns[COL_LEG_TO_X], pt.x);
+	 col_add_double(&columns[COL_LEG_TO_Y], pt.y);
+	 col_add_double(&columns[COL_LEG_TO_Z], pt.z);
+	 col_add_u32(&columns[COL_LEG_FLAGS], (uint32_t)pimg->flags);
+	 col_add_u32(&columns[COL_LEG_STYLE], (uint32_t)pimg->style);
+	 col_add_u32(&columns[COL_LEG_DATE1], (uint32_t)pimg->days1);
+	 col_add_u32(&columns[COL_LEG_DATE2], (uint32_t)pimg->days2);
+	 col_add_u64(&columns[COL_LEG_SURVEY], survey_offset);
+	 ++n_legs;
+	 prev = pt;
+	 break;
+       case img_LABEL:
+	 col_add_double(&columns[COL_STN_X], pt.x);
+	 col_add_double(&columns[COL_STN_Y], pt.y);
+	 col_add_double(&columns[COL_STN_Z], pt.z);
+	 col_add_u32(&columns[COL_STN_FLAGS], (uint32_t)pimg->flags);
+	 col_add_u64(&columns[COL_STN_NAME], add_label(pimg->label));
+	 ++n_stations;
+	 break;
+       case img_BAD:
+	 img_close(pimg);
+	 fatalerror(img_error2msg(img_error()), fnm);
+	 break;
+      }
+   } while (code != img_STOP);
+   osfree(last_survey);
+
+   memcpy(col_grow(&columns[COL_TITLE], strlen(pimg->title) + 1),
+	  pimg->title, strlen(pimg->title) + 1);
+   if (pimg->cs) {
+      memcpy(col_grow(&columns[COL_CS], strlen(pimg->cs) + 1),
+	     pimg->cs, strlen(pimg->cs) + 1);
+   }
+
+   fh = safe_fopen(fnm_out, "wb");
+   fwrite(COLUMNS_MAGIC, 8, 1, fh);
+   put32(COLUMNS_VERSION, fh);
+   put32(COL_COUNT_, fh);
+   put_u64(n_legs, fh);
+   put_u64(n_stations, fh);
+
+   offset = 32 + COL_COUNT_ * 32;
+   for (i = 0; i < COL_COUNT_; i++) {
+      char name[16];
+      memset(name, 0, sizeof(name));
+      strncpy(name, columns[i].name, sizeof(name) - 1);
+      fwrite(name, sizeof(name), 1, fh);
+      put_u64(offset, fh);
+      put_u64(columns[i].len, fh);
+      offset += (columns[i].len + 7) & ~(uint64_t)7;
+   }
+
+   for (i = 0; i < COL_COUNT_; i++) {
+      static const char padding[8] = { 0 };
+      size_t len = columns[i].len;
+      if (len) fwrite(columns[i].data, len, 1, fh);
+      fwrite(padding, (8 - len % 8) % 8, 1, fh);
+      osfree(columns[i].data);
+   }
+   safe_fclose(fh);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -63,6 +282,7 @@ main(int argc, char **argv)
    const char *survey = NULL;
    bool fRewind = fFalse;
    bool show_dates = fFalse;
+   const char *fnm_binary = NULL;
 
    msg_init(argv);
 
@@ -73,12 +293,31 @@ main(int argc, char **argv)
       if (opt == 's') survey = optarg;
       if (opt == 'r') fRewind = fTrue;
       if (opt == 'd') show_dates = fTrue;
+      if (opt == 'b') fnm_binary = optarg;
    }
    fnm = argv[optind];
 
    pimg = img_open_survey(fnm, survey);
    if (!pimg) fatalerror(img_error2msg(img_error()), fnm);
 
+   if (fnm_binary) {
+      if (fRewind) {
+	 /* Read the file through once, then write the columns from the second
+	  * read. */
+	 do {
+	    code = img_read_item(pimg, &pt);
+	    if (code == img_BAD) {
+	       img_close(pimg);
+	       fatalerror(img_error2msg(img_error()), fnm);
+	    }
+	 } while (code != img_STOP);
+	 if (!img_rewind(pimg)) fatalerror(img_error2msg(img_error()), fnm);
+      }
+      write_columns(pimg, fnm, fnm_binary);
+      img_close(pimg);
+      return 0;
+   }
+
    printf("TITLE \"%s\"\n", pimg->title);
    printf("DATE \"%s\"\n", pimg->datestamp);
    printf("DATE_NUMERIC %ld\n", pimg->datestamp_numeric);
@@ -27,8 +27,10 @@
 #include "export.h"
 
 #include "wx.h"
+#include <wx/filename.h>
 #include <wx/utils.h>
 #include "exportfilter.h"
+#include "gltf.h"
 #include "gpx.h"
 #include "hpgl.h"
 #include "json.h"
@@ -39,6 +41,7 @@
 #include <float.h>
 #include <locale.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,13 +53,18 @@
 # include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "cmdline.h"
 #include "debug.h"
 #include "filename.h"
-#include "hash.h"
 #include "img_hosted.h"
 #include "message.h"
 #include "useful.h"
@@ -78,6 +86,11 @@ const format_info export_format_info[] = {
     { ".eps", /*EPS files*/412,
       LABELS|LEGS|SURF|SPLAYS|STNS|PASG|XSECT|WALLS|ORIENTABLE,
       LABELS|LEGS|STNS },
+    /* TRANSLATORS: "glTF" is the name of a 3D file format, so should not be
+     * translated. */
+    { ".glb", /*glTF files*/525,
+      PASG,
+      PASG },
     { ".gpx", /*GPX files*/413,
       LABELS|LEGS|SURF|SPLAYS|ENTS|FIXES|EXPORTS|PROJ,
       LABELS },
@@ -161,7 +174,6 @@ static const char *layer_name(int mask) {
 }
 
 static double marker_size; /* for station markers */
-static double grid; /* grid spacing (or 0 for no grid) */
 
 const int *
 ExportFilter::passes() const
@@ -174,11 +186,15 @@ class DXF : public ExportFilter {
     const char * to_close;
     /* for station labels */
     double text_height;
+    /* grid spacing (or 0 for no grid) */
+    double grid;
     char pending[1024];
 
   public:
-    explicit DXF(double text_height_)
-	: to_close(0), text_height(text_height_) { pending[0] = '\0'; }
+    DXF(double text_height_, double grid_)
+	: to_close(0), text_height(text_height_), grid(grid_) {
+	pending[0] = '\0';
+    }
     const int * passes() const;
     bool fopen(const wxString& fnm_out);
     void header(const char *, const char *, time_t,
@@ -444,9 +460,11 @@ DXF::footer()
 
 class Skencil : public ExportFilter {
     double factor;
+    /* grid spacing (or 0 for no grid) */
+    double grid;
   public:
-    explicit Skencil(double scale)
-	: factor(POINTS_PER_MM * 1000.0 / scale) { }
+    Skencil(double scale, double grid_)
+	: factor(POINTS_PER_MM * 1000.0 / scale), grid(grid_) { }
     const int * passes() const;
     void header(const char *, const char *, time_t,
 		double min_x, double min_y, double min_z,
@@ -536,67 +554,100 @@ Skencil::footer(void)
    }
 }
 
-typedef struct point {
-   img_point p;
-   const char *label;
-   struct point *next;
-} point;
+// Map from coordinates to station name, used to find the names of stations
+// for SVG and PLT output.
+//
+// This is an open-addressing hash table using linear probing, which is grown
+// as required so chains stay short however many stations there are.  The
+// names are stored one after another in a single buffer rather than being
+// allocated individually.
+class station_names {
+    struct slot {
+	img_point p;
+	// Offset of the name in names plus one, or 0 for an empty slot.
+	size_t name;
+    };
 
-#define HTAB_SIZE 0x2000
+    vector<slot> slots;
 
-static point **htab;
+    size_t used;
 
-static void
-set_name(const img_point *p, const char *s)
-{
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z) {
-	 /* already got name for these coordinates */
-	 /* FIXME: what about multiple names for the same station? */
-	 return;
-      }
-   }
+    string names;
 
-   pt = osnew(point);
-   pt->label = osstrdup(s);
-   pt->p = *p;
-   pt->next = htab[hash];
-   htab[hash] = pt;
-
-   return;
-}
-
-static const char *
-find_name(const img_point *p)
-{
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
-   wxASSERT(p);
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z)
-	 return pt->label;
-   }
-   return "?";
+    static size_t hash(const img_point *p) {
+	// Hash the coordinates truncated to the nearest centimetre, packed into
+	// a single 64-bit value.
+	uint64_t h = uint64_t(int64_t(p->x * 100));
+	h = h * 0x9e3779b97f4a7c15ull + uint64_t(int64_t(p->y * 100));
+	h = h * 0x9e3779b97f4a7c15ull + uint64_t(int64_t(p->z * 100));
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 32;
+	return size_t(h);
+    }
+
+    static bool same(const img_point *a, const img_point *b) {
+	return a->x == b->x && a->y == b->y && a->z == b->z;
+    }
+
+    void grow();
+
+  public:
+    station_names() : slots(1024), used(0) { }
+
+    void set(const img_point *p, const char *s);
+
+    const char * find(const img_point *p) const;
+};
+
+void
+station_names::grow()
+{
+    vector<slot> old(slots.size() * 2);
+    swap(old, slots);
+    size_t mask = slots.size() - 1;
+    for (const slot & e : old) {
+	if (!e.name) continue;
+	size_t i = hash(&e.p) & mask;
+	while (slots[i].name) i = (i + 1) & mask;
+	slots[i] = e;
+    }
+}
+
+void
+station_names::set(const img_point *p, const char *s)
+{
+    size_t mask = slots.size() - 1;
+    size_t i = hash(p) & mask;
+    while (slots[i].name) {
+	if (same(&slots[i].p, p)) {
+	    /* already got name for these coordinates */
+	    /* FIXME: what about multiple names for the same station? */
+	    return;
+	}
+	i = (i + 1) & mask;
+    }
+
+    slots[i].p = *p;
+    slots[i].name = names.size() + 1;
+    names.append(s, strlen(s) + 1);
+
+    // Keep the load factor at most 1/2.
+    if (++used * 2 > slots.size()) grow();
+}
+
+const char *
+station_names::find(const img_point *p) const
+{
+    wxASSERT(p);
+    size_t mask = slots.size() - 1;
+    size_t i = hash(p) & mask;
+    while (slots[i].name) {
+	if (same(&slots[i].p, p))
+	    return names.data() + slots[i].name - 1;
+	i = (i + 1) & mask;
+    }
+    return "?";
 }
 
 class SVG : public ExportFilter {
@@ -606,6 +657,7 @@ class SVG : public ExportFilter {
     /* for station labels */
     double text_height;
     char pending[1024];
+    station_names names;
 
   public:
     SVG(double scale, double text_height_)
@@ -646,8 +698,6 @@ SVG::header(const char * title, const char *, time_t,
 {
    const char *unit = "mm";
    const double SVG_MARGIN = 5.0; // In units of "unit".
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
    fprintf(fh, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
    double width = (max_x - min_x) * factor + SVG_MARGIN * 2;
    double height = (max_y - min_y) * factor + SVG_MARGIN * 2;
@@ -721,7 +771,7 @@ SVG::label(const img_point *p, const char *s, bool fSurface, int)
 	   p->x * factor, p->y * -factor);
    html_escape(fh, s);
    fputs("</text>\n", fh);
-   set_name(p, s);
+   names.set(p, s);
 }
 
 void
@@ -729,7 +779,7 @@ SVG::cross(const img_point *p, bool fSurface)
 {
    (void)fSurface; /* unused */
    fprintf(fh, "<circle id=\"%s\" cx=\"%.3f\" cy=\"%.3f\" r=\"%.3f\"/>\n",
-	   find_name(p), p->x * factor, p->y * -factor, marker_size * SQRT_2);
+	   names.find(p), p->x * factor, p->y * -factor, marker_size * SQRT_2);
    fprintf(fh, "<path d=\"M%.3f %.3fL%.3f %.3fM%.3f %.3fL%.3f %.3f\"/>\n",
 	   p->x * factor - marker_size, p->y * -factor - marker_size,
 	   p->x * factor + marker_size, p->y * -factor + marker_size,
@@ -804,6 +854,8 @@ SVG::footer()
 class PLT : public ExportFilter {
     string escaped;
 
+    station_names names;
+
     const char * find_name_plt(const img_point *p);
 
     double min_N, max_N, min_E, max_E, min_A, max_A;
@@ -833,8 +885,6 @@ PLT::header(const char *title, const char *, time_t,
 {
    // FIXME: allow survey to be set from aven somehow!
    const char *survey = NULL;
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
    /* Survex is E, N, Alt - PLT file is N, E, Alt */
    min_N = min_y / METRES_PER_FOOT;
    max_N = max_y / METRES_PER_FOOT;
@@ -869,7 +919,7 @@ PLT::line(const img_point *p1, const img_point *p, unsigned flags, bool fPending
 const char *
 PLT::find_name_plt(const img_point *p)
 {
-    const char * s = find_name(p);
+    const char * s = names.find(p);
     escaped.resize(0);
 
     // PLT format can't handle spaces or control characters, so escape them
@@ -897,7 +947,7 @@ void
 PLT::label(const img_point *p, const char *s, bool fSurface, int)
 {
    (void)fSurface; /* unused */
-   set_name(p, s);
+   names.set(p, s);
 }
 
 void
@@ -1315,321 +1365,999 @@ transform_point(const Point& pos, const Vector3* pre_offset,
     p->z = -(z * SINT + tmp * COST);
 }
 
-bool
-Export(const wxString &fnm_out, const wxString &title,
-       const wxString &datestamp,
+// State for one output file while Export() is running.
+struct export_target {
+    ExportFilter * filt;
+    // Set if filt wants the passage tubes in 3D rather than cross-sections.
+    GLTF * gltf;
+    int show_mask;
+    // Do we need to calculate min and max for each dimension?
+    bool need_bounds;
+    bool elevation;
+    double pan;
+    double grid;
+    double SIN, COS, SINT, COST;
+    const Vector3* pre_offset;
+    double min_x, min_y, min_z, max_x, max_y, max_z;
+    double x_offset, y_offset, z_offset;
+    // The current pass, and show_mask restricted to it.
+    const int * pass;
+    int pass_mask;
+    // The previous point on the current traverse.
+    img_point p1;
+    bool fPendingMove;
+
+    void transform(const Point& pos, img_point* p) const {
+	transform_point(pos, pre_offset, COS, SIN, COST, SINT, p);
+	p->x += x_offset;
+	p->y += y_offset;
+	p->z += z_offset;
+    }
+
+    void add_to_bounds(const Point& pos) {
+	img_point p;
+	transform_point(pos, pre_offset, COS, SIN, COST, SINT, &p);
+	if (p.x < min_x) min_x = p.x;
+	if (p.x > max_x) max_x = p.x;
+	if (p.y < min_y) min_y = p.y;
+	if (p.y > max_y) max_y = p.y;
+	if (p.z < min_z) min_z = p.z;
+	if (p.z > max_z) max_z = p.z;
+    }
+};
+
+static ExportFilter *
+new_filter(export_format format, const Model& model, const export_target& t,
+	   double text_height, double scale)
+{
+    switch (format) {
+	case FMT_CSV:
+	    return new POS(model.GetSeparator(), true);
+	case FMT_DXF:
+	    return new DXF(text_height, t.grid);
+	case FMT_EPS:
+	    return new EPS(scale);
+	case FMT_GLTF:
+	    return new GLTF(model.GetOffset());
+	case FMT_GPX:
+	    return new GPX(model.GetCSProj().c_str());
+	case FMT_HPGL:
+	    // factor = POINTS_PER_MM * 1000.0 / scale;
+	    // HPGL doesn't use the bounds itself, but they are needed to set
+	    // the origin to the centre of lower left.
+	    return new HPGL;
+	case FMT_JSON:
+	    return new JSON;
+	case FMT_KML: {
+	    bool clamp_to_ground = (t.show_mask & CLAMP_TO_GROUND);
+	    return new KML(model.GetCSProj().c_str(), clamp_to_ground);
+	}
+	case FMT_PLT:
+	    return new PLT;
+	case FMT_POS:
+	    return new POS(model.GetSeparator(), false);
+	case FMT_SK:
+	    return new Skencil(scale, t.grid);
+	case FMT_SVG:
+	    return new SVG(scale, text_height);
+	default:
+	    return NULL;
+    }
+}
+
+// Walk the traverses once, feeding legs to each output in targets whose
+// current pass includes them.
+static void
+export_legs(const Model& model, const SurveyFilter* filter,
+	    const vector<export_target*>& targets)
+{
+    vector<export_target*> wanted;
+    for (int f = 0; f != 8; ++f) {
+	unsigned flags = (f & img_FLAG_SURFACE) ? SURF : LEGS;
+	wanted.clear();
+	for (export_target* t : targets) {
+	    if ((t->pass_mask & flags) == 0) {
+		// Not showing traverse because of surface/underground status.
+		continue;
+	    }
+	    if ((f & img_FLAG_SPLAY) && (t->show_mask & SPLAYS) == 0) {
+		// Not showing because it's a splay.
+		continue;
+	    }
+	    wanted.push_back(t);
+	}
+	if (wanted.empty()) continue;
+
+	if (f & img_FLAG_SPLAY) flags |= SPLAYS;
+	vector<traverse>::const_iterator trav = model.traverses_begin(f, filter);
+	vector<traverse>::const_iterator tend = model.traverses_end(f);
+	for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
+	    assert(trav->size() > 1);
+	    traverse::const_iterator pos = trav->begin();
+	    traverse::const_iterator end = trav->end();
+	    for ( ; pos != end; ++pos) {
+		for (export_target* t : wanted) {
+		    img_point p;
+		    t->transform(*pos, &p);
+		    if (pos == trav->begin()) {
+			// First point is move...
+			t->fPendingMove = true;
+		    } else {
+			t->filt->line(&t->p1, &p, flags, t->fPendingMove);
+			t->fPendingMove = false;
+		    }
+		    t->p1 = p;
+		}
+	    }
+	}
+    }
+}
+
+// Which type of label (if any) to write for station label in the current
+// pass of t.
+static int
+label_type(const export_target* t, const LabelInfo* label)
+{
+    int pass_mask = t->pass_mask;
+    if ((pass_mask & ENTS) && label->IsEntrance()) {
+	return ENTS;
+    } else if ((pass_mask & FIXES) && label->IsFixedPt()) {
+	return FIXES;
+    } else if ((pass_mask & EXPORTS) && label->IsExportedPt())  {
+	return EXPORTS;
+    } else if (pass_mask & LABELS) {
+	return LABELS;
+    }
+    return 0;
+}
+
+// Walk the stations once, feeding labels and crosses to each output in
+// targets whose current pass includes them.
+static void
+export_labels(const Model& model, const SurveyFilter* filter,
+	      const vector<export_target*>& targets)
+{
+    const SurveyTree& tree = model.GetSurveyTree();
+    vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+    vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+    for ( ; pos != end; ++pos) {
+	if (filter && !filter->CheckVisible(tree, (*pos)->survey))
+	    continue;
+
+	/* Use !UNDERGROUND as the criterion - we want stations where a
+	 * surface and underground survey meet to be in the underground
+	 * layer */
+	bool f_surface = !(*pos)->IsUnderground();
+	// Only convert the label to UTF-8 once, and only if it's wanted.
+	wxScopedCharBuffer text;
+	for (export_target* t : targets) {
+	    img_point p;
+	    t->transform(**pos, &p);
+
+	    int type = label_type(t, *pos);
+	    if (type) {
+		if (!text.data()) text = (*pos)->GetText().utf8_str();
+		t->filt->label(&p, text.data(), f_surface, type);
+	    }
+	    if (t->pass_mask & STNS)
+		t->filt->cross(&p, f_surface);
+	}
+    }
+}
+
+// Write cross-section xs at (transformed) position p to t for its current
+// pass.
+static void
+export_xsect(const export_target* t, const img_point* p, const XSect& xs)
+{
+    int pass_mask = t->pass_mask;
+    ExportFilter * filt = t->filt;
+    if (t->elevation) {
+	if (pass_mask & XSECT)
+	    filt->xsect(p, 90, xs.GetU(), xs.GetD());
+	if (pass_mask & WALL1)
+	    filt->wall(p, 90, xs.GetU());
+	if (pass_mask & WALL2)
+	    filt->wall(p, 270, xs.GetD());
+	if (pass_mask & PASG)
+	    filt->passage(p, 90, xs.GetU(), xs.GetD());
+    } else {
+	// Should only be enabled in plan or elevation mode.
+	double angle = xs.get_right_bearing() - t->pan;
+	if (pass_mask & XSECT)
+	    filt->xsect(p, angle + 180, xs.GetL(), xs.GetR());
+	if (pass_mask & WALL1)
+	    filt->wall(p, angle + 180, xs.GetL());
+	if (pass_mask & WALL2)
+	    filt->wall(p, angle, xs.GetR());
+	if (pass_mask & PASG)
+	    filt->passage(p, angle + 180, xs.GetL(), xs.GetR());
+    }
+}
+
+// Walk the passage tubes once, feeding cross-sections, walls and passages to
+// each output in targets whose current pass includes them.
+static void
+export_tubes(const Model& model, const SurveyFilter* filter,
+	     const vector<export_target*>& targets)
+{
+    const SurveyTree& tree = model.GetSurveyTree();
+    vector<export_target*> xsect_targets, gltf_targets;
+    for (export_target* t : targets) {
+	if (t->gltf) {
+	    gltf_targets.push_back(t);
+	} else {
+	    xsect_targets.push_back(t);
+	}
+    }
+
+    // Runs of visible cross-sections, for outputs which skin the tubes in 3D.
+    vector<XSect> run;
+    list<vector<XSect>>::const_iterator tube = model.tubes_begin();
+    list<vector<XSect>>::const_iterator tube_end = model.tubes_end();
+    for ( ; tube != tube_end; ++tube) {
+	vector<XSect>::const_iterator pos = tube->begin();
+	vector<XSect>::const_iterator end = tube->end();
+	size_t active_tube_len = 0;
+	for ( ; pos != end; ++pos) {
+	    const XSect & xs = *pos;
+	    // FIXME: This filtering can create tubes containing a single
+	    // cross-section, which otherwise don't exist in aven (the
+	    // Model class currently filters them out).  Perhaps we
+	    // should just always include these - a single set of LRUD
+	    // measurements is useful even if a single cross-section
+	    // 3D tube perhaps isn't.
+	    if (filter && !filter->CheckVisible(tree, xs.GetSurvey())) {
+		// Close any active tube.
+		if (active_tube_len > 0) {
+		    active_tube_len = 0;
+		    for (export_target* t : xsect_targets) {
+			t->filt->tube_end();
+		    }
+		    for (export_target* t : gltf_targets) {
+			t->gltf->passage_tube(run);
+		    }
+		    run.clear();
+		}
+		continue;
+	    }
+
+	    ++active_tube_len;
+	    for (export_target* t : xsect_targets) {
+		img_point p;
+		t->transform(xs.GetPoint(), &p);
+		export_xsect(t, &p, xs);
+	    }
+	    if (!gltf_targets.empty()) run.push_back(xs);
+	}
+	if (active_tube_len > 0) {
+	    for (export_target* t : xsect_targets) {
+		t->filt->tube_end();
+	    }
+	    for (export_target* t : gltf_targets) {
+		t->gltf->passage_tube(run);
+	    }
+	    run.clear();
+	}
+    }
+}
+
+static void
+init_target(export_target& t, const export_output& out, const Model& model,
+	    double grid_)
+{
+    t.filt = NULL;
+    t.gltf = NULL;
+    t.show_mask = out.show_mask;
+    t.need_bounds = true;
+    t.elevation = (out.tilt == 0.0);
+    t.pan = out.pan;
+    t.grid = (out.show_mask & GRID) ? grid_ : 0.0;
+    t.SIN = sin(rad(out.pan));
+    t.COS = cos(rad(out.pan));
+    t.SINT = sin(rad(out.tilt));
+    t.COST = cos(rad(out.tilt));
+    switch (out.format) {
+	case FMT_GLTF:
+	    // Uses model coordinates directly.
+	    t.need_bounds = false;
+	    break;
+	case FMT_CSV: case FMT_GPX: case FMT_KML: case FMT_POS:
+	    t.need_bounds = false;
+	    t.show_mask |= FULL_COORDS;
+	    break;
+	case FMT_PLT:
+	    t.show_mask |= FULL_COORDS;
+	    break;
+	default:
+	    break;
+    }
+    t.pre_offset = NULL;
+    if (t.show_mask & FULL_COORDS) {
+	t.pre_offset = &(model.GetOffset());
+    }
+    t.min_x = t.min_y = t.min_z = HUGE_VAL;
+    t.max_x = t.max_y = t.max_z = -HUGE_VAL;
+    t.x_offset = t.y_offset = t.z_offset = 0.0;
+}
+
+// Find the bounding box of each of targets, and set the offsets to apply.
+static void
+find_bounds(const Model& model, const SurveyFilter* filter,
+	    vector<export_target>& targets)
+{
+    const SurveyTree& tree = model.GetSurveyTree();
+   /* Get bounding boxes - one walk over the model serves all the outputs. */
+   for (int f = 0; f != 8; ++f) {
+       vector<export_target*> wanted;
+       for (export_target& t : targets) {
+	   if (!t.need_bounds) continue;
+	   if ((t.show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
+	       // Not showing traverse because of surface/underground status.
+	       continue;
+	   }
+	   if ((f & img_FLAG_SPLAY) && (t.show_mask & SPLAYS) == 0) {
+	       // Not showing because it's a splay.
+	       continue;
+	   }
+	   wanted.push_back(&t);
+       }
+       if (wanted.empty()) continue;
+       vector<traverse>::const_iterator trav = model.traverses_begin(f, filter);
+       vector<traverse>::const_iterator tend = model.traverses_end(f);
+       for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
+	   traverse::const_iterator pos = trav->begin();
+	   traverse::const_iterator end = trav->end();
+	   for ( ; pos != end; ++pos) {
+	       for (export_target* t : wanted) {
+		   t->add_to_bounds(*pos);
+	       }
+	   }
+       }
+   }
+   vector<export_target*> wanted;
+   for (export_target& t : targets) {
+       if (t.need_bounds) wanted.push_back(&t);
+   }
+   if (!wanted.empty()) {
+       vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+       vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+       for ( ; pos != end; ++pos) {
+	   if (filter && !filter->CheckVisible(tree, (*pos)->survey))
+	       continue;
+
+	   for (export_target* t : wanted) {
+	       t->add_to_bounds(**pos);
+	   }
+       }
+   }
+
+   for (export_target& t : targets) {
+       if (t.need_bounds && t.grid > 0) {
+	   t.min_x -= t.grid / 2;
+	   t.max_x += t.grid / 2;
+	   t.min_y -= t.grid / 2;
+	   t.max_y += t.grid / 2;
+       }
+
+       /* Handle empty file and gracefully, and also zero for the
+	* !need_bounds case. */
+       if (t.min_x > t.max_x) {
+	   t.min_x = t.min_y = t.min_z = 0;
+	   t.max_x = t.max_y = t.max_z = 0;
+       }
+
+       if (t.show_mask & FULL_COORDS) {
+	   // Full coordinates - offset is applied before rotations.
+	   t.x_offset = t.y_offset = t.z_offset = 0.0;
+       } else if (t.show_mask & CENTRED) {
+	   // Centred.
+	   t.x_offset = (t.min_x + t.max_x) * -0.5;
+	   t.y_offset = (t.min_y + t.max_y) * -0.5;
+	   t.z_offset = (t.min_z + t.max_z) * -0.5;
+       } else {
+	   // Origin at lowest SW corner.
+	   t.x_offset = -t.min_x;
+	   t.y_offset = -t.min_y;
+	   t.z_offset = -t.min_z;
+       }
+       if (t.need_bounds) {
+	   t.min_x += t.x_offset;
+	   t.max_x += t.x_offset;
+	   t.min_y += t.y_offset;
+	   t.max_y += t.y_offset;
+	   t.min_z += t.z_offset;
+	   t.max_z += t.z_offset;
+       }
+   }
+}
+
+int
+Export(const vector<export_output>& outputs,
+       const wxString &title, const wxString &datestamp,
        const Model& model,
        const SurveyFilter* filter,
-       double pan, double tilt, int show_mask, export_format format,
        double grid_, double text_height, double marker_size_,
        double scale)
 {
    UseNumericCLocale dummy;
-   int fPendingMove = 0;
-   img_point p, p1;
-   const int *pass;
-   double SIN = sin(rad(pan));
-   double COS = cos(rad(pan));
-   double SINT = sin(rad(tilt));
-   double COST = cos(rad(tilt));
-
-   grid = (show_mask & GRID) ? grid_ : 0.0;
+
    marker_size = marker_size_;
 
-   // Do we need to calculate min and max for each dimension?
-   bool need_bounds = true;
-   ExportFilter * filt;
-   switch (format) {
-       case FMT_CSV:
-	   filt = new POS(model.GetSeparator(), true);
-	   show_mask |= FULL_COORDS;
-	   need_bounds = false;
-	   break;
-       case FMT_DXF:
-	   filt = new DXF(text_height);
-	   break;
-       case FMT_EPS:
-	   filt = new EPS(scale);
-	   break;
-       case FMT_GPX:
-	   filt = new GPX(model.GetCSProj().c_str());
-	   show_mask |= FULL_COORDS;
-	   need_bounds = false;
-	   break;
-       case FMT_HPGL:
-	   filt = new HPGL;
-	   // factor = POINTS_PER_MM * 1000.0 / scale;
-	   // HPGL doesn't use the bounds itself, but they are needed to set
-	   // the origin to the centre of lower left.
-	   break;
-       case FMT_JSON:
-	   filt = new JSON;
-	   break;
-       case FMT_KML: {
-	   bool clamp_to_ground = (show_mask & CLAMP_TO_GROUND);
-	   filt = new KML(model.GetCSProj().c_str(), clamp_to_ground);
-	   show_mask |= FULL_COORDS;
-	   need_bounds = false;
-	   break;
+   vector<export_target> targets(outputs.size());
+   for (size_t i = 0; i != outputs.size(); ++i) {
+       export_target& t = targets[i];
+       init_target(t, outputs[i], model, grid_);
+       t.filt = new_filter(outputs[i].format, model, t, text_height, scale);
+       if (!t.filt || !t.filt->fopen(outputs[i].fnm)) {
+	   for (size_t j = 0; j <= i; ++j) {
+	       delete targets[j].filt;
+	   }
+	   // Remove the files we've already created, which are still empty.
+	   for (size_t j = 0; j < i; ++j) {
+	       wxRemoveFile(outputs[j].fnm);
+	   }
+	   return int(i);
+       }
+       if (outputs[i].format == FMT_GLTF) {
+	   t.gltf = static_cast<GLTF*>(t.filt);
        }
-       case FMT_PLT:
-	   filt = new PLT;
-	   show_mask |= FULL_COORDS;
-	   break;
-       case FMT_POS:
-	   filt = new POS(model.GetSeparator(), false);
-	   show_mask |= FULL_COORDS;
-	   need_bounds = false;
-	   break;
-       case FMT_SK:
-	   filt = new Skencil(scale);
-	   break;
-       case FMT_SVG:
-	   filt = new SVG(scale, text_height);
-	   break;
-       default:
-	   return false;
    }
 
-   if (!filt->fopen(fnm_out)) {
-       delete filt;
-       return false;
+   find_bounds(model, filter, targets);
+
+   for (export_target& t : targets) {
+       /* Header */
+       t.filt->header(title.utf8_str(), datestamp.utf8_str(),
+		      model.GetDateStamp(),
+		      t.min_x, t.min_y, t.min_z, t.max_x, t.max_y, t.max_z);
+
+       t.p1.x = t.p1.y = t.p1.z = 0; /* avoid compiler warning */
+       t.fPendingMove = false;
+       t.pass = t.filt->passes();
    }
 
-   const Vector3* pre_offset = NULL;
-   if (show_mask & FULL_COORDS) {
-	pre_offset = &(model.GetOffset());
+   // Each output needs its passes to happen in order, but the passes of
+   // different outputs are independent, so we advance all the outputs by one
+   // pass per round, and each round walks each part of the model at most once
+   // for all the outputs which need it.
+   vector<export_target*> active, legs, labels, tubes;
+   while (true) {
+       active.clear();
+       legs.clear();
+       labels.clear();
+       tubes.clear();
+       for (export_target& t : targets) {
+	   // Skip passes which have nothing to show for this output.
+	   while (*t.pass && (t.show_mask & *t.pass) == 0) ++t.pass;
+	   if (!*t.pass) continue;
+
+	   t.pass_mask = t.show_mask & *t.pass;
+	   t.filt->start_pass(*t.pass);
+	   active.push_back(&t);
+	   if (t.pass_mask & (LEGS|SURF))
+	       legs.push_back(&t);
+	   if (t.pass_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS))
+	       labels.push_back(&t);
+	   if (t.pass_mask & (XSECT|WALLS|PASG))
+	       tubes.push_back(&t);
+       }
+       if (active.empty()) break;
+
+       if (!legs.empty()) export_legs(model, filter, legs);
+       if (!labels.empty()) export_labels(model, filter, labels);
+       if (!tubes.empty()) export_tubes(model, filter, tubes);
+
+       for (export_target* t : active) {
+	   ++t->pass;
+       }
    }
 
-   /* Get bounding box */
-   double min_x, min_y, min_z, max_x, max_y, max_z;
-   min_x = min_y = min_z = HUGE_VAL;
-   max_x = max_y = max_z = -HUGE_VAL;
-   if (need_bounds) {
-	for (int f = 0; f != 8; ++f) {
-	    if ((show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
-		// Not showing traverse because of surface/underground status.
-		continue;
+   for (export_target& t : targets) {
+       t.filt->footer();
+       delete t.filt;
+   }
+   return -1;
+}
+
+bool
+Export(const wxString &fnm_out, const wxString &title,
+       const wxString &datestamp,
+       const Model& model,
+       const SurveyFilter* filter,
+       double pan, double tilt, int show_mask, export_format format,
+       double grid_, double text_height, double marker_size_,
+       double scale)
+{
+    vector<export_output> outputs(1);
+    export_output& out = outputs[0];
+    out.fnm = fnm_out;
+    out.format = format;
+    out.show_mask = show_mask;
+    out.pan = pan;
+    out.tilt = tilt;
+    return Export(outputs, title, datestamp, model, filter,
+		  grid_, text_height, marker_size_, scale) < 0;
+}
+
+// A leg (or part of one) within a tile.
+struct tile_leg {
+    img_point a, b;
+    unsigned flags;
+};
+
+// A station within a tile.
+struct tile_label {
+    img_point p;
+    const LabelInfo* label;
+    // The label in UTF-8, converted up front so the worker threads don't
+    // need to touch wxString.
+    string text;
+};
+
+// A cross-section of a passage, with its transformed position.  Where a
+// passage crosses a tile boundary this is interpolated, so the cross-section
+// is a copy.
+struct tile_xsect {
+    img_point p;
+    XSect xs;
+};
+
+// The contents of one tile.
+struct export_tile {
+    int col, row;
+    vector<tile_leg> legs;
+    vector<tile_label> labels;
+    // Indices into the runs of cross-sections within this tile.
+    vector<size_t> runs;
+    wxString fnm;
+    // Set once the file has been created.
+    bool created = false;
+};
+
+// Clip the line from a to b to the rectangle x0 <= x <= x1, y0 <= y <= y1
+// (the Liang-Barsky algorithm).  Returns false if no part of the line is
+// inside the rectangle.
+static bool
+clip_to_tile(img_point& a, img_point& b,
+	     double x0, double y0, double x1, double y1)
+{
+    double t0 = 0.0, t1 = 1.0;
+    double dx = b.x - a.x, dy = b.y - a.y;
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { a.x - x0, x1 - a.x, a.y - y0, y1 - a.y };
+    for (int i = 0; i != 4; ++i) {
+	if (p[i] == 0.0) {
+	    // Parallel to this edge, so either entirely in or entirely out.
+	    if (q[i] < 0.0) return false;
+	    continue;
+	}
+	double r = q[i] / p[i];
+	if (p[i] < 0.0) {
+	    if (r > t1) return false;
+	    if (r > t0) t0 = r;
+	} else {
+	    if (r < t0) return false;
+	    if (r < t1) t1 = r;
+	}
+    }
+    img_point c = a;
+    double dz = b.z - a.z;
+    if (t1 < 1.0) {
+	b.x = c.x + t1 * dx;
+	b.y = c.y + t1 * dy;
+	b.z = c.z + t1 * dz;
+    }
+    if (t0 > 0.0) {
+	a.x = c.x + t0 * dx;
+	a.y = c.y + t0 * dy;
+	a.z = c.z + t0 * dz;
+    }
+    return true;
+}
+
+// Partitions the plan of the model into square tiles.
+class tile_grid {
+    const export_target& t;
+    double tile_size;
+    int cols, rows;
+
+    map<size_t, export_tile> tiles;
+
+  public:
+    // Runs of consecutive visible cross-sections from the passage tubes.
+    vector<vector<tile_xsect>> runs;
+
+    tile_grid(const export_target& t_, double tile_size_)
+	: t(t_), tile_size(tile_size_) {
+	cols = max(1, int(ceil((t.max_x - t.min_x) / tile_size)));
+	rows = max(1, int(ceil((t.max_y - t.min_y) / tile_size)));
+    }
+
+    double get_tile_size() const { return tile_size; }
+
+    int get_cols() const { return cols; }
+    int get_rows() const { return rows; }
+
+    int col_of(double x) const {
+	int col = int(floor((x - t.min_x) / tile_size));
+	return min(max(col, 0), cols - 1);
+    }
+
+    int row_of(double y) const {
+	int row = int(floor((y - t.min_y) / tile_size));
+	return min(max(row, 0), rows - 1);
+    }
+
+    double tile_min_x(int col) const { return t.min_x + col * tile_size; }
+    double tile_min_y(int row) const { return t.min_y + row * tile_size; }
+
+    export_tile& tile(int col, int row) {
+	export_tile& tl = tiles[size_t(row) * cols + col];
+	tl.col = col;
+	tl.row = row;
+	return tl;
+    }
+
+    void add_leg(const img_point& a, const img_point& b, unsigned flags);
+
+    void add_run(const vector<tile_xsect>& run);
+
+    map<size_t, export_tile>& get_tiles() { return tiles; }
+
+  private:
+    void add_tile_run(int col, int row, vector<tile_xsect>& run);
+};
+
+void
+tile_grid::add_leg(const img_point& a, const img_point& b, unsigned flags)
+{
+    int c0 = col_of(min(a.x, b.x)), c1 = col_of(max(a.x, b.x));
+    int r0 = row_of(min(a.y, b.y)), r1 = row_of(max(a.y, b.y));
+    for (int row = r0; row <= r1; ++row) {
+	for (int col = c0; col <= c1; ++col) {
+	    tile_leg leg = { a, b, flags };
+	    if (c0 != c1 || r0 != r1) {
+		double x0 = tile_min_x(col), y0 = tile_min_y(row);
+		if (!clip_to_tile(leg.a, leg.b,
+				  x0, y0, x0 + tile_size, y0 + tile_size))
+		    continue;
 	    }
-	    if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
-		// Not showing because it's a splay.
-		continue;
+	    tile(col, row).legs.push_back(leg);
+	}
+    }
+}
+
+void
+tile_grid::add_tile_run(int col, int row, vector<tile_xsect>& run)
+{
+    size_t idx = runs.size();
+    runs.push_back(vector<tile_xsect>());
+    swap(runs.back(), run);
+    tile(col, row).runs.push_back(idx);
+}
+
+// Interpolate a cross-section a fraction f of the way from a to b.
+static tile_xsect
+interpolate_xsect(const tile_xsect& a, const tile_xsect& b, double f)
+{
+    double l = a.xs.GetL() + f * (b.xs.GetL() - a.xs.GetL());
+    double r = a.xs.GetR() + f * (b.xs.GetR() - a.xs.GetR());
+    double u = a.xs.GetU() + f * (b.xs.GetU() - a.xs.GetU());
+    double d = a.xs.GetD() + f * (b.xs.GetD() - a.xs.GetD());
+    tile_xsect c = { a.p, XSect(a.xs, l, r, u, d) };
+    c.p.x += f * (b.p.x - a.p.x);
+    c.p.y += f * (b.p.y - a.p.y);
+    c.p.z += f * (b.p.z - a.p.z);
+    // Turn the shortest way between the two bearings.
+    double turn = fmod(b.xs.get_right_bearing() - a.xs.get_right_bearing(),
+		       360.0);
+    if (turn > 180.0) {
+	turn -= 360.0;
+    } else if (turn < -180.0) {
+	turn += 360.0;
+    }
+    c.xs.set_right_bearing(a.xs.get_right_bearing() + f * turn);
+    return c;
+}
+
+void
+tile_grid::add_run(const vector<tile_xsect>& run)
+{
+    // Split the run where the passage crosses tile boundaries, ending each
+    // piece with a cross-section interpolated at the boundary and starting
+    // the next piece with the same one so the passage stays joined up.
+    vector<tile_xsect> piece;
+    piece.push_back(run[0]);
+    int col = col_of(run[0].p.x), row = row_of(run[0].p.y);
+    vector<double> cuts;
+    for (size_t i = 1; i < run.size(); ++i) {
+	const tile_xsect& a = run[i - 1];
+	const tile_xsect& b = run[i];
+	cuts.clear();
+	double dx = b.p.x - a.p.x, dy = b.p.y - a.p.y;
+	int col_a = col_of(a.p.x), col_b = col_of(b.p.x);
+	for (int c = min(col_a, col_b) + 1; c <= max(col_a, col_b); ++c) {
+	    cuts.push_back((tile_min_x(c) - a.p.x) / dx);
+	}
+	int row_a = row_of(a.p.y), row_b = row_of(b.p.y);
+	for (int r = min(row_a, row_b) + 1; r <= max(row_a, row_b); ++r) {
+	    cuts.push_back((tile_min_y(r) - a.p.y) / dy);
+	}
+	sort(cuts.begin(), cuts.end());
+	for (size_t k = 0; k != cuts.size(); ++k) {
+	    tile_xsect c = interpolate_xsect(a, b, cuts[k]);
+	    piece.push_back(c);
+	    add_tile_run(col, row, piece);
+	    piece.clear();
+	    piece.push_back(c);
+	    // The tile the passage is in until the next cut.
+	    double f = (cuts[k] + (k + 1 < cuts.size() ? cuts[k + 1] : 1.0)) / 2;
+	    col = col_of(a.p.x + f * dx);
+	    row = row_of(a.p.y + f * dy);
+	}
+	piece.push_back(b);
+    }
+    add_tile_run(col, row, piece);
+}
+
+// Sort the (transformed) contents of the model into tiles.
+static void
+bin_model(const Model& model, const SurveyFilter* filter,
+	  const export_target& t, tile_grid& grid)
+{
+    const SurveyTree& tree = model.GetSurveyTree();
+    if (t.show_mask & (LEGS|SURF)) {
+	for (int f = 0; f != 8; ++f) {
+	    unsigned flags = (f & img_FLAG_SURFACE) ? SURF : LEGS;
+	    if ((t.show_mask & flags) == 0) continue;
+	    if (f & img_FLAG_SPLAY) {
+		if ((t.show_mask & SPLAYS) == 0) continue;
+		flags |= SPLAYS;
 	    }
-	    list<traverse>::const_iterator trav = model.traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = model.traverses_end(f);
+	    vector<traverse>::const_iterator trav = model.traverses_begin(f, filter);
+	    vector<traverse>::const_iterator tend = model.traverses_end(f);
 	    for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
-		vector<PointInfo>::const_iterator pos = trav->begin();
-		vector<PointInfo>::const_iterator end = trav->end();
-		for ( ; pos != end; ++pos) {
-		    transform_point(*pos, pre_offset, COS, SIN, COST, SINT, &p);
-
-		    if (p.x < min_x) min_x = p.x;
-		    if (p.x > max_x) max_x = p.x;
-		    if (p.y < min_y) min_y = p.y;
-		    if (p.y > max_y) max_y = p.y;
-		    if (p.z < min_z) min_z = p.z;
-		    if (p.z > max_z) max_z = p.z;
+		img_point p1;
+		traverse::const_iterator pos = trav->begin();
+		t.transform(*pos, &p1);
+		while (++pos != trav->end()) {
+		    img_point p;
+		    t.transform(*pos, &p);
+		    grid.add_leg(p1, p, flags);
+		    p1 = p;
 		}
 	    }
 	}
-	list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+    }
+
+    if (t.show_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS)) {
+	vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+	vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
 	for ( ; pos != end; ++pos) {
-	    if (filter && !filter->CheckVisible((*pos)->GetText()))
+	    if (filter && !filter->CheckVisible(tree, (*pos)->survey))
 		continue;
+	    tile_label lab;
+	    t.transform(**pos, &lab.p);
+	    lab.label = *pos;
+	    lab.text = (*pos)->GetText().utf8_str();
+	    export_tile& tl = grid.tile(grid.col_of(lab.p.x),
+					grid.row_of(lab.p.y));
+	    tl.labels.push_back(lab);
+	}
+    }
 
-	    transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
-
-	    if (p.x < min_x) min_x = p.x;
-	    if (p.x > max_x) max_x = p.x;
-	    if (p.y < min_y) min_y = p.y;
-	    if (p.y > max_y) max_y = p.y;
-	    if (p.z < min_z) min_z = p.z;
-	    if (p.z > max_z) max_z = p.z;
+    if (t.show_mask & (XSECT|WALLS|PASG)) {
+	list<vector<XSect>>::const_iterator tube = model.tubes_begin();
+	list<vector<XSect>>::const_iterator tube_end = model.tubes_end();
+	for ( ; tube != tube_end; ++tube) {
+	    vector<tile_xsect> run;
+	    for (const XSect& xs : *tube) {
+		if (filter && !filter->CheckVisible(tree, xs.GetSurvey())) {
+		    if (!run.empty()) grid.add_run(run);
+		    run.clear();
+		    continue;
+		}
+		tile_xsect e = { img_point(), xs };
+		t.transform(xs.GetPoint(), &e.p);
+		run.push_back(e);
+	    }
+	    if (!run.empty()) grid.add_run(run);
 	}
+    }
+}
+
+// Write out one tile.  This is called from the worker threads.
+static bool
+export_tile_file(export_tile& tl, const tile_grid& grid,
+		 export_format format, const export_target& proto,
+		 const Model& model, const char* title, const char* datestamp,
+		 double text_height, double scale, mutex& header_mutex)
+{
+    export_target t = proto;
+    t.filt = new_filter(format, model, t, text_height, scale);
+    if (!t.filt) return false;
+    if (!t.filt->fopen(tl.fnm)) {
+	delete t.filt;
+	return false;
+    }
+    tl.created = true;
+
+    double min_x = grid.tile_min_x(tl.col);
+    double min_y = grid.tile_min_y(tl.row);
+    {
+	// Some filters look up the user's name or current time when writing
+	// their header, which isn't thread-safe.
+	lock_guard<mutex> lock(header_mutex);
+	t.filt->header(title, datestamp, model.GetDateStamp(),
+		       min_x, min_y, proto.min_z,
+		       min_x + grid.get_tile_size(),
+		       min_y + grid.get_tile_size(),
+		       proto.max_z);
+    }
 
-	if (grid > 0) {
-	    min_x -= grid / 2;
-	    max_x += grid / 2;
-	    min_y -= grid / 2;
-	    max_y += grid / 2;
+    for (t.pass = t.filt->passes(); *t.pass; ++t.pass) {
+	t.pass_mask = t.show_mask & *t.pass;
+	if (!t.pass_mask) continue;
+	t.filt->start_pass(*t.pass);
+	if (t.pass_mask & (LEGS|SURF)) {
+	    bool have_prev = false;
+	    img_point prev;
+	    unsigned prev_flags = 0;
+	    for (const tile_leg& leg : tl.legs) {
+		if ((t.pass_mask & leg.flags & (LEGS|SURF)) == 0) continue;
+		// Start a new line unless this carries on from the last one.
+		bool pending_move = !(have_prev && leg.flags == prev_flags &&
+				      prev.x == leg.a.x && prev.y == leg.a.y &&
+				      prev.z == leg.a.z);
+		t.filt->line(&leg.a, &leg.b, leg.flags, pending_move);
+		have_prev = true;
+		prev = leg.b;
+		prev_flags = leg.flags;
+	    }
 	}
-   }
+	if (t.pass_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS)) {
+	    for (const tile_label& lab : tl.labels) {
+		/* Use !UNDERGROUND as the criterion - we want stations where a
+		 * surface and underground survey meet to be in the underground
+		 * layer */
+		bool f_surface = !lab.label->IsUnderground();
+		int type = label_type(&t, lab.label);
+		if (type)
+		    t.filt->label(&lab.p, lab.text.c_str(), f_surface, type);
+		if (t.pass_mask & STNS)
+		    t.filt->cross(&lab.p, f_surface);
+	    }
+	}
+	if (t.pass_mask & (XSECT|WALLS|PASG)) {
+	    for (size_t idx : tl.runs) {
+		for (const tile_xsect& e : grid.runs[idx]) {
+		    export_xsect(&t, &e.p, e.xs);
+		}
+		t.filt->tube_end();
+	    }
+	}
+    }
+    t.filt->footer();
+    delete t.filt;
+    return true;
+}
 
-   /* Handle empty file and gracefully, and also zero for the !need_bounds
-    * case. */
-   if (min_x > max_x) {
-      min_x = min_y = min_z = 0;
-      max_x = max_y = max_z = 0;
-   }
+int
+ExportTiled(const vector<export_output>& outputs,
+	    const wxString &title, const wxString &datestamp,
+	    const Model& model,
+	    const SurveyFilter* filter,
+	    double grid_, double text_height, double marker_size_,
+	    double scale, double tile_size, unsigned n_threads)
+{
+   UseNumericCLocale dummy;
 
-   double x_offset, y_offset, z_offset;
-   if (show_mask & FULL_COORDS) {
-       // Full coordinates - offset is applied before rotations.
-       x_offset = y_offset = z_offset = 0.0;
-   } else if (show_mask & CENTRED) {
-       // Centred.
-       x_offset = (min_x + max_x) * -0.5;
-       y_offset = (min_y + max_y) * -0.5;
-       z_offset = (min_z + max_z) * -0.5;
-   } else {
-       // Origin at lowest SW corner.
-       x_offset = -min_x;
-       y_offset = -min_y;
-       z_offset = -min_z;
+   marker_size = marker_size_;
+
+   if (n_threads == 0) {
+       n_threads = thread::hardware_concurrency();
+       if (n_threads == 0) n_threads = 1;
    }
-   if (need_bounds) {
-	min_x += x_offset;
-	max_x += x_offset;
-	min_y += y_offset;
-	max_y += y_offset;
-	min_z += z_offset;
-	max_z += z_offset;
+
+   vector<export_target> targets(outputs.size());
+   for (size_t i = 0; i != outputs.size(); ++i) {
+       init_target(targets[i], outputs[i], model, grid_);
    }
+   find_bounds(model, filter, targets);
 
-   /* Header */
-   filt->header(title.utf8_str(), datestamp.utf8_str(), model.GetDateStamp(),
-		min_x, min_y, min_z, max_x, max_y, max_z);
-
-   p1.x = p1.y = p1.z = 0; /* avoid compiler warning */
-
-   for (pass = filt->passes(); *pass; ++pass) {
-      int pass_mask = show_mask & *pass;
-      if (!pass_mask)
-	  continue;
-      filt->start_pass(*pass);
-      if (pass_mask & (LEGS|SURF)) {
-	  for (int f = 0; f != 8; ++f) {
-	      unsigned flags = (f & img_FLAG_SURFACE) ? SURF : LEGS;
-	      if ((pass_mask & flags) == 0) {
-		  // Not showing traverse because of surface/underground status.
-		  continue;
-	      }
-	      if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
-		  // Not showing because it's a splay.
-		  continue;
-	      }
-	      if (f & img_FLAG_SPLAY) flags |= SPLAYS;
-	      list<traverse>::const_iterator trav = model.traverses_begin(f, filter);
-	      list<traverse>::const_iterator tend = model.traverses_end(f);
-	      for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
-		  assert(trav->size() > 1);
-		  vector<PointInfo>::const_iterator pos = trav->begin();
-		  vector<PointInfo>::const_iterator end = trav->end();
-		  for ( ; pos != end; ++pos) {
-		      transform_point(*pos, pre_offset, COS, SIN, COST, SINT, &p);
-		      p.x += x_offset;
-		      p.y += y_offset;
-		      p.z += z_offset;
-
-		      if (pos == trav->begin()) {
-			  // First point is move...
-			  fPendingMove = 1;
-		      } else {
-			  filt->line(&p1, &p, flags, fPendingMove);
-			  fPendingMove = 0;
-		      }
-		      p1 = p;
-		  }
-	      }
-	  }
-      }
-      if (pass_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS)) {
-	  list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	  list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
-	  for ( ; pos != end; ++pos) {
-	      if (filter && !filter->CheckVisible((*pos)->GetText()))
-		  continue;
-
-	      transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
-	      p.x += x_offset;
-	      p.y += y_offset;
-	      p.z += z_offset;
-
-	      int type = 0;
-	      if ((pass_mask & ENTS) && (*pos)->IsEntrance()) {
-		  type = ENTS;
-	      } else if ((pass_mask & FIXES) && (*pos)->IsFixedPt()) {
-		  type = FIXES;
-	      } else if ((pass_mask & EXPORTS) && (*pos)->IsExportedPt())  {
-		  type = EXPORTS;
-	      } else if (pass_mask & LABELS) {
-		  type = LABELS;
-	      }
-	      /* Use !UNDERGROUND as the criterion - we want stations where a
-	       * surface and underground survey meet to be in the underground
-	       * layer */
-	      bool f_surface = !(*pos)->IsUnderground();
-	      if (type) {
-		  const wxString & text = (*pos)->GetText();
-		  filt->label(&p, text.utf8_str(), f_surface, type);
-	      }
-	      if (pass_mask & STNS)
-		  filt->cross(&p, f_surface);
-	  }
-      }
-      if (pass_mask & (XSECT|WALLS|PASG)) {
-	  bool elevation = (tilt == 0.0);
-	  list<vector<XSect>>::const_iterator tube = model.tubes_begin();
-	  list<vector<XSect>>::const_iterator tube_end = model.tubes_end();
-	  for ( ; tube != tube_end; ++tube) {
-	      vector<XSect>::const_iterator pos = tube->begin();
-	      vector<XSect>::const_iterator end = tube->end();
-	      size_t active_tube_len = 0;
-	      for ( ; pos != end; ++pos) {
-		  const XSect & xs = *pos;
-		  // FIXME: This filtering can create tubes containing a single
-		  // cross-section, which otherwise don't exist in aven (the
-		  // Model class currently filters them out).  Perhaps we
-		  // should just always include these - a single set of LRUD
-		  // measurements is useful even if a single cross-section
-		  // 3D tube perhaps isn't.
-		  if (filter && !filter->CheckVisible(xs.GetLabel())) {
-		      // Close any active tube.
-		      if (active_tube_len > 0) {
-			  active_tube_len = 0;
-			  filt->tube_end();
-		      }
-		      continue;
-		  }
-
-		  ++active_tube_len;
-		  transform_point(xs.GetPoint(), pre_offset, COS, SIN, COST, SINT, &p);
-		  p.x += x_offset;
-		  p.y += y_offset;
-		  p.z += z_offset;
-
-		  if (elevation) {
-		      if (pass_mask & XSECT)
-			  filt->xsect(&p, 90, xs.GetU(), xs.GetD());
-		      if (pass_mask & WALL1)
-			  filt->wall(&p, 90, xs.GetU());
-		      if (pass_mask & WALL2)
-			  filt->wall(&p, 270, xs.GetD());
-		      if (pass_mask & PASG)
-			  filt->passage(&p, 90, xs.GetU(), xs.GetD());
-		  } else {
-		      // Should only be enabled in plan or elevation mode.
-		      double angle = xs.get_right_bearing() - pan;
-		      if (pass_mask & XSECT)
-			  filt->xsect(&p, angle + 180, xs.GetL(), xs.GetR());
-		      if (pass_mask & WALL1)
-			  filt->wall(&p, angle + 180, xs.GetL());
-		      if (pass_mask & WALL2)
-			  filt->wall(&p, angle, xs.GetR());
-		      if (pass_mask & PASG)
-			  filt->passage(&p, angle + 180, xs.GetL(), xs.GetR());
-		  }
-	      }
-	      if (active_tube_len > 0) {
-		  filt->tube_end();
-	      }
-	  }
-      }
+   string utf8_title(title.utf8_str());
+   string utf8_datestamp(datestamp.utf8_str());
+
+   // The files written so far, so we can remove them if we fail.
+   vector<wxString> created;
+   auto fail = [&](size_t i) {
+       for (const wxString& fnm : created) {
+	   wxRemoveFile(fnm);
+       }
+       return int(i);
+   };
+
+   for (size_t i = 0; i != outputs.size(); ++i) {
+       const export_output& out = outputs[i];
+       const export_target& t = targets[i];
+
+       // The tiles are named by inserting the column and row before the
+       // extension, and the index by replacing the extension.
+       wxString base = out.fnm;
+       wxString ext = wxString::FromUTF8(export_format_info[out.format].extension);
+       if (base.length() > ext.length() &&
+	   base.Right(ext.length()).CmpNoCase(ext) == 0) {
+	   ext = base.Right(ext.length());
+	   base.Truncate(base.length() - ext.length());
+       }
+
+       tile_grid grid(t, tile_size);
+       bin_model(model, filter, t, grid);
+
+       vector<export_tile*> todo;
+       for (auto& entry : grid.get_tiles()) {
+	   export_tile& tl = entry.second;
+	   tl.fnm = base;
+	   tl.fnm << wxT('_') << tl.col << wxT('_') << tl.row << ext;
+	   todo.push_back(&tl);
+       }
+
+       // Write the tiles using a pool of worker threads.
+       atomic<size_t> next(0);
+       atomic<bool> ok(true);
+       mutex header_mutex;
+       auto worker = [&]() {
+	   size_t j;
+	   while (ok && (j = next++) < todo.size()) {
+	       if (!export_tile_file(*todo[j], grid, out.format, t, model,
+				     utf8_title.c_str(), utf8_datestamp.c_str(),
+				     text_height, scale, header_mutex)) {
+		   ok = false;
+	       }
+	   }
+       };
+       vector<thread> pool;
+       for (unsigned k = 1; k < n_threads && k < todo.size(); ++k) {
+	   pool.push_back(thread(worker));
+       }
+       worker();
+       for (thread& th : pool) {
+	   th.join();
+       }
+       for (const export_tile* tl : todo) {
+	   if (tl->created) created.push_back(tl->fnm);
+       }
+       if (!ok) return fail(i);
+
+       // Write the index of the tiles, giving the bounds of each in the
+       // coordinate system of the tiles.  This is only written once all the
+       // tiles have been.
+       wxString index_fnm = base + wxT("_tiles.json");
+       FILE * fh_index = wxFopen(index_fnm.fn_str(), wxT("wb"));
+       if (!fh_index) return fail(i);
+       created.push_back(index_fnm);
+       fprintf(fh_index, "{\"tile_size\":%.2f,\"columns\":%d,\"rows\":%d,\n",
+	       tile_size, grid.get_cols(), grid.get_rows());
+       fprintf(fh_index, "\"bounds\":[%.2f,%.2f,%.2f,%.2f],\n\"tiles\":[",
+	       t.min_x, t.min_y, t.max_x, t.max_y);
+       const char* sep = "\n";
+       for (const export_tile* tl : todo) {
+	   wxString leaf = wxFileName(tl->fnm).GetFullName();
+	   double min_x = grid.tile_min_x(tl->col);
+	   double min_y = grid.tile_min_y(tl->row);
+	   fprintf(fh_index, "%s{\"file\":\"", sep);
+	   string escaped;
+	   json_escape(escaped, leaf.utf8_str());
+	   fputs(escaped.c_str(), fh_index);
+	   fprintf(fh_index, "\",\"column\":%d,\"row\":%d,"
+			     "\"bounds\":[%.2f,%.2f,%.2f,%.2f]}",
+		   tl->col, tl->row, min_x, min_y,
+		   min_x + tile_size, min_y + tile_size);
+	   sep = ",\n";
+       }
+       fprintf(fh_index, "\n]}\n");
+       if (fclose(fh_index) != 0) return fail(i);
    }
-   filt->footer();
-   delete filt;
-   osfree(htab);
-   htab = NULL;
-   return true;
+   return -1;
 }
@@ -25,6 +25,8 @@
 
 #include "wx.h"
 
+#include <vector>
+
 class Model;
 class SurveyFilter;
 
@@ -33,6 +35,7 @@ typedef enum {
     FMT_CSV,
     FMT_DXF,
     FMT_EPS,
+    FMT_GLTF,
     FMT_GPX,
     FMT_HPGL,
     FMT_JSON,
@@ -81,6 +84,52 @@ extern const format_info export_format_info[];
 #define DEFAULT_TEXT_HEIGHT 0.6
 #define DEFAULT_MARKER_SIZE 0.8
 
+/// One output file to write in a call to Export().
+struct export_output {
+    wxString fnm;
+    export_format format;
+    int show_mask;
+    double pan, tilt;
+};
+
+/** Export model to several files in one go.
+ *
+ *  The model is walked once per pass for all the outputs which need it, so
+ *  this is more efficient than calling Export() for each output in turn.
+ *
+ *  Returns -1 on success, or the index in outputs of a file which couldn't be
+ *  opened for writing (in which case no output is generated).
+ */
+int Export(const std::vector<export_output>& outputs,
+	   const wxString &title, const wxString &datestamp,
+	   const Model& model,
+	   const SurveyFilter* filter,
+	   double grid_, double text_height_, double marker_size_,
+	   double scale);
+
+/** Export model to several files, each split into a grid of square tiles.
+ *
+ *  The plan is partitioned into tiles of side tile_size (in metres, in the
+ *  plane of projection), with legs clipped to each tile and passages split
+ *  where they cross from one tile to the next, and the tiles are written in
+ *  parallel using n_threads threads (0 means one per CPU).  Each
+ *  tile is written to a file named by inserting "_<column>_<row>" before the
+ *  extension of the output filename, with column 0 at the west and row 0 at
+ *  the south.  Only tiles with something in are written, and these are
+ *  listed in an index file in JSON format, named by replacing the extension
+ *  with "_tiles.json".
+ *
+ *  Returns -1 on success, or the index in outputs of the output which
+ *  couldn't be written (in which case any tiles and index files already
+ *  written are removed).
+ */
+int ExportTiled(const std::vector<export_output>& outputs,
+		const wxString &title, const wxString &datestamp,
+		const Model& model,
+		const SurveyFilter* filter,
+		double grid_, double text_height_, double marker_size_,
+		double scale, double tile_size, unsigned n_threads);
+
 bool Export(const wxString &fnm_out, const wxString &title,
 	    const wxString &datestamp,
 	    const Model& model,
@@ -47,12 +47,12 @@
 #include <wx/image.h>
 #include <wx/zipstrm.h>
 
+#include <atomic>
+#include <thread>
+
 #define ACCEPT_USE_OF_DEPRECATED_PROJ_API_H 1
 #include <proj_api.h>
 
-const unsigned long DEFAULT_HGT_DIM = 3601;
-const unsigned long DEFAULT_HGT_SIZE = sqrd(DEFAULT_HGT_DIM) * 2;
-
 // Values for m_SwitchingTo
 #define PLAN 1
 #define ELEVATION 2
@@ -106,6 +106,24 @@ static const gla_colour NODATA_COLOUR = col_LIGHT_GREY_2;
 // vector for lighting angle
 static const Vector3 light(.577, .577, .577);
 
+// Number of levels of detail for legs and tubes.  Level 0 is full detail, and
+// each level after the first allows 4 times the simplification error.
+static const unsigned NUM_LOD_LEVELS = 4;
+
+// Splays and station crosses are culled once a pixel covers more than this
+// many metres, since they're just clutter by then.
+static const double LOD_CULL_SIZE = 8.0;
+
+// Return the maximum simplification error allowed for level of detail level.
+static double
+lod_tolerance(const Vector3& extent, unsigned level)
+{
+    if (level == 0) return 0.0;
+    // At the initial scale, the whole survey is about 1000 pixels across, so
+    // this makes level 2 about a pixel.
+    return extent.magnitude() / (4096 >> (2 * (level - 1)));
+}
+
 BEGIN_EVENT_TABLE(GfxCore, GLACanvas)
     EVT_PAINT(GfxCore::OnPaint)
     EVT_LEFT_DOWN(GfxCore::OnLButtonDown)
@@ -128,7 +146,6 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
     initial_scale(1.0),
     m_ScaleBarWidth(0),
     m_Control(control),
-    m_LabelGrid(NULL),
     m_Parent(parent),
     m_DoneFirstShow(false),
     m_TiltAngle(0.0),
@@ -166,20 +183,19 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
     m_RenderStats(false),
     m_PointGrid(NULL),
     m_HitTestGridValid(false),
+    visible_labels_serial(0),
     m_here(NULL),
     m_there(NULL),
     presentation_mode(0),
     pres_reverse(false),
     pres_speed(0.0),
     movie(NULL),
+    movie_failed(false),
     current_cursor(GfxCore::CURSOR_DEFAULT),
     sqrd_measure_threshold(sqrd(MEASURE_THRESHOLD)),
-    dem(NULL),
     last_time(0),
     n_tris(0)
 {
-    AddQuad = &GfxCore::AddQuadrilateralDepth;
-    AddPoly = &GfxCore::AddPolylineDepth;
     wxConfigBase::Get()->Read(wxT("metric"), &m_Metric, true);
     wxConfigBase::Get()->Read(wxT("degrees"), &m_Degrees, true);
     wxConfigBase::Get()->Read(wxT("percent"), &m_Percent, false);
@@ -203,8 +219,8 @@ GfxCore::~GfxCore()
 void GfxCore::TryToFreeArrays()
 {
     // Free up any memory allocated for arrays.
-    delete[] m_LabelGrid;
-    m_LabelGrid = NULL;
+    label_placer.reset(0, 0, 0);
+    label_placer_valid = false;
 }
 
 //
@@ -220,6 +236,7 @@ void GfxCore::Initialise(bool same_file)
     m_DoneFirstShow = false;
 
     m_HitTestGridValid = false;
+    visible_labels_serial = 0;
     m_here = NULL;
     m_there = NULL;
 
@@ -247,7 +264,9 @@ void GfxCore::Initialise(bool same_file)
     InvalidateList(LIST_CROSSES);
     InvalidateList(LIST_GRID);
     InvalidateList(LIST_SHADOW);
-    InvalidateList(LIST_TERRAIN);
+    // The terrain is often the same for different survey files, and is slow
+    // to generate.
+    if (TerrainKey() != terrain_key) InvalidateList(LIST_TERRAIN);
 
     // Set diameter of the viewing volume.
     auto ext = m_Parent->GetExtent();
@@ -286,8 +305,10 @@ void GfxCore::FirstShow()
 {
     GLACanvas::FirstShow();
 
+    SetPalette(m_Pens, NUM_COLOUR_BANDS, NODATA_COLOUR);
+
     const unsigned int quantise(GetFontSize() / QUANTISE_FACTOR);
-    list<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
+    vector<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
     while (pos != m_Parent->GetLabelsNCEnd()) {
 	LabelInfo* label = *pos++;
 	// Calculate and set the label width for use when plotting
@@ -380,187 +401,201 @@ void GfxCore::OnPaint(wxPaintEvent&)
     wxPaintDC dc(this);
 
     if (m_HaveData) {
-	// Make sure we're initialised.
-	bool first_time = !m_DoneFirstShow;
-	if (first_time) {
-	    FirstShow();
-	}
+	Draw();
+    } else {
+	dc.SetBackground(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWFRAME));
+	dc.Clear();
+    }
+}
 
-	StartDrawing();
+void GfxCore::Draw()
+{
+    // Make sure we're initialised.
+    bool first_time = !m_DoneFirstShow;
+    if (first_time) {
+	FirstShow();
+    }
 
-	// Clear the background.
-	Clear();
+    StartDrawing();
 
-	// Set up model transformation matrix.
-	SetDataTransform();
+    // Clear the background.
+    Clear();
 
-	if (m_Legs || m_Tubes) {
-	    if (m_Tubes) {
-		EnableSmoothPolygons(true); // FIXME: allow false for wireframe view
-		DrawList(LIST_TUBES);
-		DisableSmoothPolygons();
-	    }
+    // Set up model transformation matrix.
+    SetDataTransform();
 
-	    // Draw the underground legs.  Do this last so that anti-aliasing
-	    // works over polygons.
-	    SetColour(col_GREEN);
-	    DrawList(LIST_UNDERGROUND_LEGS);
+    if (m_Legs || m_Tubes) {
+	if (m_Tubes) {
+	    EnableSmoothPolygons(true); // FIXME: allow false for wireframe view
+	    DrawTubes();
+	    DisableSmoothPolygons();
 	}
 
-	if (m_Surface) {
-	    // Draw the surface legs.
-	    DrawList(LIST_SURFACE_LEGS);
-	}
+	// Draw the underground legs.  Do this last so that anti-aliasing
+	// works over polygons.
+	DrawLegs(false);
+    }
 
-	if (m_BoundingBox) {
-	    DrawShadowedBoundingBox();
-	}
-	if (m_Grid) {
-	    // Draw the grid.
-	    DrawList(LIST_GRID);
-	}
+    if (m_Surface) {
+	// Draw the surface legs.
+	DrawLegs(true);
+    }
+
+    if (m_BoundingBox) {
+	DrawShadowedBoundingBox();
+    }
+    if (m_Grid) {
+	// Draw the grid.
+	DrawList(LIST_GRID);
+    }
 
+    // Where possible, draw all the markers of each type with a single call
+    // from a buffer which doesn't need regenerating when the view changes.
+    if (CanDrawMarkerBuffer(GLAVertexBuffer::BLOBS)) {
+	DrawVertexBuffer(LIST_BLOBS, -1, 0);
+    } else {
 	DrawList(LIST_BLOBS);
+    }
 
-	if (m_Crosses) {
+    if (m_Crosses && GetPixelSize() <= LOD_CULL_SIZE) {
+	if (CanDrawMarkerBuffer(GLAVertexBuffer::CROSSES)) {
+	    DrawVertexBuffer(LIST_CROSSES, -1, 0);
+	} else {
 	    DrawList(LIST_CROSSES);
 	}
+    }
 
-	if (m_Terrain) {
-	    // Disable texturing while drawing terrain.
-	    bool texturing = GetTextured();
-	    if (texturing) GLACanvas::ToggleTextured();
+    if (m_Terrain) {
+	// Disable texturing while drawing terrain.
+	bool texturing = GetTextured();
+	if (texturing) GLACanvas::ToggleTextured();
 
-	    // This is needed if blobs and/or crosses are drawn using lines -
-	    // otherwise the terrain doesn't appear when they are enabled.
-	    SetDataTransform();
+	// This is needed if blobs and/or crosses are drawn using lines -
+	// otherwise the terrain doesn't appear when they are enabled.
+	SetDataTransform();
 
-	    // We don't want to be able to see the terrain through itself, so
-	    // do a "Z-prepass" - plot the terrain once only updating the
-	    // Z-buffer, then again with Z-clipping only plotting where the
-	    // depth matches the value in the Z-buffer.
-	    DrawListZPrepass(LIST_TERRAIN);
+	// We don't want to be able to see the terrain through itself, so
+	// do a "Z-prepass" - plot the terrain once only updating the
+	// Z-buffer, then again with Z-clipping only plotting where the
+	// depth matches the value in the Z-buffer.
+	DrawTerrain();
 
-	    if (texturing) GLACanvas::ToggleTextured();
-	}
+	if (texturing) GLACanvas::ToggleTextured();
+    }
 
-	SetIndicatorTransform();
+    SetIndicatorTransform();
 
-	// Draw station names.
-	if (m_Names /*&& !m_Control->MouseDown() && !Animating()*/) {
-	    SetColour(NAME_COLOUR);
+    // Draw station names.
+    if (m_Names /*&& !m_Control->MouseDown() && !Animating()*/) {
+	SetColour(NAME_COLOUR);
 
-	    if (m_OverlappingNames) {
-		SimpleDrawNames();
-	    } else {
-		NattyDrawNames();
-	    }
+	if (m_OverlappingNames) {
+	    SimpleDrawNames();
+	} else {
+	    NattyDrawNames();
 	}
+    }
 
-	if (!highlighted_survey.empty()) {
-	    HighlightSurvey();
-	}
+    if (!highlighted_survey.empty()) {
+	HighlightSurvey();
+    }
 
-	if (m_HitTestDebug) {
-	    // Show the hit test grid bucket sizes...
-	    SetColour(m_HitTestGridValid ? col_LIGHT_GREY : col_DARK_GREY);
-	    if (m_PointGrid) {
-		for (int i = 0; i != HITTEST_SIZE; ++i) {
-		    int x = (GetXSize() + 1) * i / HITTEST_SIZE + 2;
-		    for (int j = 0; j != HITTEST_SIZE; ++j) {
-			int square = i + j * HITTEST_SIZE;
-			unsigned long bucket_size = m_PointGrid[square].size();
-			if (bucket_size) {
-			    int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
-			    DrawIndicatorText(x, y, wxString::Format(wxT("%lu"), bucket_size));
-			}
+    if (m_HitTestDebug) {
+	// Show the hit test grid bucket sizes...
+	SetColour(m_HitTestGridValid ? col_LIGHT_GREY : col_DARK_GREY);
+	if (m_PointGrid) {
+	    for (int i = 0; i != HITTEST_SIZE; ++i) {
+		int x = (GetXSize() + 1) * i / HITTEST_SIZE + 2;
+		for (int j = 0; j != HITTEST_SIZE; ++j) {
+		    int square = i + j * HITTEST_SIZE;
+		    unsigned long bucket_size = m_PointGrid[square].size();
+		    if (bucket_size) {
+			int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
+			DrawIndicatorText(x, y, wxString::Format(wxT("%lu"), bucket_size));
 		    }
 		}
 	    }
-
-	    EnableDashedLines();
-	    BeginLines();
-	    for (int i = 0; i != HITTEST_SIZE; ++i) {
-		int x = (GetXSize() + 1) * i / HITTEST_SIZE;
-		PlaceIndicatorVertex(x, 0);
-		PlaceIndicatorVertex(x, GetYSize());
-	    }
-	    for (int j = 0; j != HITTEST_SIZE; ++j) {
-		int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
-		PlaceIndicatorVertex(0, y);
-		PlaceIndicatorVertex(GetXSize(), y);
-	    }
-	    EndLines();
-	    DisableDashedLines();
-	}
-
-	long now = timer.Time();
-	if (m_RenderStats) {
-	    // Show stats about rendering.
-	    SetColour(col_TURQUOISE);
-	    int y = GetYSize() - GetFontSize();
-	    if (last_time != 0.0) {
-		// timer.Time() measure in milliseconds.
-		double fps = 1000.0 / (now - last_time);
-		DrawIndicatorText(1, y, wxString::Format(wxT("FPS:% 5.1f"), fps));
-	    }
-	    y -= GetFontSize();
-	    DrawIndicatorText(1, y, wxString::Format(wxT("▲:%lu"), (unsigned long)n_tris));
 	}
-	last_time = now;
 
-	// Draw indicators.
-	//
-	// There's no advantage in generating an OpenGL list for the
-	// indicators since they change with almost every redraw (and
-	// sometimes several times between redraws).  This way we avoid
-	// the need to track when to update the indicator OpenGL list,
-	// and also avoid indicator update bugs when we don't quite get this
-	// right...
-	DrawIndicators();
-
-	if (zoombox.active()) {
-	    SetColour(SEL_COLOUR);
-	    EnableDashedLines();
-	    BeginPolyline();
-	    glaCoord Y = GetYSize();
-	    PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y1);
-	    PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y2);
-	    PlaceIndicatorVertex(zoombox.x2, Y - zoombox.y2);
-	    PlaceIndicatorVertex(zoombox.x2, Y - zoombox.y1);
-	    PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y1);
-	    EndPolyline();
-	    DisableDashedLines();
-	} else if (MeasuringLineActive()) {
-	    // Draw "here" and "there".
-	    double hx, hy;
-	    SetColour(HERE_COLOUR);
+	EnableDashedLines();
+	BeginLines();
+	for (int i = 0; i != HITTEST_SIZE; ++i) {
+	    int x = (GetXSize() + 1) * i / HITTEST_SIZE;
+	    PlaceIndicatorVertex(x, 0);
+	    PlaceIndicatorVertex(x, GetYSize());
+	}
+	for (int j = 0; j != HITTEST_SIZE; ++j) {
+	    int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
+	    PlaceIndicatorVertex(0, y);
+	    PlaceIndicatorVertex(GetXSize(), y);
+	}
+	EndLines();
+	DisableDashedLines();
+    }
+
+    long now = timer.Time();
+    if (m_RenderStats) {
+	// Show stats about rendering.
+	SetColour(col_TURQUOISE);
+	int y = GetYSize() - GetFontSize();
+	if (last_time != 0.0) {
+	    // timer.Time() measure in milliseconds.
+	    double fps = 1000.0 / (now - last_time);
+	    DrawIndicatorText(1, y, wxString::Format(wxT("FPS:% 5.1f"), fps));
+	}
+	y -= GetFontSize();
+	DrawIndicatorText(1, y, wxString::Format(wxT("▲:%lu"), (unsigned long)n_tris));
+    }
+    last_time = now;
+
+    // Draw indicators.
+    //
+    // There's no advantage in generating an OpenGL list for the
+    // indicators since they change with almost every redraw (and
+    // sometimes several times between redraws).  This way we avoid
+    // the need to track when to update the indicator OpenGL list,
+    // and also avoid indicator update bugs when we don't quite get this
+    // right...
+    DrawIndicators();
+
+    if (zoombox.active()) {
+	SetColour(SEL_COLOUR);
+	EnableDashedLines();
+	BeginPolyline();
+	glaCoord Y = GetYSize();
+	PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y1);
+	PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y2);
+	PlaceIndicatorVertex(zoombox.x2, Y - zoombox.y2);
+	PlaceIndicatorVertex(zoombox.x2, Y - zoombox.y1);
+	PlaceIndicatorVertex(zoombox.x1, Y - zoombox.y1);
+	EndPolyline();
+	DisableDashedLines();
+    } else if (MeasuringLineActive()) {
+	// Draw "here" and "there".
+	double hx, hy;
+	SetColour(HERE_COLOUR);
+	if (m_here) {
+	    double dummy;
+	    Transform(*m_here, &hx, &hy, &dummy);
+	    if (m_here != &temp_here) DrawRing(hx, hy);
+	}
+	if (m_there) {
+	    double tx, ty;
+	    double dummy;
+	    Transform(*m_there, &tx, &ty, &dummy);
 	    if (m_here) {
-		double dummy;
-		Transform(*m_here, &hx, &hy, &dummy);
-		if (m_here != &temp_here) DrawRing(hx, hy);
-	    }
-	    if (m_there) {
-		double tx, ty;
-		double dummy;
-		Transform(*m_there, &tx, &ty, &dummy);
-		if (m_here) {
-		    BeginLines();
-		    PlaceIndicatorVertex(hx, hy);
-		    PlaceIndicatorVertex(tx, ty);
-		    EndLines();
-		}
-		BeginBlobs();
-		DrawBlob(tx, ty);
-		EndBlobs();
+		BeginLines();
+		PlaceIndicatorVertex(hx, hy);
+		PlaceIndicatorVertex(tx, ty);
+		EndLines();
 	    }
+	    BeginBlobs();
+	    DrawBlob(tx, ty);
+	    EndBlobs();
 	}
-
-	FinishDrawing();
-    } else {
-	dc.SetBackground(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWFRAME));
-	dc.Clear();
     }
+
+    FinishDrawing();
 }
 
 void GfxCore::DrawBoundingBox()
@@ -936,99 +971,143 @@ void GfxCore::NattyDrawNames()
     const unsigned int quantise(GetFontSize() / QUANTISE_FACTOR);
     const unsigned int quantised_x = GetXSize() / quantise;
     const unsigned int quantised_y = GetYSize() / quantise;
-    const size_t buffer_size = quantised_x * quantised_y;
-
-    if (!m_LabelGrid) m_LabelGrid = new char[buffer_size];
 
-    memset((void*) m_LabelGrid, 0, buffer_size);
+    // Work in grid cells relative to where the origin projects to, so that
+    // translating the view doesn't make which labels are displayed change
+    // as the resulting twinkling effect is distracting.  This also means
+    // we can keep the placement while the view is only panned, and just
+    // consider labels which weren't on screen before.
+    double ox, oy, oz;
+    Transform(Vector3(), &ox, &oy, &oz);
+    const int origin_u = int(floor(ox / quantise));
+    const int origin_v = int(floor(oy / quantise));
+    ox -= origin_u * double(quantise);
+    oy -= origin_v * double(quantise);
+
+    // The placement is only still valid if the projection is the same apart
+    // from a translation, so record where the unit axes project to relative
+    // to the origin.
+    double key[12];
+    const Vector3 axes[3] = {
+	Vector3(1.0, 0.0, 0.0), Vector3(0.0, 1.0, 0.0), Vector3(0.0, 0.0, 1.0)
+    };
+    for (int axis = 0; axis < 3; ++axis) {
+	double* k = key + axis * 3;
+	Transform(axes[axis], &k[0], &k[1], &k[2]);
+	k[0] -= ox + origin_u * double(quantise);
+	k[1] -= oy + origin_v * double(quantise);
+	k[2] -= oz;
+    }
+    key[9] = GetFontSize();
+    key[10] = m_Splays;
+    key[11] = int(m_Surface) | int(m_Legs) << 1;
+    bool valid = label_placer_valid;
+    if (valid) {
+	for (int i = 0; i != 12; ++i) {
+	    if (fabs(key[i] - label_placer_key[i]) > 1e-6) {
+		valid = false;
+		break;
+	    }
+	}
+    }
+    // Also start again if we've been panned so far that we've accumulated a
+    // lot of placement data.
+    if (!valid ||
+	label_placer.cells() > 16 * size_t(quantised_x) * quantised_y) {
+	label_placer.reset(m_Parent->GetLabelsEnd() - m_Parent->GetLabels(),
+			   QUANTISE_FACTOR, 3);
+	label_placer.cover(-origin_u, -origin_v,
+			   int(quantised_x) - origin_u,
+			   int(quantised_y) - origin_v);
+	memcpy(label_placer_key, key, sizeof(key));
+	label_placer_valid = true;
+    }
 
+    const GLAProjectedPoints& points = ProjectLabels();
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
-    for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
-	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
+    for (size_t i = 0; i != visible_labels.size(); ++i) {
+	const LabelInfo* label = visible_labels[i];
+	if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
 	    continue;
 
-	if (!((m_Surface && (*label)->IsSurface()) ||
-	      (m_Legs && (*label)->IsUnderground()) ||
-	      (!(*label)->IsSurface() && !(*label)->IsUnderground()))) {
+	if (!((m_Surface && label->IsSurface()) ||
+	      (m_Legs && label->IsUnderground()) ||
+	      (!label->IsSurface() && !label->IsUnderground()))) {
 	    // if this station isn't to be displayed, skip to the next
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
+	if (filter && !filter->CheckVisible(tree, label->survey))
 	    continue;
 
-	double x, y, z;
-
-	Transform(**label, &x, &y, &z);
+	double x = points.GetX(i);
+	double y = points.GetY(i);
+	double z = points.GetZ(i);
 	// Check if the label is behind us (in perspective view).
 	if (z <= 0.0 || z >= 1.0) continue;
 
-	// Apply a small shift so that translating the view doesn't make which
-	// labels are displayed change as the resulting twinkling effect is
-	// distracting.
-	double tx, ty, tz;
-	Transform(Vector3(), &tx, &ty, &tz);
-	tx -= floor(tx / quantise) * quantise;
-	ty -= floor(ty / quantise) * quantise;
-
-	tx = x - tx;
+	double tx = x - ox;
 	if (tx < 0) continue;
 
-	ty = y - ty;
+	double ty = y - oy;
 	if (ty < 0) continue;
 
 	unsigned int iy = unsigned(ty) / quantise;
 	if (iy >= quantised_y) continue;
-	unsigned int width = (*label)->get_width();
+	unsigned int width = label->get_width();
 	unsigned int ix = unsigned(tx) / quantise;
 	if (ix + width >= quantised_x) continue;
 
-	char * test = m_LabelGrid + ix + iy * quantised_x;
-	if (memchr(test, 1, width)) continue;
+	switch (label_placer.get_state(label->plot_order)) {
+	    case LabelPlacer::REJECTED:
+		continue;
+	    case LabelPlacer::UNDECIDED:
+		// Decide now, in plot order of the labels not yet decided.
+		if (!label_placer.place(label->plot_order,
+					int(ix) - origin_u, int(iy) - origin_v,
+					width)) {
+		    continue;
+		}
+		break;
+	}
 
 	x += 3;
 	y -= GetFontSize() / 2;
-	DrawIndicatorText((int)x, (int)y, (*label)->GetText());
-
-	if (iy > QUANTISE_FACTOR) iy = QUANTISE_FACTOR;
-	test -= quantised_x * iy;
-	iy += 4;
-	while (--iy && test < m_LabelGrid + buffer_size) {
-	    memset(test, 1, width);
-	    test += quantised_x;
-	}
+	DrawIndicatorText((int)x, (int)y, label->GetText());
     }
 }
 
 void GfxCore::SimpleDrawNames()
 {
+    const GLAProjectedPoints& points = ProjectLabels();
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
     // Draw all station names, without worrying about overlaps
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
-    for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
-	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
+    for (size_t i = 0; i != visible_labels.size(); ++i) {
+	const LabelInfo* label = visible_labels[i];
+	if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
 	    continue;
 
-	if (!((m_Surface && (*label)->IsSurface()) ||
-	      (m_Legs && (*label)->IsUnderground()) ||
-	      (!(*label)->IsSurface() && !(*label)->IsUnderground()))) {
+	if (!((m_Surface && label->IsSurface()) ||
+	      (m_Legs && label->IsUnderground()) ||
+	      (!label->IsSurface() && !label->IsUnderground()))) {
 	    // if this station isn't to be displayed, skip to the next
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
+	if (filter && !filter->CheckVisible(tree, label->survey))
 	    continue;
 
-	double x, y, z;
-	Transform(**label, &x, &y, &z);
+	double x = points.GetX(i);
+	double y = points.GetY(i);
 
 	// Check if the label is behind us (in perspective view).
-	if (z <= 0) continue;
+	if (points.GetZ(i) <= 0) continue;
 
 	x += 3;
 	y -= GetFontSize() / 2;
-	DrawIndicatorText((int)x, (int)y, (*label)->GetText());
+	DrawIndicatorText((int)x, (int)y, label->GetText());
     }
 }
 
@@ -1596,9 +1675,10 @@ void GfxCore::Animate()
 
     long t;
     if (movie) {
-	ReadPixels(movie->GetWidth(), movie->GetHeight(), movie->GetBuffer());
-	if (!movie->AddFrame()) {
+	if (!AddMovieFrame()) {
 	    wxGetApp().ReportError(wxString(movie->get_error_string(), wxConvUTF8));
+	    movie_failed = true;
+	    CancelReadPixels();
 	    delete movie;
 	    movie = NULL;
 	    presentation_mode = 0;
@@ -1636,8 +1716,9 @@ void GfxCore::Animate()
 	    if (!next_mark.is_valid()) {
 		SetView(prev_mark);
 		presentation_mode = 0;
-		if (movie && !movie->Close()) {
+		if (movie && !FinishMovie()) {
 		    wxGetApp().ReportError(wxString(movie->get_error_string(), wxConvUTF8));
+		    movie_failed = true;
 		}
 		delete movie;
 		movie = NULL;
@@ -1834,17 +1915,18 @@ void GfxCore::HighlightSurvey()
     SurveyFilter filter;
     filter.add(highlighted_survey);
     filter.SetSeparator(m_Parent->GetSeparator());
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
 
     double x_min = HUGE_VAL, x_max = -HUGE_VAL;
     double y_min = HUGE_VAL, y_max = -HUGE_VAL;
     double xpy_min = HUGE_VAL, xpy_max = -HUGE_VAL;
     double xmy_min = HUGE_VAL, xmy_max = -HUGE_VAL;
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     double x_tot = 0, y_tot = 0;
     size_t c = 0;
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(tree, label->survey))
 	    continue;
 
 	double x, y, z;
@@ -1864,8 +1946,8 @@ void GfxCore::HighlightSurvey()
 	++c;
     }
     for (int f = 0; f != 8; ++f) {
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, &filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
+	vector<traverse>::const_iterator trav = m_Parent->traverses_begin(f, &filter);
+	vector<traverse>::const_iterator tend = m_Parent->traverses_end(f);
 	while (trav != tend) {
 	    for (auto&& p : *trav) {
 		double x, y, z;
@@ -1920,6 +2002,7 @@ void GfxCore::ZoomToSurvey(const wxString& survey) {
     SurveyFilter filter;
     filter.add(survey);
     filter.SetSeparator(m_Parent->GetSeparator());
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
 
     Double xmin = DBL_MAX;
     Double xmax = -DBL_MAX;
@@ -1928,11 +2011,11 @@ void GfxCore::ZoomToSurvey(const wxString& survey) {
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
 
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(tree, label->survey))
 	    continue;
 
 	if (label->GetX() < xmin) xmin = label->GetX();
@@ -1983,12 +2066,12 @@ void GfxCore::CreateHitTestGrid()
 	}
     }
 
+    const GLAProjectedPoints& points = ProjectLabels();
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
     // Fill the grid.
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
-    list<LabelInfo*>::const_iterator end = m_Parent->GetLabelsEnd();
-    while (pos != end) {
-	LabelInfo* label = *pos++;
+    for (size_t i = 0; i != visible_labels.size(); ++i) {
+	LabelInfo* label = visible_labels[i];
 
 	if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
 	    continue;
@@ -2001,12 +2084,11 @@ void GfxCore::CreateHitTestGrid()
 	    continue;
 	}
 
-	if (filter && !filter->CheckVisible(label->GetText()))
+	if (filter && !filter->CheckVisible(tree, label->survey))
 	    continue;
 
-	// Calculate screen coordinates.
-	double cx, cy, cz;
-	Transform(*label, &cx, &cy, &cz);
+	double cx = points.GetX(i);
+	double cy = points.GetY(i);
 	if (cx < 0 || cx >= GetXSize()) continue;
 	if (cy < 0 || cy >= GetYSize()) continue;
 
@@ -2022,6 +2104,34 @@ void GfxCore::CreateHitTestGrid()
     m_HitTestGridValid = true;
 }
 
+const GLAProjectedPoints& GfxCore::ProjectLabels()
+{
+    // Find the stations in view using the model's spatial index and calculate
+    // their screen coordinates in one go.  This is shared by everything which
+    // needs them until the view changes.
+    if (visible_labels_serial != GetTransformSerial()) {
+	visible_labels_serial = GetTransformSerial();
+	visible_labels.clear();
+	m_Parent->GetStationIndex().query(
+	    [this](const float* min, const float* max) {
+		return BoxInView(min, max);
+	    },
+	    [this](LabelInfo* label) {
+		visible_labels.push_back(label);
+	    });
+	sort(visible_labels.begin(), visible_labels.end(),
+	     [](const LabelInfo* a, const LabelInfo* b) {
+		 return a->plot_order < b->plot_order;
+	     });
+	label_points.clear();
+	for (auto&& label : visible_labels) {
+	    label_points.push_back(*label);
+	}
+    }
+    Transform(label_points);
+    return label_points;
+}
+
 //
 //  Methods for controlling the orientation of the survey
 //
@@ -2508,7 +2618,7 @@ int GfxCore::GetNumExportedPts() const
 
 void GfxCore::ToggleTerrain()
 {
-    if (!m_Terrain && !dem) {
+    if (!m_Terrain && terrain.empty()) {
 	// OnOpenTerrain() calls us if a file is selected.
 	wxCommandEvent dummy;
 	m_Parent->OnOpenTerrain(dummy);
@@ -2581,15 +2691,6 @@ void GfxCore::GenerateList(unsigned int l)
 	case LIST_STYLE_KEY:
 	    DrawStyleKey();
 	    break;
-	case LIST_UNDERGROUND_LEGS:
-	    GenerateDisplayList(false);
-	    break;
-	case LIST_TUBES:
-	    GenerateDisplayListTubes();
-	    break;
-	case LIST_SURFACE_LEGS:
-	    GenerateDisplayList(true);
-	    break;
 	case LIST_BLOBS:
 	    GenerateBlobsDisplayList();
 	    break;
@@ -2597,22 +2698,12 @@ void GfxCore::GenerateList(unsigned int l)
 	    BeginCrosses();
 	    SetColour(col_LIGHT_GREY);
 	    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+	    const SurveyTree& tree = m_Parent->GetSurveyTree();
+	    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
 	    while (pos != m_Parent->GetLabelsEnd()) {
 		const LabelInfo* label = *pos++;
-
-		if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
-		    continue;
-
-		if ((m_Surface && label->IsSurface()) ||
-		    (m_Legs && label->IsUnderground()) ||
-		    (!label->IsSurface() && !label->IsUnderground())) {
-		    // Check if this station should be displayed
-		    // (last case above is for stns with no legs attached)
-		    if (filter && !filter->CheckVisible(label->GetText()))
-			continue;
+		if (ShowStation(label, filter, tree))
 		    DrawCross(label->GetX(), label->GetY(), label->GetZ());
-		}
 	    }
 	    EndCrosses();
 	    break;
@@ -2623,9 +2714,6 @@ void GfxCore::GenerateList(unsigned int l)
 	case LIST_SHADOW:
 	    GenerateDisplayListShadow();
 	    break;
-	case LIST_TERRAIN:
-	    DrawTerrain();
-	    break;
 	default:
 	    assert(false);
 	    break;
@@ -2635,16 +2723,127 @@ void GfxCore::GenerateList(unsigned int l)
 void GfxCore::ToggleSmoothShading()
 {
     GLACanvas::ToggleSmoothShading();
-    InvalidateList(LIST_TUBES);
     ForceRefresh();
 }
 
-void GfxCore::GenerateDisplayList(bool surface)
+void GfxCore::GenerateVertexBuffer(unsigned int l, GLAVertexBuffer& buffer)
+{
+    assert(m_HaveData);
+
+    switch (l) {
+	case LIST_UNDERGROUND_LEGS:
+	    GenerateLegsVertexBuffer(false, buffer);
+	    break;
+	case LIST_TUBES:
+	    GenerateTubesVertexBuffer(buffer);
+	    break;
+	case LIST_SURFACE_LEGS:
+	    GenerateLegsVertexBuffer(true, buffer);
+	    break;
+	case LIST_BLOBS:
+	    GenerateMarkersVertexBuffer(false, buffer);
+	    break;
+	case LIST_CROSSES:
+	    GenerateMarkersVertexBuffer(true, buffer);
+	    break;
+	case LIST_TERRAIN:
+	    GenerateTerrainVertexBuffer(buffer);
+	    break;
+	default:
+	    assert(false);
+	    break;
+    }
+}
+
+static GLAPen
+survey_pen(int hash)
+{
+    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
+    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
+    GLAPen pen;
+    pen.SetColour(rgb.red / 256.0, rgb.green / 256.0, rgb.blue / 256.0);
+    return pen;
+}
+
+// Return the parameter t of the closest point to p on the line segment from a
+// to b, which is a + t * (b - a).
+static double
+closest_on_segment(const Vector3& p, const Vector3& a, const Vector3& b)
+{
+    Vector3 ab = b - a;
+    double len_sqrd = dot(ab, ab);
+    if (len_sqrd == 0.0) return 0.0;
+    double t = dot(p - a, ab) / len_sqrd;
+    return min(max(t, 0.0), 1.0);
+}
+
+// Simplify a polyline of n points with the Douglas-Peucker algorithm.
+//
+// error(a, b, i) should return how far point i is from the simplified line
+// from point a to point b.  The indices of the points to keep (always
+// including the first and last) are returned in kept.
+template<typename E>
+static void
+simplify_polyline(size_t n, double tolerance, E error, vector<size_t>& kept)
+{
+    kept.clear();
+    if (tolerance <= 0.0 || n <= 2) {
+	for (size_t i = 0; i != n; ++i) kept.push_back(i);
+	return;
+    }
+
+    vector<bool> keep(n);
+    keep[0] = keep[n - 1] = true;
+    vector<pair<size_t, size_t>> todo;
+    todo.push_back(make_pair(size_t(0), n - 1));
+    while (!todo.empty()) {
+	size_t a = todo.back().first;
+	size_t b = todo.back().second;
+	todo.pop_back();
+	size_t worst = 0;
+	double worst_error = tolerance;
+	for (size_t i = a + 1; i < b; ++i) {
+	    double e = error(a, b, i);
+	    if (e > worst_error) {
+		worst = i;
+		worst_error = e;
+	    }
+	}
+	if (worst) {
+	    keep[worst] = true;
+	    todo.push_back(make_pair(a, worst));
+	    todo.push_back(make_pair(worst, b));
+	}
+    }
+
+    for (size_t i = 0; i != n; ++i) {
+	if (keep[i]) kept.push_back(i);
+    }
+}
+
+void GfxCore::GenerateLegsVertexBuffer(bool surface, GLAVertexBuffer& buffer)
+{
+    // The buffer holds everything needed to draw the legs in any colour-by
+    // mode, so it only needs regenerating if the legs to show or their
+    // styles change.
+    buffer.primitive = GLAVertexBuffer::LINES;
+    for (unsigned level = 0; level != NUM_LOD_LEVELS; ++level) {
+	if (level) buffer.StartLevel();
+	AddLegsLevel(surface, lod_tolerance(m_Parent->GetExtent(), level),
+		     buffer);
+    }
+}
+
+void GfxCore::AddLegsLevel(bool surface, double tolerance,
+			   GLAVertexBuffer& buffer)
 {
     unsigned surf_or_not = surface ? img_FLAG_SURFACE : 0;
-    // Generate the display list for the surface or underground legs.
+    vector<size_t> kept;
     for (int f = 0; f != 8; ++f) {
 	if ((f & img_FLAG_SURFACE) != surf_or_not) continue;
+	// Splays aren't simplified (they're single legs) but once they're
+	// this small there's no point drawing them.
+	if ((f & img_FLAG_SPLAY) && tolerance > LOD_CULL_SIZE) continue;
 	const unsigned SHOW_DASHED_AND_FADED = unsigned(-1);
 	unsigned style = SHOW_NORMAL;
 	if ((f & img_FLAG_SPLAY) && m_Splays != SHOW_NORMAL) {
@@ -2660,71 +2859,288 @@ void GfxCore::GenerateDisplayList(bool surface)
 	    }
 	}
 
-	switch (style) {
-	    case SHOW_HIDE:
-		continue;
-	    case SHOW_FADED:
-		SetAlpha(0.4);
-		break;
-	    case SHOW_DASHED:
-		EnableDashedLines();
-		break;
-	    case SHOW_DASHED_AND_FADED:
-		SetAlpha(0.4);
-		EnableDashedLines();
-		break;
+	if (style == SHOW_HIDE) continue;
+	double alpha = 1.0;
+	if (style == SHOW_FADED || style == SHOW_DASHED_AND_FADED) alpha = 0.4;
+	buffer.SetDashed(style == SHOW_DASHED ||
+			 style == SHOW_DASHED_AND_FADED);
+
+	const SurveyFilter* filter = m_Parent->GetTreeFilter();
+	vector<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
+	vector<traverse>::const_iterator tend = m_Parent->traverses_end(f);
+	while (trav != tend) {
+	    const traverse& centreline = *trav;
+	    const wxString& survey = m_Parent->GetSurveyName(centreline.survey);
+	    // Zero any values which we don't set so we don't upload junk.
+	    GLAVertex vertex = GLAVertex();
+	    vertex.SetColour(VERTEX_COLOUR_PLAIN, col_WHITE, 1.0, alpha);
+	    vertex.SetColour(VERTEX_COLOUR_SURVEY,
+			     survey_pen(hash_string(survey.utf8_str())),
+			     1.0, alpha);
+	    vertex.SetColour(VERTEX_COLOUR_STYLE,
+			     style_colours[centreline.style + 1], 1.0, alpha);
+	    for (int i = 0; i != 3; ++i) {
+		vertex.value[VALUE_ERROR + i] =
+		    ErrorTo01(centreline.errors[i]);
+	    }
+
+	    simplify_polyline(centreline.size(), tolerance,
+			      [&centreline](size_t a, size_t b, size_t i) {
+				  const Vector3& p = centreline[i];
+				  const Vector3& A = centreline[a];
+				  const Vector3& B = centreline[b];
+				  double t = closest_on_segment(p, A, B);
+				  return (p - (A + t * (B - A))).magnitude();
+			      },
+			      kept);
+	    for (size_t k = 1; k < kept.size(); ++k) {
+		const PointInfo& a = centreline[kept[k - 1]];
+		const PointInfo& b = centreline[kept[k]];
+		// Apart from depth, each leg is a single colour - that of the
+		// station at the end of the leg for date.  A simplified leg
+		// uses the average length of the legs it replaces.
+		double length = 0.0;
+		for (size_t j = kept[k - 1] + 1; j <= kept[k]; ++j) {
+		    length += (centreline[j] - centreline[j - 1]).magnitude();
+		}
+		length /= (kept[k] - kept[k - 1]);
+		const Vector3 & delta = b - a;
+		vertex.value[VALUE_DATE] = DateTo01(b.GetDate());
+		vertex.value[VALUE_GRADIENT] = GradientTo01(delta.gradient());
+		vertex.value[VALUE_LENGTH] = LengthTo01(length);
+
+		vertex.SetPosition(a);
+		vertex.value[VALUE_DEPTH] = DepthTo01(a.GetZ());
+		buffer.vertices.push_back(vertex);
+		vertex.SetPosition(b);
+		vertex.value[VALUE_DEPTH] = DepthTo01(b.GetZ());
+		buffer.vertices.push_back(vertex);
+	    }
+	    trav = m_Parent->traverses_next(f, filter, trav);
 	}
+    }
+}
 
-	void (GfxCore::* add_poly)(const traverse&);
-	if (surface) {
-	    switch (m_ColourBy) {
-		case COLOUR_BY_ERROR:
-		case COLOUR_BY_H_ERROR:
-		case COLOUR_BY_V_ERROR:
-		    add_poly = &GfxCore::AddPolylineError;
-		    break;
-		case COLOUR_BY_STYLE:
-		    add_poly = &GfxCore::AddPolylineStyle;
-		    break;
-		default:
-		    add_poly = &GfxCore::AddPolyline;
+void GfxCore::GenerateTubesVertexBuffer(GLAVertexBuffer& buffer)
+{
+    class Skinner : public TubeSkinner {
+	GfxCore* gfx;
+	const vector<XSect>* centreline;
+	const SurveyFilter* filter;
+	GLAVertexBuffer& buffer;
+	GLAVertex vertex;
+
+	void add_quad(const Vector3 &a, const Vector3 &b,
+		      const Vector3 &c, const Vector3 &d,
+		      const GLAPen& survey) {
+	    Vector3 normal = (a - c) * (d - b);
+	    normal.normalise();
+	    Double factor = dot(normal, light) * .3 + .7;
+	    // Quadrilateral colouring by style isn't supported.
+	    vertex.SetColour(VERTEX_COLOUR_PLAIN, col_WHITE, factor, 1.0);
+	    vertex.SetColour(VERTEX_COLOUR_SURVEY, survey, factor, 1.0);
+	    vertex.SetColour(VERTEX_COLOUR_STYLE, col_WHITE, factor, 1.0);
+	    // Texture coordinates for the passage wall texture.
+	    GLfloat w = ((b - a).magnitude() + (d - c).magnitude()) * .5;
+	    GLfloat h = ((b - c).magnitude() + (d - a).magnitude()) * .5;
+	    const struct {
+		const Vector3* p;
+		GLfloat tex_x, tex_y;
+	    } corner[6] = {
+		{ &a, 0, 0 }, { &b, w, 0 }, { &c, w, h },
+		{ &a, 0, 0 }, { &c, w, h }, { &d, 0, h }
+	    };
+	    for (int i = 0; i < 6; ++i) {
+		vertex.SetPosition(*corner[i].p);
+		vertex.tex_x = corner[i].tex_x;
+		vertex.tex_y = corner[i].tex_y;
+		vertex.value[VALUE_DEPTH] = gfx->DepthTo01(corner[i].p->GetZ());
+		buffer.vertices.push_back(vertex);
 	    }
-	} else {
-	    add_poly = AddPoly;
 	}
 
-	const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
-	while (trav != tend) {
-	    (this->*add_poly)(*trav);
-	    trav = m_Parent->traverses_next(f, filter, trav);
+      public:
+	Skinner(GfxCore* gfx_, GLAVertexBuffer& buffer_)
+	    : gfx(gfx_), centreline(NULL),
+	      filter(gfx_->m_Parent->GetTreeFilter()), buffer(buffer_),
+	      vertex() {
+	    // FIXME: it's not simple to set the colour of a tube based on
+	    // error...
+	    for (int i = 0; i != 3; ++i) {
+		vertex.value[VALUE_ERROR + i] = ErrorTo01(0.0);
+	    }
 	}
 
-	switch (style) {
-	    case SHOW_FADED:
-		SetAlpha(1.0);
-		break;
-	    case SHOW_DASHED:
-		DisableDashedLines();
-		break;
-	    case SHOW_DASHED_AND_FADED:
-		DisableDashedLines();
-		SetAlpha(1.0);
-		break;
+	void set_tube(const vector<XSect>& tube) { centreline = &tube; }
+
+	void corners(size_t segment, const Vector3&,
+		     const Vector3 v[4], const Vector3 U[4]) {
+	    const XSect & pt_v = (*centreline)[segment];
+	    const SurveyTree& tree = gfx->m_Parent->GetSurveyTree();
+	    if (filter && !filter->CheckVisible(tree, pt_v.GetSurvey())) return;
+	    const wxString& label = pt_v.GetLabel();
+
+	    // Colour by the survey of the station, not the whole name.
+	    auto utf8 = label.utf8_str();
+	    const char* p = utf8.data();
+	    const char* q = strrchr(p, gfx->m_Parent->GetSeparator());
+	    size_t len = q ? (q - p) : strlen(p);
+	    GLAPen survey = survey_pen(hash_data(p, len));
+
+	    // Use the values for the first segment for the cap at the start.
+	    size_t i = max(segment, size_t(1));
+	    const Vector3 & delta = (*centreline)[i] - (*centreline)[i - 1];
+	    vertex.value[VALUE_DATE] = gfx->DateTo01((*centreline)[i].GetDate());
+	    vertex.value[VALUE_GRADIENT] = GradientTo01(delta.gradient());
+	    vertex.value[VALUE_LENGTH] = LengthTo01(delta.magnitude());
+
+	    if (segment > 0) {
+		const XSect & prev_pt_v = (*centreline)[segment - 1];
+		if (!filter || filter->CheckVisible(tree, prev_pt_v.GetSurvey())) {
+		    add_quad(v[0], v[1], U[1], U[0], survey);
+		    add_quad(v[2], v[3], U[3], U[2], survey);
+		    add_quad(v[1], v[2], U[2], U[1], survey);
+		    add_quad(v[3], v[0], U[0], U[3], survey);
+		}
+	    }
+
+	    if (segment == 0) {
+		add_quad(v[0], v[1], v[2], v[3], survey);
+	    } else if (segment + 1 == centreline->size()) {
+		add_quad(v[3], v[2], v[1], v[0], survey);
+	    }
+	}
+    };
+
+    buffer.primitive = GLAVertexBuffer::TRIANGLES;
+    Skinner skinner(this, buffer);
+    vector<size_t> kept;
+    vector<XSect> simplified;
+    for (unsigned level = 0; level != NUM_LOD_LEVELS; ++level) {
+	if (level) buffer.StartLevel();
+	double tolerance = lod_tolerance(m_Parent->GetExtent(), level);
+	list<vector<XSect>>::const_iterator trav = m_Parent->tubes_begin();
+	list<vector<XSect>>::const_iterator tend = m_Parent->tubes_end();
+	while (trav != tend) {
+	    const vector<XSect>& tube = *trav++;
+	    // A cross-section can be dropped if both its position and its
+	    // dimensions are close enough to those interpolated from the
+	    // cross-sections either side.
+	    simplify_polyline(tube.size(), tolerance,
+			      [&tube](size_t a, size_t b, size_t i) {
+				  const Vector3& p = tube[i].GetPoint();
+				  const Vector3& A = tube[a].GetPoint();
+				  const Vector3& B = tube[b].GetPoint();
+				  double t = closest_on_segment(p, A, B);
+				  double e = (p - (A + t * (B - A))).magnitude();
+				  auto lerp = [t](double x, double y) {
+				      return x + t * (y - x);
+				  };
+				  const XSect& X = tube[i];
+				  e = max(e, fabs(X.GetL() - lerp(tube[a].GetL(), tube[b].GetL())));
+				  e = max(e, fabs(X.GetR() - lerp(tube[a].GetR(), tube[b].GetR())));
+				  e = max(e, fabs(X.GetU() - lerp(tube[a].GetU(), tube[b].GetU())));
+				  e = max(e, fabs(X.GetD() - lerp(tube[a].GetD(), tube[b].GetD())));
+				  return e;
+			      },
+			      kept);
+	    if (kept.size() == tube.size()) {
+		skinner.set_tube(tube);
+		skin_tube(tube, skinner);
+		continue;
+	    }
+	    simplified.clear();
+	    for (size_t k : kept) {
+		simplified.push_back(tube[k]);
+	    }
+	    skinner.set_tube(simplified);
+	    skin_tube(simplified, skinner);
 	}
     }
 }
 
-void GfxCore::GenerateDisplayListTubes()
+double GfxCore::GetPixelSize() const
+{
+    // In perspective view the scale varies across the view, so return 0 to
+    // draw everything in full detail.
+    if (GetPerspective()) return 0.0;
+    return SurveyUnitsAcrossViewport() / max(GetXSize(), GetYSize());
+}
+
+unsigned GfxCore::GetLevelOfDetail() const
+{
+    // Use the coarsest level where the simplification is at most a pixel.
+    double pixel_size = GetPixelSize();
+    unsigned level = 0;
+    while (level + 1 < NUM_LOD_LEVELS &&
+	   lod_tolerance(m_Parent->GetExtent(), level + 1) <= pixel_size) {
+	++level;
+    }
+    return level;
+}
+
+void GfxCore::DrawLegs(bool surface)
+{
+    // Switching colour-by mode just selects which value or colour to use.
+    int value = -1;
+    int colour = VERTEX_COLOUR_PLAIN;
+    switch (m_ColourBy) {
+	case COLOUR_BY_ERROR:
+	case COLOUR_BY_H_ERROR:
+	case COLOUR_BY_V_ERROR:
+	    value = VALUE_ERROR + error_type;
+	    break;
+	case COLOUR_BY_STYLE:
+	    colour = VERTEX_COLOUR_STYLE;
+	    break;
+	case COLOUR_BY_DEPTH:
+	    // Surface legs are only coloured by error or style.
+	    if (!surface) value = VALUE_DEPTH;
+	    break;
+	case COLOUR_BY_DATE:
+	    if (!surface) value = VALUE_DATE;
+	    break;
+	case COLOUR_BY_GRADIENT:
+	    if (!surface) value = VALUE_GRADIENT;
+	    break;
+	case COLOUR_BY_LENGTH:
+	    if (!surface) value = VALUE_LENGTH;
+	    break;
+	case COLOUR_BY_SURVEY:
+	    if (!surface) colour = VERTEX_COLOUR_SURVEY;
+	    break;
+    }
+    DrawVertexBuffer(surface ? LIST_SURFACE_LEGS : LIST_UNDERGROUND_LEGS,
+		     value, colour, GetLevelOfDetail());
+}
+
+void GfxCore::DrawTubes()
 {
-    // Generate the display list for the tubes.
-    list<vector<XSect>>::iterator trav = m_Parent->tubes_begin();
-    list<vector<XSect>>::iterator tend = m_Parent->tubes_end();
-    while (trav != tend) {
-	SkinPassage(*trav);
-	++trav;
+    int value = -1;
+    int colour = VERTEX_COLOUR_PLAIN;
+    switch (m_ColourBy) {
+	case COLOUR_BY_DEPTH:
+	    value = VALUE_DEPTH;
+	    break;
+	case COLOUR_BY_DATE:
+	    value = VALUE_DATE;
+	    break;
+	case COLOUR_BY_ERROR:
+	case COLOUR_BY_H_ERROR:
+	case COLOUR_BY_V_ERROR:
+	    value = VALUE_ERROR + error_type;
+	    break;
+	case COLOUR_BY_GRADIENT:
+	    value = VALUE_GRADIENT;
+	    break;
+	case COLOUR_BY_LENGTH:
+	    value = VALUE_LENGTH;
+	    break;
+	case COLOUR_BY_SURVEY:
+	    colour = VERTEX_COLOUR_SURVEY;
+	    break;
     }
+    DrawVertexBuffer(LIST_TUBES, value, colour, GetLevelOfDetail());
 }
 
 void GfxCore::GenerateDisplayListShadow()
@@ -2734,8 +3150,8 @@ void GfxCore::GenerateDisplayListShadow()
     for (int f = 0; f != 8; ++f) {
 	// Only include underground legs in the shadow.
 	if ((f & img_FLAG_SURFACE) != 0) continue;
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
+	vector<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
+	vector<traverse>::const_iterator tend = m_Parent->traverses_end(f);
 	while (trav != tend) {
 	    AddPolylineShadow(*trav);
 	    trav = m_Parent->traverses_next(f, filter, trav);
@@ -2743,247 +3159,14 @@ void GfxCore::GenerateDisplayListShadow()
     }
 }
 
-void
-GfxCore::parse_hgt_filename(const wxString & lc_name)
-{
-    char * leaf = leaf_from_fnm(lc_name.utf8_str());
-    const char * p = leaf;
-    char * q;
-    char dirn = *p++;
-    o_y = strtoul(p, &q, 10);
-    p = q;
-    if (dirn == 's')
-	o_y = -o_y;
-    ++o_y;
-    dirn = *p++;
-    o_x = strtoul(p, &q, 10);
-    if (dirn == 'w')
-	o_x = -o_x;
-    bigendian = true;
-    nodata_value = -32768;
-    osfree(leaf);
-}
-
-size_t
-GfxCore::parse_hdr(wxInputStream & is, unsigned long & skipbytes)
-{
-    // ESRI docs say NBITS defaults to 8.
-    unsigned long nbits = 8;
-    // ESRI docs say NBANDS defaults to 1.
-    unsigned long nbands = 1;
-    unsigned long bandrowbytes = 0;
-    unsigned long totalrowbytes = 0;
-    // ESRI docs say ULXMAP defaults to 0.
-    o_x = 0.0;
-    // ESRI docs say ULYMAP defaults to NROWS - 1.
-    o_y = HUGE_VAL;
-    // ESRI docs say XDIM and YDIM default to 1.
-    step_x = step_y = 1.0;
-    while (!is.Eof()) {
-	wxString line;
-	int ch;
-	while ((ch = is.GetC()) != wxEOF) {
-	    if (ch == '\n' || ch == '\r') break;
-	    line += wxChar(ch);
-	}
-#define CHECK(X, COND) \
-} else if (line.StartsWith(wxT(X " "))) { \
-size_t v = line.find_first_not_of(wxT(' '), sizeof(X)); \
-if (v == line.npos || !(COND)) { \
-err += wxT("Unexpected value for " X); \
-}
-	wxString err;
-	if (false) {
-	// I = little-endian; M = big-endian
-	CHECK("BYTEORDER", (bigendian = (line[v] == 'M')) || line[v] == 'I')
-	// ESRI docs say LAYOUT defaults to BIL if not specified.
-	CHECK("LAYOUT", line.substr(v) == wxT("BIL"))
-	CHECK("NROWS", line.substr(v).ToCULong(&dem_height))
-	CHECK("NCOLS", line.substr(v).ToCULong(&dem_width))
-	// ESRI docs say NBANDS defaults to 1 if not specified.
-	CHECK("NBANDS", line.substr(v).ToCULong(&nbands) && nbands == 1)
-	CHECK("NBITS", line.substr(v).ToCULong(&nbits) && nbits == 16)
-	CHECK("BANDROWBYTES", line.substr(v).ToCULong(&bandrowbytes))
-	CHECK("TOTALROWBYTES", line.substr(v).ToCULong(&totalrowbytes))
-	// PIXELTYPE is a GDAL extension, so may not be present.
-	CHECK("PIXELTYPE", line.substr(v) == wxT("SIGNEDINT"))
-	CHECK("ULXMAP", line.substr(v).ToCDouble(&o_x))
-	CHECK("ULYMAP", line.substr(v).ToCDouble(&o_y))
-	CHECK("XDIM", line.substr(v).ToCDouble(&step_x))
-	CHECK("YDIM", line.substr(v).ToCDouble(&step_y))
-	CHECK("NODATA", line.substr(v).ToCLong(&nodata_value))
-	CHECK("SKIPBYTES", line.substr(v).ToCULong(&skipbytes))
-	}
-	if (!err.empty()) {
-	    wxMessageBox(err);
-	}
-    }
-    if (o_y == HUGE_VAL) {
-	o_y = dem_height - 1;
-    }
-    if (bandrowbytes != 0) {
-	if (nbits * dem_width != bandrowbytes * 8) {
-	    wxMessageBox("BANDROWBYTES setting indicates unused bits after each band - not currently supported");
-	}
-    }
-    if (totalrowbytes != 0) {
-	// This is the ESRI default for BIL, for BIP it would be
-	// nbands * bandrowbytes.
-	if (nbands * nbits * dem_width != totalrowbytes * 8) {
-	    wxMessageBox("TOTALROWBYTES setting indicates unused bits after "
-			 "each row - not currently supported");
-	}
-    }
-    return ((nbits * dem_width + 7) / 8) * dem_height;
-}
-
-bool
-GfxCore::read_bil(wxInputStream & is, size_t size, unsigned long skipbytes)
-{
-    bool know_size = true;
-    if (!size) {
-	// If the stream doesn't know its size, GetSize() returns 0.
-	size = is.GetSize();
-	if (!size) {
-	    size = DEFAULT_HGT_SIZE;
-	    know_size = false;
-	}
-    }
-    dem = new unsigned short[size / 2];
-    if (skipbytes) {
-	if (is.SeekI(skipbytes, wxFromStart) == ::wxInvalidOffset) {
-	    while (skipbytes) {
-		unsigned long to_read = skipbytes;
-		if (size < to_read) to_read = size;
-		is.Read(reinterpret_cast<char *>(dem), to_read);
-		size_t c = is.LastRead();
-		if (c == 0) {
-		    wxMessageBox(wxT("Failed to skip terrain data header"));
-		    break;
-		}
-		skipbytes -= c;
-	    }
-	}
-    }
-
-    if (!is.ReadAll(dem, size)) {
-	if (know_size) {
-	    // FIXME: On __WXMSW__ currently we fail to
-	    // read any data from files in zips.
-	    delete [] dem;
-	    dem = NULL;
-	    wxMessageBox(wxT("Failed to read terrain data"));
-	    return false;
-	}
-	size = is.LastRead();
-    }
-
-    if (dem_width == 0 && dem_height == 0) {
-	dem_width = dem_height = sqrt(size / 2);
-	if (dem_width * dem_height * 2 != size) {
-	    delete [] dem;
-	    dem = NULL;
-	    wxMessageBox(wxT("HGT format data doesn't form a square"));
-	    return false;
-	}
-	step_x = step_y = 1.0 / dem_width;
-    }
-
-    return true;
-}
-
-bool GfxCore::LoadDEM(const wxString & file)
+bool GfxCore::LoadDEM(const wxArrayString & files)
 {
     if (m_Parent->GetCSProj().empty()) {
 	wxMessageBox(wxT("No coordinate system specified in survey data"));
 	return false;
     }
 
-    delete [] dem;
-    dem = NULL;
-
-    size_t size = 0;
-    // Default is to not skip any bytes.
-    unsigned long skipbytes = 0;
-    // For .hgt files, default to using filesize to determine.
-    dem_width = dem_height = 0;
-    // ESRI say "The default byte order is the same as that of the host machine
-    // executing the software", but that's stupid so we default to
-    // little-endian.
-    bigendian = false;
-
-    wxFileInputStream fs(file);
-    if (!fs.IsOk()) {
-	wxMessageBox(wxT("Failed to open DEM file"));
-	return false;
-    }
-
-    const wxString & lc_file = file.Lower();
-    if (lc_file.EndsWith(wxT(".hgt"))) {
-	parse_hgt_filename(lc_file);
-	read_bil(fs, size, skipbytes);
-    } else if (lc_file.EndsWith(wxT(".bil"))) {
-	wxString hdr_file = file;
-	hdr_file.replace(file.size() - 4, 4, wxT(".hdr"));
-	wxFileInputStream hdr_is(hdr_file);
-	if (!hdr_is.IsOk()) {
-	    wxMessageBox(wxT("Failed to open HDR file '") + hdr_file + wxT("'"));
-	    return false;
-	}
-	size = parse_hdr(hdr_is, skipbytes);
-	read_bil(fs, size, skipbytes);
-    } else if (lc_file.EndsWith(wxT(".zip"))) {
-	wxZipEntry * ze_data = NULL;
-	wxZipInputStream zs(fs);
-	wxZipEntry * ze;
-	while ((ze = zs.GetNextEntry()) != NULL) {
-	    if (!ze->IsDir()) {
-		const wxString & lc_name = ze->GetName().Lower();
-		if (!ze_data && lc_name.EndsWith(wxT(".hgt"))) {
-		    // SRTM .hgt files are raw binary data, with the filename
-		    // encoding the coordinates.
-		    parse_hgt_filename(lc_name);
-		    read_bil(zs, size, skipbytes);
-		    delete ze;
-		    break;
-		}
-
-		if (!ze_data && lc_name.EndsWith(wxT(".bil"))) {
-		    if (size) {
-			read_bil(zs, size, skipbytes);
-			break;
-		    }
-		    ze_data = ze;
-		    continue;
-		}
-
-		if (lc_name.EndsWith(wxT(".hdr"))) {
-		    size = parse_hdr(zs, skipbytes);
-		    if (ze_data) {
-			if (!zs.OpenEntry(*ze_data)) {
-			    wxMessageBox(wxT("Couldn't read DEM data from .zip file"));
-			    break;
-			}
-			read_bil(zs, size, skipbytes);
-		    }
-		} else if (lc_name.EndsWith(wxT(".prj"))) {
-		    //FIXME: check this matches the datum string we use
-		    //Projection    GEOGRAPHIC
-		    //Datum         WGS84
-		    //Zunits        METERS
-		    //Units         DD
-		    //Spheroid      WGS84
-		    //Xshift        0.0000000000
-		    //Yshift        0.0000000000
-		    //Parameters
-		}
-	    }
-	    delete ze;
-	}
-	delete ze_data;
-    }
-
-    if (!dem) {
+    if (!terrain.Load(files)) {
 	return false;
     }
 
@@ -2992,18 +3175,6 @@ bool GfxCore::LoadDEM(const wxString & file)
     return true;
 }
 
-void GfxCore::DrawTerrainTriangle(const Vector3 & a, const Vector3 & b, const Vector3 & c)
-{
-    Vector3 n = (b - a) * (c - a);
-    n.normalise();
-    Double factor = dot(n, light) * .95 + .05;
-    SetColour(col_WHITE, factor);
-    PlaceVertex(a);
-    PlaceVertex(b);
-    PlaceVertex(c);
-    ++n_tris;
-}
-
 // Like wxBusyCursor, but you can cancel it early.
 class AvenBusyCursor {
     bool active;
@@ -3025,144 +3196,103 @@ class AvenBusyCursor {
     }
 };
 
-void GfxCore::DrawTerrain()
+wxString GfxCore::TerrainKey() const
 {
-    if (!dem) return;
+    // The terrain is in coordinates relative to the offset and is cut off at
+    // a distance based on the extent, so it depends on those too.
+    const Vector3 & off = m_Parent->GetOffset();
+    return wxString::Format(wxT("%s\n%s\n%.17g %.17g %.17g %.17g"),
+			    terrain.GetFiles(), m_Parent->GetCSProj(),
+			    off.GetX(), off.GetY(), off.GetZ(),
+			    m_Parent->GetExtent().magnitude());
+}
+
+void GfxCore::GenerateTerrainVertexBuffer(GLAVertexBuffer& buffer)
+{
+    buffer.primitive = GLAVertexBuffer::TRIANGLES;
+    terrain_key = TerrainKey();
+    n_tris = 0;
+    if (terrain.empty()) return;
 
     AvenBusyCursor hourglass;
 
     // Draw terrain to twice the extent, or at least 1km.
-    double r_sqrd = sqrd(max(m_Parent->GetExtent().magnitude(), 1000.0));
-#define WGS84_DATUM_STRING "+proj=longlat +ellps=WGS84 +datum=WGS84"
-    static projPJ pj_in = pj_init_plus(WGS84_DATUM_STRING);
-    if (!pj_in) {
-	ToggleTerrain();
-	delete [] dem;
-	dem = NULL;
-	hourglass.stop();
-	error(/*Failed to initialise input coordinate system “%s”*/287, WGS84_DATUM_STRING);
-	return;
-    }
-    static projPJ pj_out = pj_init_plus(m_Parent->GetCSProj().c_str());
-    if (!pj_out) {
-	ToggleTerrain();
-	delete [] dem;
-	dem = NULL;
-	hourglass.stop();
-	error(/*Failed to initialise output coordinate system “%s”*/288, (const char *)m_Parent->GetCSProj().c_str());
-	return;
+    double radius = max(m_Parent->GetExtent().magnitude(), 1000.0);
+    const string cs(m_Parent->GetCSProj().mb_str());
+    int err = terrain.Generate(cs.c_str(), m_Parent->GetOffset(), radius,
+			       buffer.vertices);
+    n_tris = buffer.vertices.size() / 3;
+    if (!err) return;
+
+    ToggleTerrain();
+    terrain.clear();
+    hourglass.stop();
+    switch (err) {
+	case 287:
+	    error(/*Failed to initialise input coordinate system “%s”*/287, WGS84_DATUM_STRING);
+	    break;
+	case 288:
+	    error(/*Failed to initialise output coordinate system “%s”*/288, cs.c_str());
+	    break;
+	default:
+	    /* TRANSLATORS: Aven shows a circle of terrain covering the area
+	     * of the survey plus a bit, but the terrain data file didn't
+	     * contain any data inside that circle.
+	     */
+	    error(/*No terrain data near area of survey*/161);
+	    break;
     }
-    n_tris = 0;
-    SetAlpha(0.3);
-    BeginTriangles();
-    const Vector3 & off = m_Parent->GetOffset();
-    vector<Vector3> prevcol(dem_height + 1);
-    for (size_t x = 0; x < dem_width; ++x) {
-	double X_ = (o_x + x * step_x) * DEG_TO_RAD;
-	Vector3 prev;
-	for (size_t y = 0; y < dem_height; ++y) {
-	    unsigned short elev = dem[x + y * dem_width];
-#ifdef WORDS_BIGENDIAN
-	    const bool MACHINE_BIGENDIAN = true;
-#else
-	    const bool MACHINE_BIGENDIAN = false;
-#endif
-	    if (bigendian != MACHINE_BIGENDIAN) {
-#if defined __GNUC__ && (__GNUC__ * 100 + __GNUC_MINOR__ >= 408)
-		elev = __builtin_bswap16(elev);
-#else
-		elev = (elev >> 8) | (elev << 8);
-#endif
-	    }
-	    double Z = (short)elev;
-	    Vector3 pt;
-	    if (Z == nodata_value) {
-		pt = Vector3(DBL_MAX, DBL_MAX, DBL_MAX);
-	    } else {
-		double X = X_;
-		double Y = (o_y - y * step_y) * DEG_TO_RAD;
-		pj_transform(pj_in, pj_out, 1, 1, &X, &Y, &Z);
-		pt = Vector3(X, Y, Z) - off;
-		double dist_2 = sqrd(pt.GetX()) + sqrd(pt.GetY());
-		if (dist_2 > r_sqrd) {
-		    pt = Vector3(DBL_MAX, DBL_MAX, DBL_MAX);
-		}
-	    }
-	    if (x > 0 && y > 0) {
-		const Vector3 & a = prevcol[y - 1];
-		const Vector3 & b = prevcol[y];
-		// If all points are valid, split the quadrilateral into
-		// triangles along the shorter 3D diagonal, which typically
-		// looks better:
-		//
-		//               ----->
-		//     prev---a    x     prev---a
-		//   |   |P  /|            |\  S|
-		// y |   |  / |    or      | \  |
-		//   V   | /  |            |  \ |
-		//       |/  Q|            |R  \|
-		//       b----pt           b----pt
-		//
-		//       FORWARD           BACKWARD
-		enum { NONE = 0, P = 1, Q = 2, R = 4, S = 8, ALL = P|Q|R|S };
-		int valid =
-		    ((prev.GetZ() != DBL_MAX)) |
-		    ((a.GetZ() != DBL_MAX) << 1) |
-		    ((b.GetZ() != DBL_MAX) << 2) |
-		    ((pt.GetZ() != DBL_MAX) << 3);
-		static const int tris_map[16] = {
-		    NONE, // nothing valid
-		    NONE, // prev
-		    NONE, // a
-		    NONE, // a, prev
-		    NONE, // b
-		    NONE, // b, prev
-		    NONE, // b, a
-		    P, // b, a, prev
-		    NONE, // pt
-		    NONE, // pt, prev
-		    NONE, // pt, a
-		    S, // pt, a, prev
-		    NONE, // pt, b
-		    R, // pt, b, prev
-		    Q, // pt, b, a
-		    ALL, // pt, b, a, prev
-		};
-		int tris = tris_map[valid];
-		if (tris == ALL) {
-		    // All points valid.
-		    if ((a - b).magnitude() < (prev - pt).magnitude()) {
-			tris = P | Q;
-		    } else {
-			tris = R | S;
-		    }
-		}
-		if (tris & P)
-		    DrawTerrainTriangle(a, prev, b);
-		if (tris & Q)
-		    DrawTerrainTriangle(a, b, pt);
-		if (tris & R)
-		    DrawTerrainTriangle(pt, prev, b);
-		if (tris & S)
-		    DrawTerrainTriangle(a, prev, pt);
-	    }
-	    prev = prevcol[y];
-	    prevcol[y].assign(pt);
-	}
+}
+
+void GfxCore::DrawTerrain()
+{
+    // Choose the detail to draw each part of the terrain at so samples are
+    // at most a few pixels apart.
+    const double MAX_SPACING_PIXELS = 4.0;
+    PrepareVertexBuffer(LIST_TERRAIN);
+    vector<pair<size_t, size_t>> ranges;
+    terrain.Select([this](const Vector3& centre, double radius) {
+			return GetPixelSizeAt(centre, radius);
+		   },
+		   MAX_SPACING_PIXELS, ranges);
+    DrawVertexBufferZPrepass(LIST_TERRAIN, -1, 0, ranges);
+}
+
+bool GfxCore::ShowStation(const LabelInfo* label, const SurveyFilter* filter,
+			  const SurveyTree& tree) const
+{
+    if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
+	return false;
+
+    if (!((m_Surface && label->IsSurface()) ||
+	  (m_Legs && label->IsUnderground()) ||
+	  (!label->IsSurface() && !label->IsUnderground()))) {
+	// This station isn't to be displayed (last case is for stns with no
+	// legs attached).
+	return false;
     }
-    EndTriangles();
-    SetAlpha(1.0);
-    if (n_tris == 0) {
-	ToggleTerrain();
-	delete [] dem;
-	dem = NULL;
-	hourglass.stop();
-	/* TRANSLATORS: Aven shows a circle of terrain covering the area
-	 * of the survey plus a bit, but the terrain data file didn't
-	 * contain any data inside that circle.
-	 */
-	error(/*No terrain data near area of survey*/161);
+    return !filter || filter->CheckVisible(tree, label->survey);
+}
+
+// Returns col_BLACK (not a colour used for blobs) if the station shouldn't
+// have a blob.
+gla_colour GfxCore::BlobColour(const LabelInfo* label) const
+{
+    // When more than one flag is set on a point:
+    // search results take priority over entrance highlighting
+    // which takes priority over fixed point
+    // highlighting, which in turn takes priority over exported
+    // point highlighting.
+    if (label->IsHighLighted()) {
+	return col_YELLOW;
+    } else if (m_Entrances && label->IsEntrance()) {
+	return col_GREEN;
+    } else if (m_FixedPts && label->IsFixedPt()) {
+	return col_RED;
+    } else if (m_ExportedPts && label->IsExportedPt()) {
+	return col_TURQUOISE;
     }
+    return col_BLACK;
 }
 
 // Plot blobs.
@@ -3174,45 +3304,19 @@ void GfxCore::GenerateBlobsDisplayList()
 
     // Plot blobs.
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
     gla_colour prev_col = col_BLACK; // not a colour used for blobs
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     BeginBlobs();
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
-
-	// When more than one flag is set on a point:
-	// search results take priority over entrance highlighting
-	// which takes priority over fixed point
-	// highlighting, which in turn takes priority over exported
-	// point highlighting.
-
-	if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
+	if (!ShowStation(label, filter, tree))
 	    continue;
 
-	if (!((m_Surface && label->IsSurface()) ||
-	      (m_Legs && label->IsUnderground()) ||
-	      (!label->IsSurface() && !label->IsUnderground()))) {
-	    // if this station isn't to be displayed, skip to the next
-	    // (last case is for stns with no legs attached)
-	    continue;
-	}
-	if (filter && !filter->CheckVisible(label->GetText()))
+	gla_colour col = BlobColour(label);
+	if (col == col_BLACK)
 	    continue;
 
-	gla_colour col;
-
-	if (label->IsHighLighted()) {
-	    col = col_YELLOW;
-	} else if (m_Entrances && label->IsEntrance()) {
-	    col = col_GREEN;
-	} else if (m_FixedPts && label->IsFixedPt()) {
-	    col = col_RED;
-	} else if (m_ExportedPts && label->IsExportedPt()) {
-	    col = col_TURQUOISE;
-	} else {
-	    continue;
-	}
-
 	// Stations are sorted by blob type, so colour changes are infrequent.
 	if (col != prev_col) {
 	    SetColour(col);
@@ -3223,6 +3327,39 @@ void GfxCore::GenerateBlobsDisplayList()
     EndBlobs();
 }
 
+void GfxCore::GenerateMarkersVertexBuffer(bool crosses,
+					  GLAVertexBuffer& buffer)
+{
+    // Each marker is a single point which OpenGL draws at a fixed size on
+    // screen, so unlike the display lists the buffer only depends on which
+    // stations are shown and how blobs are coloured, not on the view.
+    buffer.primitive = crosses ? GLAVertexBuffer::CROSSES :
+				 GLAVertexBuffer::BLOBS;
+    if (!crosses && !(m_Entrances || m_FixedPts || m_ExportedPts ||
+		      m_Parent->GetNumHighlightedPts()))
+	return;
+
+    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const SurveyTree& tree = m_Parent->GetSurveyTree();
+    GLAVertex vertex = GLAVertex();
+    vertex.SetColour(0, col_LIGHT_GREY, 1.0, 1.0);
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    while (pos != m_Parent->GetLabelsEnd()) {
+	const LabelInfo* label = *pos++;
+	if (!ShowStation(label, filter, tree))
+	    continue;
+
+	if (!crosses) {
+	    gla_colour col = BlobColour(label);
+	    if (col == col_BLACK)
+		continue;
+	    vertex.SetColour(0, col, 1.0, 1.0);
+	}
+	vertex.SetPosition(*label);
+	buffer.vertices.push_back(vertex);
+    }
+}
+
 void GfxCore::DrawIndicators()
 {
     // Draw colour key.
@@ -3265,787 +3402,74 @@ void GfxCore::DrawIndicators()
     }
 }
 
-void GfxCore::PlaceVertexWithColour(const Vector3 & v,
-				    glaTexCoord tex_x, glaTexCoord tex_y,
-				    Double factor)
+double GfxCore::DepthTo01(Double z) const
 {
-    SetColour(col_WHITE, factor);
-    PlaceVertex(v, tex_x, tex_y);
-}
-
-void GfxCore::SetDepthColour(Double z, Double factor) {
-    // Set the drawing colour based on the altitude.
+    // Altitudes are mapped linearly from the lowest to the highest point.
     Double z_ext = m_Parent->GetDepthExtent();
+    if (z_ext <= 0.0) return 0.0;
 
     z -= m_Parent->GetDepthMin();
-    // points arising from tubes may be slightly outside the limits...
-    if (z < 0) z = 0;
-    if (z > z_ext) z = z_ext;
-
-    if (z == 0) {
-	SetColour(GetPen(0), factor);
-	return;
-    }
-
-    assert(z_ext > 0.0);
-    Double how_far = z / z_ext;
-    assert(how_far >= 0.0);
-    assert(how_far <= 1.0);
-
-    int band = int(floor(how_far * (GetNumColourBands() - 1)));
-    GLAPen pen1 = GetPen(band);
-    if (band < GetNumColourBands() - 1) {
-	const GLAPen& pen2 = GetPen(band + 1);
-
-	Double interval = z_ext / (GetNumColourBands() - 1);
-	Double into_band = z / interval - band;
-
-//	printf("%g z_offset=%g interval=%g band=%d\n", into_band,
-//	       z_offset, interval, band);
-	// FIXME: why do we need to clamp here?  Is it because the walls can
-	// extend further up/down than the centre-line?
-	if (into_band < 0.0) into_band = 0.0;
-	if (into_band > 1.0) into_band = 1.0;
-	assert(into_band >= 0.0);
-	assert(into_band <= 1.0);
-
-	pen1.Interpolate(pen2, into_band);
-    }
-    SetColour(pen1, factor);
-}
-
-void GfxCore::PlaceVertexWithDepthColour(const Vector3 &v, Double factor)
-{
-    SetDepthColour(v.GetZ(), factor);
-    PlaceVertex(v);
+    // Points arising from tubes may be slightly outside the limits.
+    if (z < 0) return 0.0;
+    if (z > z_ext) return 1.0;
+    return z / z_ext;
 }
 
-void GfxCore::PlaceVertexWithDepthColour(const Vector3 &v,
-					 glaTexCoord tex_x, glaTexCoord tex_y,
-					 Double factor)
+double GfxCore::DateTo01(int date) const
 {
-    SetDepthColour(v.GetZ(), factor);
-    PlaceVertex(v, tex_x, tex_y);
-}
-
-void GfxCore::SplitLineAcrossBands(int band, int band2,
-				   const Vector3 &p, const Vector3 &q,
-				   Double factor)
-{
-    const int step = (band < band2) ? 1 : -1;
-    for (int i = band; i != band2; i += step) {
-	const Double z = GetDepthBoundaryBetweenBands(i, i + step);
-
-	// Find the intersection point of the line p -> q
-	// with the plane parallel to the xy-plane with z-axis intersection z.
-	assert(q.GetZ() - p.GetZ() != 0.0);
-
-	const Double t = (z - p.GetZ()) / (q.GetZ() - p.GetZ());
-//	assert(0.0 <= t && t <= 1.0);		FIXME: rounding problems!
-
-	const Double x = p.GetX() + t * (q.GetX() - p.GetX());
-	const Double y = p.GetY() + t * (q.GetY() - p.GetY());
-
-	PlaceVertexWithDepthColour(Vector3(x, y, z), factor);
-    }
-}
-
-void GfxCore::SplitPolyAcrossBands(vector<vector<Split>>& splits,
-				   int band, int band2,
-				   const Vector3 &p, const Vector3 &q,
-				   glaTexCoord ptx, glaTexCoord pty,
-				   glaTexCoord w, glaTexCoord h)
-{
-    const int step = (band < band2) ? 1 : -1;
-    for (int i = band; i != band2; i += step) {
-	const Double z = GetDepthBoundaryBetweenBands(i, i + step);
-
-	// Find the intersection point of the line p -> q
-	// with the plane parallel to the xy-plane with z-axis intersection z.
-	assert(q.GetZ() - p.GetZ() != 0.0);
-
-	const Double t = (z - p.GetZ()) / (q.GetZ() - p.GetZ());
-//	assert(0.0 <= t && t <= 1.0);		FIXME: rounding problems!
-
-	const Double x = p.GetX() + t * (q.GetX() - p.GetX());
-	const Double y = p.GetY() + t * (q.GetY() - p.GetY());
-	glaTexCoord tx = ptx, ty = pty;
-	if (w) tx += t * w;
-	if (h) ty += t * h;
-
-	splits[i].push_back(Split(Vector3(x, y, z), tx, ty));
-	splits[i + step].push_back(Split(Vector3(x, y, z), tx, ty));
-    }
-}
-
-int GfxCore::GetDepthColour(Double z) const
-{
-    // Return the (0-based) depth colour band index for a z-coordinate.
-    Double z_ext = m_Parent->GetDepthExtent();
-    z -= m_Parent->GetDepthMin();
-    // We seem to get rounding differences causing z to sometimes be slightly
-    // less than GetDepthMin() here, and it can certainly be true for passage
-    // tubes, so just clamp the value to 0.
-    if (z <= 0) return 0;
-    // We seem to get rounding differences causing z to sometimes exceed z_ext
-    // by a small amount here (see: https://trac.survex.com/ticket/26) and it
-    // can certainly be true for passage tubes, so just clamp the value.
-    if (z >= z_ext) return GetNumColourBands() - 1;
-    return int(z / z_ext * (GetNumColourBands() - 1));
-}
-
-Double GfxCore::GetDepthBoundaryBetweenBands(int a, int b) const
-{
-    // Return the z-coordinate of the depth colour boundary between
-    // two adjacent depth colour bands (specified by 0-based indices).
-
-    assert((a == b - 1) || (a == b + 1));
-    if (GetNumColourBands() == 1) return 0;
-
-    int band = (a > b) ? a : b; // boundary N lies on the bottom of band N.
-    Double z_ext = m_Parent->GetDepthExtent();
-    return (z_ext * band / (GetNumColourBands() - 1)) + m_Parent->GetDepthMin();
-}
-
-void GfxCore::AddPolyline(const traverse & centreline)
-{
-    BeginPolyline();
-    SetColour(col_WHITE);
-    vector<PointInfo>::const_iterator i = centreline.begin();
-    PlaceVertex(*i);
-    ++i;
-    while (i != centreline.end()) {
-	PlaceVertex(*i);
-	++i;
-    }
-    EndPolyline();
-}
-
-void GfxCore::AddPolylineShadow(const traverse & centreline)
-{
-    BeginPolyline();
-    const double z = -0.5 * m_Parent->GetExtent().GetZ();
-    vector<PointInfo>::const_iterator i = centreline.begin();
-    PlaceVertex(i->GetX(), i->GetY(), z);
-    ++i;
-    while (i != centreline.end()) {
-	PlaceVertex(i->GetX(), i->GetY(), z);
-	++i;
-    }
-    EndPolyline();
-}
-
-void GfxCore::AddPolylineDepth(const traverse & centreline)
-{
-    BeginPolyline();
-    vector<PointInfo>::const_iterator i, prev_i;
-    i = centreline.begin();
-    int band0 = GetDepthColour(i->GetZ());
-    PlaceVertexWithDepthColour(*i);
-    prev_i = i;
-    ++i;
-    while (i != centreline.end()) {
-	int band = GetDepthColour(i->GetZ());
-	if (band != band0) {
-	    SplitLineAcrossBands(band0, band, *prev_i, *i);
-	    band0 = band;
-	}
-	PlaceVertexWithDepthColour(*i);
-	prev_i = i;
-	++i;
-    }
-    EndPolyline();
-}
-
-void GfxCore::AddQuadrilateral(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-    PlaceVertexWithColour(a, 0, 0, factor);
-    PlaceVertexWithColour(b, w, 0, factor);
-    PlaceVertexWithColour(c, w, h, factor);
-    PlaceVertexWithColour(d, 0, h, factor);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddQuadrilateralDepth(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    int a_band, b_band, c_band, d_band;
-    a_band = GetDepthColour(a.GetZ());
-    a_band = min(max(a_band, 0), GetNumColourBands());
-    b_band = GetDepthColour(b.GetZ());
-    b_band = min(max(b_band, 0), GetNumColourBands());
-    c_band = GetDepthColour(c.GetZ());
-    c_band = min(max(c_band, 0), GetNumColourBands());
-    d_band = GetDepthColour(d.GetZ());
-    d_band = min(max(d_band, 0), GetNumColourBands());
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    int min_band = min(min(a_band, b_band), min(c_band, d_band));
-    int max_band = max(max(a_band, b_band), max(c_band, d_band));
-    if (min_band == max_band) {
-	// Simple case - the polygon is entirely within one band.
-	BeginPolygon();
-////	PlaceNormal(normal);
-	PlaceVertexWithDepthColour(a, 0, 0, factor);
-	PlaceVertexWithDepthColour(b, w, 0, factor);
-	PlaceVertexWithDepthColour(c, w, h, factor);
-	PlaceVertexWithDepthColour(d, 0, h, factor);
-	EndPolygon();
-    } else {
-	// We need to make a separate polygon for each depth band...
-	vector<vector<Split>> splits;
-	splits.resize(max_band + 1);
-	splits[a_band].push_back(Split(a, 0, 0));
-	if (a_band != b_band) {
-	    SplitPolyAcrossBands(splits, a_band, b_band, a, b, 0, 0, w, 0);
-	}
-	splits[b_band].push_back(Split(b, w, 0));
-	if (b_band != c_band) {
-	    SplitPolyAcrossBands(splits, b_band, c_band, b, c, w, 0, 0, h);
-	}
-	splits[c_band].push_back(Split(c, w, h));
-	if (c_band != d_band) {
-	    SplitPolyAcrossBands(splits, c_band, d_band, c, d, w, h, -w, 0);
-	}
-	splits[d_band].push_back(Split(d, 0, h));
-	if (d_band != a_band) {
-	    SplitPolyAcrossBands(splits, d_band, a_band, d, a, 0, h, 0, -h);
-	}
-	for (int band = min_band; band <= max_band; ++band) {
-	    BeginPolygon();
-	    for (auto&& item : splits[band]) {
-		PlaceVertexWithDepthColour(item.vec, item.tx, item.ty, factor);
-	    }
-	    EndPolygon();
-	}
-    }
-}
-
-void GfxCore::SetColourFromDate(int date, Double factor)
-{
-    // Set the drawing colour based on a date.
-
-    if (date == -1) {
-	// Undated.
-	SetColour(NODATA_COLOUR, factor);
-	return;
-    }
+    if (date == -1) return -1.0;
 
     int date_offset = date - m_Parent->GetDateMin();
     if (date_offset == 0) {
 	// Earliest date - handle as a special case for the single date case.
-	SetColour(GetPen(0), factor);
-	return;
+	return 0.0;
     }
 
     int date_ext = m_Parent->GetDateExtent();
     Double how_far = (Double)date_offset / date_ext;
     assert(how_far >= 0.0);
     assert(how_far <= 1.0);
-    SetColourFrom01(how_far, factor);
-}
-
-void GfxCore::AddPolylineDate(const traverse & centreline)
-{
-    BeginPolyline();
-    auto i = centreline.begin();
-    int date = i->GetDate();
-    SetColourFromDate(date, 1.0);
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	int newdate = i->GetDate();
-	if (newdate != date) {
-	    date = newdate;
-	    SetColourFromDate(date, 1.0);
-	}
-	PlaceVertex(*i);
-    }
-    EndPolyline();
-}
-
-static int static_date_hack; // FIXME
-
-void GfxCore::AddQuadrilateralDate(const Vector3 &a, const Vector3 &b,
-				   const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromDate(static_date_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
+    return how_far;
 }
 
-static double static_E_hack; // FIXME
-
-void GfxCore::SetColourFromError(double E, Double factor)
+double GfxCore::ErrorTo01(double E)
 {
-    // Set the drawing colour based on an error value.
-
-    if (E < 0) {
-	SetColour(NODATA_COLOUR, factor);
-	return;
-    }
+    if (E < 0) return -1.0;
 
     Double how_far = E / MAX_ERROR;
-    assert(how_far >= 0.0);
     if (how_far > 1.0) how_far = 1.0;
-    SetColourFrom01(how_far, factor);
+    return how_far;
 }
 
-void GfxCore::AddQuadrilateralError(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
+double GfxCore::GradientTo01(double gradient)
 {
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromError(static_E_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddPolylineError(const traverse & centreline)
-{
-    BeginPolyline();
-    SetColourFromError(centreline.errors[error_type], 1.0);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
-    }
-    EndPolyline();
-}
-
-// gradient is in *radians*.
-void GfxCore::SetColourFromGradient(double gradient, Double factor)
-{
-    // Set the drawing colour based on the gradient of the leg.
-
     const Double GRADIENT_MAX = M_PI_2;
     gradient = fabs(gradient);
-    Double how_far = gradient / GRADIENT_MAX;
-    SetColourFrom01(how_far, factor);
+    return gradient / GRADIENT_MAX;
 }
 
-void GfxCore::AddPolylineGradient(const traverse & centreline)
+double GfxCore::LengthTo01(double length)
 {
-    BeginPolyline();
-    auto i = centreline.begin();
-    auto prev_i = i;
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	SetColourFromGradient((*i - *prev_i).gradient(), 1.0);
-	PlaceVertex(*i);
-	prev_i = i;
-    }
-    EndPolyline();
-}
-
-static double static_gradient_hack; // FIXME
-
-void GfxCore::AddQuadrilateralGradient(const Vector3 &a, const Vector3 &b,
-				       const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromGradient(static_gradient_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::SetColourFromLength(double length, Double factor)
-{
-    // Set the drawing colour based on log(length_of_leg).
-
+    // Lengths are mapped by log(length_of_leg).
     Double log_len = log10(length);
     Double how_far = log_len / LOG_LEN_MAX;
     how_far = max(how_far, 0.0);
     how_far = min(how_far, 1.0);
-    SetColourFrom01(how_far, factor);
-}
-
-void GfxCore::SetColourFromSurvey(const wxString& survey)
-{
-    // Set the drawing colour based on hash of name.
-    int hash = hash_string(survey.utf8_str());
-    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
-    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
-    GLAPen pen;
-    pen.SetColour(rgb.red / 256.0, rgb.green / 256.0, rgb.blue / 256.0);
-    SetColour(pen);
-}
-
-void GfxCore::SetColourFromSurveyStation(const wxString& name, Double factor)
-{
-    // Set the drawing colour based on hash of survey name.
-    const char* p = name.utf8_str();
-    const char* q = strrchr(p, m_Parent->GetSeparator());
-    size_t len = q ? (q - p) : strlen(p);
-    int hash = hash_data(p, len);
-    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
-    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
-    GLAPen pen;
-    pen.SetColour(rgb.red / 256.0, rgb.green / 256.0, rgb.blue / 256.0);
-    SetColour(pen, factor);
+    return how_far;
 }
 
-void GfxCore::SetColourFrom01(double how_far, Double factor)
-{
-    double b;
-    double into_band = modf(how_far * (GetNumColourBands() - 1), &b);
-    int band(b);
-    GLAPen pen1 = GetPen(band);
-    // With 24bit colour, interpolating by less than this can have no effect.
-    if (into_band >= 1.0 / 512.0) {
-	const GLAPen& pen2 = GetPen(band + 1);
-	pen1.Interpolate(pen2, into_band);
-    }
-    SetColour(pen1, factor);
-}
-
-void GfxCore::AddPolylineLength(const traverse & centreline)
-{
-    BeginPolyline();
-    auto i = centreline.begin();
-    auto prev_i = i;
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	SetColourFromLength((*i - *prev_i).magnitude(), 1.0);
-	PlaceVertex(*i);
-	prev_i = i;
-    }
-    EndPolyline();
-}
-
-static double static_length_hack; // FIXME
-
-void GfxCore::AddQuadrilateralLength(const Vector3 &a, const Vector3 &b,
-				     const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromLength(static_length_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddPolylineSurvey(const traverse & centreline)
-{
-    BeginPolyline();
-    SetColourFromSurvey(centreline.name);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
-    }
-    EndPolyline();
-}
-
-static const wxString* static_survey_hack;
-
-void GfxCore::AddQuadrilateralSurvey(const Vector3 &a, const Vector3 &b,
-				     const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromSurveyStation(*static_survey_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddPolylineStyle(const traverse & centreline)
+void GfxCore::AddPolylineShadow(const traverse & centreline)
 {
     BeginPolyline();
-    SetColour(style_colours[centreline.style + 1]);
-//    SetColourFromStyle(centreline.style);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
-    }
-    EndPolyline();
-}
-
-#if 0
-static int static_style_hack;
-
-void GfxCore::AddQuadrilateralStyle(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromSurveyStation(*static_survey_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-#endif
-
-void
-GfxCore::SkinPassage(vector<XSect> & centreline)
-{
-    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-    assert(centreline.size() > 1);
-    Vector3 U[4];
-    XSect* prev_pt_v = NULL;
-    Vector3 last_right(1.0, 0.0, 0.0);
-
-//  FIXME: it's not simple to set the colour of a tube based on error...
-//    static_E_hack = something...
-    vector<XSect>::iterator i = centreline.begin();
-    vector<XSect>::size_type segment = 0;
+    const double z = -0.5 * m_Parent->GetExtent().GetZ();
+    traverse::const_iterator i = centreline.begin();
+    PlaceVertex(i->GetX(), i->GetY(), z);
+    ++i;
     while (i != centreline.end()) {
-	// get the coordinates of this vertex
-	XSect & pt_v = *i++;
-
-	bool cover_end = false;
-
-	Vector3 right, up;
-
-	const Vector3 up_v(0.0, 0.0, 1.0);
-
-	static_survey_hack = &(pt_v.GetLabel());
-	if (segment == 0) {
-	    assert(i != centreline.end());
-	    // first segment
-
-	    // get the coordinates of the next vertex
-	    const XSect & next_pt_v = *i;
-
-	    // calculate vector from this pt to the next one
-	    Vector3 leg_v = next_pt_v - pt_v;
-
-	    // obtain a vector in the LRUD plane
-	    right = leg_v * up_v;
-	    if (right.magnitude() == 0) {
-		right = last_right;
-		// Obtain a second vector in the LRUD plane,
-		// perpendicular to the first.
-		//up = right * leg_v;
-		up = up_v;
-	    } else {
-		last_right = right;
-		up = up_v;
-	    }
-
-	    cover_end = true;
-	    static_date_hack = next_pt_v.GetDate();
-	} else if (segment + 1 == centreline.size()) {
-	    // last segment
-
-	    // Calculate vector from the previous pt to this one.
-	    Vector3 leg_v = pt_v - *prev_pt_v;
-
-	    // Obtain a horizontal vector in the LRUD plane.
-	    right = leg_v * up_v;
-	    if (right.magnitude() == 0) {
-		right = Vector3(last_right.GetX(), last_right.GetY(), 0.0);
-		// Obtain a second vector in the LRUD plane,
-		// perpendicular to the first.
-		//up = right * leg_v;
-		up = up_v;
-	    } else {
-		last_right = right;
-		up = up_v;
-	    }
-
-	    cover_end = true;
-	    static_date_hack = pt_v.GetDate();
-	} else {
-	    assert(i != centreline.end());
-	    // Intermediate segment.
-
-	    // Get the coordinates of the next vertex.
-	    const XSect & next_pt_v = *i;
-
-	    // Calculate vectors from this vertex to the
-	    // next vertex, and from the previous vertex to
-	    // this one.
-	    Vector3 leg1_v = pt_v - *prev_pt_v;
-	    Vector3 leg2_v = next_pt_v - pt_v;
-
-	    // Obtain horizontal vectors perpendicular to
-	    // both legs, then normalise and average to get
-	    // a horizontal bisector.
-	    Vector3 r1 = leg1_v * up_v;
-	    Vector3 r2 = leg2_v * up_v;
-	    r1.normalise();
-	    r2.normalise();
-	    right = r1 + r2;
-	    if (right.magnitude() == 0) {
-		// This is the "mid-pitch" case...
-		right = last_right;
-	    }
-	    if (r1.magnitude() == 0) {
-		up = up_v;
-
-		// Rotate pitch section to minimise the
-		// "torsional stress" - FIXME: use
-		// triangles instead of rectangles?
-		int shift = 0;
-		Double maxdotp = 0;
-
-		// Scale to unit vectors in the LRUD plane.
-		right.normalise();
-		up.normalise();
-		Vector3 vec = up - right;
-		for (int orient = 0; orient <= 3; ++orient) {
-		    Vector3 tmp = U[orient] - prev_pt_v->GetPoint();
-		    tmp.normalise();
-		    Double dotp = dot(vec, tmp);
-		    if (dotp > maxdotp) {
-			maxdotp = dotp;
-			shift = orient;
-		    }
-		}
-		if (shift) {
-		    if (shift != 2) {
-			Vector3 temp(U[0]);
-			U[0] = U[shift];
-			U[shift] = U[2];
-			U[2] = U[shift ^ 2];
-			U[shift ^ 2] = temp;
-		    } else {
-			swap(U[0], U[2]);
-			swap(U[1], U[3]);
-		    }
-		}
-#if 0
-		// Check that the above code actually permuted
-		// the vertices correctly.
-		shift = 0;
-		maxdotp = 0;
-		for (int j = 0; j <= 3; ++j) {
-		    Vector3 tmp = U[j] - *prev_pt_v;
-		    tmp.normalise();
-		    Double dotp = dot(vec, tmp);
-		    if (dotp > maxdotp) {
-			maxdotp = dotp + 1e-6; // Add small tolerance to stop 45 degree offset cases being flagged...
-			shift = j;
-		    }
-		}
-		if (shift) {
-		    printf("New shift = %d!\n", shift);
-		    shift = 0;
-		    maxdotp = 0;
-		    for (int j = 0; j <= 3; ++j) {
-			Vector3 tmp = U[j] - *prev_pt_v;
-			tmp.normalise();
-			Double dotp = dot(vec, tmp);
-			printf("    %d : %.8f\n", j, dotp);
-		    }
-		}
-#endif
-	    } else {
-		up = up_v;
-	    }
-	    last_right = right;
-	    static_date_hack = pt_v.GetDate();
-	}
-
-	// Scale to unit vectors in the LRUD plane.
-	right.normalise();
-	up.normalise();
-
-	Double l = fabs(pt_v.GetL());
-	Double r = fabs(pt_v.GetR());
-	Double u = fabs(pt_v.GetU());
-	Double d = fabs(pt_v.GetD());
-
-	// Produce coordinates of the corners of the LRUD "plane".
-	Vector3 v[4];
-	v[0] = pt_v.GetPoint() - right * l + up * u;
-	v[1] = pt_v.GetPoint() + right * r + up * u;
-	v[2] = pt_v.GetPoint() + right * r - up * d;
-	v[3] = pt_v.GetPoint() - right * l - up * d;
-
-	if (segment > 0) {
-	    if (!filter || (filter->CheckVisible(pt_v.GetLabel()) &&
-			    filter->CheckVisible(prev_pt_v->GetLabel()))) {
-		const Vector3 & delta = pt_v - *prev_pt_v;
-		static_length_hack = delta.magnitude();
-		static_gradient_hack = delta.gradient();
-		(this->*AddQuad)(v[0], v[1], U[1], U[0]);
-		(this->*AddQuad)(v[2], v[3], U[3], U[2]);
-		(this->*AddQuad)(v[1], v[2], U[2], U[1]);
-		(this->*AddQuad)(v[3], v[0], U[0], U[3]);
-	    }
-	}
-
-	if (cover_end) {
-	    if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
-		if (segment == 0) {
-		    (this->*AddQuad)(v[0], v[1], v[2], v[3]);
-		} else {
-		    (this->*AddQuad)(v[3], v[2], v[1], v[0]);
-		}
-	    }
-	}
-
-	prev_pt_v = &pt_v;
-	U[0] = v[0];
-	U[1] = v[1];
-	U[2] = v[2];
-	U[3] = v[3];
-
-	++segment;
+	PlaceVertex(i->GetX(), i->GetY(), z);
+	++i;
     }
+    EndPolyline();
 }
 
 void GfxCore::FullScreenMode()
@@ -4137,43 +3561,6 @@ void GfxCore::PlayPres(double speed, bool change_speed) {
 
 void GfxCore::SetColourBy(int colour_by) {
     m_ColourBy = colour_by;
-    switch (colour_by) {
-	case COLOUR_BY_DEPTH:
-	    AddQuad = &GfxCore::AddQuadrilateralDepth;
-	    AddPoly = &GfxCore::AddPolylineDepth;
-	    break;
-	case COLOUR_BY_DATE:
-	    AddQuad = &GfxCore::AddQuadrilateralDate;
-	    AddPoly = &GfxCore::AddPolylineDate;
-	    break;
-	case COLOUR_BY_ERROR:
-	case COLOUR_BY_H_ERROR:
-	case COLOUR_BY_V_ERROR:
-	    AddQuad = &GfxCore::AddQuadrilateralError;
-	    AddPoly = &GfxCore::AddPolylineError;
-	    break;
-	case COLOUR_BY_GRADIENT:
-	    AddQuad = &GfxCore::AddQuadrilateralGradient;
-	    AddPoly = &GfxCore::AddPolylineGradient;
-	    break;
-	case COLOUR_BY_LENGTH:
-	    AddQuad = &GfxCore::AddQuadrilateralLength;
-	    AddPoly = &GfxCore::AddPolylineLength;
-	    break;
-	case COLOUR_BY_SURVEY:
-	    AddQuad = &GfxCore::AddQuadrilateralSurvey;
-	    AddPoly = &GfxCore::AddPolylineSurvey;
-	    break;
-	case COLOUR_BY_STYLE:
-	    // FIXME: support quad colouring by style
-	    AddQuad = &GfxCore::AddQuadrilateral;
-	    AddPoly = &GfxCore::AddPolylineStyle;
-	    break;
-	default: // case COLOUR_BY_NONE:
-	    AddQuad = &GfxCore::AddQuadrilateral;
-	    AddPoly = &GfxCore::AddPolyline;
-	    break;
-    }
 
     switch (colour_by) {
 	case COLOUR_BY_ERROR:
@@ -4187,13 +3574,43 @@ void GfxCore::SetColourBy(int colour_by) {
 	    break;
     }
 
-    InvalidateList(LIST_UNDERGROUND_LEGS);
-    InvalidateList(LIST_SURFACE_LEGS);
-    InvalidateList(LIST_TUBES);
-
+    // The vertex buffers hold the values for every colour-by mode, so there's
+    // nothing to regenerate.
     ForceRefresh();
 }
 
+// Read back the frame just drawn and add it to the movie.
+bool GfxCore::AddMovieFrame()
+{
+    int width = movie->GetWidth();
+    int height = movie->GetHeight();
+    // If we can, read frames back asynchronously and only collect each a few
+    // frames later, so we don't stall waiting for the GPU to finish drawing.
+    // The movie encodes frames in a separate thread, so AddFrame() doesn't
+    // wait either unless the encoder is falling behind.
+    if (PendingReadPixels() == MaxPendingReadPixels()) {
+	FinishReadPixels(movie->GetBuffer());
+	if (!movie->AddFrame()) return false;
+    }
+    if (StartReadPixels(width, height)) return true;
+
+    ReadPixels(width, height, movie->GetBuffer());
+    return movie->AddFrame();
+}
+
+// Add any frames still being read back, then close the movie.
+bool GfxCore::FinishMovie()
+{
+    while (PendingReadPixels()) {
+	FinishReadPixels(movie->GetBuffer());
+	if (!movie->AddFrame()) {
+	    CancelReadPixels();
+	    return false;
+	}
+    }
+    return movie->Close();
+}
+
 bool GfxCore::ExportMovie(const wxString & fnm)
 {
     FILE* fh = wxFopen(fnm.fn_str(), wxT("wb"));
@@ -4207,7 +3624,12 @@ bool GfxCore::ExportMovie(const wxString & fnm)
 
     int width;
     int height;
-    GetSize(&width, &height);
+    if (IsOffscreen()) {
+	width = GetXSize();
+	height = GetYSize();
+    } else {
+	GetSize(&width, &height);
+    }
     // Round up to next multiple of 2 (required by ffmpeg).
     width += (width & 1);
     height += (height & 1);
@@ -4222,10 +3644,59 @@ bool GfxCore::ExportMovie(const wxString & fnm)
 	return false;
     }
 
+    movie_failed = false;
     PlayPres(1);
     return true;
 }
 
+// Switch to drawing offscreen at the specified size.
+bool GfxCore::RenderOffscreen(int width, int height)
+{
+    if (!m_DoneFirstShow) {
+	FirstShow();
+    }
+    if (!SetOffscreen(width, height)) {
+	/* TRANSLATORS: Error given by aven --movie or --screenshot if the
+	 * graphics driver can't draw into an image which isn't shown on
+	 * screen. */
+	wxGetApp().ReportError(wmsg(/*Offscreen rendering isn't supported by this OpenGL implementation*/536));
+	return false;
+    }
+    m_HitTestGridValid = false;
+    return true;
+}
+
+// Render the current presentation to a movie without using the window, so
+// the size doesn't depend on the display and no frames are dropped.
+bool GfxCore::RenderMovie(const wxString & fnm, int width, int height)
+{
+    // Round up to next multiple of 2 (required by ffmpeg).
+    width += (width & 1);
+    height += (height & 1);
+    if (!RenderOffscreen(width, height)) return false;
+    if (!ExportMovie(fnm)) return false;
+
+    // Animate() adds the frame just drawn to the movie then advances the
+    // view, and stops the movie after the last mark.
+    while (movie) {
+	Draw();
+	Animate();
+    }
+    return !movie_failed;
+}
+
+// Render the current view to a PNG file without using the window.
+bool GfxCore::RenderScreenshot(const wxString & fnm, int width, int height)
+{
+    if (!RenderOffscreen(width, height)) return false;
+    Draw();
+    if (!SaveScreenshot(fnm, wxBITMAP_TYPE_PNG)) {
+	wxGetApp().ReportError(wxString::Format(wmsg(/*Error writing to file “%s”*/110), fnm.c_str()));
+	return false;
+    }
+    return true;
+}
+
 void
 GfxCore::OnPrint(const wxString &filename, const wxString &title,
 		 const wxString &datestamp,
@@ -33,6 +33,8 @@
 
 #include "guicontrol.h"
 #include "labelinfo.h"
+#include "labelplacer.h"
+#include "terrain.h"
 #include "vector3.h"
 #include "wx.h"
 #include "gla.h"
@@ -48,6 +50,8 @@ class traverse;
 
 class XSect;
 class PointInfo;
+class SurveyFilter;
+class SurveyTree;
 class MovieMaker;
 
 class PresentationMark : public Point {
@@ -113,14 +117,6 @@ enum {
     SHOW_NORMAL,
 };
 
-struct Split {
-    Vector3 vec;
-    glaCoord tx, ty;
-
-    Split(const Vector3& vec_, glaCoord tx_, glaCoord ty_)
-	: vec(vec_), tx(tx_), ty(ty_) { }
-};
-
 // It's pointless to redraw the screen as often as we can on a fast machine,
 // since the display hardware will only update so many times per second.
 // This is the maximum framerate we'll redraw at.
@@ -155,6 +151,24 @@ class GfxCore : public GLACanvas {
 
     static const int NUM_COLOUR_BANDS = 13;
 
+    // Indices into GLAVertex::value for the colour-by modes which use the
+    // palette.
+    enum {
+	VALUE_DEPTH,
+	VALUE_DATE,
+	// One for each of traverse::ERROR_3D, ERROR_H and ERROR_V.
+	VALUE_ERROR,
+	VALUE_GRADIENT = VALUE_ERROR + 3,
+	VALUE_LENGTH
+    };
+
+    // Indices into GLAVertex::colour.
+    enum {
+	VERTEX_COLOUR_PLAIN,
+	VERTEX_COLOUR_SURVEY,
+	VERTEX_COLOUR_STYLE
+    };
+
     void SetPanBase() {
 	base_pan = m_PanAngle;
 	base_pan_time = timer.Time() - (1000 / MAX_FRAMERATE);
@@ -183,7 +197,13 @@ public:
 
 private:
     GUIControl* m_Control;
-    char* m_LabelGrid;
+    // Which labels NattyDrawNames() draws, which is kept while the view is
+    // only panned.
+    LabelPlacer label_placer;
+    // Where the unit axes and origin projected to and other settings which
+    // affect label_placer when it was last reset.
+    double label_placer_key[12];
+    bool label_placer_valid = false;
     MainFrm* m_Parent;
     bool m_DoneFirstShow;
     Double m_TiltAngle;
@@ -226,6 +246,12 @@ private:
 
     list<LabelInfo*> *m_PointGrid;
     bool m_HitTestGridValid;
+    // Stations in view, in the order labels are plotted in, and their
+    // screen positions.
+    vector<LabelInfo*> visible_labels;
+    GLAProjectedPoints label_points;
+    // Transform serial visible_labels was found for (0 for none).
+    unsigned long visible_labels_serial;
 
     LabelInfo temp_here;
     const LabelInfo * m_here;
@@ -249,6 +275,8 @@ private:
     double this_mark_total;
 
     MovieMaker * movie;
+    // Set if writing the movie failed, so RenderMovie() can report it.
+    bool movie_failed;
 
     cursor current_cursor;
 
@@ -266,43 +294,40 @@ private:
     Vector3 offsets;
 
     // DEM:
-    unsigned short * dem;
-    unsigned long dem_width, dem_height;
-    double o_x, o_y, step_x, step_y;
-    long nodata_value;
-    bool bigendian;
+    Terrain terrain;
+    // TerrainKey() for the terrain vertex buffer.
+    wxString terrain_key;
     long last_time;
     size_t n_tris;
 
-    void PlaceVertexWithColour(const Vector3 &v, Double factor = 1.0);
-    void PlaceVertexWithColour(const Vector3 & v,
-			       glaTexCoord tex_x, glaTexCoord tex_y,
-			       Double factor);
-    void SetDepthColour(Double z, Double factor);
-    void PlaceVertexWithDepthColour(const Vector3 & v, Double factor = 1.0);
-    void PlaceVertexWithDepthColour(const Vector3 & v,
-				    glaTexCoord tex_x, glaTexCoord tex_y,
-				    Double factor);
-
-    void SetColourFrom01(double how_far, Double factor);
-
-    void SetColourFromDate(int date, Double factor);
-    void SetColourFromError(double E, Double factor);
-    void SetColourFromGradient(double angle, Double factor);
-    void SetColourFromLength(double len, Double factor);
-    void SetColourFromSurvey(const wxString& survey);
-    void SetColourFromSurveyStation(const wxString& survey, Double factor);
+    // Map values to the range 0 to 1 for colouring using the palette (or -1
+    // for no data).
+    double DepthTo01(Double z) const;
+    double DateTo01(int date) const;
+    static double ErrorTo01(double E);
+    static double GradientTo01(double gradient);
+    static double LengthTo01(double length);
 
     int GetClinoOffset() const;
     void DrawTick(int angle_cw);
     void DrawArrow(gla_colour col1, gla_colour col2);
 
-    void SkinPassage(vector<XSect> & centreline);
-
     virtual void GenerateList(unsigned int l);
-    void GenerateDisplayList(bool surface);
-    void GenerateDisplayListTubes();
-    void DrawTerrainTriangle(const Vector3 & a, const Vector3 & b, const Vector3 & c);
+    virtual void GenerateVertexBuffer(unsigned int l, GLAVertexBuffer& buffer);
+    void GenerateLegsVertexBuffer(bool surface, GLAVertexBuffer& buffer);
+    void AddLegsLevel(bool surface, double tolerance, GLAVertexBuffer& buffer);
+    void GenerateTubesVertexBuffer(GLAVertexBuffer& buffer);
+    void GenerateMarkersVertexBuffer(bool crosses, GLAVertexBuffer& buffer);
+    bool ShowStation(const LabelInfo* label, const SurveyFilter* filter,
+		     const SurveyTree& tree) const;
+    gla_colour BlobColour(const LabelInfo* label) const;
+    // Size of a pixel in survey units (0 if it varies across the view).
+    double GetPixelSize() const;
+    unsigned GetLevelOfDetail() const;
+    void DrawLegs(bool surface);
+    void DrawTubes();
+    wxString TerrainKey() const;
+    void GenerateTerrainVertexBuffer(GLAVertexBuffer& buffer);
     void DrawTerrain();
     void GenerateDisplayListShadow();
     void GenerateBlobsDisplayList();
@@ -312,6 +337,11 @@ private:
     void TryToFreeArrays();
     void FirstShow();
 
+    bool AddMovieFrame();
+    bool FinishMovie();
+
+    bool RenderOffscreen(int width, int height);
+
     void DrawScaleBar();
     void DrawColourKey(int num_bands, const wxString & other, const wxString & units);
     void DrawDepthKey();
@@ -334,6 +364,7 @@ private:
     void Repaint();
 
     void CreateHitTestGrid();
+    const GLAProjectedPoints& ProjectLabels();
 
     int GetCompassXPosition() const;
     int GetClinoXPosition() const;
@@ -363,6 +394,14 @@ public:
     void UpdateBlobs();
     void ForceRefresh();
 
+    // Call after the order labels are plotted in changes.
+    void LabelOrderChanged() {
+	visible_labels_serial = 0;
+	label_points.clear();
+	m_HitTestGridValid = false;
+	label_placer_valid = false;
+    }
+
     void RefreshLine(const Point* a, const Point* b, const Point* c);
 
     void SetHereSurvey(const wxString& survey) {
@@ -391,6 +430,7 @@ public:
     void TurnCaveTo(Double angle);
 
     void OnPaint(wxPaintEvent&);
+    void Draw();
     void OnSize(wxSizeEvent& event);
     void OnIdle(wxIdleEvent& event);
 
@@ -581,45 +621,9 @@ public:
 
     void DragFinished();
 
-    void SplitLineAcrossBands(int band, int band2,
-			      const Vector3 &p, const Vector3 &q,
-			      Double factor = 1.0);
-    void SplitPolyAcrossBands(vector<vector<Split>>& splits,
-			      int band, int band2,
-			      const Vector3 &p, const Vector3 &q,
-			      glaTexCoord ptx, glaTexCoord pty,
-			      glaTexCoord w, glaTexCoord h);
-    int GetDepthColour(Double z) const;
-    Double GetDepthBoundaryBetweenBands(int a, int b) const;
-    void AddPolyline(const traverse & centreline);
-    void AddPolylineDepth(const traverse & centreline);
-    void AddPolylineDate(const traverse & centreline);
-    void AddPolylineError(const traverse & centreline);
-    void AddPolylineGradient(const traverse & centreline);
-    void AddPolylineLength(const traverse & centreline);
-    void AddPolylineSurvey(const traverse & centreline);
-    void AddPolylineStyle(const traverse & centreline);
-    void AddQuadrilateral(const Vector3 &a, const Vector3 &b,
-			  const Vector3 &c, const Vector3 &d);
     void AddPolylineShadow(const traverse & centreline);
-    void AddQuadrilateralDepth(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralDate(const Vector3 &a, const Vector3 &b,
-			      const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralError(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralGradient(const Vector3 &a, const Vector3 &b,
-				  const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralLength(const Vector3 &a, const Vector3 &b,
-				const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralSurvey(const Vector3 &a, const Vector3 &b,
-				const Vector3 &c, const Vector3 &d);
     void MoveViewer(double forward, double up, double right);
 
-    void (GfxCore::* AddQuad)(const Vector3 &a, const Vector3 &b,
-			      const Vector3 &c, const Vector3 &d);
-    void (GfxCore::* AddPoly)(const traverse & centreline);
-
     PresentationMark GetView() const;
     void SetView(const PresentationMark & p);
     void PlayPres(double speed, bool change_speed = true);
@@ -628,6 +632,8 @@ public:
 
     void SetColourBy(int colour_by);
     bool ExportMovie(const wxString & fnm);
+    bool RenderMovie(const wxString & fnm, int width, int height);
+    bool RenderScreenshot(const wxString & fnm, int width, int height);
     void OnPrint(const wxString &filename, const wxString &title,
 		 const wxString &datestamp,
 		 bool close_after_print = false);
@@ -642,6 +648,8 @@ public:
 	for (int i = 0; i < LIST_LIMIT_; ++i) {
 	    InvalidateList(i);
 	}
+	// This is called when the tree filter changes.
+	label_placer_valid = false;
     }
 
     void SetZoomBox(wxPoint p1, wxPoint p2, bool centred, bool aspect);
@@ -654,10 +662,7 @@ public:
 
     void ZoomBoxGo();
 
-    void parse_hgt_filename(const wxString & lc_name);
-    size_t parse_hdr(wxInputStream & is, unsigned long & skipbytes);
-    bool read_bil(wxInputStream & is, size_t size, unsigned long skipbytes);
-    bool LoadDEM(const wxString & file);
+    bool LoadDEM(const wxArrayString & files);
 
 private:
     DECLARE_EVENT_TABLE()
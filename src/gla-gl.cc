@@ -29,6 +29,26 @@
 #include <wx/image.h>
 
 #include <algorithm>
+#include <stddef.h>
+#include <string.h>
+
+#if defined __SSE__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define HAVE_SSE
+#endif
+
+#ifndef _WIN32
+# include <dlfcn.h>
+#endif
+
+#ifdef HAVE_EGL
+// We don't create any native surfaces, so we don't want X11 headers (which
+// clash with wxWidgets).
+# define EGL_NO_X11
+# define MESA_EGL_NO_X11_HEADERS
+# include <EGL/egl.h>
+# include <EGL/eglext.h>
+#endif
 
 #include "aven.h"
 #include "gla.h"
@@ -71,6 +91,66 @@
 #ifndef GL_ALIASED_POINT_SIZE_RANGE
 #define GL_ALIASED_POINT_SIZE_RANGE 0x846D
 #endif
+// GL_CLAMP_TO_EDGE was added in OpenGL 1.2.
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+// Buffer objects were added in OpenGL 1.5.
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+// Pixel buffer objects were added in OpenGL 2.1.
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+// Framebuffer objects were added in OpenGL 3.0.
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_RENDERBUFFER
+#define GL_RENDERBUFFER 0x8D41
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_DEPTH_ATTACHMENT
+#define GL_DEPTH_ATTACHMENT 0x8D00
+#endif
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+// Multitexturing was added in OpenGL 1.3.
+#ifndef GL_TEXTURE0
+#define GL_TEXTURE0 0x84C0
+#endif
+#ifndef GL_TEXTURE1
+#define GL_TEXTURE1 0x84C1
+#endif
+// GLSL was added in OpenGL 2.0.
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
 
 using namespace std;
 
@@ -190,6 +270,256 @@ string GetGLSystemDescription()
     return info;
 }
 
+// Microsoft's opengl32.dll only provides OpenGL 1.1 functions, so we look up
+// the buffer object functions at runtime (and we don't need glext.h this way).
+typedef void (APIENTRY * gla_GenBuffers)(GLsizei, GLuint *);
+typedef void (APIENTRY * gla_DeleteBuffers)(GLsizei, const GLuint *);
+typedef void (APIENTRY * gla_BindBuffer)(GLenum, GLuint);
+typedef void (APIENTRY * gla_BufferData)(GLenum, ptrdiff_t, const void *,
+					 GLenum);
+typedef void * (APIENTRY * gla_MapBuffer)(GLenum, GLenum);
+typedef GLboolean (APIENTRY * gla_UnmapBuffer)(GLenum);
+
+static gla_GenBuffers glaGenBuffers = NULL;
+static gla_DeleteBuffers glaDeleteBuffers = NULL;
+static gla_BindBuffer glaBindBuffer = NULL;
+static gla_BufferData glaBufferData = NULL;
+static gla_MapBuffer glaMapBuffer = NULL;
+static gla_UnmapBuffer glaUnmapBuffer = NULL;
+
+static void *
+gl_get_proc_address(const char * name)
+{
+#ifdef _WIN32
+    return reinterpret_cast<void *>(wglGetProcAddress(name));
+#else
+    return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+static void
+get_gl_version(int & major, int & minor)
+{
+    const char * p = (const char *)glGetString(GL_VERSION);
+    major = atoi(p);
+    p = strchr(p, '.');
+    minor = p ? atoi(p + 1) : 0;
+}
+
+static void
+init_buffer_objects()
+{
+    // Buffer objects are in OpenGL 1.5 and later.  Without them we still use
+    // vertex arrays, but they have to be sent to the GPU each time we draw.
+    int major, minor;
+    get_gl_version(major, minor);
+    if (major == 1 && minor < 5) return;
+
+    glaGenBuffers = (gla_GenBuffers)gl_get_proc_address("glGenBuffers");
+    glaDeleteBuffers = (gla_DeleteBuffers)gl_get_proc_address("glDeleteBuffers");
+    glaBindBuffer = (gla_BindBuffer)gl_get_proc_address("glBindBuffer");
+    glaBufferData = (gla_BufferData)gl_get_proc_address("glBufferData");
+    if (!glaGenBuffers || !glaDeleteBuffers || !glaBindBuffer || !glaBufferData) {
+	glaGenBuffers = NULL;
+	return;
+    }
+
+    // Reading pixels into buffer objects needs OpenGL 2.1.
+    if (major == 1 || (major == 2 && minor < 1)) return;
+    glaMapBuffer = (gla_MapBuffer)gl_get_proc_address("glMapBuffer");
+    glaUnmapBuffer = (gla_UnmapBuffer)gl_get_proc_address("glUnmapBuffer");
+    if (!glaMapBuffer || !glaUnmapBuffer) {
+	glaMapBuffer = NULL;
+    }
+}
+
+typedef void (APIENTRY * gla_GenFramebuffers)(GLsizei, GLuint *);
+typedef void (APIENTRY * gla_DeleteFramebuffers)(GLsizei, const GLuint *);
+typedef void (APIENTRY * gla_BindFramebuffer)(GLenum, GLuint);
+typedef GLenum (APIENTRY * gla_CheckFramebufferStatus)(GLenum);
+typedef void (APIENTRY * gla_GenRenderbuffers)(GLsizei, GLuint *);
+typedef void (APIENTRY * gla_DeleteRenderbuffers)(GLsizei, const GLuint *);
+typedef void (APIENTRY * gla_BindRenderbuffer)(GLenum, GLuint);
+typedef void (APIENTRY * gla_RenderbufferStorage)(GLenum, GLenum, GLsizei,
+						  GLsizei);
+typedef void (APIENTRY * gla_FramebufferRenderbuffer)(GLenum, GLenum, GLenum,
+						      GLuint);
+
+static gla_GenFramebuffers glaGenFramebuffers = NULL;
+static gla_DeleteFramebuffers glaDeleteFramebuffers = NULL;
+static gla_BindFramebuffer glaBindFramebuffer = NULL;
+static gla_CheckFramebufferStatus glaCheckFramebufferStatus = NULL;
+static gla_GenRenderbuffers glaGenRenderbuffers = NULL;
+static gla_DeleteRenderbuffers glaDeleteRenderbuffers = NULL;
+static gla_BindRenderbuffer glaBindRenderbuffer = NULL;
+static gla_RenderbufferStorage glaRenderbufferStorage = NULL;
+static gla_FramebufferRenderbuffer glaFramebufferRenderbuffer = NULL;
+
+static bool
+init_framebuffer_objects()
+{
+    if (glaGenFramebuffers) return true;
+
+    // Framebuffer objects are in OpenGL 3.0 and later (and many older
+    // drivers provide the same functions via ARB_framebuffer_object).
+    int major, minor;
+    get_gl_version(major, minor);
+    if (major < 3 &&
+	!strstr((const char*)glGetString(GL_EXTENSIONS),
+		"GL_ARB_framebuffer_object")) {
+	return false;
+    }
+
+#define LOAD_FBO_FN(F) \
+    if (!(gla##F = (gla_##F)gl_get_proc_address("gl" #F))) return false
+    LOAD_FBO_FN(DeleteFramebuffers);
+    LOAD_FBO_FN(BindFramebuffer);
+    LOAD_FBO_FN(CheckFramebufferStatus);
+    LOAD_FBO_FN(GenRenderbuffers);
+    LOAD_FBO_FN(DeleteRenderbuffers);
+    LOAD_FBO_FN(BindRenderbuffer);
+    LOAD_FBO_FN(RenderbufferStorage);
+    LOAD_FBO_FN(FramebufferRenderbuffer);
+    // Load this last as it's used to indicate the others are all available.
+    LOAD_FBO_FN(GenFramebuffers);
+#undef LOAD_FBO_FN
+    return true;
+}
+
+typedef void (APIENTRY * gla_ActiveTexture)(GLenum);
+typedef GLuint (APIENTRY * gla_CreateShader)(GLenum);
+typedef void (APIENTRY * gla_ShaderSource)(GLuint, GLsizei, const char **,
+					   const GLint *);
+typedef void (APIENTRY * gla_CompileShader)(GLuint);
+typedef void (APIENTRY * gla_GetShaderiv)(GLuint, GLenum, GLint *);
+typedef void (APIENTRY * gla_DeleteShader)(GLuint);
+typedef GLuint (APIENTRY * gla_CreateProgram)();
+typedef void (APIENTRY * gla_AttachShader)(GLuint, GLuint);
+typedef void (APIENTRY * gla_LinkProgram)(GLuint);
+typedef void (APIENTRY * gla_GetProgramiv)(GLuint, GLenum, GLint *);
+typedef void (APIENTRY * gla_DeleteProgram)(GLuint);
+typedef void (APIENTRY * gla_UseProgram)(GLuint);
+typedef GLint (APIENTRY * gla_GetUniformLocation)(GLuint, const char *);
+typedef void (APIENTRY * gla_Uniform1i)(GLint, GLint);
+typedef void (APIENTRY * gla_Uniform1f)(GLint, GLfloat);
+
+static gla_ActiveTexture glaActiveTexture = NULL;
+static gla_ActiveTexture glaClientActiveTexture = NULL;
+static gla_CreateShader glaCreateShader = NULL;
+static gla_ShaderSource glaShaderSource = NULL;
+static gla_CompileShader glaCompileShader = NULL;
+static gla_GetShaderiv glaGetShaderiv = NULL;
+static gla_DeleteShader glaDeleteShader = NULL;
+static gla_CreateProgram glaCreateProgram = NULL;
+static gla_AttachShader glaAttachShader = NULL;
+static gla_LinkProgram glaLinkProgram = NULL;
+static gla_GetProgramiv glaGetProgramiv = NULL;
+static gla_DeleteProgram glaDeleteProgram = NULL;
+static gla_UseProgram glaUseProgram = NULL;
+static gla_GetUniformLocation glaGetUniformLocation = NULL;
+static gla_Uniform1i glaUniform1i = NULL;
+static gla_Uniform1f glaUniform1f = NULL;
+
+// Colour fragments of a GLAVertexBuffer.  We only replace the fragment stage,
+// so the fixed-function pipeline still transforms vertices and calculates the
+// fog distance for us.
+//
+// Texture coordinate set 0 is the value to colour by, which is looked up in
+// the palette per fragment (so we never need to split primitives where they
+// cross a colour band), while set 1 gives the position on the passage wall
+// texture.
+static const char colour_fragment_shader[] =
+    "uniform sampler1D palette;\n"
+    "uniform sampler2D wall;\n"
+    "uniform bool use_palette;\n"
+    "uniform bool use_wall;\n"
+    "uniform bool use_fog;\n"
+    "uniform float palette_offset;\n"
+    "uniform float palette_scale;\n"
+    "uniform float nodata;\n"
+    "void main() {\n"
+    "    vec4 colour = gl_Color;\n"
+    "    if (use_palette) {\n"
+    "        float v = gl_TexCoord[0].s;\n"
+    "        float s = (v < 0.0) ? nodata : palette_offset + v * palette_scale;\n"
+    "        colour *= texture1D(palette, s);\n"
+    "    }\n"
+    "    if (use_wall) colour *= texture2D(wall, gl_TexCoord[1].st);\n"
+    "    if (use_fog) {\n"
+    "        float f = (gl_Fog.end - gl_FogFragCoord) * gl_Fog.scale;\n"
+    "        colour.rgb = mix(gl_Fog.color.rgb, colour.rgb, clamp(f, 0.0, 1.0));\n"
+    "    }\n"
+    "    gl_FragColor = colour;\n"
+    "}\n";
+
+// Order must match the U_* enum in GLACanvas.
+static const char * colour_uniform_names[] = {
+    "palette", "wall", "use_palette", "use_wall", "use_fog",
+    "palette_offset", "palette_scale", "nodata"
+};
+
+static GLuint
+create_colour_program()
+{
+    // GLSL is in OpenGL 2.0 and later.  Without it, DrawVertexBuffer() uses
+    // the fixed-function pipeline instead.
+    int major, minor;
+    get_gl_version(major, minor);
+    (void)minor;
+    if (major < 2) return 0;
+
+#define GET_PROC(F) \
+    if (!(gla##F = (gla_##F)gl_get_proc_address("gl" #F))) return 0
+    GET_PROC(CreateShader);
+    GET_PROC(ShaderSource);
+    GET_PROC(CompileShader);
+    GET_PROC(GetShaderiv);
+    GET_PROC(DeleteShader);
+    GET_PROC(CreateProgram);
+    GET_PROC(AttachShader);
+    GET_PROC(LinkProgram);
+    GET_PROC(GetProgramiv);
+    GET_PROC(DeleteProgram);
+    GET_PROC(UseProgram);
+    GET_PROC(GetUniformLocation);
+    GET_PROC(Uniform1i);
+    GET_PROC(Uniform1f);
+#undef GET_PROC
+    glaActiveTexture = (gla_ActiveTexture)gl_get_proc_address("glActiveTexture");
+    glaClientActiveTexture =
+	(gla_ActiveTexture)gl_get_proc_address("glClientActiveTexture");
+    if (!glaActiveTexture || !glaClientActiveTexture) return 0;
+
+    GLuint shader = glaCreateShader(GL_FRAGMENT_SHADER);
+    if (!shader) return 0;
+    const char * source = colour_fragment_shader;
+    glaShaderSource(shader, 1, &source, NULL);
+    glaCompileShader(shader);
+    GLint ok = GL_FALSE;
+    glaGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+	glaDeleteShader(shader);
+	return 0;
+    }
+
+    GLuint program = glaCreateProgram();
+    if (program) {
+	glaAttachShader(program, shader);
+	glaLinkProgram(program);
+	glaGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+	    glaDeleteProgram(program);
+	    program = 0;
+	}
+    }
+    // The shader will actually be deleted when the program is.
+    glaDeleteShader(shader);
+    // Clear any error from a driver which doesn't like our shader - we'll
+    // just fall back to the fixed-function pipeline.
+    while (glGetError() != GL_NO_ERROR) { }
+    return program;
+}
+
 static bool
 glpoint_sprite_works()
 {
@@ -388,6 +718,28 @@ bool GLAList::DrawList() const {
     return true;
 }
 
+//
+//  GLAVertex
+//
+
+void GLAVertex::SetColour(int i, const GLAPen& pen, double rgb_scale,
+			  double alpha)
+{
+    rgb_scale *= 255.0;
+    colour[i][0] = GLubyte(pen.GetRed() * rgb_scale);
+    colour[i][1] = GLubyte(pen.GetGreen() * rgb_scale);
+    colour[i][2] = GLubyte(pen.GetBlue() * rgb_scale);
+    colour[i][3] = GLubyte(alpha * 255.0);
+}
+
+void GLAVertex::SetColour(int i, gla_colour c, double rgb_scale, double alpha)
+{
+    colour[i][0] = GLubyte(COLOURS[c].r * rgb_scale);
+    colour[i][1] = GLubyte(COLOURS[c].g * rgb_scale);
+    colour[i][2] = GLubyte(COLOURS[c].b * rgb_scale);
+    colour[i][3] = GLubyte(alpha * 255.0);
+}
+
 //
 //  GLACanvas
 //
@@ -412,6 +764,15 @@ GLACanvas::GLACanvas(wxWindow* parent, int id)
     m_VolumeDiameter = 1.0;
     m_SmoothShading = false;
     m_Texture = 0;
+    m_PaletteTexture = 0;
+    palette_size = 0;
+    palette_texture_width = 0;
+    m_ColourProgram = 0;
+    memset(modelview_matrix, 0, sizeof(modelview_matrix));
+    memset(projection_matrix, 0, sizeof(projection_matrix));
+    memset(viewport, 0, sizeof(viewport));
+    memset(mvp_matrix, 0, sizeof(mvp_matrix));
+    transform_serial = 1;
     m_Textured = false;
     m_Perspective = false;
     m_Fog = false;
@@ -424,20 +785,130 @@ GLACanvas::~GLACanvas()
 {
     // Destructor.
 
+    // The OpenGL objects belong to our context, which needs to be current to
+    // delete them.
+    if (opengl_initialised) MakeCurrent();
+
     if (m_Quadric) {
 	gluDeleteQuadric(m_Quadric);
 	CHECK_GL_ERROR("~GLACanvas", "gluDeleteQuadric");
     }
+
+    if (glaDeleteBuffers) {
+	for (auto&& b : vertex_buffers) {
+	    if (b.buffer) glaDeleteBuffers(1, &b.buffer);
+	}
+	if (pixel_buffers[0]) {
+	    glaDeleteBuffers(MaxPendingReadPixels(), pixel_buffers);
+	}
+    }
+
+    if (m_ColourProgram) {
+	glaDeleteProgram(m_ColourProgram);
+    }
+
+    if (offscreen_framebuffer) {
+	glaDeleteFramebuffers(1, &offscreen_framebuffer);
+	glaDeleteRenderbuffers(2, offscreen_renderbuffers);
+    }
+
+#ifdef HAVE_EGL
+    if (egl_context) {
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       EGL_NO_CONTEXT);
+	eglDestroyContext(egl_display, egl_context);
+	eglTerminate(egl_display);
+    }
+#endif
+}
+
+void GLACanvas::MakeCurrent()
+{
+#ifdef HAVE_EGL
+    if (egl_context) {
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       egl_context);
+	return;
+    }
+#endif
+    ctx.SetCurrent(*this);
+}
+
+bool GLACanvas::UseHeadlessContext()
+{
+    assert(!opengl_initialised);
+#ifdef HAVE_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+# ifdef EGL_PLATFORM_SURFACELESS_MESA
+    // Mesa's surfaceless platform doesn't need a display server at all.
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+	(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+	display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+				       EGL_DEFAULT_DISPLAY, NULL);
+    }
+# endif
+    if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY) return false;
+    if (!eglInitialize(display, NULL, NULL)) return false;
+
+    // We draw into a framebuffer object, so we need to be able to make the
+    // context current without a surface.
+    const char * extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context") ||
+	!eglBindAPI(EGL_OPENGL_API)) {
+	eglTerminate(display);
+	return false;
+    }
+
+    // The surfaceless platform may not offer any configs, but then we don't
+    // need one as we never create a surface.
+    static const EGLint config_attribs[] = {
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_NONE
+    };
+    EGLConfig config;
+    EGLint n_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &n_configs) ||
+	n_configs == 0) {
+# ifdef EGL_NO_CONFIG_KHR
+	if (!strstr(extensions, "EGL_KHR_no_config_context")) {
+	    eglTerminate(display);
+	    return false;
+	}
+	config = EGL_NO_CONFIG_KHR;
+# else
+	eglTerminate(display);
+	return false;
+# endif
+    }
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+					  NULL);
+    if (context == EGL_NO_CONTEXT) {
+	eglTerminate(display);
+	return false;
+    }
+
+    egl_display = display;
+    egl_context = context;
+    headless = true;
+    return true;
+#else
+    return false;
+#endif
 }
 
 void GLACanvas::FirstShow()
 {
-    // Update our record of the client area size and centre.
-    GetClientSize(&x_size, &y_size);
-    if (x_size < 1) x_size = 1;
-    if (y_size < 1) y_size = 1;
+    if (!offscreen_framebuffer && !headless) {
+	// Update our record of the client area size and centre.
+	GetClientSize(&x_size, &y_size);
+	if (x_size < 1) x_size = 1;
+	if (y_size < 1) y_size = 1;
+    }
 
-    ctx.SetCurrent(*this);
+    MakeCurrent();
     opengl_initialised = true;
 
     // Set the background colour of the canvas to black.
@@ -483,6 +954,23 @@ void GLACanvas::FirstShow()
 	abort(); // FIXME need to cope somehow
     }
 
+    init_buffer_objects();
+
+    m_ColourProgram = create_colour_program();
+    if (m_ColourProgram) {
+	for (int i = 0; i != U_COUNT; ++i) {
+	    colour_uniforms[i] =
+		glaGetUniformLocation(m_ColourProgram, colour_uniform_names[i]);
+	}
+	glaUseProgram(m_ColourProgram);
+	CHECK_GL_ERROR("FirstShow", "glUseProgram");
+	glaUniform1i(colour_uniforms[U_PALETTE], 0);
+	glaUniform1i(colour_uniforms[U_WALL], 1);
+	CHECK_GL_ERROR("FirstShow", "glUniform1i");
+	glaUseProgram(0);
+	CHECK_GL_ERROR("FirstShow", "glUseProgram");
+    }
+
     glShadeModel(GL_FLAT);
     CHECK_GL_ERROR("FirstShow", "glShadeModel");
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // So text works.
@@ -492,7 +980,7 @@ void GLACanvas::FirstShow()
 
     // We want glReadPixels() to read from the front buffer (which is the
     // default for single-buffered displays).
-    if (double_buffered) {
+    if (double_buffered && !offscreen_framebuffer && !headless) {
 	glReadBuffer(GL_FRONT);
 	CHECK_GL_ERROR("FirstShow", "glReadBuffer");
     }
@@ -633,6 +1121,12 @@ void GLACanvas::SetScale(Double scale)
 
 void GLACanvas::OnSize(wxSizeEvent & event)
 {
+    // When drawing offscreen the size doesn't depend on the window.
+    if (offscreen_framebuffer) {
+	event.Skip();
+	return;
+    }
+
     wxSize size = event.GetSize();
 
     unsigned int mask = 0;
@@ -693,7 +1187,7 @@ void GLACanvas::StartDrawing()
 {
     // Prepare for a redraw operation.
 
-    ctx.SetCurrent(*this);
+    MakeCurrent();
     glDepthMask(GL_TRUE);
 
     if (!save_hints) return;
@@ -800,6 +1294,13 @@ void GLACanvas::PlaceNormal(const Vector3 &v)
 
 void GLACanvas::SetDataTransform()
 {
+    GLdouble old_modelview_matrix[16];
+    GLdouble old_projection_matrix[16];
+    GLint old_viewport[4];
+    memcpy(old_modelview_matrix, modelview_matrix, sizeof(modelview_matrix));
+    memcpy(old_projection_matrix, projection_matrix, sizeof(projection_matrix));
+    memcpy(old_viewport, viewport, sizeof(viewport));
+
     // Set projection.
     glMatrixMode(GL_PROJECTION);
     CHECK_GL_ERROR("SetDataTransform", "glMatrixMode");
@@ -883,6 +1384,22 @@ void GLACanvas::SetDataTransform()
 	glGetDoublev(GL_MODELVIEW_MATRIX, modelview_matrix);
     }
 
+    if (memcmp(old_modelview_matrix, modelview_matrix, sizeof(modelview_matrix)) ||
+	memcmp(old_projection_matrix, projection_matrix, sizeof(projection_matrix)) ||
+	memcmp(old_viewport, viewport, sizeof(viewport))) {
+	++transform_serial;
+	// Both matrices are column-major.
+	for (int c = 0; c < 4; ++c) {
+	    for (int r = 0; r < 4; ++r) {
+		double t = 0.0;
+		for (int k = 0; k < 4; ++k) {
+		    t += projection_matrix[k * 4 + r] * modelview_matrix[c * 4 + k];
+		}
+		mvp_matrix[c * 4 + r] = t;
+	    }
+	}
+    }
+
     glEnable(GL_DEPTH_TEST);
     CHECK_GL_ERROR("SetDataTransform", "glEnable GL_DEPTH_TEST");
 
@@ -966,7 +1483,7 @@ void GLACanvas::FinishDrawing()
 {
     // Complete a redraw operation.
 
-    if (double_buffered) {
+    if (double_buffered && !offscreen_framebuffer) {
 	SwapBuffers();
     } else {
 	glFlush();
@@ -1005,18 +1522,6 @@ void GLACanvas::DrawList(unsigned int l)
     }
 }
 
-void GLACanvas::DrawListZPrepass(unsigned int l)
-{
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    DrawList(l);
-    glDepthMask(GL_FALSE);
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-    glDepthFunc(GL_EQUAL);
-    DrawList(l);
-    glDepthMask(GL_TRUE);
-    glDepthFunc(GL_LESS);
-}
-
 void GLACanvas::DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotation)
 {
     glMatrixMode(GL_PROJECTION);
@@ -1036,6 +1541,299 @@ void GLACanvas::DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotati
     CHECK_GL_ERROR("DrawList2D", "glPopMatrix");
 }
 
+void GLACanvas::UploadVertexBuffer(GLAVertexBuffer& b)
+{
+    b.n_vertices = b.vertices.size();
+    b.valid = true;
+    if (!glaGenBuffers || b.n_vertices == 0) return;
+
+    if (b.buffer == 0) {
+	glaGenBuffers(1, &b.buffer);
+	CHECK_GL_ERROR("UploadVertexBuffer", "glGenBuffers");
+	if (b.buffer == 0) return;
+    }
+    glaBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+    CHECK_GL_ERROR("UploadVertexBuffer", "glBindBuffer");
+    glaBufferData(GL_ARRAY_BUFFER, b.n_vertices * sizeof(GLAVertex),
+		  b.vertices.data(), GL_STATIC_DRAW);
+    CHECK_GL_ERROR("UploadVertexBuffer", "glBufferData");
+    glaBindBuffer(GL_ARRAY_BUFFER, 0);
+    CHECK_GL_ERROR("UploadVertexBuffer", "glBindBuffer");
+    // OpenGL has its own copy now.
+    vector<GLAVertex>().swap(b.vertices);
+}
+
+void GLACanvas::PrepareVertexBuffer(unsigned int l)
+{
+    if (l >= vertex_buffers.size()) vertex_buffers.resize(l + 1);
+
+    GLAVertexBuffer& b = vertex_buffers[l];
+    if (!b.valid) {
+	b.vertices.clear();
+	b.run_starts.clear();
+	b.run_dashed.clear();
+	b.level_starts.clear();
+	GenerateVertexBuffer(l, b);
+	UploadVertexBuffer(b);
+    }
+}
+
+void GLACanvas::DrawVertexBuffer(unsigned int l, int value, int colour,
+				 unsigned level)
+{
+    PrepareVertexBuffer(l);
+
+    const GLAVertexBuffer& b = vertex_buffers[l];
+    if (b.n_vertices == 0) return;
+
+    size_t level_begin = 0, level_end = b.n_vertices;
+    if (level > b.level_starts.size()) level = b.level_starts.size();
+    if (level > 0) level_begin = b.level_starts[level - 1];
+    if (level < b.level_starts.size()) level_end = b.level_starts[level];
+    if (level_begin == level_end) return;
+
+    vector<pair<size_t, size_t>> ranges(1, make_pair(level_begin, level_end));
+    DrawVertexBuffer(l, value, colour, ranges);
+}
+
+void GLACanvas::DrawVertexBuffer(unsigned int l, int value, int colour,
+				 const vector<pair<size_t, size_t>>& ranges)
+{
+    PrepareVertexBuffer(l);
+
+    GLAVertexBuffer& b = vertex_buffers[l];
+    if (b.n_vertices == 0 || ranges.empty()) return;
+
+    const char * base = NULL;
+    if (b.buffer) {
+	glaBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glBindBuffer");
+    } else {
+	base = reinterpret_cast<const char *>(b.vertices.data());
+    }
+
+    glPushAttrib(GL_ENABLE_BIT|GL_TEXTURE_BIT|GL_TRANSFORM_BIT|GL_POINT_BIT);
+    CHECK_GL_ERROR("DrawVertexBuffer", "glPushAttrib");
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    CHECK_GL_ERROR("DrawVertexBuffer", "glPushClientAttrib");
+
+    const GLsizei stride = sizeof(GLAVertex);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    CHECK_GL_ERROR("DrawVertexBuffer", "glEnableClientState GL_VERTEX_ARRAY");
+    glVertexPointer(3, GL_FLOAT, stride, base + offsetof(GLAVertex, x));
+    CHECK_GL_ERROR("DrawVertexBuffer", "glVertexPointer");
+    glEnableClientState(GL_COLOR_ARRAY);
+    CHECK_GL_ERROR("DrawVertexBuffer", "glEnableClientState GL_COLOR_ARRAY");
+    glColorPointer(4, GL_UNSIGNED_BYTE, stride,
+		   base + offsetof(GLAVertex, colour) + 4 * colour);
+    CHECK_GL_ERROR("DrawVertexBuffer", "glColorPointer");
+
+    // Only passage walls have coordinates for the wall texture.
+    bool markers = (b.primitive == GLAVertexBuffer::BLOBS ||
+		    b.primitive == GLAVertexBuffer::CROSSES);
+    bool use_palette = (value >= 0 && m_PaletteTexture && !markers);
+    bool use_wall = (m_Textured && m_Texture &&
+		     b.primitive == GLAVertexBuffer::TRIANGLES);
+    glDisable(GL_TEXTURE_2D);
+    if (markers) {
+	// All the markers are drawn by a single call, each as a point set up
+	// in the same way as BeginBlobs() or BeginCrosses() does.
+	glEnable(GL_ALPHA_TEST);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_ALPHA_TEST");
+	int method = (b.primitive == GLAVertexBuffer::BLOBS) ?
+		     blob_method : cross_method;
+	if (method == SPRITE) {
+	    glBindTexture(GL_TEXTURE_2D,
+			  b.primitive == GLAVertexBuffer::BLOBS ?
+			  m_BlobTexture : m_CrossTexture);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glBindTexture");
+	    glPointSize(8);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glPointSize");
+	    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glTexEnvi GL_POINT_SPRITE");
+	    glEnable(GL_TEXTURE_2D);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_TEXTURE_2D");
+	    glEnable(GL_POINT_SPRITE);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_POINT_SPRITE");
+	} else {
+	    glEnable(GL_POINT_SMOOTH);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_POINT_SMOOTH");
+	}
+    } else if (m_ColourProgram) {
+	glaUseProgram(m_ColourProgram);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glUseProgram");
+	glaUniform1i(colour_uniforms[U_USE_PALETTE], use_palette);
+	glaUniform1i(colour_uniforms[U_USE_WALL], use_wall);
+	glaUniform1i(colour_uniforms[U_USE_FOG], glIsEnabled(GL_FOG));
+	CHECK_GL_ERROR("DrawVertexBuffer", "glUniform1i");
+	if (use_palette) {
+	    // Map 0 to the centre of the first palette entry (texel 1) and 1
+	    // to the centre of the last.  Texel 0 is the "no data" colour.
+	    glaUniform1f(colour_uniforms[U_PALETTE_OFFSET],
+			 1.5 / palette_texture_width);
+	    glaUniform1f(colour_uniforms[U_PALETTE_SCALE],
+			 double(palette_size - 1) / palette_texture_width);
+	    glaUniform1f(colour_uniforms[U_NODATA], 0.5 / palette_texture_width);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glUniform1f");
+	}
+	if (use_wall) {
+	    glaActiveTexture(GL_TEXTURE1);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glActiveTexture");
+	    glBindTexture(GL_TEXTURE_2D, m_Texture);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glBindTexture");
+	    glaActiveTexture(GL_TEXTURE0);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glActiveTexture");
+	    glaClientActiveTexture(GL_TEXTURE1);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glClientActiveTexture");
+	    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glEnableClientState GL_TEXTURE_COORD_ARRAY");
+	    glTexCoordPointer(2, GL_FLOAT, stride,
+			      base + offsetof(GLAVertex, tex_x));
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glTexCoordPointer");
+	    glaClientActiveTexture(GL_TEXTURE0);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glClientActiveTexture");
+	}
+    } else if (use_palette) {
+	// Without shaders we can't combine the palette with the wall texture,
+	// so colouring takes precedence.
+	use_wall = false;
+    } else if (use_wall) {
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glEnableClientState GL_TEXTURE_COORD_ARRAY");
+	glTexCoordPointer(2, GL_FLOAT, stride, base + offsetof(GLAVertex, tex_x));
+	CHECK_GL_ERROR("DrawVertexBuffer", "glTexCoordPointer");
+	glBindTexture(GL_TEXTURE_2D, m_Texture);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glBindTexture");
+	glEnable(GL_TEXTURE_2D);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_TEXTURE_2D");
+    }
+
+    if (use_palette) {
+	// The palette is a 1D texture, and we select the value to colour by
+	// just by pointing the texture coordinates at it.
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glEnableClientState GL_TEXTURE_COORD_ARRAY");
+	glTexCoordPointer(1, GL_FLOAT, stride,
+			  base + offsetof(GLAVertex, value) +
+			  value * sizeof(GLfloat));
+	CHECK_GL_ERROR("DrawVertexBuffer", "glTexCoordPointer");
+	glBindTexture(GL_TEXTURE_1D, m_PaletteTexture);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glBindTexture");
+    }
+    if (use_palette && !m_ColourProgram) {
+	glEnable(GL_TEXTURE_1D);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glEnable GL_TEXTURE_1D");
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glTexEnvi");
+
+	// Use the texture matrix to map 0 to the centre of the first palette
+	// entry (texel 1) and 1 to the centre of the last.  Negative values
+	// end up clamped to texel 0, which is the "no data" colour.
+	glMatrixMode(GL_TEXTURE);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glMatrixMode");
+	glPushMatrix();
+	CHECK_GL_ERROR("DrawVertexBuffer", "glPushMatrix");
+	glLoadIdentity();
+	glTranslated(1.5 / palette_texture_width, 0, 0);
+	glScaled(double(palette_size - 1) / palette_texture_width, 1, 1);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glScaled");
+    }
+
+    GLenum mode = GL_POINTS;
+    if (b.primitive == GLAVertexBuffer::LINES) {
+	mode = GL_LINES;
+    } else if (b.primitive == GLAVertexBuffer::TRIANGLES) {
+	mode = GL_TRIANGLES;
+    }
+    for (const auto& range : ranges) {
+	if (b.run_starts.empty()) {
+	    glDrawArrays(mode, range.first, range.second - range.first);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glDrawArrays");
+	    continue;
+	}
+	for (size_t i = 0; i != b.run_starts.size(); ++i) {
+	    size_t start = max(b.run_starts[i], range.first);
+	    size_t end = b.n_vertices;
+	    if (i + 1 != b.run_starts.size()) end = b.run_starts[i + 1];
+	    end = min(end, range.second);
+	    if (start >= end) continue;
+	    if (b.run_dashed[i]) EnableDashedLines();
+	    glDrawArrays(mode, start, end - start);
+	    CHECK_GL_ERROR("DrawVertexBuffer", "glDrawArrays");
+	    if (b.run_dashed[i]) DisableDashedLines();
+	}
+    }
+
+    if (m_ColourProgram && !markers) {
+	glaUseProgram(0);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glUseProgram");
+    } else if (use_palette) {
+	glPopMatrix();
+	CHECK_GL_ERROR("DrawVertexBuffer", "glPopMatrix");
+    }
+    glPopClientAttrib();
+    CHECK_GL_ERROR("DrawVertexBuffer", "glPopClientAttrib");
+    glPopAttrib();
+    CHECK_GL_ERROR("DrawVertexBuffer", "glPopAttrib");
+
+    if (b.buffer) {
+	glaBindBuffer(GL_ARRAY_BUFFER, 0);
+	CHECK_GL_ERROR("DrawVertexBuffer", "glBindBuffer");
+    }
+}
+
+void GLACanvas::DrawVertexBufferZPrepass(unsigned int l, int value, int colour,
+					 const vector<pair<size_t, size_t>>& ranges)
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    DrawVertexBuffer(l, value, colour, ranges);
+    glDepthMask(GL_FALSE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_EQUAL);
+    DrawVertexBuffer(l, value, colour, ranges);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+}
+
+void GLACanvas::SetPalette(const GLAPen* pens, int n, gla_colour nodata)
+{
+    // Texel 0 is the "no data" colour, followed by the n pens.  Before
+    // OpenGL 2.0, texture sizes must be a power of 2 so pad with the last
+    // pen.
+    int width = 1;
+    while (width < n + 1) width <<= 1;
+    vector<GLubyte> texels(width * 3);
+    texels[0] = COLOURS[nodata].r;
+    texels[1] = COLOURS[nodata].g;
+    texels[2] = COLOURS[nodata].b;
+    for (int i = 1; i < width; ++i) {
+	const GLAPen& pen = pens[min(i, n) - 1];
+	texels[i * 3] = GLubyte(pen.GetRed() * 255.0);
+	texels[i * 3 + 1] = GLubyte(pen.GetGreen() * 255.0);
+	texels[i * 3 + 2] = GLubyte(pen.GetBlue() * 255.0);
+    }
+
+    if (m_PaletteTexture == 0) {
+	glGenTextures(1, &m_PaletteTexture);
+	CHECK_GL_ERROR("SetPalette", "glGenTextures");
+    }
+    glBindTexture(GL_TEXTURE_1D, m_PaletteTexture);
+    CHECK_GL_ERROR("SetPalette", "glBindTexture");
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    CHECK_GL_ERROR("SetPalette", "glTexParameteri GL_TEXTURE_WRAP_S");
+    // Linear interpolation between adjacent texels gives the same colours
+    // as interpolating between the pens.
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    CHECK_GL_ERROR("SetPalette", "glTexParameteri GL_TEXTURE_MAG_FILTER");
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    CHECK_GL_ERROR("SetPalette", "glTexParameteri GL_TEXTURE_MIN_FILTER");
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, width, 0, GL_RGB, GL_UNSIGNED_BYTE,
+		 texels.data());
+    CHECK_GL_ERROR("SetPalette", "glTexImage1D");
+    palette_size = n;
+    palette_texture_width = width;
+}
+
 void GLACanvas::SetColour(const GLAPen& pen, double rgb_scale)
 {
     // Set the colour for subsequent operations.
@@ -1580,6 +2378,110 @@ bool GLACanvas::Transform(const Vector3 & v,
 		      x_out, y_out, z_out);
 }
 
+void GLACanvas::Transform(GLAProjectedPoints & points) const
+{
+    if (points.serial == transform_serial) return;
+    points.serial = transform_serial;
+
+    size_t n = points.size();
+    points.sx.resize(n);
+    points.sy.resize(n);
+    points.sz.resize(n);
+
+    // Using the combined projection and modelview matrix means each point
+    // needs a single matrix multiply, then we fold in the viewport transform,
+    // giving the same results as gluProject().
+    float m[16];
+    for (int j = 0; j < 16; ++j) m[j] = mvp_matrix[j];
+    const float x_scale = viewport[2] * 0.5f;
+    const float x_offset = viewport[0] + x_scale;
+    const float y_scale = viewport[3] * 0.5f;
+    const float y_offset = viewport[1] + y_scale;
+
+    const float * x = points.x.data();
+    const float * y = points.y.data();
+    const float * z = points.z.data();
+    float * sx = points.sx.data();
+    float * sy = points.sy.data();
+    float * sz = points.sz.data();
+    size_t i = 0;
+#ifdef HAVE_SSE
+    // Project four points at a time.
+    __m128 M[16];
+    for (int j = 0; j < 16; ++j) M[j] = _mm_set1_ps(m[j]);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+    const __m128 xs = _mm_set1_ps(x_scale), xo = _mm_set1_ps(x_offset);
+    const __m128 ys = _mm_set1_ps(y_scale), yo = _mm_set1_ps(y_offset);
+    for ( ; i + 4 <= n; i += 4) {
+	__m128 X = _mm_loadu_ps(x + i);
+	__m128 Y = _mm_loadu_ps(y + i);
+	__m128 Z = _mm_loadu_ps(z + i);
+#define ROW(R) _mm_add_ps(_mm_add_ps(_mm_mul_ps(M[R], X), \
+				     _mm_mul_ps(M[4 + R], Y)), \
+			  _mm_add_ps(_mm_mul_ps(M[8 + R], Z), M[12 + R]))
+	__m128 cx = ROW(0);
+	__m128 cy = ROW(1);
+	__m128 cz = ROW(2);
+	__m128 cw = ROW(3);
+#undef ROW
+	__m128 failed = _mm_cmpeq_ps(cw, zero);
+	__m128 inv_w = _mm_div_ps(_mm_set1_ps(1.0f), cw);
+	__m128 Xs = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, inv_w), xs), xo);
+	__m128 Ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cy, inv_w), ys), yo);
+	__m128 Zs = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cz, inv_w), half), half);
+	// Where w is 0, give (0, 0, -1) like the loop below.
+	_mm_storeu_ps(sx + i, _mm_andnot_ps(failed, Xs));
+	_mm_storeu_ps(sy + i, _mm_andnot_ps(failed, Ys));
+	Zs = _mm_or_ps(_mm_and_ps(failed, minus_one), _mm_andnot_ps(failed, Zs));
+	_mm_storeu_ps(sz + i, Zs);
+    }
+#endif
+    for ( ; i < n; ++i) {
+	float cx = m[0] * x[i] + m[4] * y[i] + m[8] * z[i] + m[12];
+	float cy = m[1] * x[i] + m[5] * y[i] + m[9] * z[i] + m[13];
+	float cz = m[2] * x[i] + m[6] * y[i] + m[10] * z[i] + m[14];
+	float cw = m[3] * x[i] + m[7] * y[i] + m[11] * z[i] + m[15];
+	if (cw == 0.0f) {
+	    sx[i] = sy[i] = 0.0f;
+	    sz[i] = -1.0f;
+	    continue;
+	}
+	float inv_w = 1.0f / cw;
+	sx[i] = cx * inv_w * x_scale + x_offset;
+	sy[i] = cy * inv_w * y_scale + y_offset;
+	sz[i] = cz * inv_w * 0.5f + 0.5f;
+    }
+}
+
+bool GLACanvas::BoxInView(const float min[3], const float max[3]) const
+{
+    // Transform the corners to clip coordinates - the box is outside the
+    // view volume if all the corners are outside the same clipping plane.
+    const GLdouble * m = mvp_matrix;
+    unsigned all_outside = 0x3f;
+    for (int i = 0; i < 8; ++i) {
+	double x = (i & 1) ? max[0] : min[0];
+	double y = (i & 2) ? max[1] : min[1];
+	double z = (i & 4) ? max[2] : min[2];
+	double cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+	double cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+	double cz = m[2] * x + m[6] * y + m[10] * z + m[14];
+	double cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+	unsigned outside = 0;
+	if (cx < -cw) outside |= 0x01;
+	if (cx > cw) outside |= 0x02;
+	if (cy < -cw) outside |= 0x04;
+	if (cy > cw) outside |= 0x08;
+	if (cz < -cw) outside |= 0x10;
+	if (cz > cw) outside |= 0x20;
+	all_outside &= outside;
+	if (!all_outside) return true;
+    }
+    return false;
+}
+
 void GLACanvas::ReverseTransform(Double x, Double y,
 				 double* x_out, double* y_out, double* z_out) const
 {
@@ -1605,6 +2507,21 @@ Double GLACanvas::SurveyUnitsAcrossViewport() const
     return result;
 }
 
+double GLACanvas::GetPixelSizeAt(const Vector3& p, double radius) const
+{
+    if (!m_Perspective) {
+	return SurveyUnitsAcrossViewport() / max(x_size, y_size);
+    }
+
+    // In perspective view, the size of a pixel is proportional to the
+    // distance in front of the viewer.
+    const GLdouble* m = modelview_matrix;
+    double depth = -(m[2] * p.GetX() + m[6] * p.GetY() + m[10] * p.GetZ() +
+		     m[14]) - radius;
+    if (depth <= 0.0) return 0.0;
+    return depth * 2.0 * tan(rad(25.0)) / x_size;
+}
+
 void GLACanvas::ToggleSmoothShading()
 {
     m_SmoothShading = !m_SmoothShading;
@@ -1672,14 +2589,16 @@ bool GLACanvas::SaveScreenshot(const wxString & fnm, wxBitmapType type) const
 bool GLACanvas::CheckVisualFidelity(const unsigned char * target) const
 {
     unsigned char pixels[3 * 8 * 8];
-    if (double_buffered) {
+    // When drawing offscreen there's only one colour buffer to read from.
+    bool swap_read_buffer = (double_buffered && !offscreen_framebuffer);
+    if (swap_read_buffer) {
 	glReadBuffer(GL_BACK);
 	CHECK_GL_ERROR("FirstShow", "glReadBuffer");
     }
     glReadPixels(x_size / 2 - 4, y_size / 2 - 5, 8, 8,
 		 GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)pixels);
     CHECK_GL_ERROR("CheckVisualFidelity", "glReadPixels");
-    if (double_buffered) {
+    if (swap_read_buffer) {
 	glReadBuffer(GL_FRONT);
 	CHECK_GL_ERROR("FirstShow", "glReadBuffer");
     }
@@ -1707,6 +2626,107 @@ void GLACanvas::ReadPixels(int width, int height, unsigned char * buf) const
     glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)buf);
 }
 
+bool GLACanvas::StartReadPixels(int width, int height)
+{
+    if (!glaMapBuffer) return false;
+    if (PendingReadPixels() == MaxPendingReadPixels()) return false;
+
+    if (!pixel_buffers[0]) {
+	glaGenBuffers(MaxPendingReadPixels(), pixel_buffers);
+	CHECK_GL_ERROR("StartReadPixels", "glGenBuffers");
+    }
+    unsigned i = pixel_reads_started % MaxPendingReadPixels();
+    size_t size = size_t(width) * height * 3;
+    glaBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+    CHECK_GL_ERROR("StartReadPixels", "glBindBuffer");
+    if (pixel_buffer_sizes[i] != size) {
+	glaBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	CHECK_GL_ERROR("StartReadPixels", "glBufferData");
+	pixel_buffer_sizes[i] = size;
+    }
+    // With a buffer bound, glReadPixels() returns once the read is queued
+    // and the last argument is an offset into the buffer.
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    CHECK_GL_ERROR("StartReadPixels", "glReadPixels");
+    glaBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ++pixel_reads_started;
+    return true;
+}
+
+void GLACanvas::FinishReadPixels(unsigned char * buf)
+{
+    assert(PendingReadPixels());
+    unsigned i = pixel_reads_finished++ % MaxPendingReadPixels();
+    glaBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+    CHECK_GL_ERROR("FinishReadPixels", "glBindBuffer");
+    // This waits for the read to complete if it hasn't already.
+    const void * p = glaMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    CHECK_GL_ERROR("FinishReadPixels", "glMapBuffer");
+    if (p) {
+	memcpy(buf, p, pixel_buffer_sizes[i]);
+	glaUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	CHECK_GL_ERROR("FinishReadPixels", "glUnmapBuffer");
+    }
+    glaBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool GLACanvas::SetOffscreen(int width, int height)
+{
+    assert(opengl_initialised);
+    if (!init_framebuffer_objects()) return false;
+
+    MakeCurrent();
+    if (!offscreen_framebuffer) {
+	glaGenFramebuffers(1, &offscreen_framebuffer);
+	CHECK_GL_ERROR("SetOffscreen", "glGenFramebuffers");
+	glaGenRenderbuffers(2, offscreen_renderbuffers);
+	CHECK_GL_ERROR("SetOffscreen", "glGenRenderbuffers");
+    }
+
+    glaBindRenderbuffer(GL_RENDERBUFFER, offscreen_renderbuffers[0]);
+    CHECK_GL_ERROR("SetOffscreen", "glBindRenderbuffer");
+    glaRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    CHECK_GL_ERROR("SetOffscreen", "glRenderbufferStorage GL_RGBA8");
+    glaBindRenderbuffer(GL_RENDERBUFFER, offscreen_renderbuffers[1]);
+    CHECK_GL_ERROR("SetOffscreen", "glBindRenderbuffer (2)");
+    glaRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    CHECK_GL_ERROR("SetOffscreen", "glRenderbufferStorage GL_DEPTH_COMPONENT24");
+    glaBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // The framebuffer stays bound, so everything subsequently drawn (and
+    // read back) uses it rather than the window.
+    glaBindFramebuffer(GL_FRAMEBUFFER, offscreen_framebuffer);
+    CHECK_GL_ERROR("SetOffscreen", "glBindFramebuffer");
+    glaFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_RENDERBUFFER, offscreen_renderbuffers[0]);
+    CHECK_GL_ERROR("SetOffscreen", "glFramebufferRenderbuffer GL_COLOR_ATTACHMENT0");
+    glaFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			       GL_RENDERBUFFER, offscreen_renderbuffers[1]);
+    CHECK_GL_ERROR("SetOffscreen", "glFramebufferRenderbuffer GL_DEPTH_ATTACHMENT");
+    if (glaCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+	glaBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glaDeleteFramebuffers(1, &offscreen_framebuffer);
+	glaDeleteRenderbuffers(2, offscreen_renderbuffers);
+	offscreen_framebuffer = 0;
+	return false;
+    }
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    CHECK_GL_ERROR("SetOffscreen", "glDrawBuffer");
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    CHECK_GL_ERROR("SetOffscreen", "glReadBuffer");
+
+    if (width != x_size || height != y_size) {
+	for (auto&& l : drawing_lists) {
+	    l.invalidate_if(INVALIDATE_ON_X_RESIZE | INVALIDATE_ON_Y_RESIZE);
+	}
+	x_size = width;
+	y_size = height;
+    }
+    glViewport(0, 0, x_size, y_size);
+    CHECK_GL_ERROR("SetOffscreen", "glViewport");
+    return true;
+}
+
 void GLACanvas::PolygonOffset(bool on) const
 {
     if (on) {
@@ -25,6 +25,7 @@
 #define gla_h
 
 #include <string>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -99,6 +100,109 @@ class GLAList {
     }
 };
 
+/// A vertex with the data needed to colour it in each supported way.
+struct GLAVertex {
+    enum { MAX_VALUES = 8, MAX_COLOURS = 3 };
+
+    GLfloat x, y, z;
+    // Values which select a colour from the palette - 0 gives the first
+    // entry and 1 the last, while a negative value means "no data".
+    GLfloat value[MAX_VALUES];
+    // Alternative fixed colours, as RGBA.
+    GLubyte colour[MAX_COLOURS][4];
+    // Position on the passage wall texture (only used for triangles).
+    GLfloat tex_x, tex_y;
+
+    void SetPosition(const Vector3 & v) {
+	x = v.GetX();
+	y = v.GetY();
+	z = v.GetZ();
+    }
+    void SetColour(int i, const GLAPen& pen, double rgb_scale, double alpha);
+    void SetColour(int i, gla_colour colour, double rgb_scale, double alpha);
+};
+
+/// Geometry which is uploaded to OpenGL once and can then be drawn coloured
+/// in any of the ways its vertices support without being regenerated.
+class GLAVertexBuffer {
+    friend class GLACanvas;
+
+    // OpenGL buffer object, or 0 if we're drawing from vertices.
+    GLuint buffer;
+    size_t n_vertices;
+    bool valid;
+    // Offsets at which runs of vertices start, and whether each run should
+    // be drawn with dashed lines.
+    vector<size_t> run_starts;
+    vector<bool> run_dashed;
+    // Offsets at which each level of detail after the first starts.
+    vector<size_t> level_starts;
+
+  public:
+    // BLOBS and CROSSES are points, each drawn as a marker of a fixed size
+    // on screen.
+    enum { LINES, TRIANGLES, BLOBS, CROSSES };
+
+    // Type of primitive which the vertices make up.
+    int primitive;
+
+    vector<GLAVertex> vertices;
+
+    GLAVertexBuffer()
+	: buffer(0), n_vertices(0), valid(false), primitive(LINES) { }
+
+    /// Draw subsequently added vertices with dashed lines or not.
+    void SetDashed(bool dashed) {
+	if (!run_dashed.empty() && run_dashed.back() == dashed) return;
+	run_starts.push_back(vertices.size());
+	run_dashed.push_back(dashed);
+    }
+
+    /// Add subsequent vertices to the next (coarser) level of detail.
+    void StartLevel() { level_starts.push_back(vertices.size()); }
+
+    void invalidate() { valid = false; }
+};
+
+/// A set of points to project to screen coordinates in bulk.
+///
+/// The coordinates are packed into separate arrays so several points can be
+/// projected at once, and the results are kept until the view changes.
+class GLAProjectedPoints {
+    friend class GLACanvas;
+
+    // Data coordinates.
+    vector<float> x, y, z;
+    // Screen coordinates from the last projection (z is -1 if the projection
+    // failed).
+    vector<float> sx, sy, sz;
+    // The GLACanvas transform serial the screen coordinates are for.
+    unsigned long serial;
+
+  public:
+    GLAProjectedPoints() : serial(0) { }
+
+    size_t size() const { return x.size(); }
+
+    void clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+	serial = 0;
+    }
+
+    void push_back(const Vector3 & v) {
+	x.push_back(v.GetX());
+	y.push_back(v.GetY());
+	z.push_back(v.GetZ());
+	serial = 0;
+    }
+
+    float GetX(size_t i) const { return sx[i]; }
+    float GetY(size_t i) const { return sy[i]; }
+    float GetZ(size_t i) const { return sz[i]; }
+};
+
 class GLACanvas : public wxGLCanvas {
     friend class GLAList; // For flag values.
 
@@ -111,6 +215,10 @@ class GLACanvas : public wxGLCanvas {
     GLdouble modelview_matrix[16];
     GLdouble projection_matrix[16];
     GLint viewport[4];
+    // The projection matrix multiplied by the modelview matrix.
+    GLdouble mvp_matrix[16];
+    // Incremented each time the above change.
+    unsigned long transform_serial;
 
     // Viewing volume diameter:
     glaCoord m_VolumeDiameter;
@@ -127,6 +235,18 @@ class GLACanvas : public wxGLCanvas {
     GLuint m_Texture;
     GLuint m_BlobTexture;
     GLuint m_CrossTexture;
+    GLuint m_PaletteTexture;
+    int palette_size;
+    int palette_texture_width;
+
+    // GLSL program used to colour vertex buffers, or 0 if we have to make do
+    // with the fixed-function pipeline.
+    GLuint m_ColourProgram;
+    enum {
+	U_PALETTE, U_WALL, U_USE_PALETTE, U_USE_WALL, U_USE_FOG,
+	U_PALETTE_OFFSET, U_PALETTE_SCALE, U_NODATA, U_COUNT
+    };
+    GLint colour_uniforms[U_COUNT];
 
     Double alpha;
 
@@ -145,6 +265,28 @@ class GLACanvas : public wxGLCanvas {
 
     vector<GLAList> drawing_lists;
 
+    // Indexed by list number, like drawing_lists.
+    vector<GLAVertexBuffer> vertex_buffers;
+
+    // Ring of pixel buffer objects for reading back frames asynchronously.
+    GLuint pixel_buffers[3] = { 0, 0, 0 };
+    size_t pixel_buffer_sizes[3] = { 0, 0, 0 };
+    unsigned long pixel_reads_started = 0, pixel_reads_finished = 0;
+
+    // Framebuffer object and its colour and depth renderbuffers, used when
+    // drawing offscreen.
+    GLuint offscreen_framebuffer = 0;
+    GLuint offscreen_renderbuffers[2] = { 0, 0 };
+
+    // True if we're using a context which isn't tied to the window, so we
+    // can only draw offscreen.
+    bool headless = false;
+#ifdef HAVE_EGL
+    // The EGL display and context used when headless.
+    void * egl_display = NULL;
+    void * egl_context = NULL;
+#endif
+
     enum {
 	INVALIDATE_ON_SCALE = 1,
 	INVALIDATE_ON_X_RESIZE = 2,
@@ -156,14 +298,28 @@ class GLACanvas : public wxGLCanvas {
 
     wxString vendor, renderer;
 
+    void UploadVertexBuffer(GLAVertexBuffer& buffer);
+
     bool CheckVisualFidelity(const unsigned char * target) const;
 
+    // Make our OpenGL context the current one.
+    void MakeCurrent();
+
 public:
     GLACanvas(wxWindow* parent, int id);
     ~GLACanvas();
 
     static bool check_visual();
 
+    /** Use an OpenGL context which doesn't need the window to be shown.
+     *
+     *  This must be called before FirstShow(), and SetOffscreen() must then
+     *  be used before drawing.  Returns false if this isn't supported, in
+     *  which case the window needs to have been realised before FirstShow()
+     *  is called.
+     */
+    bool UseHeadlessContext();
+
     void FirstShow();
 
     void Clear();
@@ -175,17 +331,63 @@ public:
     void SetIndicatorTransform();
 
     void DrawList(unsigned int l);
-    void DrawListZPrepass(unsigned int l);
     void DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotation);
     void InvalidateList(unsigned int l) {
 	if (l < drawing_lists.size()) {
 	    // Invalidate any existing cached list.
 	    drawing_lists[l].invalidate_if(CACHED);
 	}
+	if (l < vertex_buffers.size()) {
+	    vertex_buffers[l].invalidate();
+	}
     }
 
     virtual void GenerateList(unsigned int l) = 0;
 
+    /** Draw the vertex buffer for list l, generating it if necessary.
+     *
+     *  @param value	Index into GLAVertex::value to colour using the
+     *			palette, or -1 to just use the fixed colour.
+     *  @param colour	Index into GLAVertex::colour.  If value is not -1,
+     *			this colour is modulated by the palette colour.
+     *  @param level	Level of detail to draw (0 for full detail).  If the
+     *			buffer has fewer levels, the coarsest is drawn.
+     */
+    void DrawVertexBuffer(unsigned int l, int value, int colour,
+			  unsigned level = 0);
+
+    /// Draw ranges [first, second) of the vertex buffer for list l.
+    void DrawVertexBuffer(unsigned int l, int value, int colour,
+			  const vector<pair<size_t, size_t>>& ranges);
+
+    /// Generate the vertex buffer for list l if necessary.
+    void PrepareVertexBuffer(unsigned int l);
+
+    /** Draw a vertex buffer with a "Z-prepass".
+     *
+     *  This draws it once only updating the Z-buffer, then again only where
+     *  the depth matches, so nothing in it can be seen through itself.
+     */
+    void DrawVertexBufferZPrepass(unsigned int l, int value, int colour,
+				  const vector<pair<size_t, size_t>>& ranges);
+
+    virtual void GenerateVertexBuffer(unsigned int l,
+				      GLAVertexBuffer& buffer) = 0;
+
+    /** Can we draw vertex buffers of markers of this type?
+     *
+     *  If not, the markers need drawing with BeginBlobs() and DrawBlob() or
+     *  BeginCrosses() and DrawCross() instead.
+     */
+    bool CanDrawMarkerBuffer(int primitive) const {
+	if (primitive == GLAVertexBuffer::BLOBS)
+	    return blob_method == SPRITE || blob_method == POINT;
+	return cross_method == SPRITE;
+    }
+
+    /// Set the palette used by DrawVertexBuffer().
+    void SetPalette(const GLAPen* pens, int n, gla_colour nodata);
+
     void SetColour(const GLAPen& pen, double rgb_scale);
     void SetColour(const GLAPen& pen);
     void SetColour(gla_colour colour, double rgb_scale);
@@ -265,6 +467,13 @@ public:
     void AddTranslationScreenCoordinates(int dx, int dy);
 
     bool Transform(const Vector3 & v, double* x_out, double* y_out, double* z_out) const;
+    /// Like Transform() for every point in points, unless they've already
+    /// been projected with the current transform.
+    void Transform(GLAProjectedPoints & points) const;
+    /// Changes whenever the transform used by Transform() does.
+    unsigned long GetTransformSerial() const { return transform_serial; }
+    /// Return false if the box is definitely outside the view volume.
+    bool BoxInView(const float min[3], const float max[3]) const;
     void ReverseTransform(Double x, Double y, double* x_out, double* y_out, double* z_out) const;
 
     int GetFontSize() const { return m_Font.get_font_size(); }
@@ -273,6 +482,10 @@ public:
     bool GetSmoothShading() const { return m_SmoothShading; }
 
     Double SurveyUnitsAcrossViewport() const;
+    /** Size of a pixel in survey units at the point within radius of p
+     *  nearest to the viewer (or 0 if that is behind the viewer).
+     */
+    double GetPixelSizeAt(const Vector3& p, double radius) const;
 
     void ToggleTextured();
     bool GetTextured() const { return m_Textured; }
@@ -290,6 +503,42 @@ public:
 
     void ReadPixels(int width, int height, unsigned char * buf) const;
 
+    /// How many reads StartReadPixels() can have pending.
+    unsigned MaxPendingReadPixels() const {
+	return sizeof(pixel_buffers) / sizeof(pixel_buffers[0]);
+    }
+
+    /** Start reading back the pixels drawn, without waiting for the read to
+     *  complete.
+     *
+     *  Returns false if this isn't supported (ReadPixels() can be used
+     *  instead), or if MaxPendingReadPixels() reads are already pending.
+     */
+    bool StartReadPixels(int width, int height);
+
+    /// Number of reads started by StartReadPixels() and not yet finished.
+    unsigned PendingReadPixels() const {
+	return pixel_reads_started - pixel_reads_finished;
+    }
+
+    /// Fetch the pixels from the oldest pending read.
+    void FinishReadPixels(unsigned char * buf);
+
+    /// Discard any pending reads.
+    void CancelReadPixels() { pixel_reads_finished = pixel_reads_started; }
+
+    /** Draw into an offscreen framebuffer of the given size instead of the
+     *  window.
+     *
+     *  This allows rendering at a size which doesn't depend on the window
+     *  (or the display).  FirstShow() must have been called first.  Returns
+     *  false if framebuffer objects aren't supported or the size is too
+     *  large.
+     */
+    bool SetOffscreen(int width, int height);
+
+    bool IsOffscreen() const { return offscreen_framebuffer != 0; }
+
     void PolygonOffset(bool on) const;
 
     int GetXSize() const { list_flags |= INVALIDATE_ON_X_RESIZE; return x_size; }
@@ -0,0 +1,242 @@
+/* gltf.cc
+ * Export passage tubes as binary glTF.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "gltf.h"
+#include "json.h"
+
+#include "export.h" // For PASG, etc
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "useful.h"
+
+using namespace std;
+
+// The binary glTF container format is described in the "GLB File Format
+// Specification" section of the glTF 2.0 specification.
+#define GLB_MAGIC 0x46546c67 // "glTF"
+#define GLB_VERSION 2
+#define GLB_CHUNK_JSON 0x4e4f534a // "JSON"
+#define GLB_CHUNK_BIN 0x004e4942 // "BIN\0"
+
+// Values from the OpenGL headers used by glTF to identify types.
+#define GLTF_ARRAY_BUFFER 34962
+#define GLTF_ELEMENT_ARRAY_BUFFER 34963
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+#define GLTF_TRIANGLES 4
+
+template<typename T>
+static void
+write_le32_array(const vector<T>& v, FILE *fh)
+{
+    static_assert(sizeof(T) == 4, "Array elements are 32 bit");
+#ifndef WORDS_BIGENDIAN
+    fwrite(v.data(), sizeof(T), v.size(), fh);
+#else
+    for (const T& e : v) {
+	int32_t w;
+	memcpy(&w, &e, sizeof(w));
+	put32(w, fh);
+    }
+#endif
+}
+
+GLTF::GLTF(const Vector3& offset_) : offset(offset_)
+{
+    for (int i = 0; i < 3; ++i) {
+	min[i] = FLT_MAX;
+	max[i] = -FLT_MAX;
+    }
+}
+
+const int *
+GLTF::passes() const
+{
+    static const int default_passes[] = { PASG, 0 };
+    return default_passes;
+}
+
+void
+GLTF::header(const char * title_, const char *, time_t,
+	     double, double, double, double, double, double)
+{
+    if (title_) title = title_;
+}
+
+void
+GLTF::add_quad(const Vector3 &a, const Vector3 &b,
+	       const Vector3 &c, const Vector3 &d)
+{
+    // Same normal as aven uses to light the passage.
+    Vector3 normal = (a - c) * (d - b);
+    normal.normalise();
+    uint32_t base = vertices.size() / 6;
+    for (const Vector3* p : { &a, &b, &c, &d }) {
+	// glTF is Y-up, so Survex's (east, north, up) maps to (x, z, -y).
+	float xyz[3] = {
+	    float(p->GetX()), float(p->GetZ()), float(-p->GetY())
+	};
+	for (int i = 0; i < 3; ++i) {
+	    vertices.push_back(xyz[i]);
+	    if (xyz[i] < min[i]) min[i] = xyz[i];
+	    if (xyz[i] > max[i]) max[i] = xyz[i];
+	}
+	vertices.push_back(float(normal.GetX()));
+	vertices.push_back(float(normal.GetZ()));
+	vertices.push_back(float(-normal.GetY()));
+    }
+    // a, b, c, d run clockwise viewed from outside the tube, but glTF wants
+    // front faces anticlockwise.
+    static const uint32_t order[6] = { 0, 2, 1, 0, 3, 2 };
+    for (uint32_t i : order) {
+	indices.push_back(base + i);
+    }
+}
+
+void
+GLTF::passage_tube(const vector<XSect>& run)
+{
+    if (run.size() < 2) return;
+    tube = &run;
+    skin_tube(run, *this);
+    tube = NULL;
+}
+
+void
+GLTF::corners(size_t i, const Vector3&, const Vector3 v[4], const Vector3 U[4])
+{
+    if (i > 0) {
+	add_quad(v[0], v[1], U[1], U[0]);
+	add_quad(v[2], v[3], U[3], U[2]);
+	add_quad(v[1], v[2], U[2], U[1]);
+	add_quad(v[3], v[0], U[0], U[3]);
+    }
+
+    // Cover the ends of the tube.
+    if (i == 0) {
+	add_quad(v[0], v[1], v[2], v[3]);
+    } else if (i + 1 == tube->size()) {
+	add_quad(v[3], v[2], v[1], v[0]);
+    }
+}
+
+void
+GLTF::footer()
+{
+    size_t n_vertices = vertices.size() / 6;
+    uint32_t indices_len = indices.size() * sizeof(uint32_t);
+    uint32_t vertices_len = vertices.size() * sizeof(float);
+
+    string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\""
+		  PACKAGE_STRING "\"},";
+    json += "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],";
+    json += "\"nodes\":[{";
+    if (!title.empty()) {
+	json += "\"name\":\"";
+	json_escape(json, title.c_str());
+	json += "\",";
+    }
+    // Vertex positions are relative to the offset, which is recorded here (in
+    // Survex's axes) so that real world coordinates can be recovered.
+    char buf[256];
+    snprintf(buf, sizeof(buf), "\"extras\":{\"offset\":[%.3f,%.3f,%.3f]}",
+	     offset.GetX(), offset.GetY(), offset.GetZ());
+    json += buf;
+    if (n_vertices == 0) {
+	// A mesh needs at least one vertex, so just write an empty node.
+	json += "}]}";
+    } else {
+	json += ",\"mesh\":0}],";
+	json += "\"meshes\":[{\"name\":\"passages\",\"primitives\":[{"
+		"\"attributes\":{\"POSITION\":1,\"NORMAL\":2},"
+		"\"indices\":0,\"material\":0,\"mode\":" STRING(GLTF_TRIANGLES)
+		"}]}],";
+	// Viewers are likely to be used to fly around inside the cave, so
+	// make the passage walls visible from both sides.
+	json += "\"materials\":[{\"name\":\"passage\","
+		"\"pbrMetallicRoughness\":{\"baseColorFactor\":[0.8,0.8,0.8,1],"
+		"\"metallicFactor\":0,\"roughnessFactor\":1},"
+		"\"doubleSided\":true}],";
+	snprintf(buf, sizeof(buf), "\"buffers\":[{\"byteLength\":%lu}],",
+		 (unsigned long)indices_len + vertices_len);
+	json += buf;
+	snprintf(buf, sizeof(buf),
+		 "\"bufferViews\":["
+		 "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%lu,"
+		 "\"target\":" STRING(GLTF_ELEMENT_ARRAY_BUFFER) "},",
+		 (unsigned long)indices_len);
+	json += buf;
+	snprintf(buf, sizeof(buf),
+		 "{\"buffer\":0,\"byteOffset\":%lu,\"byteLength\":%lu,"
+		 "\"byteStride\":24,\"target\":" STRING(GLTF_ARRAY_BUFFER) "}],",
+		 (unsigned long)indices_len, (unsigned long)vertices_len);
+	json += buf;
+	snprintf(buf, sizeof(buf),
+		 "\"accessors\":["
+		 "{\"bufferView\":0,\"componentType\":" STRING(GLTF_UNSIGNED_INT)
+		 ",\"count\":%lu,\"type\":\"SCALAR\"},",
+		 (unsigned long)indices.size());
+	json += buf;
+	snprintf(buf, sizeof(buf),
+		 "{\"bufferView\":1,\"byteOffset\":0,"
+		 "\"componentType\":" STRING(GLTF_FLOAT) ",\"count\":%lu,"
+		 "\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],"
+		 "\"max\":[%.9g,%.9g,%.9g]},",
+		 (unsigned long)n_vertices,
+		 min[0], min[1], min[2], max[0], max[1], max[2]);
+	json += buf;
+	snprintf(buf, sizeof(buf),
+		 "{\"bufferView\":1,\"byteOffset\":12,"
+		 "\"componentType\":" STRING(GLTF_FLOAT) ",\"count\":%lu,"
+		 "\"type\":\"VEC3\"}]}",
+		 (unsigned long)n_vertices);
+	json += buf;
+    }
+
+    // Chunks must be padded to a multiple of 4 bytes - the JSON chunk with
+    // spaces and the binary chunk with zeros (though the binary data is all
+    // 32-bit values so never actually needs padding).
+    json.append((4 - json.size() % 4) % 4, ' ');
+
+    uint32_t total = 12 + 8 + json.size();
+    if (n_vertices) total += 8 + indices_len + vertices_len;
+
+    put32(GLB_MAGIC, fh);
+    put32(GLB_VERSION, fh);
+    put32(total, fh);
+
+    put32(json.size(), fh);
+    put32(GLB_CHUNK_JSON, fh);
+    fwrite(json.data(), json.size(), 1, fh);
+
+    if (n_vertices) {
+	put32(indices_len + vertices_len, fh);
+	put32(GLB_CHUNK_BIN, fh);
+	write_le32_array(indices, fh);
+	write_le32_array(vertices, fh);
+    }
+}
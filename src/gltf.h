@@ -0,0 +1,58 @@
+/* gltf.h
+ * Export passage tubes as binary glTF.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "exportfilter.h"
+
+#include "model.h"
+#include "vector3.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class GLTF : public ExportFilter, public TubeSkinner {
+    // Survex coordinates of the origin of the mesh.
+    Vector3 offset;
+    std::string title;
+    // Interleaved vertex data - position then normal for each vertex.
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    float min[3], max[3];
+    // The tube currently being skinned.
+    const std::vector<XSect>* tube = NULL;
+
+    void add_quad(const Vector3 &a, const Vector3 &b,
+		  const Vector3 &c, const Vector3 &d);
+  public:
+    explicit GLTF(const Vector3& offset_);
+    const int * passes() const;
+    void header(const char *, const char *, time_t,
+		double, double, double,
+		double, double, double);
+    void label(const img_point *, const char *, bool, int) { }
+    /** Add the skin of a run of cross-sections, given in model coordinates.
+     *
+     *  Runs with fewer than two cross-sections are ignored.
+     */
+    void passage_tube(const std::vector<XSect>& run);
+    void corners(size_t i, const Vector3& right,
+		 const Vector3 v[4], const Vector3 U[4]);
+    void footer();
+};
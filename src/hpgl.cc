@@ -40,12 +40,6 @@
 
 # define HPGL_CROSS_SIZE 28 /* length of cross arms (in HPGL units) */
 
-static long xpPageWidth, ypPageDepth;
-
-static long x_org = 0, y_org = 0;
-static bool fNewLines = fTrue;
-static bool fOriginInCentre = fFalse;
-
 /* Check if this line intersects the current page */
 /* Initialise HPGL routines. */
 void HPGL::header(const char *, const char *, time_t,
@@ -22,6 +22,10 @@
 #include "exportfilter.h"
 
 class HPGL : public ExportFilter {
+    long xpPageWidth = 0, ypPageDepth = 0;
+    long x_org = 0, y_org = 0;
+    bool fNewLines = true;
+    bool fOriginInCentre = false;
   public:
     HPGL() {}
     void header(const char *, const char *, time_t,
@@ -30,6 +30,28 @@
 
 using namespace std;
 
+void
+json_escape(string& out, const char *s)
+{
+    while (*s) {
+	unsigned char ch = *s++;
+	switch (ch) {
+	    case '"': case '\\':
+		out += '\\';
+		out += char(ch);
+		break;
+	    default:
+		if (ch < 0x20) {
+		    char buf[8];
+		    sprintf(buf, "\\u%04x", ch);
+		    out += buf;
+		} else {
+		    out += char(ch);
+		}
+	}
+    }
+}
+
 const int *
 JSON::passes() const
 {
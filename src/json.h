@@ -21,6 +21,11 @@
 
 #include "exportfilter.h"
 
+#include <string>
+
+/// Append s to out, escaped for use in a JSON string.
+void json_escape(std::string& out, const char *s);
+
 class JSON : public ExportFilter {
     bool in_segment;
   public:
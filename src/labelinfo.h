@@ -68,6 +68,12 @@ class LabelInfo : public Point {
 
 public:
     wxTreeItemId tree_id;
+    // Position of this label in the order labels are plotted in.
+    unsigned plot_order = 0;
+    // Id of the survey this station is in (see SurveyTree), or of the survey
+    // with the same name as the station if there is one (to match how
+    // SurveyFilter treats names).
+    unsigned survey = 0;
 
     LabelInfo() : Point(), text(), flags(0) { }
     LabelInfo(const img_point &pt, const wxString &text_, int flags_)
@@ -0,0 +1,100 @@
+/* labelplacer.cc
+ * Choose station labels to draw which don't overlap.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "labelplacer.h"
+
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+void
+LabelPlacer::reset(size_t n_labels, unsigned above_, unsigned below_)
+{
+    grid.clear();
+    u0 = v0 = 0;
+    w = h = 0;
+    above = above_;
+    below = below_;
+    state.assign(n_labels, UNDECIDED);
+}
+
+void
+LabelPlacer::cover(int u_min, int v_min, int u_max, int v_max)
+{
+    if (w && u_min >= u0 && u_max <= u0 + int(w) &&
+	v_min >= v0 && v_max <= v0 + int(h)) {
+	return;
+    }
+
+    // Grow by at least half as much again in each direction we need to, so
+    // panning steadily doesn't reallocate on every frame.
+    int new_u0 = u_min, new_u1 = u_max;
+    int new_v0 = v_min, new_v1 = v_max;
+    if (w) {
+	int slack_u = int(w / 2), slack_v = int(h / 2);
+	new_u0 = u_min < u0 ? min(u_min, u0 - slack_u) : u0;
+	new_u1 = u_max > u0 + int(w) ? max(u_max, u0 + int(w) + slack_u)
+				     : u0 + int(w);
+	new_v0 = v_min < v0 ? min(v_min, v0 - slack_v) : v0;
+	new_v1 = v_max > v0 + int(h) ? max(v_max, v0 + int(h) + slack_v)
+				     : v0 + int(h);
+    }
+    unsigned new_w = unsigned(new_u1 - new_u0);
+    unsigned new_h = unsigned(new_v1 - new_v0);
+    vector<char> new_grid(size_t(new_w) * new_h);
+    for (unsigned row = 0; row != h; ++row) {
+	memcpy(&new_grid[size_t(row + v0 - new_v0) * new_w + (u0 - new_u0)],
+	       &grid[size_t(row) * w], w);
+    }
+    grid.swap(new_grid);
+    u0 = new_u0;
+    v0 = new_v0;
+    w = new_w;
+    h = new_h;
+}
+
+bool
+LabelPlacer::place(size_t label, int u, int v, unsigned width)
+{
+    if (width == 0) {
+	state[label] = PLACED;
+	return true;
+    }
+
+    cover(u, v - int(above), u + int(width), v + int(below));
+    char* p = &grid[size_t(v - v0) * w + (u - u0)];
+    if (memchr(p, 1, width)) {
+	state[label] = REJECTED;
+	return false;
+    }
+
+    p -= size_t(above) * w;
+    for (unsigned i = 0; i != above + below; ++i) {
+	memset(p, 1, width);
+	p += w;
+    }
+    state[label] = PLACED;
+    return true;
+}
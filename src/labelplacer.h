@@ -0,0 +1,81 @@
+/* labelplacer.h
+ * Choose station labels to draw which don't overlap.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef labelplacer_h
+#define labelplacer_h
+
+#include <cstddef>
+#include <vector>
+
+/** Greedy placement of labels on a grid of cells.
+ *
+ *  Labels are offered in priority order, and each is placed if the cells it
+ *  needs are free.  Cell coordinates are relative to a fixed point in the
+ *  view rather than to the window, and the decision for each label is
+ *  remembered, so while the view is only panned the placement can be kept
+ *  and only labels which haven't been offered before need to be tested.
+ */
+class LabelPlacer {
+    // Occupied cells, covering columns [u0, u0 + w) and rows [v0, v0 + h).
+    std::vector<char> grid;
+    int u0 = 0, v0 = 0;
+    unsigned w = 0, h = 0;
+
+    // Rows a label occupies above and below the row it's placed on.
+    unsigned above = 0, below = 0;
+
+    // Decision for each label.
+    std::vector<unsigned char> state;
+
+
+  public:
+    enum { UNDECIDED, PLACED, REJECTED };
+
+    /** Forget all placements.
+     *
+     *  @param n_labels	Labels are numbered from 0 to n_labels - 1.
+     *  @param above_	Number of rows a label occupies above its row.
+     *  @param below_	Number of rows a label occupies below its row
+     *			(including its own row).
+     */
+    void reset(size_t n_labels, unsigned above_, unsigned below_);
+
+    /** Make sure the grid covers a region.
+     *
+     *  The grid grows as needed anyway, but calling this after reset() for
+     *  the visible region avoids growing it repeatedly.
+     */
+    void cover(int u_min, int v_min, int u_max, int v_max);
+
+    int get_state(size_t label) const { return state[label]; }
+
+    /** Decide whether to place a label.
+     *
+     *  Only call this for a label whose state is UNDECIDED.
+     *
+     *  @return true if the label is placed.
+     */
+    bool place(size_t label, int u, int v, unsigned width);
+
+    /// Number of cells the grid currently covers.
+    size_t cells() const { return grid.size(); }
+};
+
+#endif
@@ -44,11 +44,11 @@
 #include <wx/image.h>
 #include <wx/imaglist.h>
 #include <wx/process.h>
-#include <wx/regex.h>
 #ifdef USING_GENERIC_TOOLBAR
 # include <wx/sysopt.h>
 #endif
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <float.h>
@@ -504,6 +504,9 @@ BEGIN_EVENT_TABLE(MainFrm, wxFrame)
     EVT_MENU(wxID_OPEN, MainFrm::OnOpen)
     EVT_MENU(menu_FILE_OPEN_TERRAIN, MainFrm::OnOpenTerrain)
     EVT_MENU(menu_FILE_LOG, MainFrm::OnShowLog)
+#ifdef CAVERNLOG_WATCH_FILES
+    EVT_MENU(menu_FILE_WATCH, MainFrm::OnWatchDataFiles)
+#endif
     EVT_MENU(wxID_PRINT, MainFrm::OnPrint)
     EVT_MENU(menu_FILE_PAGE_SETUP, MainFrm::OnPageSetup)
     EVT_MENU(menu_FILE_SCREENSHOT, MainFrm::OnScreenshot)
@@ -545,6 +548,10 @@ BEGIN_EVENT_TABLE(MainFrm, wxFrame)
 
     EVT_CLOSE(MainFrm::OnClose)
     EVT_SET_FOCUS(MainFrm::OnSetFocus)
+#if wxUSE_THREADS
+    EVT_THREAD(thread_LOAD_PROGRESS, MainFrm::OnLoadProgress)
+    EVT_THREAD(thread_LOADED, MainFrm::OnLoaded)
+#endif
 
     EVT_MENU(menu_ROTATION_TOGGLE, MainFrm::OnToggleRotation)
     EVT_MENU(menu_ROTATION_REVERSE, MainFrm::OnReverseDirectionOfRotation)
@@ -604,6 +611,9 @@ BEGIN_EVENT_TABLE(MainFrm, wxFrame)
 
     EVT_UPDATE_UI(menu_FILE_OPEN_TERRAIN, MainFrm::OnOpenTerrainUpdate)
     EVT_UPDATE_UI(menu_FILE_LOG, MainFrm::OnShowLogUpdate)
+#ifdef CAVERNLOG_WATCH_FILES
+    EVT_UPDATE_UI(menu_FILE_WATCH, MainFrm::OnWatchDataFilesUpdate)
+#endif
     EVT_UPDATE_UI(wxID_PRINT, MainFrm::OnPrintUpdate)
     EVT_UPDATE_UI(menu_FILE_SCREENSHOT, MainFrm::OnScreenshotUpdate)
     EVT_UPDATE_UI(menu_FILE_EXPORT, MainFrm::OnExportUpdate)
@@ -737,6 +747,9 @@ MainFrm::MainFrm(const wxString& title, const wxPoint& pos, const wxSize& size)
     , m_PrefsDlg(NULL)
 #endif
 {
+    wxConfigBase::Get()->Read(wxT("watch_data_files"), &watch_data_files,
+			      false);
+
 #ifdef _WIN32
     // The peculiar name is so that the icon is the first in the file
     // (required by Microsoft Windows for this type of icon)
@@ -789,6 +802,12 @@ void MainFrm::CreateMenuBar()
      * terrain. */
     filemenu->Append(menu_FILE_OPEN_TERRAIN, wmsg(/*Open &Terrain...*/453));
     filemenu->AppendCheckItem(menu_FILE_LOG, wmsg(/*Show &Log*/144));
+#ifdef CAVERNLOG_WATCH_FILES
+    /* TRANSLATORS: In the "File" menu - when ticked, survey data is
+     * processed again automatically whenever one of the files it was read
+     * from changes. */
+    filemenu->AppendCheckItem(menu_FILE_WATCH, wmsg(/*&Watch Survey Data for Changes*/538));
+#endif
     filemenu->AppendSeparator();
     // wxID_PRINT stock label lacks the ellipses
     filemenu->Append(wxID_PRINT, wmsg(/*&Print...\tCtrl+P*/380));
@@ -1127,6 +1146,119 @@ void MainFrm::CreateSidePanel()
     m_Splitter->Initialize(m_Gfx);
 }
 
+#if wxUSE_THREADS
+class SurveyLoader : public wxThread, public LoadProgress {
+    MainFrm* handler;
+    wxString file, prefix;
+    unsigned long serial;
+    int last_percent = -1;
+
+  protected:
+    virtual ExitCode Entry();
+
+  public:
+    SurveyLoader(MainFrm* handler_, const wxString& file_,
+		 const wxString& prefix_, unsigned long serial_)
+	: wxThread(wxTHREAD_JOINABLE), handler(handler_),
+	  file(file_.Clone()), prefix(prefix_.Clone()), serial(serial_) { }
+
+    bool Progress(int percent) {
+	if (TestDestroy()) return false;
+	if (percent != last_percent) {
+	    last_percent = percent;
+	    wxThreadEvent* e = new wxThreadEvent(wxEVT_THREAD,
+						 thread_LOAD_PROGRESS);
+	    e->SetExtraLong(serial);
+	    e->SetInt(percent);
+	    handler->QueueEvent(e);
+	}
+	return true;
+    }
+};
+
+wxThread::ExitCode
+SurveyLoader::Entry()
+{
+    Model* model = new Model;
+    int result = model->Load(file, prefix, this);
+    if (result == Model::LOAD_CANCELLED) {
+	delete model;
+	return (wxThread::ExitCode)0;
+    }
+    // The model is handed over to the main thread, which deletes it.
+    wxThreadEvent* e = new wxThreadEvent(wxEVT_THREAD, thread_LOADED);
+    e->SetExtraLong(serial);
+    e->SetInt(result);
+    e->SetPayload(model);
+    handler->QueueEvent(e);
+    return (wxThread::ExitCode)0;
+}
+#endif
+
+void MainFrm::CancelLoad()
+{
+    // Any results from the current load will now be ignored.
+    ++load_serial;
+#if wxUSE_THREADS
+    if (loader) {
+	// Ask the thread to stop and wait until it has, so it can't still be
+	// using this frame or running alongside a newer loader once we return.
+	// We block rather than yield so no other events get dispatched here.
+	loader->Delete(NULL, wxTHREAD_WAIT_BLOCK);
+	delete loader;
+	loader = NULL;
+    }
+#endif
+    if (!loading_file.empty()) {
+	loading_file = wxString();
+	GetStatusBar()->SetStatusText(wxString());
+    }
+}
+
+void MainFrm::OnLoadProgress(wxThreadEvent& event)
+{
+    if ((unsigned long)event.GetExtraLong() != load_serial) return;
+    wxString text = wmsg(/*Reading in data - please wait…*/105);
+    text += wxString::Format(wxT(" %d%%"), event.GetInt());
+    GetStatusBar()->SetStatusText(text);
+}
+
+void MainFrm::OnLoaded(wxThreadEvent& event)
+{
+    Model* model = event.GetPayload<Model*>();
+    if ((unsigned long)event.GetExtraLong() != load_serial) {
+	// Superseded by a later load.
+	delete model;
+	return;
+    }
+
+#if wxUSE_THREADS
+    // This event is the last thing the thread does, so reaping it won't
+    // block for long.
+    if (loader) {
+	loader->Wait(wxTHREAD_WAIT_BLOCK);
+	delete loader;
+	loader = NULL;
+    }
+#endif
+
+    wxString file = loading_file;
+    loading_file = wxString();
+    GetStatusBar()->SetStatusText(wxString());
+
+    int err_msg_code = event.GetInt();
+    if (err_msg_code) {
+	delete model;
+	wxString m = wxString::Format(wmsg(err_msg_code), file.c_str());
+	wxGetApp().ReportError(m);
+	return;
+    }
+
+    ModelLoaded(*model, file, loading_survey);
+    delete model;
+    FileOpened(file, loading_survey);
+}
+
 bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
 {
     // Load survey data from file, centre the dataset around the origin,
@@ -1137,18 +1269,34 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     timer.Start();
 #endif
 
-    int err_msg_code = Model::Load(file, prefix);
+    // A synchronous load supersedes any background one.
+    CancelLoad();
+
+    Model model;
+    int err_msg_code = model.Load(file, prefix);
     if (err_msg_code) {
 	wxString m = wxString::Format(wmsg(err_msg_code), file.c_str());
 	wxGetApp().ReportError(m);
 	return false;
     }
 
+    ModelLoaded(model, file, prefix);
+
+    return true;
+}
+
+void MainFrm::ModelLoaded(Model& model, const wxString& file, const wxString& prefix)
+{
+    // Take over the newly loaded data.  This invalidates any pointers to our
+    // old stations, so the tree must be refilled before we return to the
+    // event loop.
+    Model::operator=(std::move(model));
+
     // Update window title.
     SetTitle(GetSurveyTitle() + " - " APP_NAME);
 
     // Sort the labels ready for filling the tree.
-    m_Labels.sort(LabelCmp(GetSeparator()));
+    stable_sort(m_Labels.begin(), m_Labels.end(), LabelCmp(GetSeparator()));
 
     // Fill the tree of stations and prefixes.
     wxString root_name = wxFileNameFromPath(file);
@@ -1159,13 +1307,13 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     }
     m_Tree->FillTree(root_name);
 
-    // Sort labels so that entrances are displayed in preference,
-    // then fixed points, then exported points, then other points.
-    //
-    // Also sort by leaf name so that we'll tend to choose labels
-    // from different surveys, rather than labels from surveys which
-    // are earlier in the list.
-    m_Labels.sort(LabelPlotCmp(GetSeparator()));
+    SortLabelsForPlotting();
+
+    // Any search results were for the old stations.
+    name_index.build(m_Labels);
+    found_pattern = wxString();
+    found.clear();
+    m_NumHighlighted = 0;
 
     if (!m_FindBox->GetValue().empty()) {
 	// Highlight any stations matching the current search.
@@ -1173,8 +1321,6 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     }
 
     m_FileProcessed = file;
-
-    return true;
 }
 
 #if 0
@@ -1269,10 +1415,14 @@ void MainFrm::AddToFileHistory(const wxString & file)
     b->Flush();
 }
 
-void MainFrm::OpenFile(const wxString& file, const wxString& survey)
+void MainFrm::OpenFile(const wxString& file, const wxString& survey,
+		       bool in_background)
 {
     wxBusyCursor hourglass;
 
+    // Opening a file supersedes any survey we're still loading.
+    CancelLoad();
+
     // Check if this is an unprocessed survey data file.
     if (file.length() > 4 && file[file.length() - 4] == '.') {
 	wxString ext(file, file.length() - 3, 3);
@@ -1295,8 +1445,33 @@ void MainFrm::OpenFile(const wxString& file, const wxString& survey)
 	}
     }
 
+#if wxUSE_THREADS
+    if (in_background) {
+	// Read the file in a worker thread, so the UI stays responsive - the
+	// current survey (if any) stays usable until the new one is ready.
+	SurveyLoader* thread = new SurveyLoader(this, file, survey,
+						load_serial);
+	if (thread->Run() == wxTHREAD_NO_ERROR) {
+	    loader = thread;
+	    loading_file = file;
+	    loading_survey = survey;
+	    wxString text = wmsg(/*Reading in data - please wait…*/105);
+	    GetStatusBar()->SetStatusText(text);
+	    return;
+	}
+	delete thread;
+    }
+#else
+    (void)in_background;
+#endif
+
     if (!LoadData(file, survey))
 	return;
+    FileOpened(file, survey);
+}
+
+void MainFrm::FileOpened(const wxString& file, const wxString& survey)
+{
     AddToFileHistory(file);
     InitialiseAfterLoad(file, survey);
 
@@ -1309,6 +1484,49 @@ void MainFrm::OpenFile(const wxString& file, const wxString& survey)
     }
 }
 
+void MainFrm::SortLabelsForPlotting()
+{
+    // Sort labels so that entrances are displayed in preference,
+    // then fixed points, then exported points, then other points.
+    //
+    // Also sort by leaf name so that we'll tend to choose labels
+    // from different surveys, rather than labels from surveys which
+    // are earlier in the list.
+    stable_sort(m_Labels.begin(), m_Labels.end(), LabelPlotCmp(GetSeparator()));
+
+    // No stations are highlighted yet, so this order can be reused when the
+    // search results change.
+    labels_plot_order = m_Labels;
+
+    // Record the order so it can be restored for a subset of the labels.
+    unsigned n = 0;
+    for (auto&& label : m_Labels) {
+	label->plot_order = n++;
+    }
+
+    m_Gfx->LabelOrderChanged();
+}
+
+void MainFrm::PutFoundLabelsFirst()
+{
+    // LabelPlotCmp puts highlighted labels first but otherwise ignores
+    // whether labels are highlighted, so there's no need to sort again.
+    auto out = m_Labels.begin();
+    for (LabelInfo* label : labels_plot_order) {
+	if (label->IsHighLighted()) *out++ = label;
+    }
+    for (LabelInfo* label : labels_plot_order) {
+	if (!label->IsHighLighted()) *out++ = label;
+    }
+
+    unsigned n = 0;
+    for (auto&& label : m_Labels) {
+	label->plot_order = n++;
+    }
+
+    m_Gfx->LabelOrderChanged();
+}
+
 void MainFrm::InitialiseAfterLoad(const wxString & file, const wxString & prefix)
 {
     if (m_SashPosition < 0) {
@@ -1465,8 +1683,12 @@ void MainFrm::OnOpenTerrain(wxCommandEvent&)
      * grid of height values). */
     wxFileDialog dlg(this, wmsg(/*Select a terrain file to view*/451),
 		     wxString(), wxString(),
-		     filetypes, wxFD_OPEN|wxFD_FILE_MUST_EXIST);
-    if (dlg.ShowModal() == wxID_OK && m_Gfx->LoadDEM(dlg.GetPath())) {
+		     filetypes, wxFD_OPEN|wxFD_FILE_MUST_EXIST|wxFD_MULTIPLE);
+    if (dlg.ShowModal() != wxID_OK) return;
+    // Several files can be selected to use a mosaic of DEM tiles.
+    wxArrayString paths;
+    dlg.GetPaths(paths);
+    if (m_Gfx->LoadDEM(paths)) {
 	if (!m_Gfx->DisplayingTerrain()) m_Gfx->ToggleTerrain();
     }
 }
@@ -1489,6 +1711,19 @@ void MainFrm::OnShowLog(wxCommandEvent&)
     m_Log = NULL;
 }
 
+#ifdef CAVERNLOG_WATCH_FILES
+void MainFrm::OnWatchDataFiles(wxCommandEvent&)
+{
+    watch_data_files = !watch_data_files;
+    wxConfigBase::Get()->Write(wxT("watch_data_files"), watch_data_files);
+
+    // The log window is either hidden in m_Log or currently shown.
+    wxWindow * win = m_Log ? m_Log : m_Splitter->GetWindow1();
+    CavernLogWindow * log = dynamic_cast<CavernLogWindow*>(win);
+    if (log) log->UpdateWatches();
+}
+#endif
+
 void MainFrm::OnScreenshot(wxCommandEvent&)
 {
     wxString baseleaf;
@@ -1536,6 +1771,52 @@ void MainFrm::PrintAndExit()
     m_Gfx->OnPrint(m_File, GetSurveyTitle(), GetDateString(), true);
 }
 
+// Load a survey and optionally a presentation, then render a screenshot
+// and/or a movie of the presentation at the specified size, independent of
+// the size of the window.
+bool MainFrm::RenderOffscreen(const wxString & file, const wxString & survey,
+			      const wxString & presentation,
+			      const wxString & movie,
+			      const wxString & screenshot,
+			      int width, int height)
+{
+    if (!LoadData(file, survey))
+	return false;
+    FileOpened(file, survey);
+
+    if (!presentation.empty()) {
+	if (!m_PresList->Load(presentation))
+	    return false;
+    }
+
+    if (!m_Gfx->UseHeadlessContext()) {
+	// We need the window to have been realised before we can get an
+	// OpenGL context for it, even though we don't draw to it.
+	Show(true);
+	wxYield();
+    }
+
+    if (!screenshot.empty()) {
+	if (!m_PresList->Empty()) {
+	    m_Gfx->SetView(GetPresMark(MARK_FIRST));
+	}
+	if (!m_Gfx->RenderScreenshot(screenshot, width, height))
+	    return false;
+    }
+
+    if (!movie.empty()) {
+	if (m_PresList->Empty()) {
+	    /* TRANSLATORS: Error given by aven --movie if no presentation
+	     * was loaded with --presentation. */
+	    wxGetApp().ReportError(wmsg(/*No presentation to render*/537));
+	    return false;
+	}
+	if (!m_Gfx->RenderMovie(movie, width, height))
+	    return false;
+    }
+    return true;
+}
+
 void MainFrm::OnPageSetup(wxCommandEvent&)
 {
     wxPageSetupDialog dlg(this, wxGetApp().GetPageSetupDialogData());
@@ -1606,6 +1887,7 @@ void MainFrm::OnQuit(wxCommandEvent&)
 	    return;
 	}
     }
+    CancelLoad();
     wxConfigBase *b = wxConfigBase::Get();
     if (IsFullScreen()) {
 	b->Write(wxT("width"), -2);
@@ -1984,16 +2266,22 @@ void MainFrm::OnPresOpen(wxCommandEvent&)
 		     wxFD_OPEN|wxFD_FILE_MUST_EXIST);
 #endif
     if (dlg.ShowModal() == wxID_OK) {
-	if (!m_PresList->Load(dlg.GetPath())) {
-	    return;
-	}
 	// FIXME : keep a history of loaded/saved presentations, like we do for
 	// loaded surveys...
-	// Select the presentation page in the notebook.
-	m_Notebook->SetSelection(1);
+	OpenPresentation(dlg.GetPath());
     }
 }
 
+bool MainFrm::OpenPresentation(const wxString & fnm)
+{
+    if (!m_PresList->Load(fnm)) {
+	return false;
+    }
+    // Select the presentation page in the notebook.
+    m_Notebook->SetSelection(1);
+    return true;
+}
+
 void MainFrm::OnPresSave(wxCommandEvent&)
 {
     m_PresList->Save(true);
@@ -2192,99 +2480,47 @@ void MainFrm::OnIdle(wxIdleEvent&)
 void MainFrm::DoFind()
 {
     pending_find = false;
-    wxBusyCursor hourglass;
-    // Find stations specified by a string or regular expression pattern.
+    // Find stations specified by a glob-style pattern.
 
+    const NameIndex& index = name_index;
     wxString pattern = m_FindBox->GetValue();
-    if (pattern.empty()) {
-	// Hide any search result highlights.
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
-	while (pos != m_Labels.end()) {
-	    LabelInfo* label = *pos++;
-	    label->clear_flags(LFLAG_HIGHLIGHTED);
+    vector<unsigned> new_found;
+    if (!pattern.empty()) {
+	const vector<unsigned>* candidates = NULL;
+	// When the user extends a substring, only the stations already found
+	// can still match.
+	const wxChar* wildcards = wxT("*?");
+	if (!found_pattern.empty() &&
+	    pattern.find_first_of(wildcards) == wxString::npos &&
+	    found_pattern.find_first_of(wildcards) == wxString::npos &&
+	    pattern.Lower().Contains(found_pattern.Lower())) {
+	    candidates = &found;
 	}
-	m_NumHighlighted = 0;
-    } else {
-	int re_flags = wxRE_NOSUB;
-
-	if (true /* case insensitive */) {
-	    re_flags |= wxRE_ICASE;
-	}
-
-	bool substring = true;
-	if (false /*m_RegexpCheckBox->GetValue()*/) {
-	    re_flags |= wxRE_EXTENDED;
-	} else if (true /* simple glob-style */) {
-	    wxString pat;
-	    for (size_t i = 0; i < pattern.size(); i++) {
-	       wxChar ch = pattern[i];
-	       // ^ only special at start; $ at end.  But this is simpler...
-	       switch (ch) {
-		case '^': case '$': case '.': case '[': case '\\':
-		  pat += wxT('\\');
-		  pat += ch;
-		  break;
-		case '*':
-		  pat += wxT(".*");
-		  substring = false;
-		  break;
-		case '?':
-		  pat += wxT('.');
-		  substring = false;
-		  break;
-		default:
-		  pat += ch;
-	       }
-	    }
-	    pattern = pat;
-	    re_flags |= wxRE_BASIC;
+	index.search(pattern, new_found, candidates);
+    }
+    found_pattern = pattern;
+
+    // Only update the stations whose highlighting has changed.
+    bool changed = false;
+    auto i = found.begin();
+    auto j = new_found.begin();
+    while (i != found.end() || j != new_found.end()) {
+	if (j == new_found.end() || (i != found.end() && *i < *j)) {
+	    index.station(*i++)->clear_flags(LFLAG_HIGHLIGHTED);
+	    changed = true;
+	} else if (i == found.end() || *j < *i) {
+	    index.station(*j++)->set_flags(LFLAG_HIGHLIGHTED);
+	    changed = true;
 	} else {
-	    wxString pat;
-	    for (size_t i = 0; i < pattern.size(); i++) {
-	       wxChar ch = pattern[i];
-	       // ^ only special at start; $ at end.  But this is simpler...
-	       switch (ch) {
-		case '^': case '$': case '*': case '.': case '[': case '\\':
-		  pat += wxT('\\');
-	       }
-	       pat += ch;
-	    }
-	    pattern = pat;
-	    re_flags |= wxRE_BASIC;
+	    ++i;
+	    ++j;
 	}
-
-	if (!substring) {
-	    // FIXME "0u" required to avoid compilation error with g++-3.0
-	    if (pattern.empty() || pattern[0u] != '^') pattern = wxT('^') + pattern;
-	    // FIXME: this fails to cope with "\$" at the end of pattern...
-	    if (pattern[pattern.size() - 1] != '$') pattern += wxT('$');
-	}
-
-	wxRegEx regex;
-	if (!regex.Compile(pattern, re_flags)) {
-	    wxBell();
-	    return;
-	}
-
-	int found = 0;
-
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
-	while (pos != m_Labels.end()) {
-	    LabelInfo* label = *pos++;
-
-	    if (regex.Matches(label->GetText())) {
-		label->set_flags(LFLAG_HIGHLIGHTED);
-		++found;
-	    } else {
-		label->clear_flags(LFLAG_HIGHLIGHTED);
-	    }
-	}
-
-	m_NumHighlighted = found;
-
-	// Re-sort so highlighted points get names in preference
-	if (found) m_Labels.sort(LabelPlotCmp(GetSeparator()));
     }
+    found.swap(new_found);
+    m_NumHighlighted = found.size();
+
+    // Re-sort so highlighted points get names in preference
+    if (changed) PutFoundLabelsFirst();
 
     m_Gfx->UpdateBlobs();
     m_Gfx->ForceRefresh();
@@ -2312,18 +2548,14 @@ void MainFrm::OnGotoFound(wxCommandEvent&)
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::iterator pos = m_Labels.begin();
-    while (pos != m_Labels.end()) {
-	LabelInfo* label = *pos++;
-
-	if (label->get_flags() & LFLAG_HIGHLIGHTED) {
-	    if (label->GetX() < xmin) xmin = label->GetX();
-	    if (label->GetX() > xmax) xmax = label->GetX();
-	    if (label->GetY() < ymin) ymin = label->GetY();
-	    if (label->GetY() > ymax) ymax = label->GetY();
-	    if (label->GetZ() < zmin) zmin = label->GetZ();
-	    if (label->GetZ() > zmax) zmax = label->GetZ();
-	}
+    for (unsigned id : found) {
+	const LabelInfo* label = name_index.station(id);
+	if (label->GetX() < xmin) xmin = label->GetX();
+	if (label->GetX() > xmax) xmax = label->GetX();
+	if (label->GetY() < ymin) ymin = label->GetY();
+	if (label->GetY() > ymax) ymax = label->GetY();
+	if (label->GetZ() < zmin) zmin = label->GetZ();
+	if (label->GetZ() > zmax) zmax = label->GetZ();
     }
 
     m_Gfx->SetViewTo(xmin, xmax, ymin, ymax, zmin, zmax);
@@ -38,6 +38,7 @@
 #include "labelinfo.h"
 #include "message.h"
 #include "model.h"
+#include "nameindex.h"
 #include "vector3.h"
 #include "aven.h"
 //#include "prefsdlg.h"
@@ -67,6 +68,7 @@ enum {
     menu_FILE_SCREENSHOT,
     menu_FILE_EXPORT,
     menu_FILE_EXTEND,
+    menu_FILE_WATCH,
     menu_PRES_NEW,
     menu_PRES_OPEN,
     menu_PRES_SAVE,
@@ -148,10 +150,15 @@ enum {
     menu_SURVEY_HIDE_SIBLINGS,
     textctrl_FIND,
     button_HIDE,
-    listctrl_PRES
+    listctrl_PRES,
+    thread_LOAD_PROGRESS,
+    thread_LOADED
 };
 
 class AvenPresList;
+#if wxUSE_THREADS
+class SurveyLoader;
+#endif
 
 class MainFrm : public wxFrame, public Model {
     wxFileHistory m_history;
@@ -176,9 +183,33 @@ class MainFrm : public wxFrame, public Model {
 
     int m_NumHighlighted = 0;
     bool pending_find;
+    // The last search pattern, and the ids (see NameIndex) of the stations it
+    // found in ascending order.
+    wxString found_pattern;
+    vector<unsigned> found;
+    // Index of station names for searching (only aven searches, so this
+    // isn't part of Model).
+    NameIndex name_index;
+    // The labels in plotting order, ignoring search results.
+    vector<LabelInfo*> labels_plot_order;
 
     bool fullscreen_showing_menus;
 
+    // Reprocess survey data automatically when a data file changes?
+    bool watch_data_files;
+
+#if wxUSE_THREADS
+    // The thread loading a survey in the background, or NULL.  Only the
+    // main thread touches this - the thread is joinable, and we wait for it
+    // to finish before deleting it.
+    SurveyLoader* loader = NULL;
+#endif
+    // Incremented each time we start loading a survey, so we can ignore
+    // results from a background load which has been superseded.
+    unsigned long load_serial = 0;
+    // The file and survey prefix being loaded in the background.
+    wxString loading_file, loading_survey;
+
 #ifdef PREFDLG
     PrefsDlg* m_PrefsDlg;
 #endif
@@ -192,6 +223,13 @@ class MainFrm : public wxFrame, public Model {
 
     void UpdateStatusBar();
 
+    void SortLabelsForPlotting();
+    void PutFoundLabelsFirst();
+
+    void CancelLoad();
+    void ModelLoaded(Model& model, const wxString& file, const wxString& prefix);
+    void FileOpened(const wxString& file, const wxString& survey);
+
 #ifdef USING_GENERIC_TOOLBAR
     wxToolBar * GetToolBar() const {
 	wxSizer * sizer = GetSizer();
@@ -209,9 +247,14 @@ public:
 
     void InitialiseAfterLoad(const wxString & file, const wxString & prefix);
     void OnShowLog(wxCommandEvent& event);
+    bool GetWatchDataFiles() const { return watch_data_files; }
+    void OnWatchDataFiles(wxCommandEvent& event);
 
     void OnMRUFile(wxCommandEvent& event);
-    void OpenFile(const wxString& file, const wxString& survey = wxString());
+    void OpenFile(const wxString& file, const wxString& survey = wxString(),
+		  bool in_background = true);
+    void OnLoadProgress(wxThreadEvent& event);
+    void OnLoaded(wxThreadEvent& event);
 
     void OnPresNewUpdate(wxUpdateUIEvent& event);
     void OnPresOpenUpdate(wxUpdateUIEvent& event);
@@ -244,8 +287,13 @@ public:
     void OnFilePreferences(wxCommandEvent& event);
     void OnPrint(wxCommandEvent& event);
     void PrintAndExit();
+    bool RenderOffscreen(const wxString & file, const wxString & survey,
+			 const wxString & presentation,
+			 const wxString & movie, const wxString & screenshot,
+			 int width, int height);
     void OnPageSetup(wxCommandEvent& event);
     void OnPresNew(wxCommandEvent& event);
+    bool OpenPresentation(const wxString & fnm);
     void OnPresOpen(wxCommandEvent& event);
     void OnPresSave(wxCommandEvent& event);
     void OnPresSaveAs(wxCommandEvent& event);
@@ -279,6 +327,9 @@ public:
 	ui.Enable(m_Log != NULL || (m_Splitter->GetWindow1() != m_Gfx && m_Splitter->GetWindow2() != m_Gfx));
 	ui.Check(m_Log == NULL);
     }
+    void OnWatchDataFilesUpdate(wxUpdateUIEvent &ui) {
+	ui.Check(watch_data_files);
+    }
     void OnPrintUpdate(wxUpdateUIEvent &ui) { ui.Enable(!m_File.empty()); }
     void OnExportUpdate(wxUpdateUIEvent &ui) { ui.Enable(!m_File.empty()); }
     void OnExtendUpdate(wxUpdateUIEvent &ui) {
@@ -411,8 +462,9 @@ public:
     bool ShowingSidePanel();
 
     void SelectTreeItem(const LabelInfo* label) {
-	if (label->tree_id.IsOk())
-	    m_Tree->SelectItem(label->tree_id);
+	wxTreeItemId id = m_Tree->GetStationItem(label);
+	if (id.IsOk())
+	    m_Tree->SelectItem(id);
 	else
 	    m_Tree->UnselectAll();
     }
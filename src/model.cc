@@ -31,6 +31,8 @@
 #include "img_hosted.h"
 #include "useful.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cfloat>
 #include <map>
 
@@ -47,10 +49,46 @@ img2aven(int flags)
     return img2aven_tab[flags];
 }
 
-int Model::Load(const wxString& file, const wxString& prefix)
+static wxString
+label_to_wxstring(const char* label)
+{
+    wxString s(label, wxConvUTF8);
+    if (s.empty()) {
+	// If label isn't valid UTF-8 then this conversion will
+	// give an empty string.  In this case, assume that the
+	// label is CP1252 (the Microsoft superset of ISO8859-1).
+	static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
+	s = wxString(label, ConvCP1252);
+	if (s.empty()) {
+	    // Or if that doesn't work (ConvCP1252 doesn't like
+	    // strings with some bytes in) let's just go for
+	    // ISO8859-1.
+	    s = wxString(label, wxConvISO8859_1);
+	}
+    }
+    return s;
+}
+
+static bool
+label_name_lt(const LabelInfo* a, const LabelInfo* b)
+{
+    return a->GetText() < b->GetText();
+}
+
+int Model::Load(const wxString& file, const wxString& prefix,
+		LoadProgress* progress)
 {
     // Load the processed survey data.
-    img* survey = img_read_stream_survey(wxFopen(file, wxT("rb")),
+    FILE* fh = wxFopen(file, wxT("rb"));
+    long file_size = 0;
+    if (fh && progress) {
+	// We report progress based on how far through the file we are.
+	if (fseek(fh, 0, SEEK_END) == 0) {
+	    file_size = ftell(fh);
+	}
+	rewind(fh);
+    }
+    img* survey = img_read_stream_survey(fh,
 					 fclose,
 					 file.c_str(),
 					 prefix.utf8_str());
@@ -75,7 +113,10 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // FIXME: discard existing presentation? ask user about saving if we do!
 
     // Delete any existing list entries.
+    m_StationIndex.clear();
     m_Labels.clear();
+    labels.clear();
+    labels_by_name.clear();
 
     double xmin = DBL_MAX;
     double xmax = -DBL_MAX;
@@ -94,16 +135,29 @@ int Model::Load(const wxString& file, const wxString& prefix)
     for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
 	traverses[f].clear();
     }
+    points.clear();
+    survey_tree.clear();
     tubes.clear();
 
     // Ultimately we probably want different types (subclasses perhaps?) for
     // underground and surface data, so we don't need to store LRUD for surface
     // stuff.
     traverse * current_traverse = NULL;
-    vector<XSect> * current_tube = NULL;
 
-    map<wxString, LabelInfo *> labelmap;
-    list<LabelInfo*>::const_iterator last_mapped_label = m_Labels.begin();
+    // Traverses record the index of their survey's name in survey_names
+    // while loading, and we map these to SurveyTree ids at the end.
+    map<string, unsigned> survey_ids;
+    vector<wxString> survey_names;
+
+    // Cross-sections refer to stations by name, which we look up once all
+    // the stations have been read.
+    struct PendingXSect {
+	string label;
+	int date;
+	double l, r, u, d;
+    };
+    vector<vector<PendingXSect>> pending_tubes;
+    vector<PendingXSect> * current_tube = NULL;
 
     int result;
     img_point prev_pt = {0,0,0};
@@ -119,14 +173,19 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // generated for the current traverse.
     size_t n_traverses[8];
     memset(n_traverses, 0, sizeof(n_traverses));
+    unsigned items = 0;
     do {
-#if 0
-	if (++items % 200 == 0) {
-	    long pos = ftell(survey->fh);
-	    int progress = int((double(pos) / double(file_size)) * 100.0);
-	    // SetProgress(progress);
+	if (progress && ++items % 1000 == 0) {
+	    int percent = 0;
+	    if (file_size > 0) {
+		percent = int(double(ftell(survey->fh)) * 100.0 / file_size);
+		if (percent > 100) percent = 100;
+	    }
+	    if (!progress->Progress(percent)) {
+		img_close(survey);
+		return LOAD_CANCELLED;
+	    }
 	}
-#endif
 
 	img_point pt;
 	result = img_read_item(survey, &pt);
@@ -189,8 +248,14 @@ int Model::Load(const wxString& file, const wxString& prefix)
 			    if (prev_pt.z > depthmax) depthmax = prev_pt.z;
 			}
 		    }
-		    traverses[flags].push_back(traverse(survey->label));
+		    auto id = survey_ids.insert(make_pair(string(survey->label),
+							  unsigned(survey_names.size())));
+		    if (id.second) {
+			survey_names.push_back(label_to_wxstring(survey->label));
+		    }
+		    traverses[flags].push_back(traverse(id.first->second));
 		    current_traverse = &traverses[flags].back();
+		    current_traverse->first = points.size();
 		    current_traverse->flags = survey->flags;
 		    current_traverse->style = survey->style;
 
@@ -212,10 +277,12 @@ int Model::Load(const wxString& file, const wxString& prefix)
 			if (prev_pt.z > zmax) zmax = prev_pt.z;
 		    }
 
-		    current_traverse->push_back(PointInfo(prev_pt));
+		    points.push_back(PointInfo(prev_pt));
+		    ++current_traverse->n;
 		}
 
-		current_traverse->push_back(PointInfo(pt, date));
+		points.push_back(PointInfo(pt, date));
+		++current_traverse->n;
 
 		prev_pt = pt;
 		pending_move = false;
@@ -223,75 +290,26 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	    }
 
 	    case img_LABEL: {
-		wxString s(survey->label, wxConvUTF8);
-		if (s.empty()) {
-		    // If label isn't valid UTF-8 then this conversion will
-		    // give an empty string.  In this case, assume that the
-		    // label is CP1252 (the Microsoft superset of ISO8859-1).
-		    static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
-		    s = wxString(survey->label, ConvCP1252);
-		    if (s.empty()) {
-			// Or if that doesn't work (ConvCP1252 doesn't like
-			// strings with some bytes in) let's just go for
-			// ISO8859-1.
-			s = wxString(survey->label, wxConvISO8859_1);
-		    }
-		}
 		int flags = img2aven(survey->flags);
-		LabelInfo* label = new LabelInfo(pt, s, flags);
-		if (label->IsEntrance()) {
+		labels.emplace_back(pt, label_to_wxstring(survey->label), flags);
+		const LabelInfo& label = labels.back();
+		if (label.IsEntrance()) {
 		    m_NumEntrances++;
 		}
-		if (label->IsFixedPt()) {
+		if (label.IsFixedPt()) {
 		    m_NumFixedPts++;
 		}
-		if (label->IsExportedPt()) {
+		if (label.IsExportedPt()) {
 		    m_NumExportedPts++;
 		}
-		m_Labels.push_back(label);
 		break;
 	    }
 
 	    case img_XSECT: {
 		if (!current_tube) {
 		    // Start new current_tube.
-		    tubes.push_back(vector<XSect>());
-		    current_tube = &tubes.back();
-		}
-
-		LabelInfo * lab;
-		wxString label(survey->label, wxConvUTF8);
-		map<wxString, LabelInfo *>::const_iterator p;
-		p = labelmap.find(label);
-		if (p != labelmap.end()) {
-		    lab = p->second;
-		} else {
-		    // Initialise labelmap lazily - we may have no
-		    // cross-sections.
-		    list<LabelInfo*>::const_iterator i;
-		    if (labelmap.empty()) {
-			i = m_Labels.begin();
-		    } else {
-			i = last_mapped_label;
-			++i;
-		    }
-		    while (i != m_Labels.end() && (*i)->GetText() != label) {
-			labelmap[(*i)->GetText()] = *i;
-			++i;
-		    }
-		    last_mapped_label = i;
-		    if (i == m_Labels.end()) {
-			// Unattached cross-section - ignore for now.
-			printf("unattached cross-section\n");
-			if (current_tube->size() <= 1)
-			    tubes.resize(tubes.size() - 1);
-			current_tube = NULL;
-			if (!m_Labels.empty())
-			    --last_mapped_label;
-			break;
-		    }
-		    lab = *i;
-		    labelmap[label] = lab;
+		    pending_tubes.push_back(vector<PendingXSect>());
+		    current_tube = &pending_tubes.back();
 		}
 
 		int date = survey->days1;
@@ -301,7 +319,9 @@ int Model::Load(const wxString& file, const wxString& prefix)
 		    if (date > datemax) datemax = date;
 		}
 
-		current_tube->emplace_back(lab, date, survey->l, survey->r, survey->u, survey->d);
+		current_tube->push_back(PendingXSect{survey->label, date,
+						     survey->l, survey->r,
+						     survey->u, survey->d});
 		break;
 	    }
 
@@ -311,7 +331,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
 		// discard it for now.  FIXME: we should handle this
 		// when we come to skinning the tubes.
 		if (current_tube && current_tube->size() <= 1)
-		    tubes.resize(tubes.size() - 1);
+		    pending_tubes.pop_back();
 		current_tube = NULL;
 		break;
 
@@ -324,7 +344,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
 		}
 		m_HasErrorInformation = true;
 		for (size_t f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
-		    list<traverse>::reverse_iterator t = traverses[f].rbegin();
+		    vector<traverse>::reverse_iterator t = traverses[f].rbegin();
 		    size_t n = n_traverses[f];
 		    n_traverses[f] = 0;
 		    while (n) {
@@ -342,7 +362,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	    }
 
 	    case img_BAD: {
-		m_Labels.clear();
+		labels.clear();
 
 		// FIXME: Do we need to reset all these? - Olly
 		m_NumFixedPts = 0;
@@ -371,7 +391,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // discard it for now.  FIXME: we should handle this
     // when we come to skinning the tubes.
     if (current_tube && current_tube->size() <= 1)
-	tubes.resize(tubes.size() - 1);
+	pending_tubes.pop_back();
 
     m_separator = survey->separator;
     m_Title = wxString(survey->title, wxConvUTF8);
@@ -399,7 +419,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
     img_close(survey);
 
     // Check we've actually loaded some legs or stations!
-    if (!m_HasUndergroundLegs && !m_HasSurfaceLegs && m_Labels.empty()) {
+    if (!m_HasUndergroundLegs && !m_HasSurfaceLegs && labels.empty()) {
 	return (/*No survey data in 3d file “%s”*/202);
     }
 
@@ -412,14 +432,13 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	traverses[6].empty() &&
 	traverses[7].empty()) {
 	// No legs, so get survey extents from stations
-	list<LabelInfo*>::const_iterator i;
-	for (i = m_Labels.begin(); i != m_Labels.end(); ++i) {
-	    if ((*i)->GetX() < xmin) xmin = (*i)->GetX();
-	    if ((*i)->GetX() > xmax) xmax = (*i)->GetX();
-	    if ((*i)->GetY() < ymin) ymin = (*i)->GetY();
-	    if ((*i)->GetY() > ymax) ymax = (*i)->GetY();
-	    if ((*i)->GetZ() < zmin) zmin = (*i)->GetZ();
-	    if ((*i)->GetZ() > zmax) zmax = (*i)->GetZ();
+	for (const LabelInfo& label : labels) {
+	    if (label.GetX() < xmin) xmin = label.GetX();
+	    if (label.GetX() > xmax) xmax = label.GetX();
+	    if (label.GetY() < ymin) ymin = label.GetY();
+	    if (label.GetY() > ymax) ymax = label.GetY();
+	    if (label.GetZ() < zmin) zmin = label.GetZ();
+	    if (label.GetZ() > zmax) zmax = label.GetZ();
 	}
     }
 
@@ -431,6 +450,56 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // Centre the dataset around the origin.
     CentreDataset(Vector3(xmin, ymin, zmin));
 
+    // The stations won't move in memory now, so we can hand out pointers to
+    // them.
+    m_Labels.reserve(labels.size());
+    labels_by_name.reserve(labels.size());
+    for (LabelInfo& label : labels) {
+	m_Labels.push_back(&label);
+	labels_by_name.push_back(&label);
+    }
+    sort(labels_by_name.begin(), labels_by_name.end(), label_name_lt);
+
+    // The station positions are now final, so we can index them.
+    m_StationIndex.build(m_Labels);
+
+    // Build the survey tree from the surveys of the traverses and stations.
+    vector<wxString> tree_names(survey_names);
+    for (const LabelInfo& label : labels) {
+	tree_names.push_back(label.GetText().BeforeLast(m_separator));
+    }
+    survey_tree.build(tree_names, m_separator);
+    for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+	for (auto&& t : traverses[f]) {
+	    t.survey = survey_tree.find(survey_names[t.survey]);
+	}
+    }
+    for (LabelInfo& label : labels) {
+	unsigned id = survey_tree.find(label.GetText());
+	if (id == SurveyTree::NONE) {
+	    id = survey_tree.find(label.GetText().BeforeLast(m_separator));
+	}
+	label.survey = id;
+    }
+
+    for (auto&& pending : pending_tubes) {
+	vector<XSect> tube;
+	for (auto&& xsect : pending) {
+	    const LabelInfo* stn = FindStation(label_to_wxstring(xsect.label.c_str()));
+	    if (!stn) {
+		// Unattached cross-section - ignore for now, ending the tube
+		// here.
+		printf("unattached cross-section\n");
+		if (tube.size() > 1) tubes.push_back(std::move(tube));
+		tube.clear();
+		continue;
+	    }
+	    tube.emplace_back(stn, xsect.date,
+			      xsect.l, xsect.r, xsect.u, xsect.d);
+	}
+	if (tube.size() > 1) tubes.push_back(std::move(tube));
+    }
+
     if (depthmax < m_DepthMin) {
 	m_DepthMin = 0;
 	m_DepthExt = 0;
@@ -452,218 +521,358 @@ void Model::CentreDataset(const Vector3& vmin)
 
     m_Offset = vmin + (m_Ext * 0.5);
 
+    // Copy the points so those of each traverses[] entry are together and
+    // in the order the traverses will be iterated in, and fix up the
+    // traverses to point to their points.
+    vector<PointInfo> sorted_points;
+    sorted_points.reserve(points.size());
     for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
-	list<traverse>::iterator t = traverses[f].begin();
-	while (t != traverses[f].end()) {
-	    assert(t->size() > 1);
-	    vector<PointInfo>::iterator pos = t->begin();
-	    while (pos != t->end()) {
-		Point & point = *pos++;
-		point -= m_Offset;
+	for (auto&& t : traverses[f]) {
+	    assert(t.n > 1);
+	    size_t first = sorted_points.size();
+	    for (size_t i = t.first; i != t.first + t.n; ++i) {
+		const PointInfo& p = points[i];
+		sorted_points.push_back(PointInfo(Point(p - m_Offset), p.GetDate()));
 	    }
-	    ++t;
+	    t.first = first;
+	}
+    }
+    points.swap(sorted_points);
+    for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+	for (auto&& t : traverses[f]) {
+	    t.points = points.data() + t.first;
 	}
     }
 
-    list<LabelInfo*>::iterator lpos = m_Labels.begin();
-    while (lpos != m_Labels.end()) {
-	Point & point = **lpos++;
-	point -= m_Offset;
+    for (LabelInfo& label : labels) {
+	label -= m_Offset;
     }
 }
 
-void
-Model::do_prepare_tubes() const
+const LabelInfo*
+Model::FindStation(const wxString& name) const
 {
-    // Fill in "right_bearing" for each cross-section.
-    for (auto&& tube : tubes) {
-	assert(tube.size() > 1);
-	Vector3 U[4];
-	XSect* prev_pt_v = NULL;
-	Vector3 last_right(1.0, 0.0, 0.0);
-
-	vector<XSect>::iterator i = tube.begin();
-	vector<XSect>::size_type segment = 0;
-	while (i != tube.end()) {
-	    // get the coordinates of this vertex
-	    XSect & pt_v = *i++;
-
-	    bool cover_end = false;
-
-	    Vector3 right, up;
-
-	    const Vector3 up_v(0.0, 0.0, 1.0);
-
-	    if (segment == 0) {
-		assert(i != tube.end());
-		// first segment
-
-		// get the coordinates of the next vertex
-		const XSect & next_pt_v = *i;
-
-		// calculate vector from this pt to the next one
-		Vector3 leg_v = next_pt_v - pt_v;
-
-		// obtain a vector in the LRUD plane
-		right = leg_v * up_v;
-		if (right.magnitude() == 0) {
-		    right = last_right;
-		    // Obtain a second vector in the LRUD plane,
-		    // perpendicular to the first.
-		    //up = right * leg_v;
-		    up = up_v;
-		} else {
-		    last_right = right;
-		    up = up_v;
-		}
-
-		cover_end = true;
-	    } else if (segment + 1 == tube.size()) {
-		// last segment
-
-		// Calculate vector from the previous pt to this one.
-		Vector3 leg_v = pt_v - *prev_pt_v;
-
-		// Obtain a horizontal vector in the LRUD plane.
-		right = leg_v * up_v;
-		if (right.magnitude() == 0) {
-		    right = Vector3(last_right.GetX(), last_right.GetY(), 0.0);
-		    // Obtain a second vector in the LRUD plane,
-		    // perpendicular to the first.
-		    //up = right * leg_v;
-		    up = up_v;
-		} else {
-		    last_right = right;
-		    up = up_v;
-		}
+    auto i = lower_bound(labels_by_name.begin(), labels_by_name.end(), name,
+			 [](const LabelInfo* label, const wxString& s) {
+			     return label->GetText() < s;
+			 });
+    if (i == labels_by_name.end() || (*i)->GetText() != name) return NULL;
+    return *i;
+}
 
-		cover_end = true;
+void
+skin_tube(const vector<XSect>& tube, TubeSkinner& skinner)
+{
+    assert(tube.size() > 1);
+    Vector3 U[4];
+    const XSect* prev_pt_v = NULL;
+    Vector3 last_right(1.0, 0.0, 0.0);
+
+    vector<XSect>::const_iterator i = tube.begin();
+    vector<XSect>::size_type segment = 0;
+    while (i != tube.end()) {
+	// get the coordinates of this vertex
+	const XSect & pt_v = *i++;
+
+	Vector3 right, up;
+
+	const Vector3 up_v(0.0, 0.0, 1.0);
+
+	if (segment == 0) {
+	    assert(i != tube.end());
+	    // first segment
+
+	    // get the coordinates of the next vertex
+	    const XSect & next_pt_v = *i;
+
+	    // calculate vector from this pt to the next one
+	    Vector3 leg_v = next_pt_v - pt_v;
+
+	    // obtain a vector in the LRUD plane
+	    right = leg_v * up_v;
+	    if (right.magnitude() == 0) {
+		right = last_right;
+		// Obtain a second vector in the LRUD plane,
+		// perpendicular to the first.
+		//up = right * leg_v;
+		up = up_v;
 	    } else {
-		assert(i != tube.end());
-		// Intermediate segment.
-
-		// Get the coordinates of the next vertex.
-		const XSect & next_pt_v = *i;
-
-		// Calculate vectors from this vertex to the
-		// next vertex, and from the previous vertex to
-		// this one.
-		Vector3 leg1_v = pt_v - *prev_pt_v;
-		Vector3 leg2_v = next_pt_v - pt_v;
-
-		// Obtain horizontal vectors perpendicular to
-		// both legs, then normalise and average to get
-		// a horizontal bisector.
-		Vector3 r1 = leg1_v * up_v;
-		Vector3 r2 = leg2_v * up_v;
-		r1.normalise();
-		r2.normalise();
-		right = r1 + r2;
-		if (right.magnitude() == 0) {
-		    // This is the "mid-pitch" case...
-		    right = last_right;
-		}
-		if (r1.magnitude() == 0) {
-		    up = up_v;
-
-		    // Rotate pitch section to minimise the
-		    // "torsional stress" - FIXME: use
-		    // triangles instead of rectangles?
-		    int shift = 0;
-		    double maxdotp = 0;
-
-		    // Scale to unit vectors in the LRUD plane.
-		    right.normalise();
-		    up.normalise();
-		    Vector3 vec = up - right;
-		    for (int orient = 0; orient <= 3; ++orient) {
-			Vector3 tmp = U[orient] - prev_pt_v->GetPoint();
-			tmp.normalise();
-			double dotp = dot(vec, tmp);
-			if (dotp > maxdotp) {
-			    maxdotp = dotp;
-			    shift = orient;
-			}
+		last_right = right;
+		up = up_v;
+	    }
+	} else if (segment + 1 == tube.size()) {
+	    // last segment
+
+	    // Calculate vector from the previous pt to this one.
+	    Vector3 leg_v = pt_v - *prev_pt_v;
+
+	    // Obtain a horizontal vector in the LRUD plane.
+	    right = leg_v * up_v;
+	    if (right.magnitude() == 0) {
+		right = Vector3(last_right.GetX(), last_right.GetY(), 0.0);
+		// Obtain a second vector in the LRUD plane,
+		// perpendicular to the first.
+		//up = right * leg_v;
+		up = up_v;
+	    } else {
+		last_right = right;
+		up = up_v;
+	    }
+	} else {
+	    assert(i != tube.end());
+	    // Intermediate segment.
+
+	    // Get the coordinates of the next vertex.
+	    const XSect & next_pt_v = *i;
+
+	    // Calculate vectors from this vertex to the
+	    // next vertex, and from the previous vertex to
+	    // this one.
+	    Vector3 leg1_v = pt_v - *prev_pt_v;
+	    Vector3 leg2_v = next_pt_v - pt_v;
+
+	    // Obtain horizontal vectors perpendicular to
+	    // both legs, then normalise and average to get
+	    // a horizontal bisector.
+	    Vector3 r1 = leg1_v * up_v;
+	    Vector3 r2 = leg2_v * up_v;
+	    r1.normalise();
+	    r2.normalise();
+	    right = r1 + r2;
+	    if (right.magnitude() == 0) {
+		// This is the "mid-pitch" case...
+		right = last_right;
+	    }
+	    if (r1.magnitude() == 0) {
+		up = up_v;
+
+		// Rotate pitch section to minimise the
+		// "torsional stress" - FIXME: use
+		// triangles instead of rectangles?
+		int shift = 0;
+		double maxdotp = 0;
+
+		// Scale to unit vectors in the LRUD plane.
+		right.normalise();
+		up.normalise();
+		Vector3 vec = up - right;
+		for (int orient = 0; orient <= 3; ++orient) {
+		    Vector3 tmp = U[orient] - prev_pt_v->GetPoint();
+		    tmp.normalise();
+		    double dotp = dot(vec, tmp);
+		    if (dotp > maxdotp) {
+			maxdotp = dotp;
+			shift = orient;
 		    }
-		    if (shift) {
-			if (shift != 2) {
-			    Vector3 temp(U[0]);
-			    U[0] = U[shift];
-			    U[shift] = U[2];
-			    U[2] = U[shift ^ 2];
-			    U[shift ^ 2] = temp;
-			} else {
-			    swap(U[0], U[2]);
-			    swap(U[1], U[3]);
-			}
+		}
+		if (shift) {
+		    if (shift != 2) {
+			Vector3 temp(U[0]);
+			U[0] = U[shift];
+			U[shift] = U[2];
+			U[2] = U[shift ^ 2];
+			U[shift ^ 2] = temp;
+		    } else {
+			swap(U[0], U[2]);
+			swap(U[1], U[3]);
 		    }
+		}
 #if 0
-		    // Check that the above code actually permuted
-		    // the vertices correctly.
+		// Check that the above code actually permuted
+		// the vertices correctly.
+		shift = 0;
+		maxdotp = 0;
+		for (int j = 0; j <= 3; ++j) {
+		    Vector3 tmp = U[j] - *prev_pt_v;
+		    tmp.normalise();
+		    double dotp = dot(vec, tmp);
+		    if (dotp > maxdotp) {
+			maxdotp = dotp + 1e-6; // Add small tolerance to stop 45 degree offset cases being flagged...
+			shift = j;
+		    }
+		}
+		if (shift) {
+		    printf("New shift = %d!\n", shift);
 		    shift = 0;
 		    maxdotp = 0;
 		    for (int j = 0; j <= 3; ++j) {
 			Vector3 tmp = U[j] - *prev_pt_v;
 			tmp.normalise();
 			double dotp = dot(vec, tmp);
-			if (dotp > maxdotp) {
-			    maxdotp = dotp + 1e-6; // Add small tolerance to stop 45 degree offset cases being flagged...
-			    shift = j;
-			}
+			printf("    %d : %.8f\n", j, dotp);
 		    }
-		    if (shift) {
-			printf("New shift = %d!\n", shift);
-			shift = 0;
-			maxdotp = 0;
-			for (int j = 0; j <= 3; ++j) {
-			    Vector3 tmp = U[j] - *prev_pt_v;
-			    tmp.normalise();
-			    double dotp = dot(vec, tmp);
-			    printf("    %d : %.8f\n", j, dotp);
-			}
-		    }
-#endif
-		} else {
-		    up = up_v;
 		}
-		last_right = right;
+#endif
+	    } else {
+		up = up_v;
 	    }
+	    last_right = right;
+	}
 
-	    // Scale to unit vectors in the LRUD plane.
-	    right.normalise();
-	    up.normalise();
+	// Scale to unit vectors in the LRUD plane.
+	right.normalise();
+	up.normalise();
 
-	    double l = fabs(pt_v.GetL());
-	    double r = fabs(pt_v.GetR());
-	    double u = fabs(pt_v.GetU());
-	    double d = fabs(pt_v.GetD());
+	double l = fabs(pt_v.GetL());
+	double r = fabs(pt_v.GetR());
+	double u = fabs(pt_v.GetU());
+	double d = fabs(pt_v.GetD());
 
-	    // Produce coordinates of the corners of the LRUD "plane".
-	    Vector3 v[4];
-	    v[0] = pt_v.GetPoint() - right * l + up * u;
-	    v[1] = pt_v.GetPoint() + right * r + up * u;
-	    v[2] = pt_v.GetPoint() + right * r - up * d;
-	    v[3] = pt_v.GetPoint() - right * l - up * d;
+	// Produce coordinates of the corners of the LRUD "plane".
+	Vector3 v[4];
+	v[0] = pt_v.GetPoint() - right * l + up * u;
+	v[1] = pt_v.GetPoint() + right * r + up * u;
+	v[2] = pt_v.GetPoint() + right * r - up * d;
+	v[3] = pt_v.GetPoint() - right * l - up * d;
+
+	skinner.corners(segment, right, v, U);
+
+	prev_pt_v = &pt_v;
+	U[0] = v[0];
+	U[1] = v[1];
+	U[2] = v[2];
+	U[3] = v[3];
+
+	++segment;
+    }
+}
 
-	    prev_pt_v = &pt_v;
-	    U[0] = v[0];
-	    U[1] = v[1];
-	    U[2] = v[2];
-	    U[3] = v[3];
+class RightBearingSetter : public TubeSkinner {
+    vector<XSect>& tube;
 
-	    // FIXME: Store rather than recomputing on each draw?
-	    (void)cover_end;
+  public:
+    explicit RightBearingSetter(vector<XSect>& tube_) : tube(tube_) { }
 
-	    pt_v.set_right_bearing(deg(atan2(right.GetX(), right.GetY())));
+    void corners(size_t i, const Vector3& right, const Vector3*, const Vector3*) {
+	tube[i].set_right_bearing(deg(atan2(right.GetX(), right.GetY())));
+    }
+};
 
-	    ++segment;
+void
+Model::do_prepare_tubes() const
+{
+    // Fill in "right_bearing" for each cross-section.
+    for (auto&& tube : tubes) {
+	RightBearingSetter setter(tube);
+	skin_tube(tube, setter);
+    }
+}
+
+// Order survey names so that the surveys inside a survey immediately follow
+// it - this is the usual string order except that the separator sorts before
+// any other character.
+class SurveyNameCmp {
+    wxChar separator;
+
+  public:
+    explicit SurveyNameCmp(wxChar separator_) : separator(separator_) { }
+
+    bool operator()(const wxString& a, const wxString& b) const {
+	size_t n = min(a.size(), b.size());
+	for (size_t i = 0; i != n; ++i) {
+	    wxChar ch_a = a[i];
+	    wxChar ch_b = b[i];
+	    if (ch_a == ch_b) continue;
+	    if (ch_a == separator) return true;
+	    if (ch_b == separator) return false;
+	    return ch_a < ch_b;
+	}
+	return a.size() < b.size();
+    }
+};
+
+static std::atomic<unsigned long> survey_tree_serial(0);
+
+void
+SurveyTree::build(vector<wxString>& names_, wxChar separator_)
+{
+    separator = separator_;
+    SurveyNameCmp cmp(separator);
+    sort(names_.begin(), names_.end(), cmp);
+    names_.erase(unique(names_.begin(), names_.end()), names_.end());
+
+    // Add any surveys which are only implied by the names of the surveys
+    // inside them.
+    size_t n = names_.size();
+    for (size_t i = 0; i != n; ++i) {
+	wxString name = names_[i];
+	while (true) {
+	    size_t sep = name.rfind(separator);
+	    if (sep == wxString::npos) break;
+	    name.erase(sep);
+	    if (binary_search(names_.begin(), names_.begin() + n, name, cmp))
+		break;
+	    names_.push_back(name);
+	}
+    }
+    if (names_.size() != n) {
+	sort(names_.begin(), names_.end(), cmp);
+	names_.erase(unique(names_.begin(), names_.end()), names_.end());
+    }
+
+    names.swap(names_);
+    subtree_end.resize(names.size());
+
+    // Find where each survey's subtree ends with a stack of the surveys
+    // which contain the current one.
+    vector<unsigned> open;
+    for (unsigned i = 0; i != names.size(); ++i) {
+	const wxString& name = names[i];
+	while (!open.empty()) {
+	    const wxString& parent = names[open.back()];
+	    if (name.size() > parent.size() &&
+		name[parent.size()] == separator &&
+		name.StartsWith(parent)) {
+		break;
+	    }
+	    subtree_end[open.back()] = i;
+	    open.pop_back();
 	}
+	open.push_back(i);
+    }
+    for (unsigned i : open) {
+	subtree_end[i] = names.size();
+    }
+
+    serial = ++survey_tree_serial;
+}
+
+void
+SurveyTree::clear()
+{
+    names.clear();
+    subtree_end.clear();
+    serial = 0;
+}
+
+unsigned
+SurveyTree::find(const wxString& name) const
+{
+    auto i = lower_bound(names.begin(), names.end(), name,
+			 SurveyNameCmp(separator));
+    if (i == names.end() || *i != name) return NONE;
+    return unsigned(i - names.begin());
+}
+
+void
+SurveyFilter::UpdateVisible(const SurveyTree& tree) const
+{
+    visible.assign(tree.size(), false);
+    // Filters never include a survey inside another (those go in
+    // redundant_filters) so this touches each survey at most once.
+    for (const wxString& name : filters) {
+	unsigned id = tree.find(name);
+	if (id == SurveyTree::NONE) continue;
+	unsigned end = tree.GetSubtreeEnd(id);
+	fill(visible.begin() + id, visible.begin() + end, true);
     }
+    visible_serial = tree.GetSerial();
 }
 
 void
 SurveyFilter::add(const wxString& name)
 {
+    visible_serial = 0;
     auto it = filters.lower_bound(name);
     if (it != filters.end()) {
 	// It's invalid to add a survey which is already present.
@@ -689,6 +898,7 @@ SurveyFilter::add(const wxString& name)
 void
 SurveyFilter::remove(const wxString& name)
 {
+    visible_serial = 0;
     if (filters.erase(name) == 0) {
 	redundant_filters.erase(name);
 	return;
@@ -717,6 +927,7 @@ SurveyFilter::SetSeparator(wxChar separator_)
     if (separator_ == separator) return;
 
     separator = separator_;
+    visible_serial = 0;
 
     if (filters.empty()) {
 	return;
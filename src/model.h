@@ -27,6 +27,7 @@
 #include "wx.h"
 
 #include "labelinfo.h"
+#include "stationindex.h"
 #include "vector3.h"
 
 #include <ctime>
@@ -60,6 +61,10 @@ public:
     XSect(const LabelInfo* stn_, int date_,
 	  double l_, double r_, double u_, double d_)
 	: stn(stn_), date(date_), l(l_), r(r_), u(u_), d(d_), right_bearing(0) { }
+    /// A copy of xs with different passage dimensions.
+    XSect(const XSect& xs, double l_, double r_, double u_, double d_)
+	: stn(xs.stn), date(xs.date), l(l_), r(r_), u(u_), d(d_),
+	  right_bearing(xs.right_bearing) { }
     double GetL() const { return l; }
     double GetR() const { return r; }
     double GetU() const { return u; }
@@ -74,6 +79,7 @@ public:
     double GetX() const { return stn->GetX(); }
     double GetY() const { return stn->GetY(); }
     double GetZ() const { return stn->GetZ(); }
+    unsigned GetSurvey() const { return stn->survey; }
     friend Vector3 operator-(const XSect& a, const XSect& b);
 };
 
@@ -81,8 +87,42 @@ inline Vector3 operator-(const XSect& a, const XSect& b) {
     return *(a.stn) - *(b.stn);
 }
 
-class traverse : public vector<PointInfo> {
+/// Receives the geometry of a passage tube from skin_tube().
+class TubeSkinner {
   public:
+    virtual ~TubeSkinner() { }
+
+    /** Called for each cross-section of the tube in turn.
+     *
+     *  @param i	Index of the cross-section in the tube.
+     *  @param right	Unit vector pointing right in the LRUD plane.
+     *  @param v	Corners of the LRUD plane for this cross-section (top
+     *			left, top right, bottom right, bottom left).
+     *  @param U	Corners for the previous cross-section, permuted to
+     *			minimise twisting around pitches (only meaningful if
+     *			i > 0).
+     */
+    virtual void corners(size_t i, const Vector3& right,
+			 const Vector3 v[4], const Vector3 U[4]) = 0;
+};
+
+/// Calculate the skin of a passage tube, which must contain at least two
+/// cross-sections.  The ends of the tube are the quadrilaterals given by v
+/// for the first and last cross-sections.
+void skin_tube(const vector<XSect>& tube, TubeSkinner& skinner);
+
+class traverse {
+    friend class Model;
+    // Points of all traverses are held contiguously by the Model - this is
+    // the index of our first one (used while loading) and then a pointer to
+    // it (once loading has finished and the array won't be reallocated).
+    size_t first = 0;
+    size_t n = 0;
+    const PointInfo* points = NULL;
+
+  public:
+    typedef const PointInfo* const_iterator;
+
     int n_legs = 0;
     // Bitmask of img_FLAG_SURFACE, img_FLAG_SPLAY and img_FLAG_DUPLICATE.
     int flags = 0;
@@ -91,24 +131,56 @@ class traverse : public vector<PointInfo> {
     double length = 0.0;
     enum { ERROR_3D = 0, ERROR_H = 1, ERROR_V = 2 };
     double errors[3] = {-1, -1, -1};
-    wxString name;
-
-    explicit
-    traverse(const char* name_) : name(name_, wxConvUTF8) {
-	if (name.empty() && !name_[0]) {
-	    // If name isn't valid UTF-8 then this conversion will
-	    // give an empty string.  In this case, assume that the
-	    // label is CP1252 (the Microsoft superset of ISO8859-1).
-	    static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
-	    name = wxString(name_, ConvCP1252);
-	    if (name.empty()) {
-		// Or if that doesn't work (ConvCP1252 doesn't like
-		// strings with some bytes in) let's just go for
-		// ISO8859-1.
-		name = wxString(name_, wxConvISO8859_1);
-	    }
-	}
-    }
+    // Id of the survey this traverse is in - see Model::GetSurveyName().
+    unsigned survey;
+
+    explicit traverse(unsigned survey_) : survey(survey_) { }
+
+    const_iterator begin() const { return points; }
+    const_iterator end() const { return points + n; }
+    size_t size() const { return n; }
+    const PointInfo& operator[](size_t i) const { return points[i]; }
+    const PointInfo& front() const { return points[0]; }
+    const PointInfo& back() const { return points[n - 1]; }
+};
+
+/** The hierarchy of surveys in a model.
+ *
+ *  Each survey gets an id, numbered such that the surveys inside it follow
+ *  it, so a survey and its descendants have a contiguous range of ids.
+ */
+class SurveyTree {
+    // Full name of each survey.
+    vector<wxString> names;
+    // One more than the last id of the surveys inside each survey.
+    vector<unsigned> subtree_end;
+    wxChar separator = '.';
+    // Changes each time the tree is built.
+    unsigned long serial = 0;
+
+  public:
+    static const unsigned NONE = unsigned(-1);
+
+    /** Build the tree from a list of survey names.
+     *
+     *  @param names_	The surveys - needn't be sorted and may contain
+     *			duplicates.  Surveys containing these are added
+     *			automatically.
+     */
+    void build(vector<wxString>& names_, wxChar separator_);
+
+    void clear();
+
+    unsigned size() const { return names.size(); }
+
+    /// Look up a survey by name, returning NONE if there isn't one.
+    unsigned find(const wxString& name) const;
+
+    const wxString& GetName(unsigned id) const { return names[id]; }
+
+    unsigned GetSubtreeEnd(unsigned id) const { return subtree_end[id]; }
+
+    unsigned long GetSerial() const { return serial; }
 };
 
 class SurveyFilter {
@@ -118,6 +190,13 @@ class SurveyFilter {
     // the survey separator is known is likely to not need rebuilding.
     wxChar separator = '.';
 
+    // Which surveys of a SurveyTree are visible, and the serial of the tree
+    // this was calculated for (0 if it needs recalculating).
+    mutable vector<bool> visible;
+    mutable unsigned long visible_serial = 0;
+
+    void UpdateVisible(const SurveyTree& tree) const;
+
   public:
     SurveyFilter() {}
 
@@ -125,24 +204,66 @@ class SurveyFilter {
 
     void remove(const wxString& survey);
 
-    void clear() { filters.clear(); redundant_filters.clear(); }
+    void clear() {
+	filters.clear();
+	redundant_filters.clear();
+	visible_serial = 0;
+    }
 
     bool empty() const { return filters.empty(); }
 
     void SetSeparator(wxChar separator_);
 
     bool CheckVisible(const wxString& name) const;
+
+    /** Check if survey id in tree is visible.
+     *
+     *  This gives the same answer as CheckVisible(tree.GetName(id)), but
+     *  takes constant time (except the first time it is called after the
+     *  filter or tree changes).  It isn't safe to call from more than one
+     *  thread at once.
+     */
+    bool CheckVisible(const SurveyTree& tree, unsigned id) const {
+	if (visible_serial != tree.GetSerial()) UpdateVisible(tree);
+	return visible[id];
+    }
+};
+
+/// Receives progress reports from Model::Load().
+class LoadProgress {
+  public:
+    virtual ~LoadProgress() { }
+
+    /** Called periodically while loading.
+     *
+     *  @param percent	Roughly how much of the file has been read.
+     *
+     *  @return false to abandon loading.
+     */
+    virtual bool Progress(int percent) = 0;
 };
 
 /// Cave model.
 class Model {
-    list<traverse> traverses[8];
+    vector<traverse> traverses[8];
+    // The points of all the traverses, grouped by traverses[] entry.
+    vector<PointInfo> points;
+    // The surveys which traverses and stations are in.
+    SurveyTree survey_tree;
     mutable list<vector<XSect>> tubes;
 
+    // The stations - m_Labels points into this, so loading a new survey
+    // invalidates any LabelInfo pointers held elsewhere.
+    vector<LabelInfo> labels;
+    // Pointers to the stations sorted by name (using wxString's ordering, so
+    // suitable for binary chopping but not for display).
+    vector<const LabelInfo*> labels_by_name;
+
   public: // FIXME
-    list<LabelInfo*> m_Labels;
+    vector<LabelInfo*> m_Labels;
 
   private:
+    StationIndex m_StationIndex;
     Vector3 m_Ext;
     double m_DepthMin, m_DepthExt;
     int m_DateMin, m_DateExt;
@@ -172,7 +293,28 @@ class Model {
     void CentreDataset(const Vector3& vmin);
 
   public:
-    int Load(const wxString& file, const wxString& prefix);
+    /// Returned by Load() if it's cancelled by its LoadProgress object.
+    enum { LOAD_CANCELLED = -1 };
+
+    Model() = default;
+
+    // The traverses point into the points array, so a copy would need fixing
+    // up - moving is fine though.
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    Model(Model&&) = default;
+    Model& operator=(Model&&) = default;
+
+    /** Load a processed survey.
+     *
+     *  This only touches this object, so can be called from a worker thread
+     *  to load into a Model which is then moved into place.
+     *
+     *  @return 0 on success, LOAD_CANCELLED, or a message number describing
+     *	the error.
+     */
+    int Load(const wxString& file, const wxString& prefix,
+	     LoadProgress* progress = NULL);
 
     const Vector3& GetExtent() const { return m_Ext; }
 
@@ -208,33 +350,44 @@ class Model {
 
     const Vector3& GetOffset() const { return m_Offset; }
 
-    list<traverse>::const_iterator
+    const StationIndex& GetStationIndex() const { return m_StationIndex; }
+
+    const SurveyTree& GetSurveyTree() const { return survey_tree; }
+
+    const wxString& GetSurveyName(unsigned survey) const {
+	return survey_tree.GetName(survey);
+    }
+
+    /// Look up a station by its full name, returning NULL if there isn't one.
+    const LabelInfo* FindStation(const wxString& name) const;
+
+    vector<traverse>::const_iterator
     traverses_begin(unsigned flags, const SurveyFilter* filter) const {
 	if (flags >= sizeof(traverses)) return traverses[0].end();
 	auto it = traverses[flags].begin();
 	if (filter) {
 	    while (it != traverses[flags].end() &&
-		   !filter->CheckVisible(it->name)) {
+		   !filter->CheckVisible(survey_tree, it->survey)) {
 		++it;
 	    }
 	}
 	return it;
     }
 
-    list<traverse>::const_iterator
+    vector<traverse>::const_iterator
     traverses_next(unsigned flags, const SurveyFilter* filter,
-		   list<traverse>::const_iterator it) const {
+		   vector<traverse>::const_iterator it) const {
 	++it;
 	if (filter) {
 	    while (it != traverses[flags].end() &&
-		   !filter->CheckVisible(it->name)) {
+		   !filter->CheckVisible(survey_tree, it->survey)) {
 		++it;
 	    }
 	}
 	return it;
     }
 
-    list<traverse>::const_iterator traverses_end(unsigned flags) const {
+    vector<traverse>::const_iterator traverses_end(unsigned flags) const {
 	if (flags >= sizeof(traverses)) flags = 0;
 	return traverses[flags].end();
     }
@@ -257,27 +410,27 @@ class Model {
 	return tubes.end();
     }
 
-    list<LabelInfo*>::const_iterator GetLabels() const {
+    vector<LabelInfo*>::const_iterator GetLabels() const {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::const_iterator GetLabelsEnd() const {
+    vector<LabelInfo*>::const_iterator GetLabelsEnd() const {
 	return m_Labels.end();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
 	return m_Labels.rbegin();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
 	return m_Labels.rend();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNC() {
+    vector<LabelInfo*>::iterator GetLabelsNC() {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNCEnd() {
+    vector<LabelInfo*>::iterator GetLabelsNCEnd() {
 	return m_Labels.end();
     }
 
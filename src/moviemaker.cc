@@ -76,6 +76,9 @@ enum {
     MOVIE_AUDIO_ONLY,
     MOVIE_FILENAME_TOO_LONG
 };
+
+// How many frames can be waiting to be encoded.
+const unsigned FRAME_BUFFERS = 4;
 #endif
 
 MovieMaker::MovieMaker()
@@ -172,6 +175,8 @@ bool MovieMaker::Open(FILE* fh, const char * ext, int width, int height)
 	// but may slow encoding and decoding.
 	context->max_b_frames = 4;
     }
+    // Let the encoder use as many threads as it sees fit.
+    context->thread_count = 0;
 
     /* Some formats want stream headers to be separate. */
     if (oc->oformat->flags & AVFMT_GLOBALHEADER)
@@ -215,7 +220,7 @@ bool MovieMaker::Open(FILE* fh, const char * ext, int width, int height)
 	return false;
     }
 
-    pixels = (unsigned char *)av_malloc(width * height * 6);
+    pixels = (unsigned char *)av_malloc(width * height * 3 * FRAME_BUFFERS);
     if (!pixels) {
 	averrno = AVERROR(ENOMEM);
 	return false;
@@ -252,7 +257,17 @@ bool MovieMaker::Open(FILE* fh, const char * ext, int width, int height)
 	return false;
     }
 
+    // The worker thread converts each frame straight into the encoder's
+    // frame, which only works for the pixel format it was allocated for.
+    if (context->pix_fmt != AV_PIX_FMT_YUV420P) {
+	// FIXME convert...
+	abort();
+    }
+
     averrno = 0;
+    frames_added = frames_encoded = 0;
+    closing = false;
+    worker = std::thread(&MovieMaker::encode_frames, this);
     return true;
 #else
     (void)fh;
@@ -265,7 +280,13 @@ bool MovieMaker::Open(FILE* fh, const char * ext, int width, int height)
 
 unsigned char * MovieMaker::GetBuffer() const {
 #ifdef WITH_LIBAV
-    return pixels + GetWidth() * GetHeight() * 3;
+    std::unique_lock<std::mutex> lock(mutex);
+    // Wait for a buffer to be free (or for the encoder to fail, in which case
+    // AddFrame() will report the error).
+    cond.wait(lock, [this] {
+	return frames_added - frames_encoded < FRAME_BUFFERS || averrno;
+    });
+    return pixels + GetWidth() * GetHeight() * 3 * (frames_added % FRAME_BUFFERS);
 #else
     return NULL;
 #endif
@@ -308,7 +329,6 @@ MovieMaker::encode_frame(AVFrame* frame_or_null)
 	ret = av_interleaved_write_frame(oc, pkt);
 	if (ret < 0) {
 	    av_packet_free(&pkt);
-	    release();
 	    return ret;
 	}
     }
@@ -317,45 +337,66 @@ MovieMaker::encode_frame(AVFrame* frame_or_null)
 }
 #endif
 
-bool MovieMaker::AddFrame()
-{
 #ifdef WITH_LIBAV
-    int ret = av_frame_make_writable(frame);
-    if (ret < 0) {
-	averrno = ret;
-	return false;
-    }
-
-    enum AVPixelFormat pix_fmt = context->pix_fmt;
+// Run by the worker thread.
+void
+MovieMaker::encode_frames()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+	cond.wait(lock, [this] {
+	    return frames_encoded != frames_added || closing;
+	});
+	if (frames_encoded == frames_added) break;
+
+	size_t size = GetWidth() * GetHeight() * 3;
+	const unsigned char * src = pixels + size * (frames_encoded % FRAME_BUFFERS);
+	lock.unlock();
+
+	int ret = av_frame_make_writable(frame);
+	if (ret >= 0) {
+	    // OpenGL gives us the rows bottom up, so convert from the last row
+	    // upwards to flip the image vertically.
+	    int len = 3 * GetWidth();
+	    src += size - len;
+	    len = -len;
+	    sws_scale(sws_ctx, &src, &len, 0, GetHeight(),
+		      frame->data, frame->linesize);
+
+	    ++frame->pts;
+
+	    // Encode this frame.
+	    ret = encode_frame(frame);
+	}
 
-    if (pix_fmt != AV_PIX_FMT_YUV420P) {
-	// FIXME convert...
-	abort();
+	lock.lock();
+	++frames_encoded;
+	if (ret < 0) averrno = ret;
+	cond.notify_all();
+	if (ret < 0) break;
     }
+}
 
-    int len = 3 * GetWidth();
+void
+MovieMaker::stop_worker()
+{
+    if (!worker.joinable()) return;
     {
-	// Flip image vertically
-	int h = GetHeight();
-	unsigned char * src = pixels + h * len;
-	unsigned char * dest = src - len;
-	while (h--) {
-	    memcpy(dest, src, len);
-	    src += len;
-	    dest -= len;
-	}
+	std::lock_guard<std::mutex> lock(mutex);
+	closing = true;
     }
-    sws_scale(sws_ctx, &pixels, &len, 0, GetHeight(),
-	      frame->data, frame->linesize);
-
-    ++frame->pts;
+    cond.notify_all();
+    worker.join();
+}
+#endif
 
-    // Encode this frame.
-    ret = encode_frame(frame);
-    if (ret < 0) {
-	averrno = ret;
-	return false;
-    }
+bool MovieMaker::AddFrame()
+{
+#ifdef WITH_LIBAV
+    std::lock_guard<std::mutex> lock(mutex);
+    if (averrno) return false;
+    ++frames_added;
+    cond.notify_all();
 #endif
     return true;
 }
@@ -364,7 +405,14 @@ bool
 MovieMaker::Close()
 {
 #ifdef WITH_LIBAV
-    if (video_st && averrno == 0) {
+    // Wait for the frames already added to be encoded.
+    stop_worker();
+    if (averrno) {
+	// Encoding a frame failed.
+	release();
+	return false;
+    }
+    if (video_st) {
 	// Flush out any remaining data.
 	int ret = encode_frame(NULL);
 	if (ret < 0) {
@@ -383,6 +431,8 @@ MovieMaker::Close()
 void
 MovieMaker::release()
 {
+    stop_worker();
+
     // Close codec.
     avcodec_free_context(&context);
     av_frame_free(&frame);
@@ -29,6 +29,12 @@
 
 #include <stdio.h>
 
+#ifdef WITH_LIBAV
+# include <condition_variable>
+# include <mutex>
+# include <thread>
+#endif
+
 struct AVCodecContext;
 struct AVFormatContext;
 struct AVStream;
@@ -56,13 +62,29 @@ class MovieMaker {
     int averrno;
     FILE* fh_to_close;
 
+    // Except with old libav/FFmpeg versions, frames are converted and encoded
+    // by a worker thread.  The pixels are then a ring of FRAME_BUFFERS
+    // buffers, so the caller can read back the next frames while earlier
+    // ones are being encoded.
+    std::thread worker;
+    mutable std::mutex mutex;
+    mutable std::condition_variable cond;
+    unsigned long frames_added = 0, frames_encoded = 0;
+    bool closing = false;
+
     int encode_frame(AVFrame* frame);
+    void encode_frames();
+    void stop_worker();
     void release();
 #endif
 
 public:
     MovieMaker();
     bool Open(FILE* fh, const char* ext, int width, int height);
+    /** Get the buffer to read the next frame into.
+     *
+     *  This may wait for the encoder to finish with an earlier frame.
+     */
     unsigned char * GetBuffer() const;
     int GetWidth() const;
     int GetHeight() const;
@@ -0,0 +1,238 @@
+/* nameindex.cc
+ * Trigram index over station names.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "nameindex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+static inline unsigned
+trigram(const char* p)
+{
+    return (unsigned(static_cast<unsigned char>(p[0])) << 16) |
+	   (unsigned(static_cast<unsigned char>(p[1])) << 8) |
+	   unsigned(static_cast<unsigned char>(p[2]));
+}
+
+// Skip one UTF-8 encoded character.
+static inline const char*
+next_char(const char* s)
+{
+    do {
+	++s;
+    } while ((static_cast<unsigned char>(*s) & 0xc0) == 0x80);
+    return s;
+}
+
+// Match a glob pattern against the whole of s.
+static bool
+glob_match(const char* p, const char* s)
+{
+    // Where to resume if the text after the last "*" fails to match.
+    const char* star = NULL;
+    const char* resume = NULL;
+    while (*s) {
+	if (*p == '*') {
+	    star = ++p;
+	    resume = s;
+	} else if (*p == '?') {
+	    ++p;
+	    s = next_char(s);
+	} else if (*p && *p == *s) {
+	    ++p;
+	    ++s;
+	} else if (star) {
+	    // Let the "*" match one more character and try again.
+	    p = star;
+	    s = resume = next_char(resume);
+	} else {
+	    return false;
+	}
+    }
+    while (*p == '*') ++p;
+    return *p == '\0';
+}
+
+void
+NameIndex::build(const vector<LabelInfo*>& labels)
+{
+    clear();
+    stations = labels;
+
+    struct Posting {
+	vector<unsigned char> data;
+	unsigned last = 0;
+	unsigned count = 0;
+    };
+    unordered_map<unsigned, Posting> postings_by_trigram;
+
+    starts.reserve(labels.size() + 1);
+    for (unsigned id = 0; id != labels.size(); ++id) {
+	size_t start = names.size();
+	starts.push_back(start);
+	names += labels[id]->GetText().Lower().utf8_str();
+	size_t end = names.size();
+	names += '\0';
+
+	for (size_t i = start; i + 3 <= end; ++i) {
+	    Posting& posting = postings_by_trigram[trigram(&names[i])];
+	    // Only list each station once for a trigram.
+	    if (posting.count && posting.last == id) continue;
+	    unsigned delta = id - posting.last;
+	    while (delta >= 0x80) {
+		posting.data.push_back(delta & 0x7f);
+		delta >>= 7;
+	    }
+	    posting.data.push_back(delta | 0x80);
+	    posting.last = id;
+	    ++posting.count;
+	}
+    }
+    starts.push_back(names.size());
+
+    trigrams.reserve(postings_by_trigram.size());
+    for (auto&& i : postings_by_trigram) {
+	trigrams.push_back(i.first);
+    }
+    sort(trigrams.begin(), trigrams.end());
+    posting_starts.reserve(trigrams.size());
+    posting_counts.reserve(trigrams.size());
+    for (unsigned t : trigrams) {
+	Posting& posting = postings_by_trigram[t];
+	posting_starts.push_back(postings.size());
+	posting_counts.push_back(posting.count);
+	postings.insert(postings.end(), posting.data.begin(), posting.data.end());
+	vector<unsigned char>().swap(posting.data);
+    }
+}
+
+void
+NameIndex::clear()
+{
+    names.clear();
+    starts.clear();
+    stations.clear();
+    trigrams.clear();
+    posting_starts.clear();
+    posting_counts.clear();
+    postings.clear();
+}
+
+void
+NameIndex::decode(size_t t, vector<unsigned>& ids) const
+{
+    ids.clear();
+    ids.reserve(posting_counts[t]);
+    const unsigned char* p = &postings[posting_starts[t]];
+    unsigned id = 0;
+    for (unsigned n = posting_counts[t]; n; --n) {
+	unsigned delta = 0;
+	int shift = 0;
+	unsigned char b;
+	do {
+	    b = *p++;
+	    delta |= unsigned(b & 0x7f) << shift;
+	    shift += 7;
+	} while (!(b & 0x80));
+	id += delta;
+	ids.push_back(id);
+    }
+}
+
+bool
+NameIndex::matches(unsigned id, const string& pattern, bool glob) const
+{
+    const char* name = names.data() + starts[id];
+    if (glob) return glob_match(pattern.c_str(), name);
+    return strstr(name, pattern.c_str()) != NULL;
+}
+
+void
+NameIndex::search(const wxString& pattern_, vector<unsigned>& ids,
+		  const vector<unsigned>* candidates) const
+{
+    ids.clear();
+    string pattern(pattern_.Lower().utf8_str());
+    bool glob = pattern.find_first_of("*?") != string::npos;
+
+    // Find the stations listed for each trigram in the literal parts of the
+    // pattern.
+    vector<pair<unsigned, size_t>> lists;
+    size_t run = 0;
+    for (size_t i = 0; i != pattern.size(); ++i) {
+	if (pattern[i] == '*' || pattern[i] == '?') {
+	    run = 0;
+	    continue;
+	}
+	if (++run < 3) continue;
+	unsigned key = trigram(&pattern[i - 2]);
+	auto t = lower_bound(trigrams.begin(), trigrams.end(), key);
+	if (t == trigrams.end() || *t != key) {
+	    // No station name contains this trigram.
+	    return;
+	}
+	size_t index = t - trigrams.begin();
+	lists.push_back(make_pair(posting_counts[index], index));
+    }
+    // Intersect the shortest lists first.
+    sort(lists.begin(), lists.end());
+    lists.erase(unique(lists.begin(), lists.end()), lists.end());
+
+    bool all = (candidates == NULL);
+    vector<unsigned> found, posting, tmp;
+    if (candidates) found = *candidates;
+    for (auto&& list : lists) {
+	// Once there are only a few possible matches it's quicker to check
+	// them directly than to decode long lists of stations.
+	if (!all && found.size() * 8 < list.first) break;
+	decode(list.second, posting);
+	if (all) {
+	    found.swap(posting);
+	    all = false;
+	    continue;
+	}
+	tmp.clear();
+	set_intersection(found.begin(), found.end(),
+			 posting.begin(), posting.end(),
+			 back_inserter(tmp));
+	found.swap(tmp);
+	if (found.empty()) return;
+    }
+
+    if (all) {
+	// No trigrams to narrow the search, so check every station.
+	for (unsigned id = 0; id != stations.size(); ++id) {
+	    if (matches(id, pattern, glob)) ids.push_back(id);
+	}
+	return;
+    }
+    for (unsigned id : found) {
+	if (matches(id, pattern, glob)) ids.push_back(id);
+    }
+}
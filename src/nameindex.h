@@ -0,0 +1,80 @@
+/* nameindex.h
+ * Trigram index over station names.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef nameindex_h
+#define nameindex_h
+
+#include "labelinfo.h"
+
+#include <string>
+#include <vector>
+
+/** Index of station names for searching.
+ *
+ *  Station names are folded to lower case and each is indexed by the three
+ *  byte sequences ("trigrams") it contains.  A search only needs to check the
+ *  names containing all the trigrams in the pattern.
+ */
+class NameIndex {
+    // The lower case names, each followed by a zero byte.
+    std::string names;
+    // Offset of the start of each name in names.
+    std::vector<unsigned> starts;
+    std::vector<LabelInfo*> stations;
+
+    // The trigrams in sorted order, and where the list of stations containing
+    // each starts in postings.  The lists are delta encoded with 7 bits per
+    // byte and the top bit set on the last byte for each delta.
+    std::vector<unsigned> trigrams;
+    std::vector<unsigned> posting_starts;
+    std::vector<unsigned> posting_counts;
+    std::vector<unsigned char> postings;
+
+    void decode(size_t t, std::vector<unsigned>& ids) const;
+
+    bool matches(unsigned id, const std::string& pattern, bool glob) const;
+
+  public:
+    void build(const std::vector<LabelInfo*>& labels);
+
+    void clear();
+
+    size_t size() const { return stations.size(); }
+
+    LabelInfo* station(unsigned id) const { return stations[id]; }
+
+    /** Find stations matching a pattern.
+     *
+     *  The match ignores case.  In the pattern "*" matches any sequence of
+     *  characters and "?" any single character, and the whole name must
+     *  match.  A pattern with neither matches any name containing it.
+     *
+     *  @param pattern		The pattern.
+     *  @param ids		Set to the ids of the matching stations, in
+     *				ascending order.
+     *  @param candidates	If not NULL, only these stations (in ascending
+     *				order) can match - e.g. the matches for a
+     *				pattern which this one contains.
+     */
+    void search(const wxString& pattern, std::vector<unsigned>& ids,
+		const std::vector<unsigned>* candidates = NULL) const;
+};
+
+#endif
@@ -436,14 +436,17 @@ replace_travs(void)
      * term - these messages mostly indicate how processing is progressing. */
    out_current_action(msg(/*Calculating traverses*/127));
 
-   if (!fhErrStat && !fSuppress)
+   if (!fhErrStat && !fSuppress) {
       fhErrStat = safe_fopen_with_ext(fnm_output_base, EXT_SVX_ERRS, "w");
+      set_close_on_exec(fhErrStat);
+   }
 
    if (!pimg) {
       char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
       filename_register_output(fnm);
       pimg = img_open_write_cs(fnm, survey_title, proj_str_out, 0);
       if (!pimg) fatalerror(img_error(), fnm);
+      set_close_on_exec(pimg->fh);
       osfree(fnm);
    }
 
@@ -31,6 +31,7 @@
 #include <wx/statbox.h>
 #include <wx/valgen.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <stdio.h>
@@ -188,6 +189,34 @@ class svxPrintout : public wxPrintout {
 
     bool fBlankPage;
 
+    // What's drawn is projected once per layout and each part noted against
+    // the pages it falls on, so each page only needs to draw its own
+    // contents rather than everything in the survey.
+    enum { PEN_LEG, PEN_SURFACE_LEG, PEN_SPLAY };
+    struct PageSegment {
+	long x1, y1, x2, y2;
+	int pen;
+    };
+    struct PageLabel {
+	long x, y;
+	const LabelInfo* label;
+    };
+    vector<PageSegment> segments;
+    vector<PageLabel> labels;
+    // Indexed by (row * pagesX + column), with row 0 at the bottom.
+    vector<vector<unsigned>> page_segments, page_labels;
+    // The page size the contents were binned for (0 if not yet binned).
+    int binned_width, binned_depth;
+
+    // If recording_pen is set, MoveTo() and DrawTo() add to segments
+    // instead of drawing.
+    int recording_pen;
+    long x_rec, y_rec;
+
+    void BinPageContents();
+    void AddToPages(vector<vector<unsigned>>& pages, unsigned item,
+		    long x_min, long y_min, long x_max, long y_max);
+
     int check_intersection(long x_p, long y_p);
     void draw_info_box();
     void draw_scale_bar(double x, double y, double MaxLength);
@@ -270,6 +299,7 @@ static wxString formats[] = {
     wxT("CSV"),
     wxT("DXF"),
     wxT("EPS"),
+    wxT("glTF"),
     wxT("GPX"),
     wxT("HPGL"),
     wxT("JSON"),
@@ -865,6 +895,7 @@ svxPrintDlg::RecalcBounds()
     double COST = cos(rad(m_layout.tilt));
 
     const SurveyFilter* filter = mainfrm->GetTreeFilter();
+    const SurveyTree& tree = mainfrm->GetSurveyTree();
     int show_mask = m_layout.get_effective_show_mask();
     if (show_mask & LEGS) {
 	for (int f = 0; f != 8; ++f) {
@@ -876,11 +907,11 @@ svxPrintDlg::RecalcBounds()
 		// Not showing because it's a splay.
 		continue;
 	    }
-	    list<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = mainfrm->traverses_end(f);
+	    vector<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
+	    vector<traverse>::const_iterator tend = mainfrm->traverses_end(f);
 	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, filter, trav)) {
-		vector<PointInfo>::const_iterator pos = trav->begin();
-		vector<PointInfo>::const_iterator end = trav->end();
+		traverse::const_iterator pos = trav->begin();
+		traverse::const_iterator end = trav->end();
 		for ( ; pos != end; ++pos) {
 		    double x = pos->GetX();
 		    double y = pos->GetY();
@@ -914,7 +945,7 @@ svxPrintDlg::RecalcBounds()
 		    Double d = pt_v.GetD();
 
 		    if (u >= 0 || d >= 0) {
-			if (filter && !filter->CheckVisible(pt_v.GetLabel()))
+			if (filter && !filter->CheckVisible(tree, pt_v.GetSurvey()))
 			    continue;
 
 			double x = pt_v.GetX();
@@ -1003,7 +1034,7 @@ svxPrintDlg::RecalcBounds()
 		    Double r = pt_v.GetR();
 
 		    if (l >= 0 || r >= 0) {
-			if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
+			if (!filter || filter->CheckVisible(tree, pt_v.GetSurvey())) {
 			    // Get the x and y coordinates of the survey station
 			    double pt_X = pt_v.GetX() * COS - pt_v.GetY() * SIN;
 			    double pt_Y = pt_v.GetX() * SIN + pt_v.GetY() * COS;
@@ -1051,7 +1082,7 @@ svxPrintDlg::RecalcBounds()
 	for (auto label = mainfrm->GetLabels();
 	     label != mainfrm->GetLabelsEnd();
 	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
+	    if (filter && !filter->CheckVisible(tree, (*label)->survey))
 		continue;
 	    double x = (*label)->GetX();
 	    double y = (*label)->GetY();
@@ -1079,7 +1110,8 @@ static const char *fontname = "Arial", *fontname_labels = "Arial";
 svxPrintout::svxPrintout(MainFrm *mainfrm_, layout *l,
 			 wxPageSetupDialogData *data, const wxString & title)
     : wxPrintout(title), font_labels(NULL), font_default(NULL),
-      scan_for_blank_pages(false)
+      scan_for_blank_pages(false), binned_width(0), binned_depth(0),
+      recording_pen(-1)
 {
     mainfrm = mainfrm_;
     m_layout = l;
@@ -1529,11 +1561,6 @@ svxPrintout::OnPrintPage(int pageNum) {
 	l->PaperDepth = pdepth -= MarginTop + MarginBottom;
     }
 
-    double SIN = sin(rad(l->rot));
-    double COS = cos(rad(l->rot));
-    double SINT = sin(rad(l->tilt));
-    double COST = cos(rad(l->tilt));
-
     NewPage(pageNum, l->pagesX, l->pagesY);
 
     if (l->Legend && pageNum == (l->pagesY - 1) * l->pagesX + 1) {
@@ -1543,90 +1570,38 @@ svxPrintout::OnPrintPage(int pageNum) {
 
     pdc->SetClippingRegion(x_offset, y_offset, xpPageWidth + 1, ypPageDepth + 1);
 
-    const double Sc = 1000 / l->Scale;
-
-    const SurveyFilter* filter = mainfrm->GetTreeFilter();
-    int show_mask = l->get_effective_show_mask();
-    if (show_mask & (LEGS|SURF)) {
-	for (int f = 0; f != 8; ++f) {
-	    if ((show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
-		// Not showing traverse because of surface/underground status.
-		continue;
-	    }
-	    if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
-		// Not showing because it's a splay.
-		continue;
-	    }
-	    if (f & img_FLAG_SPLAY) {
-		pdc->SetPen(*pen_splay);
-	    } else if (f & img_FLAG_SURFACE) {
-		pdc->SetPen(*pen_surface_leg);
-	    } else {
-		pdc->SetPen(*pen_leg);
-	    }
-	    list<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = mainfrm->traverses_end(f);
-	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, filter, trav)) {
-		vector<PointInfo>::const_iterator pos = trav->begin();
-		vector<PointInfo>::const_iterator end = trav->end();
-		for ( ; pos != end; ++pos) {
-		    double x = pos->GetX();
-		    double y = pos->GetY();
-		    double z = pos->GetZ();
-		    double X = x * COS - y * SIN;
-		    double Y = z * COST - (x * SIN + y * COS) * SINT;
-		    long px = (long)((X * Sc + l->xOrg) * l->scX);
-		    long py = (long)((Y * Sc + l->yOrg) * l->scY);
-		    if (pos == trav->begin()) {
-			MoveTo(px, py);
-		    } else {
-			DrawTo(px, py);
-		    }
-		}
-	    }
-	}
+    if (binned_width != xpPageWidth || binned_depth != ypPageDepth) {
+	BinPageContents();
     }
-
-    if ((show_mask & XSECT) &&
-	(l->tilt == 0.0 || l->tilt == 90.0 || l->tilt == -90.0)) {
-	pdc->SetPen(*pen_splay);
-	list<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
-	list<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
-	for ( ; trav != tend; ++trav) {
-	    if (l->tilt == 0.0) {
-		PlotUD(*trav);
-	    } else {
-		// m_layout.tilt is 90.0 or -90.0 due to check above.
-		PlotLR(*trav);
-	    }
+    int page_x = (pageNum - 1) % l->pagesX;
+    int page_y = l->pagesY - 1 - ((pageNum - 1) / l->pagesX);
+    unsigned page = page_y * l->pagesX + page_x;
+
+    wxPen* pens[] = { pen_leg, pen_surface_leg, pen_splay };
+    int pen = -1;
+    for (unsigned i : page_segments[page]) {
+	const PageSegment& segment = segments[i];
+	if (segment.pen != pen) {
+	    pen = segment.pen;
+	    pdc->SetPen(*pens[pen]);
 	}
+	MoveTo(segment.x1, segment.y1);
+	DrawTo(segment.x2, segment.y2);
     }
 
+    int show_mask = l->get_effective_show_mask();
     if (show_mask & (LABELS|STNS)) {
 	if (show_mask & LABELS) SetFont(font_labels);
-	for (auto label = mainfrm->GetLabels();
-	     label != mainfrm->GetLabelsEnd();
-	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
-		continue;
-	    double px = (*label)->GetX();
-	    double py = (*label)->GetY();
-	    double pz = (*label)->GetZ();
-	    if ((show_mask & SURF) || (*label)->IsUnderground()) {
-		double X = px * COS - py * SIN;
-		double Y = pz * COST - (px * SIN + py * COS) * SINT;
-		long xnew, ynew;
-		xnew = (long)((X * Sc + l->xOrg) * l->scX);
-		ynew = (long)((Y * Sc + l->yOrg) * l->scY);
-		if (show_mask & STNS) {
-		    pdc->SetPen(*pen_cross);
-		    DrawCross(xnew, ynew);
-		}
-		if (show_mask & LABELS) {
-		    pdc->SetTextForeground(colour_labels);
-		    MoveTo(xnew, ynew);
-		    WriteString((*label)->GetText());
-		}
+	for (unsigned i : page_labels[page]) {
+	    const PageLabel& label = labels[i];
+	    if (show_mask & STNS) {
+		pdc->SetPen(*pen_cross);
+		DrawCross(label.x, label.y);
+	    }
+	    if (show_mask & LABELS) {
+		pdc->SetTextForeground(colour_labels);
+		MoveTo(label.x, label.y);
+		WriteString(label.label->GetText());
 	    }
 	}
     }
@@ -1650,6 +1625,8 @@ svxPrintout::HasPage(int pageNum) {
 void
 svxPrintout::OnBeginPrinting() {
     /* Initialise printer routines */
+    binned_width = binned_depth = 0;
+
     fontsize_labels = 10;
     fontsize = 10;
 
@@ -1754,6 +1731,11 @@ svxPrintout::check_intersection(long x_p, long y_p)
 void
 svxPrintout::MoveTo(long x, long y)
 {
+    if (recording_pen >= 0) {
+	x_rec = x;
+	y_rec = y;
+	return;
+    }
     x_t = x_offset + x - clip.x_min;
     y_t = y_offset + clip.y_max - y;
 }
@@ -1761,6 +1743,14 @@ svxPrintout::MoveTo(long x, long y)
 void
 svxPrintout::DrawTo(long x, long y)
 {
+    if (recording_pen >= 0) {
+	AddToPages(page_segments, segments.size(),
+		   min(x_rec, x), min(y_rec, y), max(x_rec, x), max(y_rec, y));
+	segments.push_back(PageSegment{x_rec, y_rec, x, y, recording_pen});
+	x_rec = x;
+	y_rec = y;
+	return;
+    }
     long x_p = x_t, y_p = y_t;
     x_t = x_offset + x - clip.x_min;
     y_t = y_offset + clip.y_max - y;
@@ -2007,10 +1997,162 @@ svxPrintout::NewPage(int pg, int pagesX, int pagesY)
     drawticks((int)(9 * m_layout->scX / POINTS_PER_MM), x, y);
 }
 
+// Project everything to be drawn and note which pages each part is on.
+void
+svxPrintout::BinPageContents()
+{
+    layout * l = m_layout;
+    binned_width = xpPageWidth;
+    binned_depth = ypPageDepth;
+    segments.clear();
+    labels.clear();
+    page_segments.clear();
+    page_segments.resize(l->pagesX * l->pagesY);
+    page_labels.clear();
+    page_labels.resize(l->pagesX * l->pagesY);
+
+    double SIN = sin(rad(l->rot));
+    double COS = cos(rad(l->rot));
+    double SINT = sin(rad(l->tilt));
+    double COST = cos(rad(l->tilt));
+
+    const double Sc = 1000 / l->Scale;
+
+    const SurveyFilter* filter = mainfrm->GetTreeFilter();
+    const SurveyTree& tree = mainfrm->GetSurveyTree();
+    int show_mask = l->get_effective_show_mask();
+    if (show_mask & (LEGS|SURF)) {
+	for (int f = 0; f != 8; ++f) {
+	    if ((show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
+		// Not showing traverse because of surface/underground status.
+		continue;
+	    }
+	    if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
+		// Not showing because it's a splay.
+		continue;
+	    }
+	    if (f & img_FLAG_SPLAY) {
+		recording_pen = PEN_SPLAY;
+	    } else if (f & img_FLAG_SURFACE) {
+		recording_pen = PEN_SURFACE_LEG;
+	    } else {
+		recording_pen = PEN_LEG;
+	    }
+	    vector<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
+	    vector<traverse>::const_iterator tend = mainfrm->traverses_end(f);
+	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, filter, trav)) {
+		traverse::const_iterator pos = trav->begin();
+		traverse::const_iterator end = trav->end();
+		for ( ; pos != end; ++pos) {
+		    double x = pos->GetX();
+		    double y = pos->GetY();
+		    double z = pos->GetZ();
+		    double X = x * COS - y * SIN;
+		    double Y = z * COST - (x * SIN + y * COS) * SINT;
+		    long px = (long)((X * Sc + l->xOrg) * l->scX);
+		    long py = (long)((Y * Sc + l->yOrg) * l->scY);
+		    if (pos == trav->begin()) {
+			MoveTo(px, py);
+		    } else {
+			DrawTo(px, py);
+		    }
+		}
+	    }
+	}
+    }
+
+    if ((show_mask & XSECT) &&
+	(l->tilt == 0.0 || l->tilt == 90.0 || l->tilt == -90.0)) {
+	recording_pen = PEN_SPLAY;
+	list<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
+	list<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
+	for ( ; trav != tend; ++trav) {
+	    if (l->tilt == 0.0) {
+		PlotUD(*trav);
+	    } else {
+		// m_layout.tilt is 90.0 or -90.0 due to check above.
+		PlotLR(*trav);
+	    }
+	}
+    }
+    recording_pen = -1;
+
+    if (show_mask & (LABELS|STNS)) {
+	// Measure labels as WriteString() draws them.
+	double xsc, ysc;
+	if (show_mask & LABELS) {
+	    SetFont(font_labels);
+	    pdc->GetUserScale(&xsc, &ysc);
+	    pdc->SetUserScale(xsc * font_scaling_x, ysc * font_scaling_y);
+	}
+	for (auto label = mainfrm->GetLabels();
+	     label != mainfrm->GetLabelsEnd();
+	     ++label) {
+	    if (filter && !filter->CheckVisible(tree, (*label)->survey))
+		continue;
+	    double px = (*label)->GetX();
+	    double py = (*label)->GetY();
+	    double pz = (*label)->GetZ();
+	    if ((show_mask & SURF) || (*label)->IsUnderground()) {
+		double X = px * COS - py * SIN;
+		double Y = pz * COST - (px * SIN + py * COS) * SINT;
+		long xnew, ynew;
+		xnew = (long)((X * Sc + l->xOrg) * l->scX);
+		ynew = (long)((Y * Sc + l->yOrg) * l->scY);
+		long x_min = xnew, x_max = xnew;
+		long y_min = ynew, y_max = ynew;
+		if (show_mask & STNS) {
+		    x_min -= PWX_CROSS_SIZE;
+		    x_max += PWX_CROSS_SIZE;
+		    y_min -= PWX_CROSS_SIZE;
+		    y_max += PWX_CROSS_SIZE;
+		}
+		if (show_mask & LABELS) {
+		    int w, h;
+		    pdc->GetTextExtent((*label)->GetText(), &w, &h);
+		    x_max = max(x_max, xnew + long(w * font_scaling_x));
+		    y_max = max(y_max, ynew + long(h * font_scaling_y));
+		}
+		AddToPages(page_labels, labels.size(),
+			   x_min, y_min, x_max, y_max);
+		labels.push_back(PageLabel{xnew, ynew, *label});
+	    }
+	}
+	if (show_mask & LABELS) {
+	    pdc->SetUserScale(xsc, ysc);
+	}
+    }
+}
+
+// Note item against each page the box given in page coordinates overlaps.
+void
+svxPrintout::AddToPages(vector<vector<unsigned>>& pages, unsigned item,
+			long x_min, long y_min, long x_max, long y_max)
+{
+    // Allow for the clipping region being one pixel larger than the page,
+    // and for the width of lines.
+    const long SLACK = 2;
+    x_min -= SLACK;
+    y_min -= SLACK;
+    x_max += SLACK;
+    y_max += SLACK;
+    if (x_max < 0 || y_max < 0) return;
+    long page_x_min = max(x_min, 0L) / xpPageWidth;
+    long page_y_min = max(y_min, 0L) / ypPageDepth;
+    long page_x_max = min(x_max / xpPageWidth, long(m_layout->pagesX - 1));
+    long page_y_max = min(y_max / ypPageDepth, long(m_layout->pagesY - 1));
+    for (long page_y = page_y_min; page_y <= page_y_max; ++page_y) {
+	for (long page_x = page_x_min; page_x <= page_x_max; ++page_x) {
+	    pages[page_y * m_layout->pagesX + page_x].push_back(item);
+	}
+    }
+}
+
 void
 svxPrintout::PlotLR(const vector<XSect> & centreline)
 {
     const SurveyFilter* filter = mainfrm->GetTreeFilter();
+    const SurveyTree& tree = mainfrm->GetSurveyTree();
     assert(centreline.size() > 1);
     const XSect* prev_pt_v = NULL;
     Vector3 last_right(1.0, 0.0, 0.0);
@@ -2094,7 +2236,7 @@ svxPrintout::PlotLR(const vector<XSect> & centreline)
 	Double r = pt_v.GetR();
 
 	if (l >= 0 || r >= 0) {
-	    if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
+	    if (!filter || filter->CheckVisible(tree, pt_v.GetSurvey())) {
 		// Get the x and y coordinates of the survey station
 		double pt_X = pt_v.GetX() * COS - pt_v.GetY() * SIN;
 		double pt_Y = pt_v.GetX() * SIN + pt_v.GetY() * COS;
@@ -2167,6 +2309,7 @@ void
 svxPrintout::PlotUD(const vector<XSect> & centreline)
 {
     const SurveyFilter* filter = mainfrm->GetTreeFilter();
+    const SurveyTree& tree = mainfrm->GetSurveyTree();
     assert(centreline.size() > 1);
     const double Sc = 1000 / m_layout->Scale;
 
@@ -2179,7 +2322,7 @@ svxPrintout::PlotUD(const vector<XSect> & centreline)
 	Double d = pt_v.GetD();
 
 	if (u >= 0 || d >= 0) {
-	    if (filter && !filter->CheckVisible(pt_v.GetLabel()))
+	    if (filter && !filter->CheckVisible(tree, pt_v.GetSurvey()))
 		continue;
 
 	    // Get the coordinates of the survey point
@@ -0,0 +1,99 @@
+/* stationindex.cc
+ * Bounding volume hierarchy over station positions.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "stationindex.h"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+// Maximum number of stations in a leaf node.  Checking a few stations is
+// cheaper than descending further.
+const unsigned LEAF_SIZE = 16;
+
+static double
+coord(const LabelInfo* label, int axis)
+{
+    switch (axis) {
+	case 0: return label->GetX();
+	case 1: return label->GetY();
+	default: return label->GetZ();
+    }
+}
+
+void
+StationIndex::build(const vector<LabelInfo*>& labels)
+{
+    clear();
+    stations.assign(labels.begin(), labels.end());
+    if (stations.empty()) return;
+    nodes.reserve(2 * (stations.size() / LEAF_SIZE + 1));
+    nodes.resize(1);
+    split(0, 0, stations.size());
+}
+
+void
+StationIndex::split(unsigned n, unsigned begin, unsigned end)
+{
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (unsigned i = begin; i != end; ++i) {
+	for (int axis = 0; axis < 3; ++axis) {
+	    float v = coord(stations[i], axis);
+	    if (v < min[axis]) min[axis] = v;
+	    if (v > max[axis]) max[axis] = v;
+	}
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+	nodes[n].min[axis] = min[axis];
+	nodes[n].max[axis] = max[axis];
+    }
+
+    if (end - begin <= LEAF_SIZE) {
+	nodes[n].first = begin;
+	nodes[n].count = end - begin;
+	return;
+    }
+
+    // Split at the median along the longest axis of the bounding box.
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+	if (max[i] - min[i] > max[axis] - min[axis]) axis = i;
+    }
+    unsigned mid = begin + (end - begin) / 2;
+    nth_element(stations.begin() + begin,
+		stations.begin() + mid,
+		stations.begin() + end,
+		[axis](const LabelInfo* a, const LabelInfo* b) {
+		    return coord(a, axis) < coord(b, axis);
+		});
+
+    unsigned child = nodes.size();
+    nodes[n].first = child;
+    nodes[n].count = 0;
+    nodes.resize(child + 2);
+    split(child, begin, mid);
+    split(child + 1, mid, end);
+}
@@ -0,0 +1,85 @@
+/* stationindex.h
+ * Bounding volume hierarchy over station positions.
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef stationindex_h
+#define stationindex_h
+
+#include "labelinfo.h"
+
+#include <vector>
+
+/** Spatial index of stations.
+ *
+ *  This is built once the positions of the stations are final, and lets us
+ *  find the stations in a region (e.g. the current view) without looking at
+ *  every station.
+ */
+class StationIndex {
+    struct Node {
+	float min[3], max[3];
+	// For a leaf, the stations in it are [first, first + count).
+	// Otherwise count is 0 and the children are first and first + 1.
+	unsigned first, count;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<LabelInfo*> stations;
+
+    void split(unsigned n, unsigned begin, unsigned end);
+
+  public:
+    void build(const std::vector<LabelInfo*>& labels);
+
+    void clear() {
+	nodes.clear();
+	stations.clear();
+    }
+
+    /** Visit the stations in a region.
+     *
+     *  @param in_region	Called as in_region(min, max) with a bounding box
+     *				(each an array of 3 floats), and should return
+     *				false if the box is definitely outside the
+     *				region.
+     *  @param visit		Called with each station in a box inside (or
+     *				partly inside) the region.
+     */
+    template<typename InRegion, typename Visit>
+    void query(InRegion in_region, Visit visit) const {
+	if (nodes.empty()) return;
+	// The tree is balanced so its depth is O(log(n)).
+	std::vector<unsigned> stack(1, 0);
+	while (!stack.empty()) {
+	    const Node& node = nodes[stack.back()];
+	    stack.pop_back();
+	    if (!in_region(node.min, node.max)) continue;
+	    if (node.count) {
+		for (unsigned i = node.first; i != node.first + node.count; ++i) {
+		    visit(stations[i]);
+		}
+	    } else {
+		stack.push_back(node.first + 1);
+		stack.push_back(node.first);
+	    }
+	}
+    }
+};
+
+#endif
@@ -41,6 +41,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -49,20 +50,24 @@ main(int argc, char **argv)
 {
    double pan = 0;
    double tilt = -90.0;
-   export_format format = FMT_MAX_PLUS_ONE_;
+   // Formats to export to, in the order specified.
+   vector<export_format> formats;
+   bool default_to_pos = false;
    int show_mask = 0;
    const char *survey = NULL;
    double grid = 0.0; /* grid spacing (or 0 for no grid) */
    double text_height = DEFAULT_TEXT_HEIGHT; /* for station labels */
    double marker_size = DEFAULT_MARKER_SIZE; /* for station markers */
    double scale = 500.0;
+   double tile_size = 0.0; /* tile size (or 0 for no tiling) */
+   int threads = 0; /* threads for writing tiles (or 0 for one per CPU) */
    SurveyFilter* filter = NULL;
 
    {
        /* Default to .pos output if installed as 3dtopos. */
        char* progname = baseleaf_from_fnm(argv[0]);
        if (strcasecmp(progname, "3dtopos") == 0) {
-	   format = FMT_POS;
+	   default_to_pos = true;
        }
        osfree(progname);
    }
@@ -72,7 +77,8 @@ main(int argc, char **argv)
        OPT_SCALE = 0x100, OPT_BEARING, OPT_TILT, OPT_PLAN, OPT_ELEV,
        OPT_LEGS, OPT_SURF, OPT_SPLAYS, OPT_CROSSES, OPT_LABELS, OPT_ENTS,
        OPT_FIXES, OPT_EXPORTS, OPT_XSECT, OPT_WALLS, OPT_PASG,
-       OPT_CENTRED, OPT_FULL_COORDS, OPT_CLAMP_TO_GROUND, OPT_DEFAULTS
+       OPT_CENTRED, OPT_FULL_COORDS, OPT_CLAMP_TO_GROUND, OPT_DEFAULTS,
+       OPT_TILE_SIZE, OPT_THREADS
    };
    static const struct option long_opts[] = {
 	/* const char *name; int has_arg (0 no_argument, 1 required, 2 options_*); int *flag; int val */
@@ -103,6 +109,7 @@ main(int argc, char **argv)
 	{"csv", no_argument, 0, OPT_FMT_BASE + FMT_CSV},
 	{"dxf", no_argument, 0, OPT_FMT_BASE + FMT_DXF},
 	{"eps", no_argument, 0, OPT_FMT_BASE + FMT_EPS},
+	{"gltf", no_argument, 0, OPT_FMT_BASE + FMT_GLTF},
 	{"gpx", no_argument, 0, OPT_FMT_BASE + FMT_GPX},
 	{"hpgl", no_argument, 0, OPT_FMT_BASE + FMT_HPGL},
 	{"json", no_argument, 0, OPT_FMT_BASE + FMT_JSON},
@@ -111,6 +118,8 @@ main(int argc, char **argv)
 	{"skencil", no_argument, 0, OPT_FMT_BASE + FMT_SK},
 	{"pos", no_argument, 0, OPT_FMT_BASE + FMT_POS},
 	{"svg", no_argument, 0, OPT_FMT_BASE + FMT_SVG},
+	{"tile-size", required_argument, 0, OPT_TILE_SIZE},
+	{"threads", required_argument, 0, OPT_THREADS},
 	{"help", no_argument, 0, HLP_HELP},
 	{"version", no_argument, 0, HLP_VERSION},
 	// US spelling:
@@ -156,18 +165,23 @@ main(int argc, char **argv)
 	{HLP_ENCODELONG(24),  /*produce CSV output*/102, 0},
 	{HLP_ENCODELONG(25),  /*produce DXF output*/156, 0},
 	{HLP_ENCODELONG(26),  /*produce EPS output*/454, 0},
-	{HLP_ENCODELONG(27),  /*produce GPX output*/455, 0},
-	{HLP_ENCODELONG(28),  /*produce HPGL output*/456, 0},
-	{HLP_ENCODELONG(29),  /*produce JSON output*/457, 0},
-	{HLP_ENCODELONG(30),  /*produce KML output*/458, 0},
+	/* TRANSLATORS: "glTF" is the name of a 3D file format, so should not be
+	 * translated. */
+	{HLP_ENCODELONG(27),  /*produce glTF output*/526, 0},
+	{HLP_ENCODELONG(28),  /*produce GPX output*/455, 0},
+	{HLP_ENCODELONG(29),  /*produce HPGL output*/456, 0},
+	{HLP_ENCODELONG(30),  /*produce JSON output*/457, 0},
+	{HLP_ENCODELONG(31),  /*produce KML output*/458, 0},
 	/* TRANSLATORS: "Compass" and "Carto" are the names of software packages,
 	 * so should not be translated. */
-	{HLP_ENCODELONG(31),  /*produce Compass PLT output for Carto*/159, 0},
+	{HLP_ENCODELONG(32),  /*produce Compass PLT output for Carto*/159, 0},
 	/* TRANSLATORS: "Skencil" is the name of a software package, so should not be
 	 * translated. */
-	{HLP_ENCODELONG(32),  /*produce Skencil output*/158, 0},
-	{HLP_ENCODELONG(33),  /*produce Survex POS output*/459, 0},
-	{HLP_ENCODELONG(34),  /*produce SVG output*/160, 0},
+	{HLP_ENCODELONG(33),  /*produce Skencil output*/158, 0},
+	{HLP_ENCODELONG(34),  /*produce Survex POS output*/459, 0},
+	{HLP_ENCODELONG(35),  /*produce SVG output*/160, 0},
+	{HLP_ENCODELONG(36),  /*split plan into square tiles of this size (in metres)*/523, 0},
+	{HLP_ENCODELONG(37),  /*number of threads to use for writing tiles*/524, 0},
 	{0, 0, 0}
    };
 
@@ -229,6 +243,14 @@ main(int argc, char **argv)
        case OPT_DEFAULTS:
 	 always_include_defaults = true;
 	 break;
+       case OPT_TILE_SIZE:
+	 tile_size = cmdline_double_arg();
+	 break;
+       case OPT_THREADS:
+	 threads = cmdline_int_arg();
+	 if (threads < 0)
+	    fatalerror(/*numeric argument “%s” out of range*/185, optarg);
+	 break;
        case 'g': /* Grid */
 	 if (optarg) {
 	    grid = cmdline_double_arg();
@@ -340,7 +362,13 @@ main(int argc, char **argv)
 	 break;
        default:
 	 if (opt >= OPT_FMT_BASE && opt < OPT_FMT_BASE + FMT_MAX_PLUS_ONE_) {
-	     format = export_format(opt - OPT_FMT_BASE);
+	     export_format format = export_format(opt - OPT_FMT_BASE);
+	     // Specifying the same format twice is harmless.
+	     bool dup = false;
+	     for (export_format f : formats) {
+		 if (f == format) dup = true;
+	     }
+	     if (!dup) formats.push_back(format);
 	 }
       }
       if (bit) {
@@ -381,60 +409,109 @@ main(int argc, char **argv)
 
    const char* fnm_in = argv[optind++];
    const char* fnm_out = argv[optind];
-   if (fnm_out) {
-      if (format == FMT_MAX_PLUS_ONE_) {
-	 // Select format based on extension.
-	 size_t len = strlen(fnm_out);
+   if (formats.empty() && default_to_pos) {
+      formats.push_back(FMT_POS);
+   }
+   if (formats.empty()) {
+      if (!fnm_out) {
+	 fatalerror(/*Export format not specified*/253);
+      }
+      // Select format based on extension.
+      size_t len = strlen(fnm_out);
+      for (size_t i = 0; i < FMT_MAX_PLUS_ONE_; ++i) {
+	 const auto& info = export_format_info[i];
+	 size_t l = strlen(info.extension);
+	 if (len > l + 1 &&
+	     strcasecmp(fnm_out + len - l, info.extension) == 0) {
+	    formats.push_back(export_format(i));
+	    break;
+	 }
+      }
+      if (formats.empty()) {
+	 fatalerror(/*Export format not specified and not known from output file extension*/252);
+      }
+   }
+
+   // If exporting to several formats, the output filename (or if none is
+   // given, the leafname of the input file) is used as a base to which the
+   // extension for each format is added.
+   bool use_base = (formats.size() > 1 || !fnm_out);
+   string base;
+   if (formats.size() > 1) {
+      if (fnm_out) {
+	 base = fnm_out;
+	 // Allow "survexport --svg --dxf cave.3d out.svg" to write out.svg and
+	 // out.dxf.
 	 for (size_t i = 0; i < FMT_MAX_PLUS_ONE_; ++i) {
-	    const auto& info = export_format_info[i];
-	    size_t l = strlen(info.extension);
-	    if (len > l + 1 &&
-		strcasecmp(fnm_out + len - l, info.extension) == 0) {
-	       format = export_format(i);
+	    const char* ext = export_format_info[i].extension;
+	    size_t l = strlen(ext);
+	    if (base.size() > l + 1 &&
+		strcasecmp(base.c_str() + base.size() - l, ext) == 0) {
+	       base.resize(base.size() - l);
 	       break;
 	    }
 	 }
-	 if (format == FMT_MAX_PLUS_ONE_) {
-	    fatalerror(/*Export format not specified and not known from output file extension*/252);
-	 }
-      }
-   } else {
-      if (format == FMT_MAX_PLUS_ONE_) {
-	 fatalerror(/*Export format not specified*/253);
+      } else {
+	 char *baseleaf = baseleaf_from_fnm(fnm_in);
+	 base = baseleaf;
+	 osfree(baseleaf);
       }
+   } else if (!fnm_out) {
       char *baseleaf = baseleaf_from_fnm(fnm_in);
-      /* note : memory allocated by fnm_out gets leaked in this case... */
-      fnm_out = add_ext(baseleaf, export_format_info[format].extension);
+      base = baseleaf;
       osfree(baseleaf);
    }
 
-   const auto& format_info_mask = export_format_info[format].mask;
-   unsigned not_allowed = show_mask &~ format_info_mask;
-   if (not_allowed) {
-       printf("warning: The following options are not supported for this export format and will be ignored:\n");
-       int i = 0;
-       int bit = 1;
-       while (not_allowed) {
-	   if (not_allowed & bit) {
+   vector<export_output> outputs;
+   for (export_format format : formats) {
+      export_output out;
+      if (!use_base) {
+	 out.fnm = fnm_out;
+      } else {
+	 string fnm = base;
+	 fnm += export_format_info[format].extension;
+	 out.fnm = fnm.c_str();
+      }
+      out.format = format;
+      out.pan = pan;
+      out.tilt = tilt;
+      out.show_mask = show_mask;
+
+      const auto& format_info_mask = export_format_info[format].mask;
+      unsigned not_allowed = out.show_mask &~ format_info_mask;
+      if (not_allowed) {
+	 if (formats.size() == 1) {
+	    printf("warning: The following options are not supported for this export format and will be ignored:\n");
+	 } else {
+	    printf("warning: The following options are not supported for export format %s and will be ignored:\n",
+		   export_format_info[format].extension + 1);
+	 }
+	 int i = 0;
+	 int bit = 1;
+	 while (not_allowed) {
+	    if (not_allowed & bit) {
 	       // E.g. --walls maps to two bits in show_mask, but the options
 	       // are only put on the least significant in such cases.
 	       if (!optmap[i].empty())
-		   printf("%s\n", optmap[i].c_str());
+		  printf("%s\n", optmap[i].c_str());
 	       not_allowed &= ~bit;
-	   }
-	   ++i;
-	   bit <<= 1;
-       }
-       show_mask &= format_info_mask;
-   }
+	    }
+	    ++i;
+	    bit <<= 1;
+	 }
+	 out.show_mask &= format_info_mask;
+      }
 
-   if (always_include_defaults || show_mask == 0) {
-       show_mask |= export_format_info[format].defaults;
-   }
+      if (always_include_defaults || out.show_mask == 0) {
+	 out.show_mask |= export_format_info[format].defaults;
+      }
+
+      if (!(format_info_mask & ORIENTABLE)) {
+	 out.pan = 0.0;
+	 out.tilt = -90.0;
+      }
 
-   if (!(format_info_mask & ORIENTABLE)) {
-       pan = 0.0;
-       tilt = -90.0;
+      outputs.push_back(out);
    }
 
    Model model;
@@ -443,13 +520,41 @@ main(int argc, char **argv)
    if (filter) filter->SetSeparator(model.GetSeparator());
 
    try {
-       if (!Export(fnm_out, model.GetSurveyTitle(),
-		   model.GetDateString(),
-		   model, filter,
-		   pan, tilt, show_mask, format,
-		   grid, text_height, marker_size,
-		   scale)) {
-	  fatalerror(/*Couldn’t write file “%s”*/402, fnm_out);
+       // Tiling only makes sense for formats which are drawn in the plane
+       // of projection.
+       vector<export_output> tiled;
+       if (tile_size > 0.0) {
+	   size_t j = 0;
+	   for (size_t i = 0; i != outputs.size(); ++i) {
+	       if (export_format_info[outputs[i].format].mask & ORIENTABLE) {
+		   tiled.push_back(outputs[i]);
+	       } else {
+		   printf("warning: Tiled output is not supported for export format %s so a single file will be written\n",
+			  export_format_info[outputs[i].format].extension + 1);
+		   outputs[j++] = outputs[i];
+	       }
+	   }
+	   outputs.resize(j);
+       }
+       int failed = Export(outputs, model.GetSurveyTitle(),
+			   model.GetDateString(),
+			   model, filter,
+			   grid, text_height, marker_size,
+			   scale);
+       if (failed >= 0) {
+	  fatalerror(/*Couldn’t write file “%s”*/402,
+		     (const char*)outputs[failed].fnm.mb_str());
+       }
+       if (!tiled.empty()) {
+	   failed = ExportTiled(tiled, model.GetSurveyTitle(),
+				model.GetDateString(),
+				model, filter,
+				grid, text_height, marker_size,
+				scale, tile_size, unsigned(threads));
+	   if (failed >= 0) {
+	      fatalerror(/*Couldn’t write file “%s”*/402,
+			 (const char*)tiled[failed].fnm.mb_str());
+	   }
        }
    } catch (const wxString & m) {
        wxString r = msg_appname();
@@ -0,0 +1,663 @@
+/* terrain.cc
+ * Terrain from DEM tiles, triangulated at several levels of detail
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "terrain.h"
+
+#include "filename.h"
+#include "useful.h"
+
+#include <wx/wfstream.h>
+#include <wx/zipstrm.h>
+
+#include <atomic>
+#include <float.h>
+#include <math.h>
+#include <thread>
+
+#define ACCEPT_USE_OF_DEPRECATED_PROJ_API_H 1
+#include <proj_api.h>
+
+using namespace std;
+
+const unsigned long DEFAULT_HGT_DIM = 3601;
+const unsigned long DEFAULT_HGT_SIZE = sqrd(DEFAULT_HGT_DIM) * 2;
+
+// Number of sample intervals across a patch.
+const size_t PATCH_CELLS = 64;
+
+// Direction of the light used to shade the terrain (the same as GfxCore uses).
+static const Vector3 light(.577, .577, .577);
+
+void
+DEMTile::parse_hgt_filename(const wxString & lc_name)
+{
+    char * leaf = leaf_from_fnm(lc_name.utf8_str());
+    const char * p = leaf;
+    char * q;
+    char dirn = *p++;
+    o_y = strtoul(p, &q, 10);
+    p = q;
+    if (dirn == 's')
+	o_y = -o_y;
+    ++o_y;
+    dirn = *p++;
+    o_x = strtoul(p, &q, 10);
+    if (dirn == 'w')
+	o_x = -o_x;
+    bigendian = true;
+    nodata_value = -32768;
+    osfree(leaf);
+}
+
+size_t
+DEMTile::parse_hdr(wxInputStream & is, unsigned long & skipbytes)
+{
+    // ESRI docs say NBITS defaults to 8.
+    unsigned long nbits = 8;
+    // ESRI docs say NBANDS defaults to 1.
+    unsigned long nbands = 1;
+    unsigned long bandrowbytes = 0;
+    unsigned long totalrowbytes = 0;
+    // ESRI docs say ULXMAP defaults to 0.
+    o_x = 0.0;
+    // ESRI docs say ULYMAP defaults to NROWS - 1.
+    o_y = HUGE_VAL;
+    // ESRI docs say XDIM and YDIM default to 1.
+    step_x = step_y = 1.0;
+    while (!is.Eof()) {
+	wxString line;
+	int ch;
+	while ((ch = is.GetC()) != wxEOF) {
+	    if (ch == '\n' || ch == '\r') break;
+	    line += wxChar(ch);
+	}
+#define CHECK(X, COND) \
+} else if (line.StartsWith(wxT(X " "))) { \
+size_t v = line.find_first_not_of(wxT(' '), sizeof(X)); \
+if (v == line.npos || !(COND)) { \
+err += wxT("Unexpected value for " X); \
+}
+	wxString err;
+	if (false) {
+	// I = little-endian; M = big-endian
+	CHECK("BYTEORDER", (bigendian = (line[v] == 'M')) || line[v] == 'I')
+	// ESRI docs say LAYOUT defaults to BIL if not specified.
+	CHECK("LAYOUT", line.substr(v) == wxT("BIL"))
+	CHECK("NROWS", line.substr(v).ToCULong(&height))
+	CHECK("NCOLS", line.substr(v).ToCULong(&width))
+	// ESRI docs say NBANDS defaults to 1 if not specified.
+	CHECK("NBANDS", line.substr(v).ToCULong(&nbands) && nbands == 1)
+	CHECK("NBITS", line.substr(v).ToCULong(&nbits) && nbits == 16)
+	CHECK("BANDROWBYTES", line.substr(v).ToCULong(&bandrowbytes))
+	CHECK("TOTALROWBYTES", line.substr(v).ToCULong(&totalrowbytes))
+	// PIXELTYPE is a GDAL extension, so may not be present.
+	CHECK("PIXELTYPE", line.substr(v) == wxT("SIGNEDINT"))
+	CHECK("ULXMAP", line.substr(v).ToCDouble(&o_x))
+	CHECK("ULYMAP", line.substr(v).ToCDouble(&o_y))
+	CHECK("XDIM", line.substr(v).ToCDouble(&step_x))
+	CHECK("YDIM", line.substr(v).ToCDouble(&step_y))
+	CHECK("NODATA", line.substr(v).ToCLong(&nodata_value))
+	CHECK("SKIPBYTES", line.substr(v).ToCULong(&skipbytes))
+	}
+	if (!err.empty()) {
+	    wxMessageBox(err);
+	}
+    }
+    if (o_y == HUGE_VAL) {
+	o_y = height - 1;
+    }
+    if (bandrowbytes != 0) {
+	if (nbits * width != bandrowbytes * 8) {
+	    wxMessageBox("BANDROWBYTES setting indicates unused bits after each band - not currently supported");
+	}
+    }
+    if (totalrowbytes != 0) {
+	// This is the ESRI default for BIL, for BIP it would be
+	// nbands * bandrowbytes.
+	if (nbands * nbits * width != totalrowbytes * 8) {
+	    wxMessageBox("TOTALROWBYTES setting indicates unused bits after "
+			 "each row - not currently supported");
+	}
+    }
+    return ((nbits * width + 7) / 8) * height;
+}
+
+bool
+DEMTile::read_bil(wxInputStream & is, size_t size, unsigned long skipbytes)
+{
+    bool know_size = true;
+    if (!size) {
+	// If the stream doesn't know its size, GetSize() returns 0.
+	size = is.GetSize();
+	if (!size) {
+	    size = DEFAULT_HGT_SIZE;
+	    know_size = false;
+	}
+    }
+    data.resize(size / 2);
+    if (skipbytes) {
+	if (is.SeekI(skipbytes, wxFromStart) == ::wxInvalidOffset) {
+	    while (skipbytes) {
+		unsigned long to_read = skipbytes;
+		if (size < to_read) to_read = size;
+		is.Read(reinterpret_cast<char *>(data.data()), to_read);
+		size_t c = is.LastRead();
+		if (c == 0) {
+		    wxMessageBox(wxT("Failed to skip terrain data header"));
+		    break;
+		}
+		skipbytes -= c;
+	    }
+	}
+    }
+
+    if (!is.ReadAll(data.data(), size)) {
+	if (know_size) {
+	    // FIXME: On __WXMSW__ currently we fail to
+	    // read any data from files in zips.
+	    Discard();
+	    wxMessageBox(wxT("Failed to read terrain data"));
+	    return false;
+	}
+	size = is.LastRead();
+	data.resize(size / 2);
+    }
+
+    if (width == 0 && height == 0) {
+	width = height = sqrt(size / 2);
+	if (width * height * 2 != size) {
+	    Discard();
+	    wxMessageBox(wxT("HGT format data doesn't form a square"));
+	    return false;
+	}
+	step_x = step_y = 1.0 / width;
+    }
+
+    return true;
+}
+
+bool
+DEMTile::Read(bool header_only)
+{
+    size_t size = 0;
+    // Default is to not skip any bytes.
+    unsigned long skipbytes = 0;
+    // For .hgt files, default to using filesize to determine.
+    width = height = 0;
+    // ESRI say "The default byte order is the same as that of the host machine
+    // executing the software", but that's stupid so we default to
+    // little-endian.
+    bigendian = false;
+
+    wxFileInputStream fs(file);
+    if (!fs.IsOk()) {
+	wxMessageBox(wxT("Failed to open DEM file"));
+	return false;
+    }
+
+    const wxString & lc_file = file.Lower();
+    if (lc_file.EndsWith(wxT(".hgt"))) {
+	parse_hgt_filename(lc_file);
+	return header_only || read_bil(fs, size, skipbytes);
+    }
+
+    if (lc_file.EndsWith(wxT(".bil"))) {
+	wxString hdr_file = file;
+	hdr_file.replace(file.size() - 4, 4, wxT(".hdr"));
+	wxFileInputStream hdr_is(hdr_file);
+	if (!hdr_is.IsOk()) {
+	    wxMessageBox(wxT("Failed to open HDR file '") + hdr_file + wxT("'"));
+	    return false;
+	}
+	size = parse_hdr(hdr_is, skipbytes);
+	return header_only || read_bil(fs, size, skipbytes);
+    }
+
+    if (!lc_file.EndsWith(wxT(".zip"))) {
+	wxMessageBox(wxT("Unknown DEM file type '") + file + wxT("'"));
+	return false;
+    }
+
+    bool have_header = false;
+    wxZipEntry * ze_data = NULL;
+    wxZipInputStream zs(fs);
+    wxZipEntry * ze;
+    while ((ze = zs.GetNextEntry()) != NULL) {
+	if (!ze->IsDir()) {
+	    const wxString & lc_name = ze->GetName().Lower();
+	    if (!ze_data && lc_name.EndsWith(wxT(".hgt"))) {
+		// SRTM .hgt files are raw binary data, with the filename
+		// encoding the coordinates.
+		parse_hgt_filename(lc_name);
+		have_header = true;
+		if (!header_only) read_bil(zs, size, skipbytes);
+		delete ze;
+		break;
+	    }
+
+	    if (!ze_data && lc_name.EndsWith(wxT(".bil"))) {
+		if (size) {
+		    if (!header_only) read_bil(zs, size, skipbytes);
+		    break;
+		}
+		ze_data = ze;
+		continue;
+	    }
+
+	    if (lc_name.EndsWith(wxT(".hdr"))) {
+		size = parse_hdr(zs, skipbytes);
+		have_header = true;
+		if (ze_data && !header_only) {
+		    if (!zs.OpenEntry(*ze_data)) {
+			wxMessageBox(wxT("Couldn't read DEM data from .zip file"));
+			break;
+		    }
+		    read_bil(zs, size, skipbytes);
+		}
+	    } else if (lc_name.EndsWith(wxT(".prj"))) {
+		//FIXME: check this matches the datum string we use
+		//Projection    GEOGRAPHIC
+		//Datum         WGS84
+		//Zunits        METERS
+		//Units         DD
+		//Spheroid      WGS84
+		//Xshift        0.0000000000
+		//Yshift        0.0000000000
+		//Parameters
+	    }
+	}
+	delete ze;
+    }
+    delete ze_data;
+
+    if (header_only) {
+	if (!have_header) {
+	    wxMessageBox(wxT("No terrain data found in '") + file + wxT("'"));
+	}
+	return have_header;
+    }
+    return !data.empty();
+}
+
+void
+DEMTile::GetBounds(double & lon_min, double & lat_min,
+		   double & lon_max, double & lat_max) const
+{
+    lon_min = o_x;
+    lat_max = o_y;
+    if (width == 0) {
+	// A .hgt file whose data hasn't been read yet - these cover one
+	// degree square.
+	lon_max = o_x + 1.0;
+	lat_min = o_y - 1.0;
+    } else {
+	lon_max = o_x + (width - 1) * step_x;
+	lat_min = o_y - (height - 1) * step_y;
+    }
+}
+
+double
+DEMTile::Elevation(size_t x, size_t y) const
+{
+    unsigned short elev = data[x + y * width];
+#ifdef WORDS_BIGENDIAN
+    const bool MACHINE_BIGENDIAN = true;
+#else
+    const bool MACHINE_BIGENDIAN = false;
+#endif
+    if (bigendian != MACHINE_BIGENDIAN) {
+#if defined __GNUC__ && (__GNUC__ * 100 + __GNUC_MINOR__ >= 408)
+	elev = __builtin_bswap16(elev);
+#else
+	elev = (elev >> 8) | (elev << 8);
+#endif
+    }
+    return (short)elev;
+}
+
+bool
+Terrain::Load(const wxArrayString & files)
+{
+    clear();
+    for (size_t i = 0; i != files.size(); ++i) {
+	tiles.push_back(DEMTile(files[i]));
+	if (!tiles.back().Read(true)) {
+	    clear();
+	    return false;
+	}
+    }
+    return !tiles.empty();
+}
+
+wxString
+Terrain::GetFiles() const
+{
+    wxString result;
+    for (const DEMTile & tile : tiles) {
+	result += tile.GetFile();
+	result += wxT('\n');
+    }
+    return result;
+}
+
+// Add a triangle of terrain, shaded as if lit from a fixed direction.
+static void
+add_terrain_triangle(vector<GLAVertex> & vertices,
+		     const Vector3 & a, const Vector3 & b, const Vector3 & c)
+{
+    Vector3 n = (b - a) * (c - a);
+    n.normalise();
+    Double factor = dot(n, light) * .95 + .05;
+    GLAVertex vertex = GLAVertex();
+    vertex.SetColour(0, col_WHITE, factor, 0.3);
+    for (const Vector3* p : { &a, &b, &c }) {
+	vertex.SetPosition(*p);
+	vertices.push_back(vertex);
+    }
+}
+
+namespace {
+
+// The samples of a tile which a patch covers.
+struct PatchGrid {
+    // Columns [x0, x1] and rows [y0, y1] (so neighbouring patches share the
+    // samples along their common edge), taking every step-th sample.
+    size_t x0, y0, x1, y1, step;
+
+    // The sample indices to use from first to last.
+    static void samples(size_t first, size_t last, size_t step,
+			vector<size_t> & result) {
+	result.clear();
+	for (size_t i = first; i < last; i += step) result.push_back(i);
+	result.push_back(last);
+    }
+};
+
+}
+
+int
+Terrain::Generate(const char * cs, const Vector3 & offset, double radius,
+		  vector<GLAVertex> & vertices)
+{
+    patches.clear();
+    roots.clear();
+
+    // PROJ objects can't be shared between threads, so each worker sets up
+    // its own, but check here that we can so we can report any problem.
+    projPJ pj_in = pj_init_plus(WGS84_DATUM_STRING);
+    if (!pj_in) return 287;
+    projPJ pj_out = pj_init_plus(cs);
+    if (!pj_out) {
+	pj_free(pj_in);
+	return 288;
+    }
+
+    // Find the area of DEM data we need by converting points around the
+    // circle to latitude and longitude.  The circle is a little larger than
+    // the area we draw, so the polygon approximating it covers that area.
+    double lon_min = HUGE_VAL, lat_min = HUGE_VAL;
+    double lon_max = -HUGE_VAL, lat_max = -HUGE_VAL;
+    const int N = 32;
+    for (int i = 0; i != N; ++i) {
+	double angle = i * (2.0 * M_PI / N);
+	double X = offset.GetX() + 1.02 * radius * cos(angle);
+	double Y = offset.GetY() + 1.02 * radius * sin(angle);
+	double Z = offset.GetZ();
+	if (pj_transform(pj_out, pj_in, 1, 1, &X, &Y, &Z) != 0) continue;
+	X *= RAD_TO_DEG;
+	Y *= RAD_TO_DEG;
+	lon_min = min(lon_min, X);
+	lon_max = max(lon_max, X);
+	lat_min = min(lat_min, Y);
+	lat_max = max(lat_max, Y);
+    }
+    pj_free(pj_in);
+    pj_free(pj_out);
+    if (lon_min > lon_max) return 161;
+
+    const double r_sqrd = sqrd(radius);
+    const string cs_out(cs);
+    const Vector3 no_data(DBL_MAX, DBL_MAX, DBL_MAX);
+    unsigned n_threads = thread::hardware_concurrency();
+    vector<PatchGrid> grids;
+    vector<vector<GLAVertex>> patch_vertices;
+    for (DEMTile & tile : tiles) {
+	double t_lon_min, t_lat_min, t_lon_max, t_lat_max;
+	tile.GetBounds(t_lon_min, t_lat_min, t_lon_max, t_lat_max);
+	if (t_lon_max < lon_min || t_lon_min > lon_max ||
+	    t_lat_max < lat_min || t_lat_min > lat_max) {
+	    // Don't even read tiles which are entirely outside the area.
+	    continue;
+	}
+
+	if (!tile.Read(false)) continue;
+
+	// The samples in the area.
+	double x_lo = max(floor((lon_min - tile.o_x) / tile.step_x), 0.0);
+	double x_hi = min(ceil((lon_max - tile.o_x) / tile.step_x),
+			  double(tile.width) - 1.0);
+	double y_lo = max(floor((tile.o_y - lat_max) / tile.step_y), 0.0);
+	double y_hi = min(ceil((tile.o_y - lat_min) / tile.step_y),
+			  double(tile.height) - 1.0);
+	if (x_lo >= x_hi || y_lo >= y_hi) {
+	    tile.Discard();
+	    continue;
+	}
+
+	// Build the quadtree of patches breadth first, so the children of
+	// each patch are consecutive.
+	size_t first = patches.size();
+	roots.push_back(first);
+	size_t step = 1;
+	while (PATCH_CELLS * step < max(x_hi - x_lo, y_hi - y_lo)) step *= 2;
+	grids.clear();
+	grids.push_back(PatchGrid{size_t(x_lo), size_t(y_lo),
+				  size_t(x_hi), size_t(y_hi), step});
+	patches.push_back(Patch());
+	for (size_t i = first; i != patches.size(); ++i) {
+	    PatchGrid g = grids[i - first];
+	    if (g.step == 1) continue;
+	    size_t size = PATCH_CELLS * (g.step / 2);
+	    patches[i].first_child = patches.size();
+	    for (size_t y = g.y0; y < g.y1; y += size) {
+		for (size_t x = g.x0; x < g.x1; x += size) {
+		    grids.push_back(PatchGrid{x, y,
+					      min(x + size, g.x1),
+					      min(y + size, g.y1),
+					      g.step / 2});
+		    patches.push_back(Patch());
+		}
+	    }
+	    patches[i].n_children = patches.size() - patches[i].first_child;
+	}
+
+	// Triangulate the patches in parallel, projecting a column of samples
+	// at a time.
+	patch_vertices.clear();
+	patch_vertices.resize(patches.size() - first);
+	atomic<size_t> next(first);
+	atomic<bool> ok(true);
+	auto worker = [&]() {
+	    projCtx ctx = pj_ctx_alloc();
+	    projPJ in = pj_init_plus_ctx(ctx, WGS84_DATUM_STRING);
+	    projPJ out = pj_init_plus_ctx(ctx, cs_out.c_str());
+	    if (!in || !out) ok = false;
+
+	    vector<size_t> columns, rows;
+	    vector<Vector3> prevcol, col;
+	    vector<double> xs, ys, zs;
+	    vector<size_t> valid;
+	    size_t i;
+	    while (ok && (i = next++) < patches.size()) {
+		const PatchGrid & g = grids[i - first];
+		Patch & patch = patches[i];
+		vector<GLAVertex> & verts = patch_vertices[i - first];
+		PatchGrid::samples(g.x0, g.x1, g.step, columns);
+		PatchGrid::samples(g.y0, g.y1, g.step, rows);
+		prevcol.resize(rows.size());
+		col.resize(rows.size());
+		Vector3 lo(DBL_MAX, DBL_MAX, DBL_MAX);
+		Vector3 hi(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+		for (size_t c = 0; c != columns.size(); ++c) {
+		    xs.clear();
+		    ys.clear();
+		    zs.clear();
+		    valid.clear();
+		    double X = (tile.o_x + columns[c] * tile.step_x) * DEG_TO_RAD;
+		    for (size_t r = 0; r != rows.size(); ++r) {
+			col[r] = no_data;
+			double Z = tile.Elevation(columns[c], rows[r]);
+			if (Z == tile.nodata_value) continue;
+			xs.push_back(X);
+			ys.push_back((tile.o_y - rows[r] * tile.step_y) * DEG_TO_RAD);
+			zs.push_back(Z);
+			valid.push_back(r);
+		    }
+		    if (!valid.empty() &&
+			pj_transform(in, out, valid.size(), 1,
+				     xs.data(), ys.data(), zs.data()) != 0) {
+			valid.clear();
+		    }
+		    for (size_t k = 0; k != valid.size(); ++k) {
+			// PROJ sets points it fails to transform to HUGE_VAL.
+			if (xs[k] == HUGE_VAL) continue;
+			Vector3 pt = Vector3(xs[k], ys[k], zs[k]) - offset;
+			double dist_2 = sqrd(pt.GetX()) + sqrd(pt.GetY());
+			if (dist_2 > r_sqrd) continue;
+			col[valid[k]] = pt;
+			lo = Vector3(min(lo.GetX(), pt.GetX()),
+				     min(lo.GetY(), pt.GetY()),
+				     min(lo.GetZ(), pt.GetZ()));
+			hi = Vector3(max(hi.GetX(), pt.GetX()),
+				     max(hi.GetY(), pt.GetY()),
+				     max(hi.GetZ(), pt.GetZ()));
+		    }
+
+		    for (size_t r = 1; c > 0 && r < rows.size(); ++r) {
+			const Vector3 & prev = prevcol[r - 1];
+			const Vector3 & a = col[r - 1];
+			const Vector3 & b = prevcol[r];
+			const Vector3 & pt = col[r];
+			// If all points are valid, split the quadrilateral
+			// into triangles along the shorter 3D diagonal, which
+			// typically looks better:
+			//
+			//               ----->
+			//     prev---a    x     prev---a
+			//   |   |P  /|            |\  S|
+			// y |   |  / |    or      | \  |
+			//   V   | /  |            |  \ |
+			//       |/  Q|            |R  \|
+			//       b----pt           b----pt
+			//
+			//       FORWARD           BACKWARD
+			enum { NONE = 0, P = 1, Q = 2, R = 4, S = 8, ALL = P|Q|R|S };
+			int mask =
+			    ((prev.GetZ() != DBL_MAX)) |
+			    ((a.GetZ() != DBL_MAX) << 1) |
+			    ((b.GetZ() != DBL_MAX) << 2) |
+			    ((pt.GetZ() != DBL_MAX) << 3);
+			static const int tris_map[16] = {
+			    NONE, // nothing valid
+			    NONE, // prev
+			    NONE, // a
+			    NONE, // a, prev
+			    NONE, // b
+			    NONE, // b, prev
+			    NONE, // b, a
+			    P, // b, a, prev
+			    NONE, // pt
+			    NONE, // pt, prev
+			    NONE, // pt, a
+			    S, // pt, a, prev
+			    NONE, // pt, b
+			    R, // pt, b, prev
+			    Q, // pt, b, a
+			    ALL, // pt, b, a, prev
+			};
+			int tris = tris_map[mask];
+			if (tris == ALL) {
+			    // All points valid.
+			    if ((a - b).magnitude() < (prev - pt).magnitude()) {
+				tris = P | Q;
+			    } else {
+				tris = R | S;
+			    }
+			    // Note how far apart the samples are.
+			    for (const Vector3 & d : { a - prev, b - prev }) {
+				patch.spacing = max(patch.spacing,
+						    hypot(d.GetX(), d.GetY()));
+			    }
+			}
+			if (tris & P)
+			    add_terrain_triangle(verts, a, prev, b);
+			if (tris & Q)
+			    add_terrain_triangle(verts, a, b, pt);
+			if (tris & R)
+			    add_terrain_triangle(verts, pt, prev, b);
+			if (tris & S)
+			    add_terrain_triangle(verts, a, prev, pt);
+		    }
+		    swap(prevcol, col);
+		}
+		if (lo.GetX() <= hi.GetX()) {
+		    patch.centre = (lo + hi) * 0.5;
+		    patch.radius = (hi - lo).magnitude() * 0.5;
+		}
+		// If we couldn't tell how far apart the samples are, always use
+		// the children (if any) instead.
+		if (patch.spacing == 0.0) patch.spacing = HUGE_VAL;
+	    }
+
+	    if (in) pj_free(in);
+	    if (out) pj_free(out);
+	    pj_ctx_free(ctx);
+	};
+	vector<thread> pool;
+	for (unsigned k = 1; k < n_threads && k < patches.size() - first; ++k) {
+	    pool.push_back(thread(worker));
+	}
+	worker();
+	for (thread & th : pool) {
+	    th.join();
+	}
+	tile.Discard();
+	if (!ok) {
+	    patches.clear();
+	    roots.clear();
+	    return 288;
+	}
+
+	for (size_t i = first; i != patches.size(); ++i) {
+	    vector<GLAVertex> & verts = patch_vertices[i - first];
+	    patches[i].begin = vertices.size();
+	    vertices.insert(vertices.end(), verts.begin(), verts.end());
+	    patches[i].end = vertices.size();
+	    vector<GLAVertex>().swap(verts);
+	}
+    }
+
+    if (vertices.empty()) return 161;
+    return 0;
+}
@@ -0,0 +1,183 @@
+/* terrain.h
+ * Terrain from DEM tiles, triangulated at several levels of detail
+ */
+/* Copyright (C) 2020 Olly Betts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef terrain_h
+#define terrain_h
+
+#include "gla.h"
+#include "vector3.h"
+#include "wx.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Coordinate system of DEM data.
+#define WGS84_DATUM_STRING "+proj=longlat +ellps=WGS84 +datum=WGS84"
+
+/// Elevation data from one DEM file.
+class DEMTile {
+    wxString file;
+
+    std::vector<unsigned short> data;
+
+    void parse_hgt_filename(const wxString & lc_name);
+    size_t parse_hdr(wxInputStream & is, unsigned long & skipbytes);
+    bool read_bil(wxInputStream & is, size_t size, unsigned long skipbytes);
+
+  public:
+    // Size of the grid (0 for a .hgt file until the data is read).
+    unsigned long width = 0, height = 0;
+    // Longitude and latitude of the top left sample, and the spacing of the
+    // samples, all in degrees.
+    double o_x = 0.0, o_y = 0.0, step_x = 0.0, step_y = 0.0;
+    long nodata_value = 0;
+    bool bigendian = false;
+
+    explicit DEMTile(const wxString & file_) : file(file_) { }
+
+    const wxString & GetFile() const { return file; }
+
+    /** Read the file.
+     *
+     *  Problems are reported to the user.
+     *
+     *  @param header_only	Just read enough to know where the tile is.
+     */
+    bool Read(bool header_only);
+
+    /// Free the data read.
+    void Discard() { std::vector<unsigned short>().swap(data); }
+
+    void GetBounds(double & lon_min, double & lat_min,
+		   double & lon_max, double & lat_max) const;
+
+    double Elevation(size_t x, size_t y) const;
+};
+
+/** Terrain from a mosaic of DEM tiles.
+ *
+ *  The terrain is triangulated as a quadtree of patches for each tile.  Each
+ *  patch has the same number of samples across, so a patch covers four times
+ *  the area of each of its children at half their resolution, and the
+ *  resolution to draw can be chosen for each part of the view.
+ */
+class Terrain {
+    std::vector<DEMTile> tiles;
+
+    struct Patch {
+	// Vertices [begin, end) in the mesh.
+	size_t begin = 0, end = 0;
+	// The children of a patch are consecutive.
+	size_t first_child = 0;
+	unsigned n_children = 0;
+	// Bounding sphere of the patch's points (radius is negative if the
+	// patch has no points).
+	Vector3 centre;
+	double radius = -1.0;
+	// Greatest horizontal distance between adjacent samples.
+	double spacing = 0.0;
+    };
+
+    std::vector<Patch> patches;
+
+    // The root patch for each tile.
+    std::vector<size_t> roots;
+
+  public:
+    /** Use the DEM files listed.
+     *
+     *  Only enough of each file is read to know where the tile is - the data
+     *  is read by Generate(), and only for tiles which are needed.  Problems
+     *  are reported to the user.
+     */
+    bool Load(const wxArrayString & files);
+
+    bool empty() const { return tiles.empty(); }
+
+    void clear() {
+	tiles.clear();
+	patches.clear();
+	roots.clear();
+    }
+
+    /// The files in use, one per line.
+    wxString GetFiles() const;
+
+    /** Triangulate the terrain within a radius of a point.
+     *
+     *  @param cs	The survey coordinate system.
+     *  @param offset	The survey coordinates of the origin of the mesh.
+     *  @param radius	Horizontal distance from offset to include.
+     *  @param vertices	The triangles are appended to this.
+     *
+     *  @return 0 on success, or the number of a message describing the
+     *		problem: 287 (the DEM coordinate system is invalid), 288
+     *		(the survey coordinate system is invalid) or 161 (there's
+     *		no terrain data in the area).
+     */
+    int Generate(const char * cs, const Vector3 & offset, double radius,
+		 std::vector<GLAVertex> & vertices);
+
+    /** Choose which patches to draw.
+     *
+     *  @param pixel_size	pixel_size(centre, radius) should return the
+     *				size in survey units of a pixel at the point
+     *				within radius of centre nearest to the viewer
+     *				(or 0 for full detail).
+     *  @param max_spacing	How many pixels apart samples can be drawn.
+     *  @param ranges		Set to the ranges of vertices to draw, in
+     *				order and with adjacent ranges merged.
+     */
+    template<typename F>
+    void Select(F pixel_size, double max_spacing,
+		std::vector<std::pair<size_t, size_t>> & ranges) const {
+	ranges.clear();
+	std::vector<size_t> todo(roots);
+	while (!todo.empty()) {
+	    const Patch & p = patches[todo.back()];
+	    todo.pop_back();
+	    if (p.n_children &&
+		(p.radius < 0.0 ||
+		 p.spacing > max_spacing * pixel_size(p.centre, p.radius))) {
+		for (unsigned i = 0; i != p.n_children; ++i) {
+		    todo.push_back(p.first_child + i);
+		}
+		continue;
+	    }
+	    if (p.begin != p.end) ranges.push_back(std::make_pair(p.begin, p.end));
+	}
+
+	// Siblings are stored consecutively, so merging adjacent ranges often
+	// reduces the number of draw calls.
+	std::sort(ranges.begin(), ranges.end());
+	size_t j = 0;
+	for (size_t i = 0; i != ranges.size(); ++i) {
+	    if (j && ranges[j - 1].second == ranges[i].first) {
+		ranges[j - 1].second = ranges[i].second;
+	    } else {
+		ranges[j++] = ranges[i];
+	    }
+	}
+	ranges.resize(j);
+    }
+};
+
+#endif
@@ -29,6 +29,7 @@ test -x "$testdir"/../src/cavern || testdir=.
 
 : ${DIFFPOS="$testdir"/../src/diffpos}
 : ${SURVEXPORT="$testdir"/../src/survexport}
+: ${DUMP3D="$testdir"/../src/dump3d}
 
 : ${TESTS=${*:-"pos.pos v0 v0b v1 v2 v3"}}
 
@@ -37,6 +38,7 @@ vg_log=vg.log
 if [ -n "$VALGRIND" ] ; then
   rm -f "$vg_log"
   SURVEXPORT="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $SURVEXPORT"
+  DUMP3D="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $DUMP3D"
   DIFFPOS="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $DIFFPOS"
 fi
 
@@ -73,6 +75,90 @@ for file in $TESTS ; do
   fi
   test -s diffpos.tmp && exit 1
   rm -f tmp.pos diffpos.tmp
+  # Check that exporting to several formats at once gives the same .pos.
+  rm -f tmp.pos tmp.json
+  $SURVEXPORT --pos --json "$input" tmp.pos
+  exitcode=$?
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test $exitcode = 0 || exit 1
+  test -f tmp.json || exit 1
+  $DIFFPOS "$input" tmp.pos > diffpos.tmp
+  exitcode=$?
+  if test -n "$VERBOSE" ; then
+    cat diffpos.tmp
+  fi
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test -s diffpos.tmp && exit 1
+  rm -f tmp.pos tmp.json diffpos.tmp
+  # Check dump3d --binary lists the same number of stations as the text
+  # output, and gives the same columns after rewinding.
+  rm -f tmp.cols tmp2.cols tmp.txt
+  for args in "--binary=tmp.cols" "--rewind --binary=tmp2.cols" ; do
+    $DUMP3D $args "$input"
+    exitcode=$?
+    if [ -n "$VALGRIND" ] ; then
+      if [ $exitcode = "$vg_error" ] ; then
+	cat "$vg_log"
+	rm "$vg_log"
+	exit 1
+      fi
+      rm "$vg_log"
+    fi
+    test $exitcode = 0 || exit 1
+  done
+  test "`head -c 8 tmp.cols`" = SVX3DCOL || exit 1
+  cmp tmp.cols tmp2.cols || exit 1
+  $DUMP3D "$input" > tmp.txt || exit 1
+  nodes=`grep -c '^NODE ' tmp.txt`
+  # The station count is a little-endian 64-bit value at offset 24.
+  stations=`od -An -tu1 -j24 -N8 tmp.cols|awk '{n=0;for(i=NF;i>0;i--)n=n*256+$i;print n}'`
+  test "$nodes" = "$stations" || exit 1
+  rm -f tmp.cols tmp2.cols tmp.txt
+  # Check tiled export writes one file per tile listed in the index, and
+  # that the index is the same whatever the number of threads.
+  for threads in 1 3 ; do
+    rm -f tmp_*.svg tmp_tiles.json
+    $SURVEXPORT --svg --tile-size=10 --threads=$threads "$input" tmp.svg
+    exitcode=$?
+    if [ -n "$VALGRIND" ] ; then
+      if [ $exitcode = "$vg_error" ] ; then
+	cat "$vg_log"
+	rm "$vg_log"
+	exit 1
+      fi
+      rm "$vg_log"
+    fi
+    test $exitcode = 0 || exit 1
+    test -f tmp_tiles.json || exit 1
+    test -f tmp.svg && exit 1
+    test -n "$VERBOSE" && cat tmp_tiles.json
+    grep -q '^{"tile_size":10.00,"columns":[1-9][0-9]*,"rows":[1-9][0-9]*,$' tmp_tiles.json || exit 1
+    grep -q '^"tiles":\[$' tmp_tiles.json || exit 1
+    tiles=`ls tmp_*_*.svg|wc -l`
+    listed=`grep -c '^{"file":"tmp_[0-9]*_[0-9]*\.svg","column":' tmp_tiles.json`
+    test "$tiles" -gt 0 || exit 1
+    test "$tiles" = "$listed" || exit 1
+    for f in `sed 's/^{"file":"\([^"]*\)".*/\1/p;d' tmp_tiles.json` ; do
+      test -f "$f" || exit 1
+    done
+    mv tmp_tiles.json tmp_tiles$threads.json
+  done
+  cmp tmp_tiles1.json tmp_tiles3.json || exit 1
+  rm -f tmp_*.svg tmp_tiles1.json tmp_tiles3.json
 done
 test -n "$VERBOSE" && echo "Test passed"
 exit 0
@@ -261,5 +261,80 @@ for file in $TESTS ; do
   fi
   rm -f tmp.*
 done
+
+# Check --list-files lists the data files read, including *include-d ones,
+# and that it does so even if processing fails.
+for t in "includecomment:./includecomment.svx ./singlefix.svx"\
+ "badinc3:./badinc3.svx ./badinc2.svx ./badinc.svx" ; do
+  file=`expr "$t" : '\([^:]*\)'`
+  expected=`expr "$t" : '[^:]*:\(.*\)'`
+  echo "$file --list-files"
+  rm -f tmp.*
+  pwd=`pwd`
+  cd "$srcdir"
+  srcdir=. $CAVERN --list-files="$pwd/tmp.lst" "./$file.svx" --output="$pwd/tmp" > "$pwd/tmp.out"
+  exitcode=$?
+  cd "$pwd"
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test -f tmp.lst || exit 1
+  test -n "$VERBOSE" && cat tmp.lst
+  # Join the lines with spaces to compare.
+  got=`echo \`cat tmp.lst\``
+  test x"$got" = x"$expected" || exit 1
+  rm -f tmp.*
+done
+
+# Read the little-endian 32-bit value at offset $2 in file $1.
+le32() {
+  od -An -tu1 -j"$2" -N4 "$1"|awk '{print $1+256*($2+256*($3+256*$4))}'
+}
+
+# Check survexport --gltf writes a valid binary glTF file for a survey with
+# passage data.
+echo "passage --gltf"
+rm -f tmp.*
+pwd=`pwd`
+cd "$srcdir"
+srcdir=. $CAVERN ./passage.svx --output="$pwd/tmp" > "$pwd/tmp.out"
+exitcode=$?
+cd "$pwd"
+test $exitcode = 0 || exit 1
+$SURVEXPORT --gltf tmp.3d tmp.glb > /dev/null
+exitcode=$?
+if [ -n "$VALGRIND" ] ; then
+  if [ $exitcode = "$vg_error" ] ; then
+    cat "$vg_log"
+    rm "$vg_log"
+    exit 1
+  fi
+  rm "$vg_log"
+fi
+test $exitcode = 0 || exit 1
+# Header: magic "glTF", version 2, total length.
+test "`head -c 4 tmp.glb`" = glTF || exit 1
+test "`le32 tmp.glb 4`" = 2 || exit 1
+size=`wc -c < tmp.glb`
+test "`le32 tmp.glb 8`" = $size || exit 1
+# The first chunk must be JSON (0x4E4F534A) and the second BIN (0x004E4942).
+json_len=`le32 tmp.glb 12`
+test "`le32 tmp.glb 16`" = 1313821514 || exit 1
+bin_start=`expr 20 + $json_len`
+bin_len=`le32 tmp.glb $bin_start`
+test "`le32 tmp.glb \`expr $bin_start + 4\``" = 5130562 || exit 1
+test `expr $bin_start + 8 + $bin_len` = $size || exit 1
+dd if=tmp.glb of=tmp.json bs=1 skip=20 count=$json_len 2> /dev/null
+test -n "$VERBOSE" && { cat tmp.json ; echo ; }
+grep -q '"buffers":\[{"byteLength":'$bin_len'}\]' tmp.json || exit 1
+if (python3 -c '') 2> /dev/null ; then
+  python3 -c 'import json,sys; json.load(open(sys.argv[1]))' tmp.json || exit 1
+fi
+rm -f tmp.*
 test -n "$VERBOSE" && echo "Test passed"
 exit 0